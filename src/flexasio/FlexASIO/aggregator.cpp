@@ -0,0 +1,180 @@
+#include "aggregator.h"
+
+#include <algorithm>
+
+#include "log.h"
+
+namespace flexasio {
+
+	std::vector<std::unique_ptr<Aggregator::DeviceState>> Aggregator::MakeDeviceStates(const Aggregator& aggregator, const Options& options, bool input) {
+		std::vector<std::unique_ptr<DeviceState>> deviceStates;
+		const auto& devices = input ? options.inputDevices : options.outputDevices;
+		for (const auto& device : devices) {
+			const auto downstreamSampleType = input ? options.inputSampleType : options.outputSampleType;
+			deviceStates.push_back(std::unique_ptr<DeviceState>(new DeviceState{
+				.aggregator = aggregator,
+				.queue = ResamplingQueue({
+					.name = std::string(input ? "input" : "output") + " device `" + device.name + "`",
+					.channelCount = device.channelCount,
+					.writeSampleType = input ? device.sampleType : downstreamSampleType,
+					.readSampleType = input ? downstreamSampleType : device.sampleType,
+					.dither = !input && device.dither,
+					.sampleRate = options.sampleRate,
+					.framesPerBuffer = options.framesPerBuffer,
+					.safetyMarginFrames = options.safetyMarginFrames,
+					.lockMemory = options.lockMemory,
+				}),
+			}));
+		}
+		return deviceStates;
+	}
+
+	Aggregator::Aggregator(Options options) :
+		options(std::move(options)),
+		inputDevices(MakeDeviceStates(*this, this->options, true)),
+		outputDevices(MakeDeviceStates(*this, this->options, false)) {
+		const auto makeBlocks = [&](const std::vector<Device>& devices, ASIOSampleType sampleType, int masterChannelCount, std::vector<std::vector<std::byte>>& blocks, std::vector<std::byte*>& pointers) {
+			pointers.resize(masterChannelCount);
+			for (const auto& device : devices)
+				for (int channelIndex = 0; channelIndex < device.channelCount; ++channelIndex)
+					pointers.push_back(blocks.emplace_back(this->options.framesPerBuffer * GetSampleSizeInBytes(sampleType)).data());
+		};
+		makeBlocks(this->options.inputDevices, this->options.inputSampleType, this->options.masterInputChannelCount, inputBlock, inputPointers);
+		makeBlocks(this->options.outputDevices, this->options.outputSampleType, this->options.masterOutputChannelCount, outputBlock, outputPointers);
+
+		if (this->options.lockMemory) {
+			const auto memoryRanges = GetMemoryRanges();
+			size_t sizeInBytes = 0;
+			try {
+				for (const auto& memoryRange : memoryRanges) sizeInBytes += memoryLocks.emplace_back(memoryRange).GetSize();
+				Log() << "Locked aggregator state in memory: " << memoryRanges.size() << " ranges spanning " << sizeInBytes << " bytes of pages";
+			}
+			catch (const std::exception& exception) {
+				memoryLocks.clear();
+				Log() << "WARNING: unable to lock aggregator state in memory, stream callbacks may incur page faults: " << exception.what();
+			}
+		}
+		Log() << "Aggregating " << inputPointers.size() << " input channels (" << this->options.masterInputChannelCount << " from the master device, the rest from "
+			<< inputDevices.size() << " additional devices) and " << outputPointers.size() << " output channels (" << this->options.masterOutputChannelCount
+			<< " from the master device, the rest from " << outputDevices.size() << " additional devices)";
+	}
+
+	std::vector<std::span<const std::byte>> Aggregator::GetMemoryRanges() const {
+		std::vector<std::span<const std::byte>> memoryRanges;
+		for (const auto& channelBlock : inputBlock) memoryRanges.push_back(std::as_bytes(std::span(channelBlock)));
+		for (const auto& channelBlock : outputBlock) memoryRanges.push_back(std::as_bytes(std::span(channelBlock)));
+		memoryRanges.push_back(std::as_bytes(std::span(inputPointers)));
+		memoryRanges.push_back(std::as_bytes(std::span(outputPointers)));
+		return memoryRanges;
+	}
+
+	void Aggregator::AlignLatencies(std::optional<size_t> masterInputLatencyInFrames, std::optional<size_t> masterOutputLatencyInFrames,
+		std::span<const size_t> inputDeviceLatenciesInFrames, std::span<const size_t> outputDeviceLatenciesInFrames) {
+		AlignLatencies("input", masterInputLatencyInFrames, inputDeviceLatenciesInFrames, inputDevices);
+		AlignLatencies("output", masterOutputLatencyInFrames, outputDeviceLatenciesInFrames, outputDevices);
+	}
+
+	void Aggregator::AlignLatencies(std::string_view direction, std::optional<size_t> masterLatencyInFrames, std::span<const size_t> deviceLatenciesInFrames, std::span<const std::unique_ptr<DeviceState>> devices) {
+		if (deviceLatenciesInFrames.size() != devices.size()) throw std::runtime_error("Wrong number of " + std::string(direction) + " device latencies");
+
+		std::vector<size_t> pathLatenciesInFrames;
+		for (size_t deviceIndex = 0; deviceIndex < devices.size(); ++deviceIndex)
+			pathLatenciesInFrames.push_back(deviceLatenciesInFrames[deviceIndex] + devices[deviceIndex]->queue.GetLatencyInFrames());
+		auto alignedLatencyInFrames = masterLatencyInFrames.value_or(0);
+		for (const auto pathLatencyInFrames : pathLatenciesInFrames) alignedLatencyInFrames = (std::max)(alignedLatencyInFrames, pathLatencyInFrames);
+
+		if (masterLatencyInFrames.has_value() && *masterLatencyInFrames < alignedLatencyInFrames)
+			Log() << "Master " << direction << " channels cannot be delayed; they will be " << alignedLatencyInFrames - *masterLatencyInFrames << " frames ahead of the channels of additional devices";
+		for (size_t deviceIndex = 0; deviceIndex < devices.size(); ++deviceIndex)
+			devices[deviceIndex]->queue.SetExtraLatencyInFrames(alignedLatencyInFrames - pathLatenciesInFrames[deviceIndex]);
+	}
+
+	void Aggregator::Start(const Clock& clock) {
+		this->clock = &clock;
+		for (const auto& device : inputDevices) device->queue.Start();
+		for (const auto& device : outputDevices) device->queue.Start();
+	}
+
+	int Aggregator::MasterStreamCallback(const void* input, void* output, unsigned long frameCount, const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void* userData) throw() {
+		try {
+			auto& aggregator = *static_cast<Aggregator*>(userData);
+			if (aggregator.clock != nullptr) return aggregator.ProcessMaster(static_cast<const std::byte* const*>(input), static_cast<std::byte* const*>(output), frameCount, timeInfo, statusFlags);
+		}
+		catch (const std::exception& exception) {
+			if (IsLoggingEnabled()) Log() << "Caught exception in aggregator master stream callback: " << exception.what();
+		}
+		catch (...) {
+			if (IsLoggingEnabled()) Log() << "Caught unknown exception in aggregator master stream callback";
+		}
+		return paContinue;
+	}
+
+	int Aggregator::DeviceStreamCallback(const void* input, void* output, unsigned long frameCount, const PaStreamCallbackTimeInfo*, PaStreamCallbackFlags statusFlags, void* userData) throw() {
+		try {
+			auto& device = *static_cast<DeviceState*>(userData);
+			if (IsLoggingEnabled()) {
+				if (statusFlags & paInputOverflow) Log() << "Additional device: INPUT OVERFLOW detected (some input data was discarded)";
+				if (statusFlags & paOutputUnderflow) Log() << "Additional device: OUTPUT UNDERFLOW detected (gaps were inserted in the output)";
+			}
+			const auto clock = device.aggregator.clock;
+			if (clock == nullptr) return paContinue;
+			const auto timeNanoseconds = clock->GetTimeNanoseconds();
+			if (input != nullptr) device.queue.Write(static_cast<const std::byte* const*>(input), frameCount, timeNanoseconds);
+			if (output != nullptr) device.queue.Read(static_cast<std::byte* const*>(output), frameCount, timeNanoseconds);
+		}
+		catch (const std::exception& exception) {
+			if (IsLoggingEnabled()) Log() << "Caught exception in aggregator device stream callback: " << exception.what();
+		}
+		catch (...) {
+			if (IsLoggingEnabled()) Log() << "Caught unknown exception in aggregator device stream callback";
+		}
+		return paContinue;
+	}
+
+	PaStreamCallbackResult Aggregator::ProcessMaster(const std::byte* const* input, std::byte* const* output, size_t frameCount, const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags) {
+		const auto timeNanoseconds = clock->GetTimeNanoseconds();
+		const auto inputSampleSizeInBytes = GetSampleSizeInBytes(options.inputSampleType);
+		const auto outputSampleSizeInBytes = GetSampleSizeInBytes(options.outputSampleType);
+		const auto additionalInputPointers = inputPointers.data() + options.masterInputChannelCount;
+		const auto additionalOutputPointers = outputPointers.data() + options.masterOutputChannelCount;
+
+		for (size_t frameOffset = 0; frameOffset < frameCount; ) {
+			const auto blockFrameCount = (std::min)(frameCount - frameOffset, options.framesPerBuffer);
+			const auto blockTimeNanoseconds = timeNanoseconds + int64_t(double(frameOffset) * 1e9 / options.sampleRate);
+
+			for (int channelIndex = 0; channelIndex < options.masterInputChannelCount; ++channelIndex)
+				inputPointers[channelIndex] = const_cast<std::byte*>(input[channelIndex]) + frameOffset * inputSampleSizeInBytes;
+			for (int channelIndex = 0; channelIndex < options.masterOutputChannelCount; ++channelIndex)
+				outputPointers[channelIndex] = output[channelIndex] + frameOffset * outputSampleSizeInBytes;
+			{
+				auto devicePointers = additionalInputPointers;
+				for (size_t deviceIndex = 0; deviceIndex < inputDevices.size(); ++deviceIndex) {
+					inputDevices[deviceIndex]->queue.Read(devicePointers, blockFrameCount, blockTimeNanoseconds);
+					devicePointers += options.inputDevices[deviceIndex].channelCount;
+				}
+			}
+
+			std::optional<PaStreamCallbackTimeInfo> blockTimeInfo;
+			if (timeInfo != nullptr) {
+				blockTimeInfo = *timeInfo;
+				if (blockTimeInfo->inputBufferAdcTime != 0) blockTimeInfo->inputBufferAdcTime += double(frameOffset) / options.sampleRate;
+				if (blockTimeInfo->outputBufferDacTime != 0) blockTimeInfo->outputBufferDacTime += double(frameOffset) / options.sampleRate;
+			}
+			const auto result = options.downstreamCallback(
+				inputPointers.data(), outputPointers.data(), static_cast<unsigned long>(blockFrameCount),
+				blockTimeInfo.has_value() ? &*blockTimeInfo : nullptr, frameOffset == 0 ? statusFlags : 0, options.downstreamUserData);
+
+			{
+				auto devicePointers = additionalOutputPointers;
+				for (size_t deviceIndex = 0; deviceIndex < outputDevices.size(); ++deviceIndex) {
+					outputDevices[deviceIndex]->queue.Write(devicePointers, blockFrameCount, blockTimeNanoseconds);
+					devicePointers += options.outputDevices[deviceIndex].channelCount;
+				}
+			}
+			if (result != paContinue) return PaStreamCallbackResult(result);
+			frameOffset += blockFrameCount;
+		}
+		return paContinue;
+	}
+
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "engine.h"
+#include "resampling_queue.h"
+#include "../FlexASIOUtil/memory_lock.h"
+
+#include <dechamps_ASIOUtil/asiosdk/asiosys.h>
+#include <dechamps_ASIOUtil/asiosdk/asio.h>
+
+#include <portaudio.h>
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace flexasio {
+
+	// Presents several PortAudio streams, typically on different devices, as a single stream to a downstream callback,
+	// typically Engine::StreamCallback(). The downstream callback runs on the stream of the device that acts as the clock
+	// master. It sees the channels of the master stream first (if any), followed by the channels of each additional
+	// device, in order.
+	//
+	// Each additional device runs its own input-only or output-only stream, which exchanges audio with the master stream
+	// through a ResamplingQueue. This compensates for the drift between the device clocks.
+	class Aggregator final {
+	public:
+		struct Device final {
+			// Identifies the device in the log.
+			std::string name;
+			int channelCount;
+			// Sample type of the device stream.
+			ASIOSampleType sampleType;
+			// Only applies to output devices.
+			bool dither = false;
+		};
+
+		struct Options final {
+			int masterInputChannelCount;
+			int masterOutputChannelCount;
+			// Sample types of the buffers exchanged with the downstream callback. For master channels, this is also the
+			// sample type of the master stream.
+			ASIOSampleType inputSampleType;
+			ASIOSampleType outputSampleType;
+			std::vector<Device> inputDevices;
+			std::vector<Device> outputDevices;
+			double sampleRate;
+			// Callback size that all streams are expected to use. Larger master callbacks are split.
+			size_t framesPerBuffer;
+			// See ResamplingQueue::Options.
+			size_t safetyMarginFrames;
+			PaStreamCallback* downstreamCallback;
+			void* downstreamUserData;
+			bool lockMemory = false;
+		};
+
+		explicit Aggregator(Options options);
+		Aggregator(const Aggregator&) = delete;
+		Aggregator(Aggregator&&) = delete;
+
+		// The queue of an additional device adds its latency on top of the latency of the device stream itself.
+		const ResamplingQueue& GetInputDeviceQueue(size_t deviceIndex) const { return inputDevices[deviceIndex]->queue; }
+		const ResamplingQueue& GetOutputDeviceQueue(size_t deviceIndex) const { return outputDevices[deviceIndex]->queue; }
+
+		// Given the latency of each stream, delays audio to and from additional devices so that all the channels in a
+		// given direction line up, as far as possible: the master stream cannot be delayed. Must be called while no stream
+		// is running.
+		void AlignLatencies(std::optional<size_t> masterInputLatencyInFrames, std::optional<size_t> masterOutputLatencyInFrames,
+			std::span<const size_t> inputDeviceLatenciesInFrames, std::span<const size_t> outputDeviceLatenciesInFrames);
+
+		// Must be called while no stream is running, before starting them. `clock` must outlive the streams.
+		void Start(const Clock& clock);
+
+		// Stream callback for the master stream. `userData` must point to the Aggregator.
+		static int MasterStreamCallback(const void* input, void* output, unsigned long frameCount, const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void* userData) throw();
+		// Stream callback for additional devices. `userData` must be the result of GetInputDeviceUserData() or
+		// GetOutputDeviceUserData().
+		static int DeviceStreamCallback(const void* input, void* output, unsigned long frameCount, const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void* userData) throw();
+		void* GetInputDeviceUserData(size_t deviceIndex) { return inputDevices[deviceIndex].get(); }
+		void* GetOutputDeviceUserData(size_t deviceIndex) { return outputDevices[deviceIndex].get(); }
+
+	private:
+		struct DeviceState final {
+			const Aggregator& aggregator;
+			ResamplingQueue queue;
+		};
+
+		static std::vector<std::unique_ptr<DeviceState>> MakeDeviceStates(const Aggregator& aggregator, const Options& options, bool input);
+		static void AlignLatencies(std::string_view direction, std::optional<size_t> masterLatencyInFrames, std::span<const size_t> deviceLatenciesInFrames, std::span<const std::unique_ptr<DeviceState>> devices);
+		std::vector<std::span<const std::byte>> GetMemoryRanges() const;
+		PaStreamCallbackResult ProcessMaster(const std::byte* const* input, std::byte* const* output, size_t frameCount, const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags);
+
+		const Options options;
+		const std::vector<std::unique_ptr<DeviceState>> inputDevices;
+		const std::vector<std::unique_ptr<DeviceState>> outputDevices;
+		const Clock* clock = nullptr;
+
+		// Only accessed from the master stream callback. Channels of additional devices point to `inputBlock` and
+		// `outputBlock`; master channels are updated on every callback.
+		std::vector<std::vector<std::byte>> inputBlock;
+		std::vector<std::vector<std::byte>> outputBlock;
+		std::vector<std::byte*> inputPointers;
+		std::vector<std::byte*> outputPointers;
+
+		std::vector<MemoryLock> memoryLocks;
+	};
+
+}
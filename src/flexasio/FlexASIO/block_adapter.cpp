@@ -0,0 +1,71 @@
+#include "block_adapter.h"
+
+#include <cstring>
+
+#include "log.h"
+
+namespace flexasio {
+
+	BlockAdapter::BlockAdapter(size_t inputChannelCount, size_t inputSampleSizeInBytes, size_t outputChannelCount, size_t outputSampleSizeInBytes, size_t blockSizeInFrames) :
+		inputChannelCount(inputChannelCount), inputSampleSizeInBytes(inputSampleSizeInBytes), outputChannelCount(outputChannelCount), outputSampleSizeInBytes(outputSampleSizeInBytes), blockSizeInFrames(blockSizeInFrames),
+		inputBlock(inputChannelCount * blockSizeInFrames * inputSampleSizeInBytes),
+		outputBlock(outputChannelCount * blockSizeInFrames * outputSampleSizeInBytes),
+		outputQueue(outputChannelCount * outputQueueSizeInFrames * outputSampleSizeInBytes) {
+		for (size_t channelIndex = 0; channelIndex < inputChannelCount; ++channelIndex)
+			inputBlockPointers.push_back(inputBlock.data() + channelIndex * blockSizeInFrames * inputSampleSizeInBytes);
+		for (size_t channelIndex = 0; channelIndex < outputChannelCount; ++channelIndex)
+			outputBlockPointers.push_back(outputBlock.data() + channelIndex * blockSizeInFrames * outputSampleSizeInBytes);
+	}
+
+	void BlockAdapter::PushInput(const std::byte* const* input, size_t frameOffset, size_t frameCount) {
+		for (size_t channelIndex = 0; channelIndex < inputChannelCount; ++channelIndex)
+			memcpy(inputBlockPointers[channelIndex] + inputFrameCount * inputSampleSizeInBytes, input[channelIndex] + frameOffset * inputSampleSizeInBytes, frameCount * inputSampleSizeInBytes);
+	}
+
+	void BlockAdapter::PushOutputBlock() {
+		if (outputFrameCount + blockSizeInFrames > outputQueueSizeInFrames) {
+			// Should never happen, see outputQueueSizeInFrames.
+			if (IsLoggingEnabled()) Log() << "Block adapter output queue overflow, discarding block";
+			return;
+		}
+
+		const auto writeFrameIndex = (outputReadFrameIndex + outputFrameCount) % outputQueueSizeInFrames;
+		const auto firstPartFrameCount = (std::min)(blockSizeInFrames, outputQueueSizeInFrames - writeFrameIndex);
+		for (size_t channelIndex = 0; channelIndex < outputChannelCount; ++channelIndex) {
+			const auto channelQueue = outputQueue.data() + channelIndex * outputQueueSizeInFrames * outputSampleSizeInBytes;
+			memcpy(channelQueue + writeFrameIndex * outputSampleSizeInBytes, outputBlockPointers[channelIndex], firstPartFrameCount * outputSampleSizeInBytes);
+			memcpy(channelQueue, outputBlockPointers[channelIndex] + firstPartFrameCount * outputSampleSizeInBytes, (blockSizeInFrames - firstPartFrameCount) * outputSampleSizeInBytes);
+		}
+		outputFrameCount += blockSizeInFrames;
+	}
+
+	void BlockAdapter::PopOutput(std::byte* const* output, size_t frameOffset, size_t frameCount) {
+		const auto underrunFrameCount = frameCount - (std::min)(frameCount, outputFrameCount);
+		if (underrunFrameCount > 0) {
+			if (IsLoggingEnabled()) Log() << "Block adapter does not have enough output queued, inserting " << underrunFrameCount << " frames of silence";
+			for (size_t channelIndex = 0; channelIndex < outputChannelCount; ++channelIndex)
+				memset(output[channelIndex] + frameOffset * outputSampleSizeInBytes, 0, underrunFrameCount * outputSampleSizeInBytes);
+			frameOffset += underrunFrameCount;
+			frameCount -= underrunFrameCount;
+		}
+
+		const auto firstPartFrameCount = (std::min)(frameCount, outputQueueSizeInFrames - outputReadFrameIndex);
+		for (size_t channelIndex = 0; channelIndex < outputChannelCount; ++channelIndex) {
+			const auto channelQueue = outputQueue.data() + channelIndex * outputQueueSizeInFrames * outputSampleSizeInBytes;
+			const auto channelOutput = output[channelIndex] + frameOffset * outputSampleSizeInBytes;
+			memcpy(channelOutput, channelQueue + outputReadFrameIndex * outputSampleSizeInBytes, firstPartFrameCount * outputSampleSizeInBytes);
+			memcpy(channelOutput + firstPartFrameCount * outputSampleSizeInBytes, channelQueue, (frameCount - firstPartFrameCount) * outputSampleSizeInBytes);
+		}
+		outputReadFrameIndex = (outputReadFrameIndex + frameCount) % outputQueueSizeInFrames;
+		outputFrameCount -= frameCount;
+	}
+
+	std::vector<std::span<const std::byte>> BlockAdapter::GetMemoryRanges() const {
+		return {
+			std::as_bytes(std::span(inputBlock)), std::as_bytes(std::span(inputBlockPointers)),
+			std::as_bytes(std::span(outputBlock)), std::as_bytes(std::span(outputBlockPointers)),
+			std::as_bytes(std::span(outputQueue)),
+		};
+	}
+
+}
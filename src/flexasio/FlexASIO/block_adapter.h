@@ -0,0 +1,78 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace flexasio {
+
+	// Adapts non-interleaved audio delivered in chunks of arbitrary size (e.g. PortAudio stream callbacks opened with
+	// paFramesPerBufferUnspecified) to processing in fixed-size blocks (e.g. ASIO buffers).
+	//
+	// Input is accumulated until a full block is available, at which point the block is processed. The resulting output
+	// block is queued and drained as subsequent chunks come in. Output latency is not fixed in advance; instead, if there
+	// is not enough output available to fill a chunk, silence is inserted, which effectively adds the minimum amount of
+	// latency required for the chunk sizes that are actually seen.
+	//
+	// All memory is allocated upfront; Process() is real-time safe.
+	class BlockAdapter final {
+	public:
+		BlockAdapter(size_t inputChannelCount, size_t inputSampleSizeInBytes, size_t outputChannelCount, size_t outputSampleSizeInBytes, size_t blockSizeInFrames);
+		BlockAdapter(const BlockAdapter&) = delete;
+		BlockAdapter(BlockAdapter&&) = delete;
+
+		// True if there is no pending input nor queued output, i.e. a chunk that is exactly one block long can be processed
+		// directly without going through the adapter.
+		bool IsEmpty() const { return inputFrameCount == 0 && outputFrameCount == 0; }
+
+		// Heap memory accessed by Process().
+		std::vector<std::span<const std::byte>> GetMemoryRanges() const;
+
+		// Calls processBlock(const std::byte* const* input, std::byte* const* output) once for every full block.
+		// `input` and `output` can be null if there are no channels in that direction.
+		template <typename ProcessBlock> void Process(const std::byte* const* input, std::byte* const* output, size_t frameCount, ProcessBlock processBlock) {
+			for (size_t frameOffset = 0; frameOffset < frameCount; ) {
+				const auto chunkFrameCount = (std::min)(frameCount - frameOffset, blockSizeInFrames - inputFrameCount);
+				if (input != nullptr) PushInput(input, frameOffset, chunkFrameCount);
+				inputFrameCount += chunkFrameCount;
+
+				if (inputFrameCount == blockSizeInFrames) {
+					processBlock(input == nullptr ? nullptr : inputBlockPointers.data(), output == nullptr ? nullptr : outputBlockPointers.data());
+					inputFrameCount = 0;
+					if (output != nullptr) PushOutputBlock();
+				}
+
+				if (output != nullptr) PopOutput(output, frameOffset, chunkFrameCount);
+				frameOffset += chunkFrameCount;
+			}
+		}
+
+	private:
+		void PushInput(const std::byte* const* input, size_t frameOffset, size_t frameCount);
+		void PushOutputBlock();
+		void PopOutput(std::byte* const* output, size_t frameOffset, size_t frameCount);
+
+		const size_t inputChannelCount;
+		const size_t inputSampleSizeInBytes;
+		const size_t outputChannelCount;
+		const size_t outputSampleSizeInBytes;
+		const size_t blockSizeInFrames;
+		// Because silence is only inserted when the queue runs dry, less than one block is ever left queued when a new
+		// block is pushed.
+		const size_t outputQueueSizeInFrames = 2 * blockSizeInFrames;
+
+		std::vector<std::byte> inputBlock;
+		std::vector<std::byte*> inputBlockPointers;
+		size_t inputFrameCount = 0;
+
+		std::vector<std::byte> outputBlock;
+		std::vector<std::byte*> outputBlockPointers;
+
+		// One ring buffer per channel.
+		std::vector<std::byte> outputQueue;
+		size_t outputReadFrameIndex = 0;
+		size_t outputFrameCount = 0;
+	};
+
+}
@@ -0,0 +1,59 @@
+#include "cache_file.h"
+
+#include <windows.h>
+
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+#include "log.h"
+#include "../FlexASIOUtil/shell.h"
+
+namespace flexasio {
+
+	std::filesystem::path GetCacheDirectory() {
+		return std::filesystem::path(GetLocalAppDataDirectory()) / "FlexASIO";
+	}
+
+	CacheSections LoadCacheFile(const std::filesystem::path& path, std::string_view header) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file) return {};
+		std::string line;
+		if (!std::getline(file, line) || line != header) {
+			Log() << "Ignoring cache file " << path << " with unexpected header: " << line;
+			return {};
+		}
+		CacheSections sections;
+		std::vector<std::string>* section = nullptr;
+		while (std::getline(file, line)) {
+			if (line.starts_with("[")) section = &sections[line.substr(1, line.size() - 2)];
+			else if (section != nullptr) section->push_back(line);
+		}
+		return sections;
+	}
+
+	void SaveCacheFile(const std::filesystem::path& path, std::string_view header, const CacheSections& sections) {
+		std::filesystem::create_directories(path.parent_path());
+		auto temporaryPath = path;
+		temporaryPath += "." + std::to_string(GetCurrentProcessId()) + ".tmp";
+		{
+			std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+			if (!file) throw std::runtime_error("Unable to open temporary cache file for writing");
+			file << header << "\n";
+			for (const auto& [name, lines] : sections) {
+				file << "[" << name << "]\n";
+				for (const auto& line : lines) file << line << "\n";
+			}
+			if (!file.flush()) throw std::runtime_error("Unable to write temporary cache file");
+		}
+		try {
+			std::filesystem::rename(temporaryPath, path);
+		}
+		catch (...) {
+			std::error_code error;
+			std::filesystem::remove(temporaryPath, error);
+			throw;
+		}
+	}
+
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace flexasio {
+
+	// %LOCALAPPDATA%\FlexASIO. Everything in there can be deleted at any time.
+	std::filesystem::path GetCacheDirectory();
+
+	// A cache file is a text file made of sections, each one starting with a `[name]` line, followed by lines that are
+	// opaque to this code. The first line of the file identifies the format of the rest of the file; if it does not match
+	// `header`, the file is ignored.
+	using CacheSections = std::map<std::string, std::vector<std::string>>;
+	// Returns no sections if the file does not exist.
+	CacheSections LoadCacheFile(const std::filesystem::path& path, std::string_view header);
+	// Replaces the file atomically, so that concurrent readers (e.g. other processes) never see a partially written file.
+	void SaveCacheFile(const std::filesystem::path& path, std::string_view header, const CacheSections& sections);
+
+}
@@ -127,11 +127,13 @@ namespace flexasio {
 					flexASIO->ControlPanel();
 				});
 			}
-			ASIOError future(long selector, void *) throw() final {
-				return Enter("future()", [&] {
-					Log() << "Requested future selector: " << ::dechamps_ASIOUtil::GetASIOFutureSelectorString(selector);
-					throw ASIOException(ASE_InvalidParameter, "future() is not supported");
+			ASIOError future(long selector, void* opt) throw() final {
+				const auto error = EnterInitialized("future()", [&] {
+					if (IsLoggingEnabled()) Log() << "Requested future selector: " << ::dechamps_ASIOUtil::GetASIOFutureSelectorString(selector);
+					flexASIO->Future(selector, opt);
 				});
+				// Unlike every other IASIO method, future() signals success with ASE_SUCCESS, not ASE_OK.
+				return error == ASE_OK ? ASE_SUCCESS : error;
 			}
 
 			ASIOError outputReady() throw() final {
@@ -0,0 +1,71 @@
+#include "clock_model.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+#include "log.h"
+
+namespace flexasio {
+
+	namespace {
+
+		// Errors larger than this, relative to the time between observations, make the observation an outlier.
+		constexpr double maxRelativeError = 2;
+		// Floor for the above, so that short periods do not make the model too jumpy.
+		constexpr double minMaxErrorNanoseconds = 10e6;
+		constexpr int maxConsecutiveOutlierCount = 4;
+		// Real audio clocks are never this far off their nominal rate; if we end up there, the model went off the rails.
+		constexpr double maxRateDeviation = 0.01;
+
+	}
+
+	ClockModel::ClockModel(const double sampleRate, const double bandwidthHz) : nominalNanosecondsPerFrame(1e9 / sampleRate), bandwidthHz(bandwidthHz) {}
+
+	void ClockModel::Reset(const int64_t frame, const int64_t timeNanoseconds) {
+		state = { .frame = frame, .timeNanoseconds = double(timeNanoseconds), .nanosecondsPerFrame = nominalNanosecondsPerFrame };
+		consecutiveOutlierCount = 0;
+	}
+
+	void ClockModel::Update(const int64_t frame, const int64_t timeNanoseconds) {
+		if (!state.has_value()) {
+			Reset(frame, timeNanoseconds);
+			return;
+		}
+		const auto frameCount = frame - state->frame;
+		if (frameCount <= 0) {
+			if (IsLoggingEnabled()) Log() << "Clock model: stream position went from " << state->frame << " to " << frame << ", resetting";
+			Reset(frame, timeNanoseconds);
+			return;
+		}
+
+		const auto periodNanoseconds = double(frameCount) * nominalNanosecondsPerFrame;
+		const auto predictedTimeNanoseconds = state->timeNanoseconds + double(frameCount) * state->nanosecondsPerFrame;
+		const auto errorNanoseconds = double(timeNanoseconds) - predictedTimeNanoseconds;
+		if (std::abs(errorNanoseconds) > (std::max)(maxRelativeError * periodNanoseconds, minMaxErrorNanoseconds)) {
+			if (++consecutiveOutlierCount < maxConsecutiveOutlierCount) {
+				if (IsLoggingEnabled()) Log() << "Clock model: observed time is " << errorNanoseconds / 1e3 << " microseconds off, ignoring";
+				return;
+			}
+			if (IsLoggingEnabled()) Log() << "Clock model: observed time is " << errorNanoseconds / 1e3 << " microseconds off, resetting";
+			Reset(frame, timeNanoseconds);
+			return;
+		}
+		consecutiveOutlierCount = 0;
+
+		const auto omega = (std::min)(2 * std::numbers::pi * bandwidthHz * periodNanoseconds / 1e9, 1.0);
+		state->frame = frame;
+		state->timeNanoseconds = predictedTimeNanoseconds + std::numbers::sqrt2 * omega * errorNanoseconds;
+		state->nanosecondsPerFrame += omega * omega * errorNanoseconds / double(frameCount);
+
+		if (std::abs(state->nanosecondsPerFrame / nominalNanosecondsPerFrame - 1) > maxRateDeviation) {
+			if (IsLoggingEnabled()) Log() << "Clock model: estimated rate is " << 1e9 / state->nanosecondsPerFrame << " Hz, too far from nominal, resetting";
+			Reset(frame, timeNanoseconds);
+		}
+	}
+
+	int64_t ClockModel::GetTimeNanoseconds(const int64_t frame) const {
+		return int64_t(std::llround(state->timeNanoseconds + double(frame - state->frame) * state->nanosecondsPerFrame));
+	}
+
+}
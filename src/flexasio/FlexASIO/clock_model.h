@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+namespace flexasio {
+
+	// Models the relationship between the position of an audio stream (in frames) and system time, using the second
+	// order delay-locked loop (DLL) described in F. Adriaensen, "Using a DLL to filter time" (2005).
+	//
+	// Observations are typically noisy, e.g. because they are taken from a thread that is subject to scheduling jitter.
+	// The model filters that noise out, while still tracking the drift between the audio clock and the system clock.
+	// Larger bandwidths make the model converge faster, at the cost of letting more noise through.
+	//
+	// Observations that are too far off the model (e.g. a callback that ran very late) are ignored. If several of them
+	// occur in a row (e.g. following a dropout), the model starts over.
+	class ClockModel final {
+	public:
+		ClockModel(double sampleRate, double bandwidthHz);
+
+		// `frame` is the stream position at `timeNanoseconds`. It is expected to increase from one call to the next.
+		void Update(int64_t frame, int64_t timeNanoseconds);
+
+		// Interpolates or extrapolates the time at which the stream is (or was, or will be) at `frame`.
+		// Must not be called before the first Update().
+		int64_t GetTimeNanoseconds(int64_t frame) const;
+
+	private:
+		struct State final {
+			int64_t frame;
+			double timeNanoseconds;
+			double nanosecondsPerFrame;
+		};
+
+		void Reset(int64_t frame, int64_t timeNanoseconds);
+
+		const double nominalNanosecondsPerFrame;
+		const double bandwidthHz;
+		std::optional<State> state;
+		int consecutiveOutlierCount = 0;
+	};
+
+}
@@ -1,17 +1,11 @@
 #pragma once
 
-#include <windows.h>
-
-#include <array>
+#include <cstdint>
 #include <filesystem>
-#include <functional>
-#include <mutex>
 #include <optional>
 #include <regex>
 #include <string>
-#include <semaphore>
-#include <span>
-#include <thread>
+#include <string_view>
 #include <variant>
 #include <vector>
 
@@ -40,94 +34,111 @@ namespace flexasio {
 
 		std::optional<std::string> backend;
 		std::optional<int64_t> bufferSizeSamples;
+		bool adaptBackendBufferSize = false;
+		bool alignBuffersToPages = false;
+		bool useLargePages = false;
+		bool lockMemory = false;
+		bool splitDuplex = false;
 
 		struct Stream {			
+			// The first device listed in the configuration. If several devices are listed, the rest are in
+			// `additionalDevices`, and are aggregated with this one.
 			Device device;
 			std::optional<int> channels;
+			// Only contains std::string and DeviceRegex alternatives.
+			std::vector<Device> additionalDevices;
+			// Either empty, or one channel count per additional device.
+			std::vector<int> additionalChannels;
 			std::optional<std::string> sampleType;
+			std::optional<std::string> deviceSampleType;
+			bool dither = false;
 			std::optional<double> suggestedLatencySeconds;
 			bool wasapiExclusiveMode = false;
 			bool wasapiAutoConvert = true;
 			bool wasapiExplicitSampleFormat = true;
+			bool trimInactiveChannels = false;
+			// Either "peak" or "rms".
+			std::string meter = "peak";
+
+			struct Route final {
+				int asioChannel;
+				int deviceChannel;
+				double gain = 1;
+
+				bool operator==(const Route&) const = default;
+			};
+			// If set, replaces the one-to-one mapping between ASIO channels and device channels.
+			std::optional<std::vector<Route>> routing;
 
 			bool operator==(const Stream& other) const {
 				return
 					device == other.device &&
 					channels == other.channels &&
+					additionalDevices == other.additionalDevices &&
+					additionalChannels == other.additionalChannels &&
 					sampleType == other.sampleType &&
+					deviceSampleType == other.deviceSampleType &&
+					dither == other.dither &&
 					suggestedLatencySeconds == other.suggestedLatencySeconds &&
 					wasapiExclusiveMode == other.wasapiExclusiveMode &&
 					wasapiAutoConvert == other.wasapiAutoConvert &&
-					wasapiExplicitSampleFormat == other.wasapiExplicitSampleFormat;
+					wasapiExplicitSampleFormat == other.wasapiExplicitSampleFormat &&
+					trimInactiveChannels == other.trimInactiveChannels &&
+					meter == other.meter &&
+					routing == other.routing;
 			}
 		};
 		Stream input;
 		Stream output;
 
+		struct Realtime {
+			std::optional<std::string> schedulingPolicy;
+			std::optional<int> priority;
+			std::optional<int64_t> cpuAffinityMask;
+			bool flushDenormals = false;
+
+			bool operator==(const Realtime& other) const {
+				return
+					schedulingPolicy == other.schedulingPolicy &&
+					priority == other.priority &&
+					cpuAffinityMask == other.cpuAffinityMask &&
+					flushDenormals == other.flushDenormals;
+			}
+		};
+		Realtime realtime;
+
 		bool operator==(const Config& other) const {
 			return
 				backend == other.backend &&
 				bufferSizeSamples == other.bufferSizeSamples &&
+				adaptBackendBufferSize == other.adaptBackendBufferSize &&
+				alignBuffersToPages == other.alignBuffersToPages &&
+				useLargePages == other.useLargePages &&
+				lockMemory == other.lockMemory &&
+				splitDuplex == other.splitDuplex &&
 				input == other.input &&
-				output == other.output;
+				output == other.output &&
+				realtime == other.realtime;
 		}
 	};
 
+	// True if `after` only differs from `before` in options that can be applied while streaming, without resetting the
+	// stream (see Engine::LiveOptions). Any change to devices, formats, channels or buffers requires a reset, and so does
+	// clearing a real-time option.
+	bool IsLiveConfigChange(const Config& before, const Config& after);
+
+	// Parses the contents of a configuration file. Throws if the configuration is invalid.
+	Config ParseConfig(std::string_view toml);
+
 	class ConfigLoader {
 	public:
 		ConfigLoader();
 
 		const Config& Initial() const { return initialConfig; }
-
-		class Watcher {
-		public:
-			Watcher(const ConfigLoader& configLoader, std::function<void()> onConfigChange);
-			~Watcher() noexcept(false);
-
-		private:
-			class ConfigDirectoryWatchOperation final {
-			public:
-				ConfigDirectoryWatchOperation(HANDLE directory, OVERLAPPED* overlapped, std::span<std::byte> fileNotifyInformationBuffer);
-				~ConfigDirectoryWatchOperation() noexcept(false);
-
-				ConfigDirectoryWatchOperation(const ConfigDirectoryWatchOperation&) = delete;
-				ConfigDirectoryWatchOperation& operator=(const ConfigDirectoryWatchOperation&) = delete;
-
-				void Cancel();
-
-				struct Aborted final {};
-				struct Overflow final {};
-				using Outcome = std::variant<Aborted, Overflow, std::span<const std::byte>>;
-				Outcome Await();
-
-			private:
-				const HANDLE directory;
-				OVERLAPPED* overlapped;
-				std::span<std::byte> fileNotifyInformationBuffer;
-			};
-
-			// We abuse exception handling to handle stop requests. This is a bit unorthodox, but
-			// it does make the code significantly simpler.
-			struct StopRequested final {};
-			void CheckStopRequested(std::chrono::milliseconds timeout);
-
-			void RunThread();
-			void TriggerConfigFileEventThenWait(OVERLAPPED*, std::span<std::byte> fileNotifyInformationBuffer);
-			bool FileNotifyInformationContainsConfigFileEvents(std::span<const std::byte> fileNotifyInformationBuffer);
-			void OnConfigFileEvent();
-
-			const ConfigLoader& configLoader;
-			const std::function<void()> onConfigChange;
-			
-			std::binary_semaphore stopSemaphore{0};
-			std::mutex directoryMutex;
-			HANDLE directory = INVALID_HANDLE_VALUE;
-
-			std::thread thread;
-		};
+		const std::filesystem::path& GetConfigFilePath() const { return configFilePath; }
 
 	private:
-		const std::filesystem::path configDirectory;
+		const std::filesystem::path configFilePath;
 		const Config initialConfig;
 	};
 
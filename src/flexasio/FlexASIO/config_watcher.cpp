@@ -0,0 +1,431 @@
+#include "config_watcher.h"
+
+#include <dechamps_cpputil/exception.h>
+
+#include "log.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <semaphore>
+#include <span>
+#include <sstream>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace flexasio {
+
+	namespace {
+
+		// It's best to debounce events that arrive in quick succession, otherwise we might attempt to read the file while
+		// it's being changed, resulting in spurious resets (e.g. the Visual Studio Code editor will empty the file first
+		// before writing the new contents). Another reason to debounce is that it might make it less likely we'll run into
+		// file locking issues.
+		constexpr auto debounceDelay = std::chrono::milliseconds(250);
+
+		// Note: we need to be careful about logging while waiting for changes - since the logfile is in the same directory
+		// as the config file, we could end up with directory change events entering an infinite feedback loop.
+
+#ifdef _WIN32
+		struct HandleCloser {
+			void operator()(HANDLE handle) {
+				if (::CloseHandle(handle) == 0)
+					Log() << "Unable to close handle: " << std::system_category().message(::GetLastError());
+			}
+		};
+		using UniqueHandle = std::unique_ptr<std::remove_pointer_t<HANDLE>, HandleCloser>;
+
+		UniqueHandle CreateManualResetEvent() {
+			const auto event = ::CreateEventA(NULL, TRUE, FALSE, NULL);
+			if (event == NULL) throw std::system_error(::GetLastError(), std::system_category(), "Unable to create event");
+			return UniqueHandle(event);
+		}
+
+		// Reports changes to a file using ReadDirectoryChangesW() on the directory that contains it.
+		class FileChangeWatch final {
+		public:
+			explicit FileChangeWatch(const std::filesystem::path& path) :
+				fileName(path.filename().native()),
+				directory([&] {
+					Log() << "Opening config directory for watching: " << path.parent_path();
+					const auto handle = ::CreateFileW(
+						path.parent_path().c_str(),
+						FILE_LIST_DIRECTORY,
+						FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+						/*lpSecurityAttributes=*/NULL,
+						OPEN_EXISTING,
+						FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+						/*hTemplateFile=*/NULL);
+					if (handle == INVALID_HANDLE_VALUE)
+						throw std::system_error(::GetLastError(), std::system_category(), "Unable to open config directory for watching");
+					return UniqueHandle(handle);
+				}()),
+				operationEvent(CreateManualResetEvent()),
+				cancelEvent(CreateManualResetEvent()) {}
+			FileChangeWatch(const FileChangeWatch&) = delete;
+			FileChangeWatch& operator=(const FileChangeWatch&) = delete;
+
+			~FileChangeWatch() {
+				if (!operationPending) return;
+				if (::CancelIoEx(directory.get(), &overlapped) == 0) {
+					Log() << "Unable to cancel directory watch operation: " << std::system_category().message(::GetLastError());
+					return;
+				}
+				DWORD size;
+				::GetOverlappedResult(directory.get(), &overlapped, &size, /*bWait=*/TRUE);
+			}
+
+			// Blocks until the file might have changed (returns true), or until Cancel() is called (returns false).
+			bool Wait() {
+				for (;;) {
+					if (!operationPending) StartOperation();
+
+					const HANDLE handles[] = { cancelEvent.get(), operationEvent.get() };
+					const auto waitResult = ::WaitForMultipleObjects(DWORD(std::size(handles)), handles, /*bWaitAll=*/FALSE, INFINITE);
+					if (waitResult == WAIT_OBJECT_0) return false;
+					if (waitResult != WAIT_OBJECT_0 + 1)
+						throw std::system_error(::GetLastError(), std::system_category(), "Unable to wait for directory changes");
+
+					DWORD size;
+					if (::GetOverlappedResult(directory.get(), &overlapped, &size, /*bWait=*/FALSE) == 0)
+						throw std::system_error(::GetLastError(), std::system_category(), "GetOverlappedResult() failed");
+					operationPending = false;
+					if (size > buffer.size() * sizeof(buffer[0]))
+						throw std::runtime_error("ReadDirectoryChangesW() produced invalid size: " + std::to_string(size));
+					if (size == 0) {
+						// The buffer overflowed. We don't know if something happened to the file, so assume it did.
+						// If for some reason there is enough churn in the directory and we overflow all the time,
+						// this will de facto fall back to polling at intervals given by the debounce period.
+						Log() << "Config watcher file notify information buffer overflowed";
+						return true;
+					}
+					if (ContainsFileEvents(std::as_bytes(std::span(buffer)).first(size))) return true;
+				}
+			}
+
+			// Can be called from any thread, including before Wait() is called.
+			void Cancel() {
+				if (::SetEvent(cancelEvent.get()) == 0)
+					throw std::system_error(::GetLastError(), std::system_category(), "Unable to signal config watcher cancellation");
+			}
+
+		private:
+			void StartOperation() {
+				overlapped = {};
+				overlapped.hEvent = operationEvent.get();
+				if (::ResetEvent(operationEvent.get()) == 0)
+					throw std::system_error(::GetLastError(), std::system_category(), "Unable to reset watch event");
+				if (::ReadDirectoryChangesW(
+					directory.get(),
+					buffer.data(), DWORD(buffer.size() * sizeof(buffer[0])),
+					/*bWatchSubtree=*/FALSE,
+					FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE,
+					/*lpBytesReturned=*/NULL,
+					&overlapped,
+					/*lpCompletionRoutine=*/NULL) == 0)
+					throw std::system_error(::GetLastError(), std::system_category(), "Unable to watch for directory changes");
+				operationPending = true;
+			}
+
+			bool ContainsFileEvents(std::span<const std::byte> fileNotifyInformationBuffer) const {
+				for (;;) {
+					constexpr auto fileNotifyInformationHeaderSize = offsetof(FILE_NOTIFY_INFORMATION, FileName);
+					FILE_NOTIFY_INFORMATION fileNotifyInformationHeader;
+					const auto fileNotifyInformationHeaderBuffer = fileNotifyInformationBuffer.first(fileNotifyInformationHeaderSize);
+					memcpy(&fileNotifyInformationHeader, fileNotifyInformationHeaderBuffer.data(), fileNotifyInformationHeaderBuffer.size());
+
+					const auto fileNameBuffer = fileNotifyInformationBuffer.subspan(fileNotifyInformationHeaderSize, fileNotifyInformationHeader.FileNameLength);
+					std::wstring eventFileName(fileNameBuffer.size() / sizeof(wchar_t), 0);
+					memcpy(eventFileName.data(), fileNameBuffer.data(), fileNameBuffer.size());
+					if (eventFileName == fileName) {
+						// Here we can safely log.
+						Log() << "Config directory change received with matching file name: "
+							<< " NextEntryOffset = " << fileNotifyInformationHeader.NextEntryOffset
+							<< " Action = " << fileNotifyInformationHeader.Action
+							<< " FileNameLength = " << fileNotifyInformationHeader.FileNameLength;
+
+						if (fileNotifyInformationHeader.Action == FILE_ACTION_ADDED ||
+							fileNotifyInformationHeader.Action == FILE_ACTION_REMOVED ||
+							fileNotifyInformationHeader.Action == FILE_ACTION_MODIFIED ||
+							fileNotifyInformationHeader.Action == FILE_ACTION_RENAMED_NEW_NAME) {
+							Log() << "Detected configuration file change event";
+							return true;
+						}
+					}
+
+					if (fileNotifyInformationHeader.NextEntryOffset == 0) break;
+					fileNotifyInformationBuffer = fileNotifyInformationBuffer.subspan(fileNotifyInformationHeader.NextEntryOffset);
+				}
+				return false;
+			}
+
+			const std::wstring fileName;
+			const UniqueHandle directory;
+			const UniqueHandle operationEvent;
+			const UniqueHandle cancelEvent;
+			// ReadDirectoryChangesW() requires DWORD alignment.
+			std::vector<DWORD> buffer = std::vector<DWORD>(16 * 1024);
+			OVERLAPPED overlapped = {};
+			bool operationPending = false;
+		};
+#else
+		class UniqueFileDescriptor final {
+		public:
+			explicit UniqueFileDescriptor(int fileDescriptor) : fileDescriptor(fileDescriptor) {}
+			UniqueFileDescriptor(const UniqueFileDescriptor&) = delete;
+			UniqueFileDescriptor& operator=(const UniqueFileDescriptor&) = delete;
+			~UniqueFileDescriptor() { if (fileDescriptor >= 0) ::close(fileDescriptor); }
+
+			int Get() const { return fileDescriptor; }
+
+		private:
+			const int fileDescriptor;
+		};
+
+		int CheckFileDescriptor(int fileDescriptor, const char* what) {
+			if (fileDescriptor < 0) throw std::system_error(errno, std::generic_category(), what);
+			return fileDescriptor;
+		}
+
+		// Reports changes to a file using inotify on the directory that contains it, so that the file being replaced (as
+		// opposed to modified in place) is detected as well.
+		class FileChangeWatch final {
+		public:
+			explicit FileChangeWatch(const std::filesystem::path& path) :
+				fileName(path.filename().native()),
+				inotify(CheckFileDescriptor(::inotify_init1(IN_NONBLOCK | IN_CLOEXEC), "Unable to initialize inotify")),
+				cancelEvent(CheckFileDescriptor(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), "Unable to create config watcher cancellation event")) {
+				Log() << "Watching config directory: " << path.parent_path();
+				CheckFileDescriptor(
+					::inotify_add_watch(inotify.Get(), path.parent_path().c_str(), IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO),
+					"Unable to watch config directory");
+			}
+
+			bool Wait() {
+				for (;;) {
+					pollfd pollFileDescriptors[] = { { .fd = cancelEvent.Get(), .events = POLLIN, .revents = 0 }, { .fd = inotify.Get(), .events = POLLIN, .revents = 0 } };
+					if (::poll(pollFileDescriptors, std::size(pollFileDescriptors), -1) < 0) {
+						if (errno == EINTR) continue;
+						throw std::system_error(errno, std::generic_category(), "Unable to wait for directory changes");
+					}
+					if (pollFileDescriptors[0].revents != 0) return false;
+					if (ReadEventsContainFileEvents()) return true;
+				}
+			}
+
+			void Cancel() {
+				const uint64_t one = 1;
+				if (::write(cancelEvent.Get(), &one, sizeof(one)) != sizeof(one))
+					throw std::system_error(errno, std::generic_category(), "Unable to signal config watcher cancellation");
+			}
+
+		private:
+			bool ReadEventsContainFileEvents() {
+				bool fileEvents = false;
+				for (;;) {
+					alignas(inotify_event) char buffer[16 * 1024];
+					const auto size = ::read(inotify.Get(), buffer, sizeof(buffer));
+					if (size < 0) {
+						if (errno == EINTR) continue;
+						if (errno == EAGAIN) return fileEvents;
+						throw std::system_error(errno, std::generic_category(), "Unable to read inotify events");
+					}
+					for (ssize_t offset = 0; offset < size;) {
+						inotify_event event;
+						memcpy(&event, buffer + offset, sizeof(event));
+						if (event.mask & IN_Q_OVERFLOW) {
+							// We don't know if something happened to the file, so assume it did.
+							Log() << "Config watcher inotify queue overflowed";
+							fileEvents = true;
+						}
+						// The name is null-terminated within the `len` bytes that follow the event.
+						else if (event.len > 0 && fileName == buffer + offset + sizeof(event)) {
+							// Here we can safely log.
+							Log() << "Detected configuration file change event (inotify mask " << event.mask << ")";
+							fileEvents = true;
+						}
+						offset += ssize_t(sizeof(event) + event.len);
+					}
+				}
+			}
+
+			const std::string fileName;
+			const UniqueFileDescriptor inotify;
+			const UniqueFileDescriptor cancelEvent;
+		};
+#endif
+
+		// A missing file is treated as an empty one, like ConfigLoader does.
+		std::string ReadFile(const std::filesystem::path& path) {
+			std::error_code error;
+			if (!std::filesystem::exists(std::filesystem::status(path, error))) return {};
+			std::ifstream stream(path, std::ios::binary);
+			if (!stream) throw std::runtime_error("Unable to open config file");
+			std::stringstream contents;
+			contents << stream.rdbuf();
+			if (stream.bad()) throw std::runtime_error("Unable to read config file");
+			return contents.str();
+		}
+
+	}
+
+	struct ConfigWatcher::Subscriber final {
+		const std::function<void(const Config&)> onConfigChange;
+		Config lastConfig;
+	};
+
+	class ConfigWatcher::Service final {
+	public:
+		static std::shared_ptr<Service> Get(const std::filesystem::path& path) {
+			static std::mutex mutex;
+			static std::map<std::filesystem::path, std::weak_ptr<Service>> services;
+
+			std::scoped_lock lock(mutex);
+			auto& weakService = services[path];
+			auto service = weakService.lock();
+			if (service == nullptr) {
+				service = std::make_shared<Service>(path);
+				weakService = service;
+			}
+			else Log() << "Sharing existing config watcher";
+			return service;
+		}
+
+		explicit Service(std::filesystem::path path) : path(std::move(path)) {
+			Log() << "Starting config watcher thread";
+			thread = std::thread([this] { RunThread(); });
+		}
+
+		Service(const Service&) = delete;
+		Service& operator=(const Service&) = delete;
+
+		~Service() {
+			Log() << "Stopping config watcher";
+			stopSemaphore.release();
+			fileChangeWatch.Cancel();
+
+			Log() << "Waiting for config watcher thread to finish";
+			thread.join();
+
+			Log() << "Joined config watcher thread";
+		}
+
+		void Subscribe(Subscriber& subscriber) {
+			std::scoped_lock lock(mutex);
+			// The file might have changed since the subscriber loaded it, or since the thread last looked at it.
+			Refresh();
+			Notify(subscriber);
+			subscribers.push_back(&subscriber);
+		}
+
+		void Unsubscribe(const Subscriber& subscriber) {
+			std::scoped_lock lock(mutex);
+			std::erase(subscribers, &subscriber);
+		}
+
+	private:
+		void RunThread() {
+			Log() << "Config watcher thread running";
+
+			try {
+				while (fileChangeWatch.Wait()) {
+					// Events that arrive during the debounce period will wake us up again, but by then the file will most
+					// likely not have changed since Refresh() looked at it, which is cheap to check as the file is small.
+					Log() << "Sleeping for debounce";
+					if (stopSemaphore.try_acquire_for(debounceDelay)) break;
+
+					std::scoped_lock lock(mutex);
+					Refresh();
+					for (const auto subscriber : subscribers) Notify(*subscriber);
+				}
+			}
+			catch (const std::exception& exception) {
+				Log() << "Config watcher thread encountered error: " << ::dechamps_cpputil::GetNestedExceptionMessage(exception);
+			}
+			catch (...) {
+				Log() << "Config watcher thread encountered unknown exception";
+			}
+
+			Log() << "Config watcher thread stopping";
+		}
+
+		// Must be called with `mutex` held.
+		void Refresh() {
+			Log() << "Checking config file for changes";
+			try {
+				// Size and modification time are not enough to tell if the file changed: an edit that keeps the size can land
+				// within the modification time granularity.
+				const auto contents = ReadFile(path);
+				const auto newContentHash = std::hash<std::string>()(contents);
+				const auto contentChanged = newContentHash != contentHash;
+				contentHash = newContentHash;
+				if (!contentChanged) {
+					Log() << "Config file contents did not change, not parsing it";
+					return;
+				}
+
+				Log() << "Parsing changed config file";
+				config = ParseConfig(contents);
+			}
+			catch (const std::exception& exception) {
+				Log() << "Unable to load config, ignoring event: " << ::dechamps_cpputil::GetNestedExceptionMessage(exception);
+			}
+		}
+
+		// Must be called with `mutex` held.
+		void Notify(Subscriber& subscriber) {
+			if (!config.has_value()) return;
+			if (*config == subscriber.lastConfig) {
+				Log() << "Config is identical to the subscriber's current config, not taking any action";
+				return;
+			}
+			subscriber.lastConfig = *config;
+			try {
+				subscriber.onConfigChange(subscriber.lastConfig);
+			}
+			catch (const std::exception& exception) {
+				Log() << "Config change handler failed: " << ::dechamps_cpputil::GetNestedExceptionMessage(exception);
+			}
+		}
+
+		const std::filesystem::path path;
+		FileChangeWatch fileChangeWatch{path};
+		std::binary_semaphore stopSemaphore{0};
+
+		std::mutex mutex;
+		std::vector<Subscriber*> subscribers;
+		// Of the file as it was last read.
+		std::optional<size_t> contentHash;
+		// The last valid config read from the file.
+		std::optional<Config> config;
+
+		std::thread thread;
+	};
+
+	ConfigWatcher::ConfigWatcher(const ConfigLoader& configLoader, std::function<void(const Config&)> onConfigChange) :
+		service(Service::Get(configLoader.GetConfigFilePath())),
+		subscriber(std::make_unique<Subscriber>(Subscriber{ .onConfigChange = std::move(onConfigChange), .lastConfig = configLoader.Initial() })) {
+		service->Subscribe(*subscriber);
+	}
+
+	ConfigWatcher::~ConfigWatcher() {
+		service->Unsubscribe(*subscriber);
+	}
+
+}
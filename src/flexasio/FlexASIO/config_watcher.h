@@ -0,0 +1,34 @@
+#pragma once
+
+#include "config.h"
+
+#include <functional>
+#include <memory>
+
+namespace flexasio {
+
+	// Calls `onConfigChange` with the new config whenever the configuration file changes to a valid config that is
+	// different from the last one passed to `onConfigChange` (initially, the ConfigLoader's initial config). If the file
+	// already changed by the time the ConfigWatcher is constructed, `onConfigChange` is called from the constructor.
+	// Otherwise, it is called from a background thread. `onConfigChange` must not destroy the ConfigWatcher.
+	//
+	// All ConfigWatchers in the process that watch the same file share a single background thread, which parses the file
+	// once per change and hands the same parsed config to every ConfigWatcher. The file is read and hashed on every event,
+	// but only parsed again if its contents changed, which makes bursts of events (e.g. an editor saving the file in
+	// several steps) cheap.
+	class ConfigWatcher final {
+	public:
+		ConfigWatcher(const ConfigLoader& configLoader, std::function<void(const Config&)> onConfigChange);
+		ConfigWatcher(const ConfigWatcher&) = delete;
+		ConfigWatcher(ConfigWatcher&&) = delete;
+		~ConfigWatcher();
+
+	private:
+		class Service;
+		struct Subscriber;
+
+		const std::shared_ptr<Service> service;
+		const std::unique_ptr<Subscriber> subscriber;
+	};
+
+}
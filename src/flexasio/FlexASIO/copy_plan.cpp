@@ -0,0 +1,284 @@
+#include "copy_plan.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FLEXASIO_COPY_PLAN_SSE2
+#endif
+
+#include "log.h"
+
+namespace flexasio {
+
+	namespace {
+
+		// Above this amount of data moved per buffer, the data is unlikely to still be in cache by the time it is read
+		// again, so it's best not to evict everything else from the cache to make room for it.
+		constexpr size_t nonTemporalThresholdInBytes = 1024 * 1024;
+
+#ifdef FLEXASIO_COPY_PLAN_SSE2
+		constexpr size_t nonTemporalAlignment = 16;
+
+		template <typename Store> void ForEachNonTemporalBlock(std::byte*& destination, size_t& size, Store store) {
+			const auto misalignment = reinterpret_cast<uintptr_t>(destination) % nonTemporalAlignment;
+			const auto headSize = (std::min)(size, misalignment == 0 ? 0 : nonTemporalAlignment - misalignment);
+			store(destination, headSize, false);
+			destination += headSize;
+			size -= headSize;
+			for (; size >= nonTemporalAlignment; size -= nonTemporalAlignment, destination += nonTemporalAlignment)
+				store(destination, nonTemporalAlignment, true);
+		}
+#endif
+
+		void Copy(std::byte* destination, const std::byte* source, size_t size, bool nonTemporal) {
+#ifdef FLEXASIO_COPY_PLAN_SSE2
+			if (nonTemporal) {
+				ForEachNonTemporalBlock(destination, size, [&](std::byte* blockDestination, size_t blockSize, bool aligned) {
+					if (aligned) _mm_stream_si128(reinterpret_cast<__m128i*>(blockDestination), _mm_loadu_si128(reinterpret_cast<const __m128i*>(source)));
+					else memcpy(blockDestination, source, blockSize);
+					source += blockSize;
+				});
+			}
+#else
+			(void)nonTemporal;
+#endif
+			memcpy(destination, source, size);
+		}
+
+		void Zero(std::byte* destination, size_t size, bool nonTemporal) {
+#ifdef FLEXASIO_COPY_PLAN_SSE2
+			if (nonTemporal) {
+				ForEachNonTemporalBlock(destination, size, [&](std::byte* blockDestination, size_t blockSize, bool aligned) {
+					if (aligned) _mm_stream_si128(reinterpret_cast<__m128i*>(blockDestination), _mm_setzero_si128());
+					else memset(blockDestination, 0, blockSize);
+				});
+			}
+#else
+			(void)nonTemporal;
+#endif
+			memset(destination, 0, size);
+		}
+
+		// Non-temporal stores are weakly ordered; make sure they are visible to other threads (e.g. the ASIO host
+		// application or the PortAudio backend) before we hand the buffers over.
+		void Fence(bool nonTemporal) {
+#ifdef FLEXASIO_COPY_PLAN_SSE2
+			if (nonTemporal) _mm_sfence();
+#else
+			(void)nonTemporal;
+#endif
+		}
+
+		template <typename Pointer> bool IsContiguous(const Pointer* portAudioBuffers, int firstChannel, int channelCount, size_t bufferSizeInBytes) {
+			for (int channelOffset = 1; channelOffset < channelCount; ++channelOffset)
+				if (portAudioBuffers[firstChannel + channelOffset] != portAudioBuffers[firstChannel] + channelOffset * bufferSizeInBytes)
+					return false;
+			return true;
+		}
+
+	}
+
+	CopyPlan::Runs CopyPlan::MakeRuns(const std::vector<ASIOBufferInfo>& bufferInfos, bool isInput, size_t bufferSizeInBytes) {
+		std::vector<ASIOBufferInfo> sortedBufferInfos;
+		std::copy_if(bufferInfos.begin(), bufferInfos.end(), std::back_inserter(sortedBufferInfos), [&](const ASIOBufferInfo& bufferInfo) { return !!bufferInfo.isInput == isInput; });
+		std::sort(sortedBufferInfos.begin(), sortedBufferInfos.end(), [](const ASIOBufferInfo& lhs, const ASIOBufferInfo& rhs) { return lhs.channelNum < rhs.channelNum; });
+
+		Runs runs;
+		for (const auto& bufferInfo : sortedBufferInfos) {
+			const auto extendsPreviousRun = [&] {
+				if (runs.channelCount.empty()) return false;
+				const auto channelCount = runs.channelCount.back();
+				if (bufferInfo.channelNum != runs.firstPortAudioChannel.back() + channelCount) return false;
+				for (size_t bufferIndex = 0; bufferIndex < 2; ++bufferIndex)
+					if (static_cast<std::byte*>(bufferInfo.buffers[bufferIndex]) != runs.asioBuffers[bufferIndex].back() + channelCount * bufferSizeInBytes)
+						return false;
+				return true;
+			}();
+			if (extendsPreviousRun) {
+				++runs.channelCount.back();
+				continue;
+			}
+			runs.firstPortAudioChannel.push_back(bufferInfo.channelNum);
+			runs.channelCount.push_back(1);
+			for (size_t bufferIndex = 0; bufferIndex < 2; ++bufferIndex)
+				runs.asioBuffers[bufferIndex].push_back(static_cast<std::byte*>(bufferInfo.buffers[bufferIndex]));
+		}
+		return runs;
+	}
+
+	std::array<std::vector<std::byte*>, 2> CopyPlan::GetAsioBuffersByChannel(const std::vector<ASIOBufferInfo>& bufferInfos, bool isInput, int channelCount) {
+		std::array<std::vector<std::byte*>, 2> asioBuffersByChannel;
+		for (size_t bufferIndex = 0; bufferIndex < 2; ++bufferIndex) {
+			asioBuffersByChannel[bufferIndex].resize(channelCount, nullptr);
+			for (const auto& bufferInfo : bufferInfos)
+				if (!!bufferInfo.isInput == isInput)
+					asioBuffersByChannel[bufferIndex][bufferInfo.channelNum] = static_cast<std::byte*>(bufferInfo.buffers[bufferIndex]);
+		}
+		return asioBuffersByChannel;
+	}
+
+	CopyPlan::CopyPlan(const std::vector<ASIOBufferInfo>& bufferInfos, size_t bufferSizeInFrames, Direction input, Direction output) :
+		bufferSizeInFrames(bufferSizeInFrames),
+		inputConverter(std::move(input.converter)), outputConverter(std::move(output.converter)),
+		inputBufferSizeInBytes(bufferSizeInFrames * input.asioSampleSizeInBytes), outputBufferSizeInBytes(bufferSizeInFrames * output.asioSampleSizeInBytes),
+		portAudioInputBufferSizeInBytes(inputConverter.has_value() ? bufferSizeInFrames * inputConverter->GetInputSampleSizeInBytes() : inputBufferSizeInBytes),
+		portAudioOutputBufferSizeInBytes(outputConverter.has_value() ? bufferSizeInFrames * outputConverter->GetOutputSampleSizeInBytes() : outputBufferSizeInBytes),
+		inputRuns(MakeRuns(bufferInfos, /*isInput=*/true, inputBufferSizeInBytes)),
+		outputRuns(MakeRuns(bufferInfos, /*isInput=*/false, outputBufferSizeInBytes)),
+		outputChannelCount(output.channelCount),
+		inputAsioBuffersByChannel(GetAsioBuffersByChannel(bufferInfos, /*isInput=*/true, input.channelCount)),
+		outputAsioBuffersByChannel(GetAsioBuffersByChannel(bufferInfos, /*isInput=*/false, output.channelCount)),
+		mixSources((std::max)(input.channelCount, output.channelCount)),
+		inputMixScratch(inputConverter.has_value() ? input.channelCount * bufferSizeInFrames : 0),
+		outputMixScratch(outputConverter.has_value() ? bufferSizeInFrames : 0) {
+		std::vector<bool> outputChannelIsActive(outputChannelCount, false);
+		for (size_t runIndex = 0; runIndex < outputRuns.channelCount.size(); ++runIndex)
+			for (int channelOffset = 0; channelOffset < outputRuns.channelCount[runIndex]; ++channelOffset)
+				outputChannelIsActive[outputRuns.firstPortAudioChannel[runIndex] + channelOffset] = true;
+		for (int channel = 0; channel < outputChannelCount; ++channel) {
+			if (outputChannelIsActive[channel]) continue;
+			if (!inactiveOutputRuns.channelCount.empty() && inactiveOutputRuns.firstPortAudioChannel.back() + inactiveOutputRuns.channelCount.back() == channel) {
+				++inactiveOutputRuns.channelCount.back();
+				continue;
+			}
+			inactiveOutputRuns.firstPortAudioChannel.push_back(channel);
+			inactiveOutputRuns.channelCount.push_back(1);
+		}
+
+		const auto bytesPerBuffer = bufferInfos.size() * (std::max)(inputBufferSizeInBytes, outputBufferSizeInBytes);
+		// Non-temporal stores only apply to plain copies.
+		nonTemporal = !inputConverter.has_value() && !outputConverter.has_value() && bytesPerBuffer >= nonTemporalThresholdInBytes;
+
+		Log() << "Copy plan: " << inputRuns.channelCount.size() << " input runs, " << outputRuns.channelCount.size() << " output runs, "
+			<< inactiveOutputRuns.channelCount.size() << " inactive output runs, " << bytesPerBuffer << " bytes per buffer, "
+			<< (nonTemporal ? "using" : "not using") << " non-temporal stores";
+		if (inputConverter.has_value()) Log() << "Converting input samples using " << GetInstructionSetString(inputConverter->GetInstructionSet()) << " code";
+		if (outputConverter.has_value()) Log() << "Converting output samples using " << GetInstructionSetString(outputConverter->GetInstructionSet()) << " code";
+	}
+
+	void CopyPlan::CopyFromPortAudioBuffers(long doubleBufferIndex, const std::byte* const* portAudioBuffers) {
+		const auto transfer = [&](std::byte* asioBuffer, const std::byte* portAudioBuffer, int channelCount) {
+			if (inputConverter.has_value()) inputConverter->Convert(portAudioBuffer, asioBuffer, channelCount * bufferSizeInFrames);
+			else Copy(asioBuffer, portAudioBuffer, channelCount * inputBufferSizeInBytes, nonTemporal);
+		};
+		const auto& asioBuffers = inputRuns.asioBuffers[doubleBufferIndex];
+		for (size_t runIndex = 0; runIndex < asioBuffers.size(); ++runIndex) {
+			const auto firstChannel = inputRuns.firstPortAudioChannel[runIndex];
+			const auto channelCount = inputRuns.channelCount[runIndex];
+			if (IsContiguous(portAudioBuffers, firstChannel, channelCount, portAudioInputBufferSizeInBytes)) {
+				transfer(asioBuffers[runIndex], portAudioBuffers[firstChannel], channelCount);
+				continue;
+			}
+			for (int channelOffset = 0; channelOffset < channelCount; ++channelOffset)
+				transfer(asioBuffers[runIndex] + channelOffset * inputBufferSizeInBytes, portAudioBuffers[firstChannel + channelOffset], 1);
+		}
+		Fence(nonTemporal);
+	}
+
+	void CopyPlan::CopyToPortAudioBuffers(long doubleBufferIndex, std::byte* const* portAudioBuffers) {
+		const auto transfer = [&](std::byte* portAudioBuffer, const std::byte* asioBuffer, int channelCount) {
+			if (outputConverter.has_value()) outputConverter->Convert(asioBuffer, portAudioBuffer, channelCount * bufferSizeInFrames);
+			else Copy(portAudioBuffer, asioBuffer, channelCount * outputBufferSizeInBytes, nonTemporal);
+		};
+		const auto& asioBuffers = outputRuns.asioBuffers[doubleBufferIndex];
+		for (size_t runIndex = 0; runIndex < asioBuffers.size(); ++runIndex) {
+			const auto firstChannel = outputRuns.firstPortAudioChannel[runIndex];
+			const auto channelCount = outputRuns.channelCount[runIndex];
+			if (IsContiguous(portAudioBuffers, firstChannel, channelCount, portAudioOutputBufferSizeInBytes)) {
+				transfer(portAudioBuffers[firstChannel], asioBuffers[runIndex], channelCount);
+				continue;
+			}
+			for (int channelOffset = 0; channelOffset < channelCount; ++channelOffset)
+				transfer(portAudioBuffers[firstChannel + channelOffset], asioBuffers[runIndex] + channelOffset * outputBufferSizeInBytes, 1);
+		}
+		Fence(nonTemporal);
+	}
+
+	void CopyPlan::ZeroInactivePortAudioOutputBuffers(std::byte* const* portAudioBuffers) const {
+		for (size_t runIndex = 0; runIndex < inactiveOutputRuns.channelCount.size(); ++runIndex) {
+			const auto firstChannel = inactiveOutputRuns.firstPortAudioChannel[runIndex];
+			const auto channelCount = inactiveOutputRuns.channelCount[runIndex];
+			if (IsContiguous(portAudioBuffers, firstChannel, channelCount, portAudioOutputBufferSizeInBytes)) {
+				Zero(portAudioBuffers[firstChannel], channelCount * portAudioOutputBufferSizeInBytes, nonTemporal);
+				continue;
+			}
+			for (int channelOffset = 0; channelOffset < channelCount; ++channelOffset)
+				Zero(portAudioBuffers[firstChannel + channelOffset], portAudioOutputBufferSizeInBytes, nonTemporal);
+		}
+		Fence(nonTemporal);
+	}
+
+	void CopyPlan::MixFromPortAudioBuffers(long doubleBufferIndex, const std::byte* const* portAudioBuffers, const MixPlan& mixPlan) {
+		for (const auto channel : mixPlan.GetSourceChannels()) {
+			if (!inputConverter.has_value()) {
+				mixSources[channel] = reinterpret_cast<const float*>(portAudioBuffers[channel]);
+				continue;
+			}
+			const auto scratch = inputMixScratch.data() + channel * bufferSizeInFrames;
+			inputConverter->Convert(portAudioBuffers[channel], reinterpret_cast<std::byte*>(scratch), bufferSizeInFrames);
+			mixSources[channel] = scratch;
+		}
+
+		const auto& asioBuffers = inputAsioBuffersByChannel[doubleBufferIndex];
+		const auto& destinationChannels = mixPlan.GetDestinationChannels();
+		size_t destinationIndex = 0;
+		for (int channel = 0; channel < int(asioBuffers.size()); ++channel) {
+			const auto asioBuffer = asioBuffers[channel];
+			const auto isDestination = destinationIndex < destinationChannels.size() && destinationChannels[destinationIndex] == channel;
+			if (asioBuffer == nullptr) {
+				if (isDestination) ++destinationIndex;
+				continue;
+			}
+			if (!isDestination) {
+				Zero(asioBuffer, inputBufferSizeInBytes, /*nonTemporal=*/false);
+				continue;
+			}
+			mixPlan.Mix(destinationIndex++, mixSources.data(), reinterpret_cast<float*>(asioBuffer), bufferSizeInFrames);
+		}
+	}
+
+	void CopyPlan::MixToPortAudioBuffers(long doubleBufferIndex, std::byte* const* portAudioBuffers, const MixPlan& mixPlan) {
+		const auto& asioBuffers = outputAsioBuffersByChannel[doubleBufferIndex];
+		for (const auto channel : mixPlan.GetSourceChannels())
+			mixSources[channel] = reinterpret_cast<const float*>(asioBuffers[channel]);
+
+		const auto& destinationChannels = mixPlan.GetDestinationChannels();
+		size_t destinationIndex = 0;
+		for (int channel = 0; channel < outputChannelCount; ++channel) {
+			const auto portAudioBuffer = portAudioBuffers[channel];
+			if (destinationIndex >= destinationChannels.size() || destinationChannels[destinationIndex] != channel) {
+				Zero(portAudioBuffer, portAudioOutputBufferSizeInBytes, /*nonTemporal=*/false);
+				continue;
+			}
+			if (!outputConverter.has_value()) {
+				mixPlan.Mix(destinationIndex++, mixSources.data(), reinterpret_cast<float*>(portAudioBuffer), bufferSizeInFrames);
+				continue;
+			}
+			mixPlan.Mix(destinationIndex++, mixSources.data(), outputMixScratch.data(), bufferSizeInFrames);
+			outputConverter->Convert(reinterpret_cast<const std::byte*>(outputMixScratch.data()), portAudioBuffer, bufferSizeInFrames);
+		}
+	}
+
+	std::vector<std::span<const std::byte>> CopyPlan::GetMemoryRanges() const {
+		std::vector<std::span<const std::byte>> memoryRanges;
+		for (const auto runs : { &inputRuns, &outputRuns }) {
+			memoryRanges.push_back(std::as_bytes(std::span(runs->firstPortAudioChannel)));
+			memoryRanges.push_back(std::as_bytes(std::span(runs->channelCount)));
+			for (const auto& asioBuffers : runs->asioBuffers) memoryRanges.push_back(std::as_bytes(std::span(asioBuffers)));
+		}
+		memoryRanges.push_back(std::as_bytes(std::span(inactiveOutputRuns.firstPortAudioChannel)));
+		memoryRanges.push_back(std::as_bytes(std::span(inactiveOutputRuns.channelCount)));
+		for (const auto asioBuffersByChannel : { &inputAsioBuffersByChannel, &outputAsioBuffersByChannel })
+			for (const auto& asioBuffers : *asioBuffersByChannel) memoryRanges.push_back(std::as_bytes(std::span(asioBuffers)));
+		memoryRanges.push_back(std::as_bytes(std::span(mixSources)));
+		memoryRanges.push_back(std::as_bytes(std::span(inputMixScratch)));
+		memoryRanges.push_back(std::as_bytes(std::span(outputMixScratch)));
+		return memoryRanges;
+	}
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <dechamps_ASIOUtil/asiosdk/asiosys.h>
+#include <dechamps_ASIOUtil/asiosdk/asio.h>
+
+#include "mix_plan.h"
+#include "sample_conversion.h"
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace flexasio {
+
+	// Describes, once and for all, how to move a full buffer of samples between the PortAudio buffers and the ASIO
+	// buffers, so that the stream callback does not have to figure it out again on every period.
+	//
+	// Channels that are adjacent both in the PortAudio stream and in ASIO buffer memory are grouped into runs. At
+	// execution time, a run is copied with a single operation if the PortAudio buffers happen to be contiguous as well.
+	// PortAudio output channels that have no corresponding ASIO buffer are zeroed; the others are written exactly once.
+	//
+	// If the PortAudio stream uses a different sample type from the ASIO buffers, samples are converted on the fly.
+	//
+	// Alternatively, the Mix*() methods route channels according to a MixPlan instead of mapping each ASIO channel to the
+	// PortAudio channel with the same number. These require Float32 ASIO buffers.
+	class CopyPlan final {
+	public:
+		struct Direction final {
+			// Number of channels the PortAudio stream is opened with.
+			int channelCount;
+			size_t asioSampleSizeInBytes;
+			// Converts from PortAudio to ASIO samples for input, and from ASIO to PortAudio samples for output.
+			std::optional<SampleConverter> converter;
+		};
+
+		CopyPlan(const std::vector<ASIOBufferInfo>& bufferInfos, size_t bufferSizeInFrames, Direction input, Direction output);
+
+		void CopyFromPortAudioBuffers(long doubleBufferIndex, const std::byte* const* portAudioBuffers);
+		void CopyToPortAudioBuffers(long doubleBufferIndex, std::byte* const* portAudioBuffers);
+		void ZeroInactivePortAudioOutputBuffers(std::byte* const* portAudioBuffers) const;
+
+		// Sources are PortAudio channels, destinations are ASIO channels. ASIO channels that are not fed are zeroed.
+		void MixFromPortAudioBuffers(long doubleBufferIndex, const std::byte* const* portAudioBuffers, const MixPlan& mixPlan);
+		// Sources are ASIO channels, destinations are PortAudio channels. All PortAudio channels are written, including
+		// the ones that are not fed, which are zeroed; ZeroInactivePortAudioOutputBuffers() is not needed.
+		// `mixPlan` must only use active ASIO channels as sources.
+		void MixToPortAudioBuffers(long doubleBufferIndex, std::byte* const* portAudioBuffers, const MixPlan& mixPlan);
+
+		// Heap memory accessed by the above methods (not including the buffers themselves).
+		std::vector<std::span<const std::byte>> GetMemoryRanges() const;
+
+	private:
+		// Structure of arrays; one element per run.
+		struct Runs final {
+			std::vector<int> firstPortAudioChannel;
+			std::vector<int> channelCount;
+			std::array<std::vector<std::byte*>, 2> asioBuffers;
+		};
+
+		static Runs MakeRuns(const std::vector<ASIOBufferInfo>& bufferInfos, bool isInput, size_t bufferSizeInBytes);
+		// Indexed by channel number; null for inactive channels.
+		static std::array<std::vector<std::byte*>, 2> GetAsioBuffersByChannel(const std::vector<ASIOBufferInfo>& bufferInfos, bool isInput, int channelCount);
+
+		const size_t bufferSizeInFrames;
+		std::optional<SampleConverter> inputConverter;
+		std::optional<SampleConverter> outputConverter;
+		const size_t inputBufferSizeInBytes;
+		const size_t outputBufferSizeInBytes;
+		const size_t portAudioInputBufferSizeInBytes;
+		const size_t portAudioOutputBufferSizeInBytes;
+		const Runs inputRuns;
+		const Runs outputRuns;
+		struct {
+			std::vector<int> firstPortAudioChannel;
+			std::vector<int> channelCount;
+		} inactiveOutputRuns;
+		const int outputChannelCount;
+		const std::array<std::vector<std::byte*>, 2> inputAsioBuffersByChannel;
+		const std::array<std::vector<std::byte*>, 2> outputAsioBuffersByChannel;
+		// Used by the Mix*() methods. Indexed by source channel.
+		std::vector<const float*> mixSources;
+		// Float32 samples, for PortAudio channels that need to be converted. One buffer per PortAudio input channel, and a
+		// single buffer for output.
+		std::vector<float> inputMixScratch;
+		std::vector<float> outputMixScratch;
+		// Use non-temporal stores, which avoid polluting the cache when moving large amounts of data.
+		bool nonTemporal = false;
+	};
+
+}
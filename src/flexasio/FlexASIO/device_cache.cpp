@@ -0,0 +1,219 @@
+#include "device_cache.h"
+
+#include <mmdeviceapi.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+
+#include "cache_file.h"
+#include "log.h"
+
+namespace flexasio {
+
+	namespace {
+
+		// Bump this whenever the format of the file, or the meaning of what it contains, changes.
+		constexpr std::string_view fileHeader = "FlexASIO device cache 1";
+
+		std::filesystem::path GetCachePath() {
+			return GetCacheDirectory() / "devices.cache";
+		}
+
+		std::optional<WAVEFORMATEXTENSIBLE> GetWasapiFormat(WAVEFORMATEXTENSIBLE (*getFormat)(PaDeviceIndex), PaDeviceIndex deviceIndex) {
+			try {
+				return getFormat(deviceIndex);
+			}
+			catch (const std::exception& exception) {
+				Log() << "Unable to get WASAPI format of device " << deviceIndex << ": " << exception.what();
+				return std::nullopt;
+			}
+		}
+
+		std::vector<DeviceCache::Entry> EnumerateEntries(const HostApi& hostApi) {
+			std::vector<DeviceCache::Entry> entries;
+			for (int hostApiDeviceIndex = 0; hostApiDeviceIndex < hostApi.info.deviceCount; ++hostApiDeviceIndex) {
+				const Device device(Pa_HostApiDeviceIndexToDeviceIndex(hostApi.index, hostApiDeviceIndex));
+				const auto isWasapi = hostApi.info.type == paWASAPI;
+				entries.push_back({
+					.index = device.index,
+					.name = device.info.name,
+					.maxInputChannels = device.info.maxInputChannels,
+					.maxOutputChannels = device.info.maxOutputChannels,
+					.defaultSampleRate = device.info.defaultSampleRate,
+					.wasapiDefaultFormat = isWasapi ? GetWasapiFormat(GetWasapiDeviceDefaultFormat, device.index) : std::nullopt,
+					.wasapiMixFormat = isWasapi ? GetWasapiFormat(GetWasapiDeviceMixFormat, device.index) : std::nullopt,
+				});
+			}
+			return entries;
+		}
+
+		std::unordered_map<std::string, std::vector<size_t>> IndexByName(std::span<const DeviceCache::Entry> entries) {
+			std::unordered_map<std::string, std::vector<size_t>> entriesByName;
+			for (size_t entryIndex = 0; entryIndex < entries.size(); ++entryIndex) entriesByName[entries[entryIndex].name].push_back(entryIndex);
+			return entriesByName;
+		}
+
+		std::unordered_map<PaDeviceIndex, size_t> IndexByDeviceIndex(std::span<const DeviceCache::Entry> entries) {
+			std::unordered_map<PaDeviceIndex, size_t> entriesByDeviceIndex;
+			for (size_t entryIndex = 0; entryIndex < entries.size(); ++entryIndex) entriesByDeviceIndex.emplace(entries[entryIndex].index, entryIndex);
+			return entriesByDeviceIndex;
+		}
+
+		void SerializeWaveFormat(std::ostream& stream, const std::optional<WAVEFORMATEXTENSIBLE>& waveFormat) {
+			if (!waveFormat.has_value()) {
+				stream << "-";
+				return;
+			}
+			const auto bytes = reinterpret_cast<const unsigned char*>(&*waveFormat);
+			for (size_t byteIndex = 0; byteIndex < sizeof(*waveFormat); ++byteIndex)
+				stream << std::hex << std::setw(2) << std::setfill('0') << unsigned(bytes[byteIndex]);
+		}
+
+		// One line per device. The device index is not included, as it depends on the devices of other host APIs.
+		// The name comes last, so that it can contain anything but a line break.
+		std::vector<std::string> SerializeEntries(std::span<const DeviceCache::Entry> entries) {
+			std::vector<std::string> serializedEntries;
+			for (const auto& entry : entries) {
+				std::stringstream stream;
+				stream << entry.maxInputChannels << "\t" << entry.maxOutputChannels << "\t" << std::hexfloat << entry.defaultSampleRate << "\t";
+				SerializeWaveFormat(stream, entry.wasapiDefaultFormat);
+				stream << "\t";
+				SerializeWaveFormat(stream, entry.wasapiMixFormat);
+				stream << "\t" << entry.name;
+				serializedEntries.push_back(stream.str());
+			}
+			return serializedEntries;
+		}
+
+		// FNV-1a.
+		uint64_t ComputeFingerprint(std::span<const std::string> serializedEntries) {
+			uint64_t hash = 0xcbf29ce484222325;
+			const auto add = [&](unsigned char byte) {
+				hash ^= byte;
+				hash *= 0x100000001b3;
+			};
+			for (const auto& serializedEntry : serializedEntries) {
+				for (const auto character : serializedEntry) add(static_cast<unsigned char>(character));
+				add('\n');
+			}
+			return hash;
+		}
+
+		void LogChanges(std::span<const std::string> previousEntries, std::span<const std::string> currentEntries) {
+			if (!IsLoggingEnabled()) return;
+			for (const auto& previousEntry : previousEntries)
+				if (std::find(currentEntries.begin(), currentEntries.end(), previousEntry) == currentEntries.end())
+					Log() << "Device removed or changed since last enumeration: " << previousEntry;
+			for (const auto& currentEntry : currentEntries)
+				if (std::find(previousEntries.begin(), previousEntries.end(), currentEntry) == previousEntries.end())
+					Log() << "Device added or changed since last enumeration: " << currentEntry;
+		}
+
+	}
+
+	class DeviceCache::DeviceChangeListener final : public IMMNotificationClient {
+	public:
+		explicit DeviceChangeListener(std::filesystem::path path) : path(std::move(path)) {
+			const auto createResult = CoCreateInstance(__uuidof(MMDeviceEnumerator), NULL, CLSCTX_ALL, __uuidof(IMMDeviceEnumerator), reinterpret_cast<void**>(&enumerator));
+			if (FAILED(createResult)) throw std::system_error(createResult, std::system_category(), "Unable to create MMDevice enumerator");
+			const auto registerResult = enumerator->RegisterEndpointNotificationCallback(this);
+			if (FAILED(registerResult)) {
+				enumerator->Release();
+				throw std::system_error(registerResult, std::system_category(), "Unable to register endpoint notification callback");
+			}
+		}
+		DeviceChangeListener(const DeviceChangeListener&) = delete;
+		DeviceChangeListener& operator=(const DeviceChangeListener&) = delete;
+		~DeviceChangeListener() {
+			enumerator->UnregisterEndpointNotificationCallback(this);
+			enumerator->Release();
+		}
+
+		HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, void** object) final {
+			if (iid == __uuidof(IUnknown) || iid == __uuidof(IMMNotificationClient)) {
+				*object = static_cast<IMMNotificationClient*>(this);
+				return S_OK;
+			}
+			*object = nullptr;
+			return E_NOINTERFACE;
+		}
+		// The lifetime of this object is managed by DeviceCache, not by reference counting.
+		ULONG STDMETHODCALLTYPE AddRef() final { return 1; }
+		ULONG STDMETHODCALLTYPE Release() final { return 1; }
+
+		HRESULT STDMETHODCALLTYPE OnDeviceStateChanged(LPCWSTR, DWORD) final { Invalidate("device state changed"); return S_OK; }
+		HRESULT STDMETHODCALLTYPE OnDeviceAdded(LPCWSTR) final { Invalidate("device added"); return S_OK; }
+		HRESULT STDMETHODCALLTYPE OnDeviceRemoved(LPCWSTR) final { Invalidate("device removed"); return S_OK; }
+		// The default device is not part of the cache.
+		HRESULT STDMETHODCALLTYPE OnDefaultDeviceChanged(EDataFlow, ERole, LPCWSTR) final { return S_OK; }
+		HRESULT STDMETHODCALLTYPE OnPropertyValueChanged(LPCWSTR, const PROPERTYKEY) final { Invalidate("device property changed"); return S_OK; }
+
+	private:
+		// Called from a system thread.
+		void Invalidate(std::string_view reason) {
+			std::error_code error;
+			if (!std::filesystem::remove(path, error)) return;
+			Log() << "Invalidated device cache because of an audio endpoint notification (" << reason << ")";
+		}
+
+		const std::filesystem::path path;
+		IMMDeviceEnumerator* enumerator = nullptr;
+	};
+
+	DeviceCache::DeviceCache(const HostApi& hostApi) :
+		entries(EnumerateEntries(hostApi)),
+		entriesByName(IndexByName(entries)),
+		entriesByDeviceIndex(IndexByDeviceIndex(entries)),
+		serializedEntries(SerializeEntries(entries)),
+		fingerprint(ComputeFingerprint(serializedEntries)) {
+		Log() << "Indexed " << entries.size() << " devices, fingerprint " << fingerprint;
+
+		// The cache is an optimization. Failing to use it is not an error.
+		std::filesystem::path path;
+		try {
+			path = GetCachePath();
+			auto sections = LoadCacheFile(path, fileHeader);
+			auto& section = sections[hostApi.info.name];
+			warm = section == serializedEntries;
+			if (warm) Log() << "Device list matches device cache " << path;
+			else {
+				Log() << "Device list does not match device cache " << path << ", updating it";
+				LogChanges(section, serializedEntries);
+				section = serializedEntries;
+				SaveCacheFile(path, fileHeader, sections);
+			}
+		}
+		catch (const std::exception& exception) {
+			Log() << "Unable to use device cache: " << exception.what();
+		}
+
+		if (path.empty()) return;
+		try {
+			deviceChangeListener = std::make_unique<DeviceChangeListener>(path);
+		}
+		catch (const std::exception& exception) {
+			Log() << "Unable to listen for audio endpoint changes, device changes will only be detected on the next enumeration: " << exception.what();
+		}
+	}
+
+	DeviceCache::~DeviceCache() = default;
+
+	std::vector<const DeviceCache::Entry*> DeviceCache::Find(const std::string& name) const {
+		std::vector<const Entry*> found;
+		const auto entryIndices = entriesByName.find(name);
+		if (entryIndices == entriesByName.end()) return found;
+		for (const auto entryIndex : entryIndices->second) found.push_back(&entries[entryIndex]);
+		return found;
+	}
+
+	const DeviceCache::Entry& DeviceCache::Get(PaDeviceIndex deviceIndex) const {
+		const auto entryIndex = entriesByDeviceIndex.find(deviceIndex);
+		if (entryIndex == entriesByDeviceIndex.end()) throw std::runtime_error("Device " + std::to_string(deviceIndex) + " does not belong to the selected host API");
+		return entries[entryIndex->second];
+	}
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "../FlexASIOUtil/portaudio.h"
+
+#include <windows.h>
+#include <MMReg.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace flexasio {
+
+	// Index of the devices of a PortAudio host API and their capabilities, so that devices can be looked up without
+	// going through the whole PortAudio device list.
+	//
+	// The index is also persisted in devices.cache in the cache directory, with one section per host API. This tells
+	// the driver whether the device list changed since a previous instance saw it, which makes it possible to reuse
+	// results that are expensive to obtain for as long as it does not. The section is rewritten whenever it does not
+	// match what PortAudio enumerated. Some changes are invisible in the PortAudio device list (e.g. a device being
+	// replaced by another one with the same name), so the file is also deleted as soon as Windows reports an audio
+	// endpoint change while a DeviceCache exists.
+	class DeviceCache final {
+	public:
+		struct Entry final {
+			PaDeviceIndex index;
+			std::string name;
+			int maxInputChannels;
+			int maxOutputChannels;
+			double defaultSampleRate;
+			// Only set on WASAPI devices.
+			std::optional<WAVEFORMATEXTENSIBLE> wasapiDefaultFormat;
+			std::optional<WAVEFORMATEXTENSIBLE> wasapiMixFormat;
+		};
+
+		explicit DeviceCache(const HostApi& hostApi);
+		DeviceCache(const DeviceCache&) = delete;
+		DeviceCache(DeviceCache&&) = delete;
+		~DeviceCache();
+
+		// True if the persisted index matched the device list, i.e. the device list is the same as the last time it was
+		// enumerated.
+		bool IsWarm() const { return warm; }
+		// Identifies the device list of the host API, along with the capabilities of each device.
+		uint64_t GetFingerprint() const { return fingerprint; }
+
+		std::span<const Entry> GetEntries() const { return entries; }
+		// Devices of the host API with this exact name, in PortAudio order.
+		std::vector<const Entry*> Find(const std::string& name) const;
+		// Throws if the device does not belong to the host API.
+		const Entry& Get(PaDeviceIndex deviceIndex) const;
+
+	private:
+		class DeviceChangeListener;
+
+		const std::vector<Entry> entries;
+		const std::unordered_map<std::string, std::vector<size_t>> entriesByName;
+		const std::unordered_map<PaDeviceIndex, size_t> entriesByDeviceIndex;
+		const std::vector<std::string> serializedEntries;
+		const uint64_t fingerprint;
+		bool warm = false;
+		std::unique_ptr<DeviceChangeListener> deviceChangeListener;
+	};
+
+}
@@ -0,0 +1,662 @@
+#include "engine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <numbers>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include <dechamps_cpputil/string.h>
+
+#include <dechamps_ASIOUtil/asio.h>
+
+#include "log.h"
+#include "../FlexASIOUtil/portaudio.h"
+
+namespace flexasio {
+
+	namespace {
+
+		std::string GetPaStreamCallbackResultString(PaStreamCallbackResult result) {
+			return ::dechamps_cpputil::EnumToString(result, {
+				{paContinue, "paContinue"},
+				{paComplete, "paComplete"},
+				{paAbort, "paAbort"},
+				});
+		}
+
+		long GetBufferInfosChannelCount(const ASIOBufferInfo* asioBufferInfos, const long numChannels, const bool input) {
+			long result = 0;
+			for (long channelIndex = 0; channelIndex < numChannels; ++channelIndex)
+				if (!asioBufferInfos[channelIndex].isInput == !input)
+					++result;
+			return result;
+		}
+
+		size_t GetPortAudioSampleSizeInBytes(const Engine::StreamFormat& format) {
+			return format.conversion.has_value() ? GetSampleSizeInBytes(format.conversion->portAudioSampleType) : format.sampleSizeInBytes;
+		}
+
+		CopyPlan::Direction GetCopyPlanDirection(const Engine::StreamFormat& format, const bool isInput) {
+			std::optional<SampleConverter> converter;
+			if (format.conversion.has_value()) {
+				const auto& conversion = *format.conversion;
+				converter.emplace(
+					isInput ? conversion.portAudioSampleType : conversion.asioSampleType,
+					isInput ? conversion.asioSampleType : conversion.portAudioSampleType,
+					SampleConverter::Options{ .dither = conversion.dither });
+			}
+			return { .channelCount = format.channelCount, .asioSampleSizeInBytes = format.sampleSizeInBytes, .converter = std::move(converter) };
+		}
+
+		std::optional<LevelMeter> MakeLevelMeter(const Engine::StreamFormat& format, size_t channelCount) {
+			if (!format.asioSampleType.has_value() || channelCount == 0) return std::nullopt;
+			return std::optional<LevelMeter>(std::in_place, *format.asioSampleType, channelCount, LevelMeter::Options());
+		}
+
+		template <typename Enum> void IncrementEnum(Enum& value) {
+			value = static_cast<Enum>(std::underlying_type_t<Enum>(value) + 1);
+		}
+
+		size_t RoundUp(size_t value, size_t multiple) {
+			return (value + multiple - 1) / multiple * multiple;
+		}
+
+		int64_t GetSteadyClockNanoseconds() {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		// Narrow enough to filter out scheduling jitter, wide enough to converge in a fraction of a second.
+		constexpr double clockModelBandwidthHz = 1;
+
+		template <typename Functor> void AddDuration(int64_t& durationNanoseconds, Functor functor) {
+			const auto startTime = GetSteadyClockNanoseconds();
+			functor();
+			durationNanoseconds += GetSteadyClockNanoseconds() - startTime;
+		}
+
+		void LockMemory(std::vector<MemoryLock>& memoryLocks, std::string_view description, const std::vector<std::span<const std::byte>>& memoryRanges) {
+			size_t sizeInBytes = 0;
+			try {
+				for (const auto& memoryRange : memoryRanges) sizeInBytes += memoryLocks.emplace_back(memoryRange).GetSize();
+			}
+			catch (const std::exception& exception) {
+				Log() << "WARNING: unable to lock " << description << " in memory, stream callbacks may incur page faults: " << exception.what();
+				return;
+			}
+			Log() << "Locked " << description << " in memory: " << memoryRanges.size() << " ranges spanning " << sizeInBytes << " bytes of pages";
+		}
+
+		void LogDurationHistogram(std::string_view name, const Histogram& histogram) {
+			Log() << "..." << name << " (microseconds): "
+				<< "min " << histogram.GetMin() / 1e3
+				<< ", 50% " << histogram.GetValueAtPercentile(50) / 1e3
+				<< ", 90% " << histogram.GetValueAtPercentile(90) / 1e3
+				<< ", 99% " << histogram.GetValueAtPercentile(99) / 1e3
+				<< ", 99.9% " << histogram.GetValueAtPercentile(99.9) / 1e3
+				<< ", max " << histogram.GetMax() / 1e3;
+		}
+
+	}
+
+	int64_t SteadyClock::GetTimeNanoseconds() const {
+		return GetSteadyClockNanoseconds();
+	}
+
+	long Message(decltype(ASIOCallbacks::asioMessage) asioMessage, long selector, long value, void* message, double* opt) {
+		Log() << "Sending message: selector = " << ::dechamps_ASIOUtil::GetASIOMessageSelectorString(selector) << ", value = " << value << ", message = " << message << ", opt = " << opt;
+		const auto result = asioMessage(selector, value, message, opt);
+		Log() << "Result: " << result;
+		return result;
+	}
+
+	Engine::Buffers::Buffers(size_t bufferSetCount, size_t inputChannelCount, size_t outputChannelCount, size_t bufferSizeInFrames, size_t inputSampleSizeInBytes, size_t outputSampleSizeInBytes, const BufferOptions& options) :
+		bufferSetCount(bufferSetCount), inputChannelCount(inputChannelCount), outputChannelCount(outputChannelCount), bufferSizeInFrames(bufferSizeInFrames), inputSampleSizeInBytes(inputSampleSizeInBytes), outputSampleSizeInBytes(outputSampleSizeInBytes),
+		inputBufferStrideInBytes(RoundUp(bufferSizeInFrames * inputSampleSizeInBytes, options.alignment)),
+		outputBufferStrideInBytes(RoundUp(bufferSizeInFrames * outputSampleSizeInBytes, options.alignment)),
+		bufferSetStrideInBytes(RoundUp(inputChannelCount * inputBufferStrideInBytes + outputChannelCount * outputBufferStrideInBytes, (std::max)(options.alignment, falseSharingRangeInBytes))),
+		buffers(bufferSetCount * bufferSetStrideInBytes, options.alignment, options.largePages) {
+		Log() << "Allocated "
+			<< bufferSetCount << " buffer sets, "
+			<< inputChannelCount << "/" << outputChannelCount << " (I/O) channels per buffer set, "
+			<< bufferSizeInFrames << " samples per channel, "
+			<< inputSampleSizeInBytes << "/" << outputSampleSizeInBytes << " (I/O) bytes per sample, "
+			<< inputBufferStrideInBytes << "/" << outputBufferStrideInBytes << " (I/O) bytes between channels, "
+			<< bufferSetStrideInBytes << " bytes between buffer sets, aligned to " << options.alignment << " bytes, "
+			<< (buffers.UsesLargePages() ? "using large pages" : options.largePages ? "large pages requested but unavailable" : "not using large pages") << ", memory range: "
+			<< buffers.GetData() << "-" << buffers.GetData() + buffers.GetSize();
+	}
+
+	Engine::Buffers::~Buffers() {
+		Log() << "Destroying buffers";
+	}
+
+	Engine::Engine(ASIOSampleRate sampleRate, ASIOBufferInfo* asioBufferInfos, long numChannels, long bufferSizeInFrames, const ASIOCallbacks& callbacks, StreamFormat inputFormat, StreamFormat outputFormat, BufferOptions bufferOptions, LiveOptions liveOptions, std::optional<CallbackTracer::Options> traceOptions) :
+		sampleRate(sampleRate), callbacks(callbacks), inputFormat(inputFormat), outputFormat(outputFormat), traceOptions(std::move(traceOptions)), lockMemory(bufferOptions.lockMemory),
+		buffers(
+			2,
+			GetBufferInfosChannelCount(asioBufferInfos, numChannels, true), GetBufferInfosChannelCount(asioBufferInfos, numChannels, false),
+			bufferSizeInFrames,
+			inputFormat.sampleSizeInBytes, outputFormat.sampleSizeInBytes,
+			bufferOptions),
+		bufferInfos([&] {
+		std::vector<ASIOBufferInfo> bufferInfos;
+		bufferInfos.reserve(numChannels);
+		size_t nextBuffersInputChannelIndex = 0;
+		size_t nextBuffersOutputChannelIndex = 0;
+		for (long channelIndex = 0; channelIndex < numChannels; ++channelIndex)
+		{
+			ASIOBufferInfo& asioBufferInfo = asioBufferInfos[channelIndex];
+			if (asioBufferInfo.isInput)
+			{
+				if (asioBufferInfo.channelNum < 0 || asioBufferInfo.channelNum >= inputFormat.channelCount)
+					throw ASIOException(ASE_InvalidParameter, "out of bounds input channel in createBuffers() buffer info");
+			}
+			else
+			{
+				if (asioBufferInfo.channelNum < 0 || asioBufferInfo.channelNum >= outputFormat.channelCount)
+					throw ASIOException(ASE_InvalidParameter, "out of bounds output channel in createBuffers() buffer info");
+			}
+			const auto getBuffer = asioBufferInfo.isInput ? &Buffers::GetInputBuffer : &Buffers::GetOutputBuffer;
+			auto& nextBuffersChannelIndex = asioBufferInfo.isInput ? nextBuffersInputChannelIndex : nextBuffersOutputChannelIndex;
+			const auto bufferSizeInBytes = asioBufferInfo.isInput ? buffers.GetInputBufferSizeInBytes() : buffers.GetOutputBufferSizeInBytes();
+
+			std::byte* first_half = (buffers.*getBuffer)(0, nextBuffersChannelIndex);
+			std::byte* second_half = (buffers.*getBuffer)(1, nextBuffersChannelIndex);
+			++nextBuffersChannelIndex;
+			asioBufferInfo.buffers[0] = first_half;
+			asioBufferInfo.buffers[1] = second_half;
+			Log() << "ASIO buffer #" << channelIndex << " is " << (asioBufferInfo.isInput ? "input" : "output") << " channel " << asioBufferInfo.channelNum
+				<< " - first half: " << first_half << "-" << first_half + bufferSizeInBytes
+				<< " - second half: " << second_half << "-" << second_half + bufferSizeInBytes;
+			bufferInfos.push_back(asioBufferInfo);
+		}
+		return bufferInfos;
+	}()),
+		copyPlan(bufferInfos, buffers.bufferSizeInFrames, GetCopyPlanDirection(inputFormat, /*isInput=*/true), GetCopyPlanDirection(outputFormat, /*isInput=*/false)),
+		inputLevelMeter(MakeLevelMeter(inputFormat, buffers.inputChannelCount)),
+		outputLevelMeter(MakeLevelMeter(outputFormat, buffers.outputChannelCount)),
+		inputMeterType(liveOptions.inputMeterType),
+		outputMeterType(liveOptions.outputMeterType),
+		inputMonitorSources(size_t(inputFormat.channelCount)),
+		liveOptions(MakeLiveOptionsSnapshot(std::move(liveOptions), 1)) {
+		if (!lockMemory) return;
+		// Note this includes storage for the running state and callback statistics.
+		std::vector<std::span<const std::byte>> memoryRanges = {
+			std::as_bytes(std::span(this, 1)),
+			{ buffers.buffers.GetData(), buffers.buffers.GetSize() },
+			std::as_bytes(std::span(bufferInfos)),
+			std::as_bytes(std::span(inputMonitorSources)),
+		};
+		const auto copyPlanMemoryRanges = copyPlan.GetMemoryRanges();
+		memoryRanges.insert(memoryRanges.end(), copyPlanMemoryRanges.begin(), copyPlanMemoryRanges.end());
+		for (const auto& levelMeter : { &inputLevelMeter, &outputLevelMeter }) {
+			if (!levelMeter->has_value()) continue;
+			const auto levelMeterMemoryRanges = (*levelMeter)->GetMemoryRanges();
+			memoryRanges.insert(memoryRanges.end(), levelMeterMemoryRanges.begin(), levelMeterMemoryRanges.end());
+		}
+		LockMemory(memoryLocks, "ASIO buffers and engine state", memoryRanges);
+	}
+
+	Engine::~Engine() {
+		// Make sure the stream callback is not running anymore while we read the statistics.
+		runningState.reset();
+
+		const auto& statistics = callbackStatistics;
+		if (statistics.callbackDuration.GetCount() == 0) return;
+		Log() << "Stream callback timing statistics over " << statistics.callbackDuration.GetCount() << " callbacks, for a buffer duration of " << 1e6 * double(buffers.bufferSizeInFrames) / sampleRate << " microseconds:";
+		LogDurationHistogram("Deviation from expected callback interval (jitter)", statistics.jitter);
+		LogDurationHistogram("Total callback duration", statistics.callbackDuration);
+		LogDurationHistogram("Time spent in the ASIO host application (bufferSwitch)", statistics.bufferSwitchDuration);
+		LogDurationHistogram("Time spent waiting for the ASIO host application (OutputReady)", statistics.outputReadyWait);
+		LogDurationHistogram("Time spent copying buffers", statistics.copyDuration);
+	}
+
+	Engine::LiveOptionsSnapshot Engine::MakeLiveOptionsSnapshot(LiveOptions options, uint64_t generation) const {
+		auto inputMixPlan = MakeMixPlan(options.inputRouting, /*isInput=*/true);
+		auto outputMixPlan = MakeMixPlan(options.outputRouting, /*isInput=*/false);
+		auto inputMonitorMixPlan = MakeInputMonitorMixPlan(options);
+		return { .options = std::move(options), .generation = generation, .inputMixPlan = std::move(inputMixPlan), .outputMixPlan = std::move(outputMixPlan), .inputMonitorMixPlan = std::move(inputMonitorMixPlan) };
+	}
+
+	std::optional<MixPlan> Engine::MakeInputMonitorMixPlan(const LiveOptions& options) const {
+		if (inputMonitors.empty()) return std::nullopt;
+		if (options.inputRouting.has_value() || options.outputRouting.has_value()) {
+			Log() << "Suspending input monitoring, as it cannot be combined with routing";
+			return std::nullopt;
+		}
+		std::vector<MixPlan::Route> routes;
+		for (const auto& inputMonitor : inputMonitors) {
+			if (inputMonitor.inputChannel < 0 || inputMonitor.inputChannel >= inputFormat.channelCount || inputMonitor.outputChannel < 0 || inputMonitor.outputChannel >= outputFormat.channelCount) {
+				Log() << "Ignoring monitor from input channel " << inputMonitor.inputChannel << " to output channel " << inputMonitor.outputChannel << " as it is outside of the streams";
+				continue;
+			}
+			if (inputMonitor.outputChannel + 1 == outputFormat.channelCount) {
+				routes.push_back({ .sourceChannel = inputMonitor.inputChannel, .destinationChannel = inputMonitor.outputChannel, .gain = inputMonitor.gain });
+				continue;
+			}
+			const auto pan = std::clamp(inputMonitor.pan, 0.0f, 1.0f);
+			// Avoid a useless (and not quite zero) route at the extremes.
+			const auto leftGain = pan == 1 ? 0 : inputMonitor.gain * std::cos(pan * std::numbers::pi_v<float> / 2);
+			const auto rightGain = pan == 0 ? 0 : inputMonitor.gain * std::sin(pan * std::numbers::pi_v<float> / 2);
+			routes.push_back({ .sourceChannel = inputMonitor.inputChannel, .destinationChannel = inputMonitor.outputChannel, .gain = leftGain });
+			routes.push_back({ .sourceChannel = inputMonitor.inputChannel, .destinationChannel = inputMonitor.outputChannel + 1, .gain = rightGain });
+		}
+		if (routes.empty()) return std::nullopt;
+		if (IsLoggingEnabled()) Log() << "Compiling input monitoring with " << routes.size() << " routes";
+		return MixPlan(std::move(routes), { .accumulate = true });
+	}
+
+	std::optional<MixPlan> Engine::MakeMixPlan(const std::optional<std::vector<MixPlan::Route>>& routing, bool isInput) const {
+		if (!routing.has_value()) return std::nullopt;
+		const auto& format = isInput ? inputFormat : outputFormat;
+		const auto asioChannelCount = format.asioChannelCount.value_or(format.channelCount);
+		const auto describe = [&](const MixPlan::Route& route) {
+			return std::string(isInput ? "input" : "output") + " route from channel " + std::to_string(route.sourceChannel) + " to channel " + std::to_string(route.destinationChannel);
+		};
+		std::vector<MixPlan::Route> routes;
+		for (const auto& route : *routing) {
+			const auto asioChannel = isInput ? route.destinationChannel : route.sourceChannel;
+			const auto streamChannel = isInput ? route.sourceChannel : route.destinationChannel;
+			if (asioChannel < 0 || asioChannel >= asioChannelCount)
+				throw std::runtime_error(describe(route) + " is out of bounds (there are " + std::to_string(asioChannelCount) + " ASIO channels)");
+			// Routes from or to ASIO channels the ASIO host application did not create buffers for do not do anything. The
+			// stream might not even include their device channels if it was trimmed.
+			if (!IsChannelActive(isInput, asioChannel)) continue;
+			if (streamChannel < 0 || streamChannel >= format.channelCount)
+				throw std::runtime_error(describe(route) + " is out of bounds (the stream has " + std::to_string(format.channelCount) + " channels)");
+			routes.push_back(route);
+		}
+		if (IsLoggingEnabled()) Log() << "Compiling " << (isInput ? "input" : "output") << " routing with " << routes.size() << " routes involving active ASIO channels";
+		return MixPlan(std::move(routes), {});
+	}
+
+	std::optional<LevelMeter::Level> Engine::GetLevel(bool isInput, long channel) {
+		auto& levelMeter = isInput ? inputLevelMeter : outputLevelMeter;
+		if (!levelMeter.has_value()) return std::nullopt;
+		std::scoped_lock lock(levelReadMutex);
+		size_t buffersChannelIndex = 0;
+		for (const auto& bufferInfo : bufferInfos) {
+			if (!!bufferInfo.isInput != isInput) continue;
+			if (bufferInfo.channelNum == channel) {
+				if (!levelMeteringEnabled.exchange(true, std::memory_order_relaxed)) Log() << "ASIO host application requested a level meter, enabling level metering";
+				return levelMeter->Read(buffersChannelIndex);
+			}
+			++buffersChannelIndex;
+		}
+		return std::nullopt;
+	}
+
+	bool Engine::CanMonitorInputs() const {
+		const auto getPortAudioSampleType = [](const StreamFormat& format) {
+			return format.conversion.has_value() ? std::optional(format.conversion->portAudioSampleType) : format.asioSampleType;
+		};
+		return HasInputBuffers() && HasOutputBuffers() && getPortAudioSampleType(inputFormat) == ASIOSTFloat32LSB && getPortAudioSampleType(outputFormat) == ASIOSTFloat32LSB;
+	}
+
+	void Engine::SetInputMonitors(std::vector<InputMonitor> newInputMonitors) {
+		if (!CanMonitorInputs()) throw ASIOException(ASE_InvalidMode, "input monitoring requires full duplex Float32 streams");
+		std::scoped_lock lock(liveOptionsWriterMutex);
+		inputMonitors = std::move(newInputMonitors);
+		// The options themselves do not change, so there is no need to increment the generation.
+		const auto& currentLiveOptions = liveOptions.Read();
+		liveOptions.Publish(MakeLiveOptionsSnapshot(currentLiveOptions.options, currentLiveOptions.generation));
+	}
+
+	void Engine::MixInputMonitors(const MixPlan& inputMonitorMixPlan, const std::byte* const* input, std::byte* const* output) {
+		for (const auto inputChannel : inputMonitorMixPlan.GetSourceChannels())
+			inputMonitorSources[inputChannel] = reinterpret_cast<const float*>(input[inputChannel]);
+		const auto& destinationChannels = inputMonitorMixPlan.GetDestinationChannels();
+		for (size_t destinationIndex = 0; destinationIndex < destinationChannels.size(); ++destinationIndex)
+			inputMonitorMixPlan.Mix(destinationIndex, inputMonitorSources.data(), reinterpret_cast<float*>(output[destinationChannels[destinationIndex]]), buffers.bufferSizeInFrames);
+	}
+
+	void Engine::MeasureLevels(bool isInput, long bufferSetIndex) {
+		auto& levelMeter = isInput ? inputLevelMeter : outputLevelMeter;
+		if (!levelMeter.has_value() || !levelMeteringEnabled.load(std::memory_order_relaxed)) return;
+		const auto channelCount = isInput ? buffers.inputChannelCount : buffers.outputChannelCount;
+		const auto getBuffer = isInput ? &Buffers::GetInputBuffer : &Buffers::GetOutputBuffer;
+		for (size_t channelIndex = 0; channelIndex < channelCount; ++channelIndex)
+			levelMeter->Measure(channelIndex, (buffers.*getBuffer)(bufferSetIndex, channelIndex), buffers.bufferSizeInFrames);
+	}
+
+	bool Engine::IsChannelActive(bool isInput, long channel) const {
+		for (const auto& buffersInfo : bufferInfos)
+			if (!!buffersInfo.isInput == !!isInput && buffersInfo.channelNum == channel)
+				return true;
+		return false;
+	}
+
+	void Engine::Start(PaStream* const stream, const Clock& clock, const bool hostSupportsOutputReady)
+	{
+		if (runningState.has_value()) throw ASIOException(ASE_InvalidMode, "start() called twice");
+		runningState.emplace(*this, stream, clock, hostSupportsOutputReady);
+		runningState->Start();
+	}
+
+	void Engine::Stop()
+	{
+		if (!runningState.has_value()) throw ASIOException(ASE_InvalidMode, "stop() called before start()");
+		runningState.reset();
+	}
+
+	Engine::RunningState::RunningState(Engine& engine, PaStream* const stream, const Clock& clock, const bool hostSupportsOutputReady) :
+		engine(engine),
+		stream(stream),
+		clock(clock),
+		host_supports_timeinfo([&] {
+		Log() << "Checking if the host supports time info";
+		const bool result = engine.callbacks.asioMessage &&
+			Message(engine.callbacks.asioMessage, kAsioSelectorSupported, kAsioSupportsTimeInfo, NULL, NULL) == 1 &&
+			Message(engine.callbacks.asioMessage, kAsioSupportsTimeInfo, 0, NULL, NULL) == 1;
+		Log() << "The host " << (result ? "supports" : "does not support") << " time info";
+		return result;
+	}()),
+		outputReadyState([&]() -> std::optional<std::atomic<OutputReadyState>> {
+		if (hostSupportsOutputReady) return OutputReadyState::READY; else return std::nullopt;
+	}()),
+		clockModel(engine.sampleRate, clockModelBandwidthHz),
+		outputLatencySeconds([&] {
+		if (stream == nullptr) return 0.0;
+		const auto streamInfo = Pa_GetStreamInfo(stream);
+		return streamInfo == nullptr ? 0.0 : streamInfo->outputLatency;
+	}()),
+		blockAdapter(
+			engine.inputFormat.channelCount, GetPortAudioSampleSizeInBytes(engine.inputFormat),
+			engine.outputFormat.channelCount, GetPortAudioSampleSizeInBytes(engine.outputFormat),
+			engine.buffers.bufferSizeInFrames) {
+		if (engine.traceOptions.has_value()) tracer.emplace(*engine.traceOptions, engine.sampleRate, engine.buffers.bufferSizeInFrames);
+		if (engine.lockMemory) {
+			auto memoryRanges = blockAdapter.GetMemoryRanges();
+			if (tracer.has_value()) memoryRanges.push_back(tracer->GetMemoryRange());
+			LockMemory(memoryLocks, "stream scratch memory", memoryRanges);
+		}
+	}
+
+	Engine::RunningState::~RunningState() {
+		if (outputReadyState.has_value()) {
+			auto& outputReady = *outputReadyState;
+			// Some applications (e.g. Max) will call stop() without calling outputReady() for the last bufferSwitch().
+			// In this situation, make sure we don't hang forever waiting for that outputReady() call.
+			// See https://github.com/dechamps/FlexASIO/issues/235
+			//
+			// Note this code assumes that an application calls outputReady() *before* calling stop(), or that it calls
+			// it from within bufferSwitch(). If an application calls outputReady() after returning from bufferSwitch()
+			// *and* after calling stop(), then outputReady() will sadly race against RunningState teardown.
+			outputReady = OutputReadyState::STOPPING;
+			outputReady.notify_all();
+		}
+	}
+
+	void Engine::RunningState::Start() {
+		if (stream == nullptr) return;
+		activeStream = StartStream(stream);
+	}
+
+	int Engine::StreamCallback(const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags, void *userData) throw() {
+		if (IsLoggingEnabled()) Log() << "--- ENTERING STREAM CALLBACK";
+		PaStreamCallbackResult result = paContinue;
+		try {
+			auto& engine = *static_cast<Engine*>(userData);
+			if (!engine.runningState.has_value()) {
+				throw std::runtime_error("PortAudio stream callback fired in non-started state");
+			}
+			result = engine.runningState->StreamCallback(input, output, frameCount, timeInfo, statusFlags);
+		}
+		catch (const std::exception& exception) {
+			if (IsLoggingEnabled()) Log() << "Caught exception in stream callback: " << exception.what();
+		}
+		catch (...) {
+			if (IsLoggingEnabled()) Log() << "Caught unknown exception in stream callback";
+		}
+		if (IsLoggingEnabled()) Log() << "--- EXITING STREAM CALLBACK (" << GetPaStreamCallbackResultString(result) << ")";
+		return result;
+	}
+
+	PaStreamCallbackResult Engine::RunningState::StreamCallback(const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags)
+	{
+		const auto& liveOptions = engine.liveOptions.Read();
+		if (appliedLiveOptionsGeneration != liveOptions.generation) {
+			appliedLiveOptionsGeneration = liveOptions.generation;
+			// The generation also changes when only routing changes.
+			if (appliedRealtimeOptions != liveOptions.options.realtime) {
+				appliedRealtimeOptions = liveOptions.options.realtime;
+				if (IsLoggingEnabled()) Log() << "Stream callback thread: " << ApplyRealtimeOptionsToCurrentThread(liveOptions.options.realtime);
+				else ApplyRealtimeOptionsToCurrentThreadQuietly(liveOptions.options.realtime);
+			}
+		}
+
+		const auto entryTime = GetSteadyClockNanoseconds();
+		CallbackTiming timing;
+		const auto result = ProcessStreamCallback(input, output, frameCount, timeInfo, statusFlags, timing);
+		const auto callbackDuration = GetSteadyClockNanoseconds() - entryTime;
+
+		auto& statistics = engine.callbackStatistics;
+		const auto frameDurationNanoseconds = int64_t(1e9 * double(frameCount) / engine.sampleRate);
+		if (previousCallback.has_value()) statistics.jitter.Record(std::abs(entryTime - previousCallback->entryTime - previousCallback->frameDurationNanoseconds));
+		previousCallback = { .entryTime = entryTime, .frameDurationNanoseconds = frameDurationNanoseconds };
+		statistics.callbackDuration.Record(callbackDuration);
+		statistics.bufferSwitchDuration.Record(timing.bufferSwitchDurationNanoseconds);
+		statistics.outputReadyWait.Record(timing.outputReadyWaitNanoseconds);
+		statistics.copyDuration.Record(timing.copyDurationNanoseconds);
+
+		if (tracer.has_value()) {
+			CallbackTraceRecord record;
+			record.entryTimeNanoseconds = entryTime;
+			record.inputBufferAdcTime = timeInfo == nullptr ? NAN : timeInfo->inputBufferAdcTime;
+			record.currentTime = timeInfo == nullptr ? NAN : timeInfo->currentTime;
+			record.outputBufferDacTime = timeInfo == nullptr ? NAN : timeInfo->outputBufferDacTime;
+			record.callbackDurationNanoseconds = callbackDuration;
+			record.bufferSwitchDurationNanoseconds = timing.bufferSwitchDurationNanoseconds;
+			record.outputReadyWaitNanoseconds = timing.outputReadyWaitNanoseconds;
+			record.frameCount = uint32_t(frameCount);
+			record.statusFlags = uint32_t(statusFlags);
+			const auto anomaly = (statusFlags & (paInputUnderflow | paInputOverflow | paOutputUnderflow | paOutputOverflow)) != 0 || callbackDuration > frameDurationNanoseconds;
+			tracer->Record(record, anomaly);
+		}
+
+		engine.liveOptions.Quiesce();
+		return result;
+	}
+
+	PaStreamCallbackResult Engine::RunningState::ProcessStreamCallback(const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags, CallbackTiming& timing)
+	{
+		if (IsLoggingEnabled()) Log() << "PortAudio stream callback with input " << input << ", output "
+			<< output << ", "
+			<< frameCount << " frames, time info ("
+			<< (timeInfo == nullptr ? "none" : DescribeStreamCallbackTimeInfo(*timeInfo)) << "), flags "
+			<< GetStreamCallbackFlagsString(statusFlags);
+
+		if (statusFlags & paInputOverflow && IsLoggingEnabled())
+			Log() << "INPUT OVERFLOW detected (some input data was discarded)";
+		if (statusFlags & paInputUnderflow && IsLoggingEnabled())
+			Log() << "INPUT UNDERFLOW detected (gaps were inserted in the input)";
+		if (statusFlags & paOutputOverflow && IsLoggingEnabled())
+			Log() << "OUTPUT OVERFLOW detected (some output data was discarded)";
+		if (statusFlags & paOutputUnderflow && IsLoggingEnabled())
+			Log() << "OUTPUT UNDERFLOW detected (gaps were inserted in the output)";
+
+		UpdateClockModel(frameCount, timeInfo);
+
+		const std::byte* const* input_samples = static_cast<const std::byte* const*> (input);
+		std::byte* const* output_samples = static_cast<std::byte* const*>(output);
+
+		// Fast path for the common case where PortAudio gives us exactly one ASIO buffer. This does not add any latency.
+		if (frameCount == engine.buffers.bufferSizeInFrames && blockAdapter.IsEmpty()) {
+			ProcessBlock(input_samples, output_samples, timing);
+			return paContinue;
+		}
+
+		if (IsLoggingEnabled()) Log() << "Adapting " << frameCount << " frames to ASIO buffer size of " << engine.buffers.bufferSizeInFrames << " frames";
+		// The time spent adapting is accounted for as copy time. ProcessBlock() accounts for its own time.
+		int64_t processBlockDuration = 0;
+		const auto adapterStartTime = GetSteadyClockNanoseconds();
+		blockAdapter.Process(input_samples, output_samples, frameCount, [&](const std::byte* const* input_block, std::byte* const* output_block) {
+			AddDuration(processBlockDuration, [&] { ProcessBlock(input_block, output_block, timing); });
+		});
+		timing.copyDurationNanoseconds += GetSteadyClockNanoseconds() - adapterStartTime - processBlockDuration;
+		return paContinue;
+	}
+
+	void Engine::RunningState::UpdateClockModel(const unsigned long frameCount, const PaStreamCallbackTimeInfo* const timeInfo) {
+		const auto now = clock.GetTimeNanoseconds();
+		portAudioFrameCount += frameCount;
+
+		// Estimate when the end of this PortAudio buffer went through the ADC, or, for output-only streams, when the buffer
+		// was due. Backends that provide timing information typically derive it from the hardware position, which is
+		// more accurate than the time the callback happens to run.
+		const auto portAudioTime = [&]() -> std::optional<PaTime> {
+			if (timeInfo == nullptr || timeInfo->currentTime == 0) return std::nullopt;
+			if (engine.inputFormat.channelCount > 0 && timeInfo->inputBufferAdcTime != 0) return timeInfo->inputBufferAdcTime + frameCount / engine.sampleRate;
+			if (engine.outputFormat.channelCount > 0 && timeInfo->outputBufferDacTime != 0) return timeInfo->outputBufferDacTime - outputLatencySeconds;
+			return std::nullopt;
+		}();
+		if (!portAudioTime.has_value()) {
+			clockModel.Update(portAudioFrameCount, now);
+			return;
+		}
+		if (!portAudioTimeOffsetNanoseconds.has_value()) {
+			portAudioTimeOffsetNanoseconds = now - std::llround(timeInfo->currentTime * 1e9);
+			if (IsLoggingEnabled()) Log() << "PortAudio stream time offset: " << *portAudioTimeOffsetNanoseconds << " nanoseconds";
+		}
+		clockModel.Update(portAudioFrameCount, std::llround(*portAudioTime * 1e9) + *portAudioTimeOffsetNanoseconds);
+	}
+
+	void Engine::RunningState::ProcessBlock(const std::byte* const* input_samples, std::byte* const* output_samples, CallbackTiming& timing)
+	{
+		const auto frameCount = engine.buffers.bufferSizeInFrames;
+
+		processedFrameCount += frameCount;
+		auto currentSamplePosition = samplePosition.Load();
+		currentSamplePosition.timestamp = ::dechamps_ASIOUtil::Int64ToASIO<ASIOTimeStamp>(clockModel.GetTimeNanoseconds(processedFrameCount));
+		if (state == State::STEADYSTATE) currentSamplePosition.samples = ::dechamps_ASIOUtil::Int64ToASIO<ASIOSamples>(::dechamps_ASIOUtil::ASIOToInt64(currentSamplePosition.samples) + frameCount);
+		samplePosition.Store(currentSamplePosition);
+		if (IsLoggingEnabled()) Log() << "Updated sample position: timestamp " << ::dechamps_ASIOUtil::ASIOToInt64(currentSamplePosition.timestamp) << ", " << ::dechamps_ASIOUtil::ASIOToInt64(currentSamplePosition.samples) << " samples";
+
+		// Read once per ASIO buffer, so that routing changes apply to whole buffers.
+		const auto& liveOptions = engine.liveOptions.Read();
+
+		// Active output channels are always fully overwritten by the final copy below.
+		if (output_samples && !liveOptions.outputMixPlan.has_value()) AddDuration(timing.copyDurationNanoseconds, [&] { engine.copyPlan.ZeroInactivePortAudioOutputBuffers(output_samples); });
+
+		const auto outputReady = outputReadyState.has_value() ? &*outputReadyState : nullptr;
+
+		// See dechamps_ASIOUtil/BUFFERS.md for the gory details of how ASIO buffer management works.
+
+		if (state != State::PRIMING) {
+			if (IsLoggingEnabled()) Log() << "Transferring input buffers from PortAudio to ASIO buffer index #" << driverBufferIndex;
+			AddDuration(timing.copyDurationNanoseconds, [&] {
+				if (liveOptions.inputMixPlan.has_value()) engine.copyPlan.MixFromPortAudioBuffers(driverBufferIndex, input_samples, *liveOptions.inputMixPlan);
+				else engine.copyPlan.CopyFromPortAudioBuffers(driverBufferIndex, input_samples);
+				engine.MeasureLevels(/*isInput=*/true, driverBufferIndex);
+			});
+
+			if (outputReady != nullptr) {
+				// Reset OutputReady, but only if we are not STOPPING, atomically.
+				auto outputReadyState = OutputReadyState::READY;
+				outputReady->compare_exchange_strong(outputReadyState, OutputReadyState::NOT_READY);
+			}
+			const auto bufferSwitchStartTime = GetSteadyClockNanoseconds();
+			if (!host_supports_timeinfo)
+			{
+				if (IsLoggingEnabled()) Log() << "Firing ASIO bufferSwitch() callback with buffer index: " << driverBufferIndex;
+				engine.callbacks.bufferSwitch(driverBufferIndex, ASIOTrue);
+				if (IsLoggingEnabled()) Log() << "bufferSwitch() complete";
+			}
+			else
+			{
+				ASIOTime time = { 0 };
+				time.timeInfo.flags = kSystemTimeValid | kSamplePositionValid | kSampleRateValid;
+				time.timeInfo.samplePosition = currentSamplePosition.samples;
+				time.timeInfo.systemTime = currentSamplePosition.timestamp;
+				time.timeInfo.sampleRate = engine.sampleRate;
+				if (IsLoggingEnabled()) Log() << "Firing ASIO bufferSwitchTimeInfo() callback with buffer index: " << driverBufferIndex << ", time info: (" << ::dechamps_ASIOUtil::DescribeASIOTime(time) << ")";
+				const auto timeResult = engine.callbacks.bufferSwitchTimeInfo(&time, driverBufferIndex, ASIOTrue);
+				if (IsLoggingEnabled()) Log() << "bufferSwitchTimeInfo() complete, returned time info: " << (timeResult == nullptr ? "none" : ::dechamps_ASIOUtil::DescribeASIOTime(*timeResult));
+			}
+			timing.bufferSwitchDurationNanoseconds += GetSteadyClockNanoseconds() - bufferSwitchStartTime;
+		}
+
+		if (outputReady == nullptr) {
+			driverBufferIndex = (driverBufferIndex + 1) % 2;
+		}
+		else if (*outputReady == OutputReadyState::NOT_READY) {
+			if (IsLoggingEnabled()) Log() << "Waiting for the ASIO Host Application to signal OutputReady or stop";
+			const auto waitStartTime = GetSteadyClockNanoseconds();
+			outputReady->wait(OutputReadyState::NOT_READY);
+			timing.outputReadyWaitNanoseconds += GetSteadyClockNanoseconds() - waitStartTime;
+		}
+
+		if (IsLoggingEnabled()) Log() << "Transferring output buffers from buffer index #" << driverBufferIndex << " to PortAudio";
+		AddDuration(timing.copyDurationNanoseconds, [&] {
+			if (!liveOptions.outputMixPlan.has_value()) engine.copyPlan.CopyToPortAudioBuffers(driverBufferIndex, output_samples);
+			else if (output_samples) engine.copyPlan.MixToPortAudioBuffers(driverBufferIndex, output_samples, *liveOptions.outputMixPlan);
+			engine.MeasureLevels(/*isInput=*/false, driverBufferIndex);
+			// The output stream buffers were just fully overwritten, so the monitored inputs can be added on top. This is the
+			// lowest possible monitoring latency: the input is played back in the same callback it was captured in.
+			if (liveOptions.inputMonitorMixPlan.has_value() && input_samples && output_samples)
+				engine.MixInputMonitors(*liveOptions.inputMonitorMixPlan, input_samples, output_samples);
+		});
+
+		if (outputReadyState.has_value()) driverBufferIndex = (driverBufferIndex + 1) % 2;
+
+		if (state != State::STEADYSTATE) IncrementEnum(state);
+	}
+
+	void Engine::GetSamplePosition(ASIOSamples* sPos, ASIOTimeStamp* tStamp) const
+	{
+		if (!runningState.has_value()) throw ASIOException(ASE_InvalidMode, "getSamplePosition() called before start()");
+		return runningState->GetSamplePosition(sPos, tStamp);
+	}
+
+	void Engine::RunningState::GetSamplePosition(ASIOSamples* sPos, ASIOTimeStamp* tStamp) const
+	{
+		const auto currentSamplePosition = samplePosition.Load();
+		*sPos = currentSamplePosition.samples;
+		*tStamp = currentSamplePosition.timestamp;
+		if (IsLoggingEnabled()) Log() << "Returning: sample position " << ::dechamps_ASIOUtil::ASIOToInt64(*sPos) << ", timestamp " << ::dechamps_ASIOUtil::ASIOToInt64(*tStamp);
+	}
+
+	void Engine::OutputReady() {
+		if (runningState.has_value()) runningState->OutputReady();
+	}
+
+	void Engine::SetLiveOptions(LiveOptions options) {
+		std::scoped_lock lock(liveOptionsWriterMutex);
+		// Only writers replace the snapshot, so reading it here does not race.
+		const auto generation = liveOptions.Read().generation + 1;
+		inputMeterType.store(options.inputMeterType, std::memory_order_relaxed);
+		outputMeterType.store(options.outputMeterType, std::memory_order_relaxed);
+		liveOptions.Publish(MakeLiveOptionsSnapshot(std::move(options), generation));
+	}
+
+	void Engine::RunningState::OutputReady() {
+		if (!outputReadyState.has_value()) {
+			if (IsLoggingEnabled()) Log() << "Received OutputReady signal, but the ASIO Host Application did not advertise support for OutputReady!";
+			return;
+		}
+
+		auto& outputReady = *outputReadyState;
+		auto outputReadyState = OutputReadyState::NOT_READY;
+		if (outputReady.compare_exchange_strong(outputReadyState, OutputReadyState::READY)) {
+			if (IsLoggingEnabled()) Log() << "Successfully set OutputReady";
+			outputReady.notify_all();
+			return;
+		}
+
+		switch (outputReadyState) {
+			case OutputReadyState::NOT_READY: abort();
+			case OutputReadyState::READY:
+				if (IsLoggingEnabled()) Log() << "Received redundant OutputReady signal!";
+				break;
+			case OutputReadyState::STOPPING:
+				if (IsLoggingEnabled()) Log() << "Ignoring OutputReady signal because we are currently stopping";
+				break;
+		}
+	}
+
+}
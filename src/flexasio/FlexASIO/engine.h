@@ -0,0 +1,345 @@
+#pragma once
+
+#include "block_adapter.h"
+#include "clock_model.h"
+#include "copy_plan.h"
+#include "level_meter.h"
+#include "mix_plan.h"
+#include "portaudio.h"
+#include "trace.h"
+#include "../FlexASIOUtil/aligned_buffer.h"
+#include "../FlexASIOUtil/histogram.h"
+#include "../FlexASIOUtil/memory_lock.h"
+#include "../FlexASIOUtil/rcu.h"
+#include "../FlexASIOUtil/realtime.h"
+#include "../FlexASIOUtil/seqlock.h"
+
+#include <dechamps_ASIOUtil/asiosdk/asiosys.h>
+#include <dechamps_ASIOUtil/asiosdk/asio.h>
+
+#include <portaudio.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+namespace flexasio {
+
+	class ASIOException : public std::runtime_error {
+	public:
+		template <typename... Args> ASIOException(ASIOError asioError, Args&&... args) : std::runtime_error(std::forward<Args>(args)...), asioError(asioError) {}
+		ASIOError GetASIOError() const { return asioError; }
+
+	private:
+		ASIOError asioError;
+	};
+
+	long Message(decltype(ASIOCallbacks::asioMessage) asioMessage, long selector, long value, void* message, double* opt);
+
+	// Source of the system time that is reported to the ASIO host application alongside sample positions.
+	class Clock {
+	public:
+		virtual ~Clock() = default;
+		virtual int64_t GetTimeNanoseconds() const = 0;
+	};
+
+	// Portable monotonic clock with nanosecond resolution (std::chrono::steady_clock). The epoch is unspecified.
+	class SteadyClock final : public Clock {
+	public:
+		int64_t GetTimeNanoseconds() const override;
+	};
+
+	// The platform-independent core of FlexASIO. It owns the ASIO buffers and implements the ASIO buffer switching
+	// protocol (priming, OutputReady, sample position tracking) on top of PortAudio stream callbacks.
+	//
+	// Anything that is specific to the host OS or to the ASIO driver interface (COM, configuration, device selection,
+	// timers) lives outside of this class, so that the streaming hot path can be built and profiled on any platform.
+	class Engine final {
+	public:
+		struct StreamFormat final {
+			// Number of channels the PortAudio stream is opened with.
+			int channelCount;
+			// Number of channels exposed to the ASIO host application, if the stream does not include all of them.
+			std::optional<int> asioChannelCount = std::nullopt;
+			size_t sampleSizeInBytes;
+			// Sample type of the ASIO buffers. Only used for level metering, which is not available if unset.
+			std::optional<ASIOSampleType> asioSampleType = std::nullopt;
+
+			// If set, the PortAudio stream uses a different sample type from the ASIO buffers, and the engine converts
+			// samples itself instead of relying on PortAudio to do it.
+			struct Conversion final {
+				ASIOSampleType asioSampleType;
+				ASIOSampleType portAudioSampleType;
+				bool dither;
+			};
+			std::optional<Conversion> conversion = std::nullopt;
+		};
+
+		struct BufferOptions final {
+			// Alignment of the start of each individual ASIO buffer. Must be a power of two, e.g. the cache line size or the
+			// page size.
+			size_t alignment = 64;
+			bool largePages = false;
+			// Fault in and lock in physical memory everything the stream callback touches (buffers, engine state, scratch
+			// memory), so that the first callbacks after Start() do not incur page faults. Failures are logged, not fatal.
+			bool lockMemory = false;
+		};
+
+		// Options that can be changed while the engine is running, without resetting the stream.
+		struct LiveOptions final {
+			RealtimeOptions realtime;
+			// If set, replaces the one-to-one mapping between ASIO channels and PortAudio stream channels. For input, sources
+			// are stream channels and destinations are ASIO channels; for output, it's the other way around. Channels that
+			// are not fed are silent. Requires Float32 ASIO buffers.
+			std::optional<std::vector<MixPlan::Route>> inputRouting;
+			std::optional<std::vector<MixPlan::Route>> outputRouting;
+			// The level the ASIO host application gets from level meters. Not used by the engine itself; see GetMeterType().
+			enum class MeterType { PEAK, RMS };
+			MeterType inputMeterType = MeterType::PEAK;
+			MeterType outputMeterType = MeterType::PEAK;
+		};
+
+		// Mixes an input stream channel directly into output stream channels, in the same stream callback, without going
+		// through the ASIO host application.
+		struct InputMonitor final {
+			int inputChannel;
+			int outputChannel;
+			// Linear.
+			float gain;
+			// From 0 (only `outputChannel`) to 1 (only `outputChannel + 1`), with a constant power pan law. Ignored if
+			// `outputChannel` is the last output channel.
+			float pan;
+		};
+
+		Engine(ASIOSampleRate sampleRate, ASIOBufferInfo* asioBufferInfos, long numChannels, long bufferSizeInFrames, const ASIOCallbacks& callbacks, StreamFormat inputFormat, StreamFormat outputFormat, BufferOptions bufferOptions, LiveOptions liveOptions, std::optional<CallbackTracer::Options> traceOptions);
+		Engine(const Engine&) = delete;
+		Engine(Engine&&) = delete;
+		~Engine();
+
+		size_t GetBufferSizeInFrames() const { return buffers.bufferSizeInFrames; }
+		bool HasInputBuffers() const { return buffers.inputChannelCount > 0; }
+		bool HasOutputBuffers() const { return buffers.outputChannelCount > 0; }
+		bool IsChannelActive(bool isInput, long channel) const;
+
+		bool IsRunning() const { return runningState.has_value(); }
+		// Starts streaming. `clock` must outlive the running state, i.e. until Stop() returns.
+		// If `stream` is null, no PortAudio stream is started and the caller is expected to invoke StreamCallback() itself
+		// (this is how benchmarks drive the engine).
+		void Start(PaStream* stream, const Clock& clock, bool hostSupportsOutputReady);
+		void Stop();
+
+		void GetSamplePosition(ASIOSamples* sPos, ASIOTimeStamp* tStamp) const;
+		void OutputReady();
+
+		// Takes effect on the next stream callback.
+		void SetLiveOptions(LiveOptions);
+
+		// Input monitoring requires the stream to be full duplex and both directions to use Float32 samples.
+		bool CanMonitorInputs() const;
+		// Replaces all input monitors. Takes effect on the next stream callback. Monitors that involve channels outside of
+		// the streams are ignored. Monitor channels are ASIO channels, which are only the same as stream channels when no
+		// routing is configured; monitoring is suspended while it is.
+		void SetInputMonitors(std::vector<InputMonitor>);
+
+		// Level of an active ASIO channel since the previous call for the same channel (see LevelMeter::Read()). Returns
+		// nullopt if the channel is not active or if metering is not available. The stream callback only starts measuring
+		// levels once this is called for the first time, so that metering costs nothing if the ASIO host application does
+		// not use it. Can be called from any thread.
+		std::optional<LevelMeter::Level> GetLevel(bool isInput, long channel);
+		// As last set through the live options. Can be called from any thread.
+		LiveOptions::MeterType GetMeterType(bool isInput) const { return (isInput ? inputMeterType : outputMeterType).load(std::memory_order_relaxed); }
+
+		// PortAudio stream callback. `userData` must point to the Engine.
+		static int StreamCallback(const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags, void *userData) throw();
+
+	private:
+		// Adjacent cache line prefetchers typically fetch 128-byte aligned pairs of cache lines.
+		static constexpr size_t falseSharingRangeInBytes = 128;
+
+		struct Buffers
+		{
+			Buffers(size_t bufferSetCount, size_t inputChannelCount, size_t outputChannelCount, size_t bufferSizeInFrames, size_t inputSampleSizeInBytes, size_t outputSampleSizeInBytes, const BufferOptions& options);
+			~Buffers();
+			std::byte* GetInputBuffer(size_t bufferSetIndex, size_t channelIndex) { return buffers.GetData() + bufferSetIndex * bufferSetStrideInBytes + channelIndex * inputBufferStrideInBytes; }
+			std::byte* GetOutputBuffer(size_t bufferSetIndex, size_t channelIndex) { return GetInputBuffer(bufferSetIndex, inputChannelCount) + channelIndex * outputBufferStrideInBytes; }
+			size_t GetInputBufferSizeInBytes() const { if (buffers.GetSize() == 0) return 0; return bufferSizeInFrames * inputSampleSizeInBytes; }
+			size_t GetOutputBufferSizeInBytes() const { if (buffers.GetSize() == 0) return 0; return bufferSizeInFrames * outputSampleSizeInBytes; }
+
+			const size_t bufferSetCount;
+			const size_t inputChannelCount;
+			const size_t outputChannelCount;
+			const size_t bufferSizeInFrames;
+			const size_t inputSampleSizeInBytes;
+			const size_t outputSampleSizeInBytes;
+			// Each buffer is padded to the requested alignment, so that SIMD code always sees aligned buffers and two
+			// buffers never share a cache line.
+			const size_t inputBufferStrideInBytes;
+			const size_t outputBufferStrideInBytes;
+			// Buffer sets are further padded to avoid false sharing between the half that the ASIO host application is
+			// working on and the half we are copying, even in the presence of adjacent cache line prefetching.
+			const size_t bufferSetStrideInBytes;
+
+			// This is a giant buffer containing all ASIO buffers. It is organized as follows:
+			// [ input channel 0 buffer 0 ] [ input channel 1 buffer 0 ] ... [ input channel N buffer 0 ] [ output channel 0 buffer 0 ] [ output channel 1 buffer 0 ] .. [ output channel N buffer 0 ] [ padding ]
+			// [ input channel 0 buffer 1 ] [ input channel 1 buffer 1 ] ... [ input channel N buffer 1 ] [ output channel 0 buffer 1 ] [ output channel 1 buffer 1 ] .. [ output channel N buffer 1 ] [ padding ]
+			// The reason why this is a giant blob is to slightly improve performance by (theroretically) improving memory locality.
+			AlignedBuffer buffers;
+		};
+
+		class RunningState {
+		public:
+			RunningState(Engine& engine, PaStream* stream, const Clock& clock, bool hostSupportsOutputReady);
+			~RunningState();
+
+			// Note: the reason why this is not done in the constructor is to allow `Engine::Start()`
+			// to properly set `Engine::runningState` before callbacks start flying. This is because
+			// the ASIO host application may decide to call GetSamplePosition() or OutputReady() as soon
+			// as bufferSwitch() is called without waiting for Start() to return - we don't want these calls
+			// to race with `Engine::Start()` constructing `Engine::runningState`.
+			void Start();
+
+			void GetSamplePosition(ASIOSamples* sPos, ASIOTimeStamp* tStamp) const;
+			void OutputReady();
+
+			PaStreamCallbackResult StreamCallback(const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags);
+
+		private:
+			// Accumulated by ProcessStreamCallback() and ProcessBlock() as they go, as there can be several blocks per callback.
+			struct CallbackTiming final {
+				int64_t bufferSwitchDurationNanoseconds = 0;
+				int64_t outputReadyWaitNanoseconds = 0;
+				int64_t copyDurationNanoseconds = 0;
+			};
+
+			void UpdateClockModel(unsigned long frameCount, const PaStreamCallbackTimeInfo* timeInfo);
+			PaStreamCallbackResult ProcessStreamCallback(const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags, CallbackTiming& timing);
+			// Processes exactly one ASIO buffer worth of frames.
+			void ProcessBlock(const std::byte* const* input, std::byte* const* output, CallbackTiming& timing);
+
+			enum class State { PRIMING, PRIMED, STEADYSTATE };
+
+			struct SamplePosition {
+				ASIOSamples samples = { 0 };
+				ASIOTimeStamp timestamp = { 0 };
+			};
+
+			Engine& engine;
+			PaStream* const stream;
+			const Clock& clock;
+			const bool host_supports_timeinfo;
+
+			// Accessed from ASIO host application threads (through OutputReady() and GetSamplePosition()) concurrently with
+			// the stream callback.
+			enum class OutputReadyState { NOT_READY, READY, STOPPING };
+			std::optional<std::atomic<OutputReadyState>> outputReadyState;
+			SeqLock<SamplePosition> samplePosition;
+
+			// Keeps the callback-only state below off the cache lines that host application threads touch, so that a host
+			// polling GetSamplePosition() does not slow down the callback through false sharing.
+			std::byte falseSharingPadding[falseSharingRangeInBytes];
+
+			State state = outputReadyState.has_value() ? State::PRIMING : State::PRIMED;
+			// The index of the "unlocked" buffer (or "half-buffer", i.e. 0 or 1) that contains data not currently being processed by the ASIO host.
+			long driverBufferIndex = state == State::PRIMING ? 1 : 0;
+
+			// Timestamps reported to the ASIO host application come from this model, which is fed the best estimate we have of
+			// when each PortAudio buffer was captured (or played). Positions are counted in PortAudio stream frames.
+			ClockModel clockModel;
+			int64_t portAudioFrameCount = 0;
+			// Stream position at the end of the last ASIO buffer processed.
+			int64_t processedFrameCount = 0;
+			const double outputLatencySeconds;
+			// Offset from PortAudio stream time to `clock` time. Measured once, on the first callback that provides timing
+			// information, so that it does not add any jitter.
+			std::optional<int64_t> portAudioTimeOffsetNanoseconds;
+
+			// Used when PortAudio calls us with a frame count that does not match the ASIO buffer size.
+			BlockAdapter blockAdapter;
+
+			struct PreviousCallback final {
+				int64_t entryTime;
+				int64_t frameDurationNanoseconds;
+			};
+			std::optional<PreviousCallback> previousCallback;
+			// Real-time options are applied to the callback thread on the first callback, and whenever they change.
+			uint64_t appliedLiveOptionsGeneration = 0;
+			std::optional<RealtimeOptions> appliedRealtimeOptions;
+			std::optional<CallbackTracer> tracer;
+			std::vector<MemoryLock> memoryLocks;
+
+			ActiveStream activeStream;
+		};
+
+		const ASIOSampleRate sampleRate;
+		const ASIOCallbacks callbacks;
+		const StreamFormat inputFormat;
+		const StreamFormat outputFormat;
+		const std::optional<CallbackTracer::Options> traceOptions;
+		const bool lockMemory;
+
+		// PortAudio buffer addresses are dynamic and are only valid for the duration of the stream callback.
+		// In contrast, ASIO buffer addresses are static and are valid for as long as the stream is running.
+		// Thus we need our own buffer on top of PortAudio's buffers. This doens't add any latency because buffers are copied immediately.
+		Buffers buffers;
+		const std::vector<ASIOBufferInfo> bufferInfos;
+		CopyPlan copyPlan;
+
+		// Indexed like the ASIO buffers of the corresponding direction.
+		std::optional<LevelMeter> inputLevelMeter;
+		std::optional<LevelMeter> outputLevelMeter;
+		std::atomic<bool> levelMeteringEnabled = false;
+		// Serializes GetLevel(), as LevelMeter::Read() must only be called from one thread at a time. Never taken by the stream
+		// callback.
+		std::mutex levelReadMutex;
+		// Copied from the live options, so that they can be read outside of the stream callback.
+		std::atomic<LiveOptions::MeterType> inputMeterType;
+		std::atomic<LiveOptions::MeterType> outputMeterType;
+		// Called by the stream callback right after the ASIO buffers of the given direction are copied.
+		void MeasureLevels(bool isInput, long bufferSetIndex);
+		// Called by the stream callback once the output stream buffers are filled.
+		void MixInputMonitors(const MixPlan& inputMonitorMixPlan, const std::byte* const* input, std::byte* const* output);
+
+		struct LiveOptionsSnapshot final {
+			LiveOptions options;
+			// Starts at 1, so that the first snapshot is never considered already applied. Only incremented when `options`
+			// change.
+			uint64_t generation;
+			// Compiled from the routing options, so that the stream callback can use them as is.
+			std::optional<MixPlan> inputMixPlan;
+			std::optional<MixPlan> outputMixPlan;
+			// Compiled from `inputMonitors`. Sources are input stream channels, destinations are output stream channels.
+			std::optional<MixPlan> inputMonitorMixPlan;
+		};
+		LiveOptionsSnapshot MakeLiveOptionsSnapshot(LiveOptions options, uint64_t generation) const;
+		std::optional<MixPlan> MakeMixPlan(const std::optional<std::vector<MixPlan::Route>>& routing, bool isInput) const;
+		std::optional<MixPlan> MakeInputMonitorMixPlan(const LiveOptions& options) const;
+		// Serializes SetLiveOptions() and SetInputMonitors(), which can be called from different threads.
+		std::mutex liveOptionsWriterMutex;
+		std::vector<InputMonitor> inputMonitors;
+		// Scratch memory for the stream callback; one element per input stream channel.
+		std::vector<const float*> inputMonitorSources;
+		// Published by SetLiveOptions(), read by the stream callback. Replacing a snapshot atomically replaces all the
+		// routing coefficients at once; the stream callback reads it once per ASIO buffer.
+		Rcu<LiveOptionsSnapshot> liveOptions;
+
+		// Accumulated over the lifetime of the engine, and logged when the engine is destroyed. Only accessed from the stream
+		// callback while running.
+		struct CallbackStatistics final {
+			Histogram jitter;
+			Histogram callbackDuration;
+			Histogram bufferSwitchDuration;
+			Histogram outputReadyWait;
+			Histogram copyDuration;
+		};
+		CallbackStatistics callbackStatistics;
+
+		std::vector<MemoryLock> memoryLocks;
+
+		std::optional<RunningState> runningState;
+	};
+
+}
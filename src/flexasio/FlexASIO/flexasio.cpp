@@ -1,6 +1,7 @@
 #include "flexasio.h"
 
 #include <algorithm>
+#include <filesystem>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -21,17 +22,81 @@
 
 #include "control_panel.h"
 #include "log.h"
+#include "../FlexASIOUtil/aligned_buffer.h"
+#include "../FlexASIOUtil/shell.h"
 
 namespace flexasio {
 
-	FlexASIO::PortAudioHandle::PortAudioHandle() {
-		Log() << "Initializing PortAudio";
-		PaError error = Pa_Initialize();
-		if (error != paNoError)
-			throw ASIOException(ASE_HWMalfunction, std::string("could not initialize PortAudio: ") + Pa_GetErrorText(error));
-		Log() << "PortAudio initialization successful";
+	namespace {
+
+		// Names PortAudio gives to the host APIs it can be built with on Windows.
+		constexpr std::pair<std::string_view, PaHostApiTypeId> hostApiNames[] = {
+			{"MME", paMME},
+			{"Windows DirectSound", paDirectSound},
+			{"Windows WASAPI", paWASAPI},
+			{"Windows WDM-KS", paWDMKS},
+			{"ASIO", paASIO},
+		};
+
+		// The host API that will be selected, if it can be determined without initializing PortAudio.
+		std::optional<PaHostApiTypeId> GetConfiguredHostApiTypeId(const Config& config) {
+			// See SelectDefaultHostApi().
+			if (!config.backend.has_value()) return paDirectSound;
+			return ::dechamps_cpputil::Find(std::string_view(*config.backend), hostApiNames);
+		}
+
+		// Returns the only host API PortAudio was initialized with, or nullopt if all of them were initialized.
+		std::optional<PaHostApiTypeId> InitializePortAudio(const std::optional<PaHostApiTypeId> hostApiTypeId) {
+			if (hostApiTypeId.has_value()) {
+				if (!RestrictPortAudioHostApi(*hostApiTypeId))
+					Log() << "PortAudio was built without host API " << GetHostApiTypeIdString(*hostApiTypeId);
+				else {
+					Log() << "Initializing PortAudio with host API " << GetHostApiTypeIdString(*hostApiTypeId) << " only";
+					const auto error = Pa_Initialize();
+					if (error == paNoError && Pa_HostApiTypeIdToHostApiIndex(*hostApiTypeId) >= 0) {
+						Log() << "PortAudio initialization successful";
+						return hostApiTypeId;
+					}
+					if (error == paNoError) {
+						Log() << "Host API is not available";
+						Pa_Terminate();
+					}
+					else Log() << "PortAudio initialization failed with " << Pa_GetErrorText(error);
+				}
+				RestrictPortAudioHostApi(std::nullopt);
+			}
+
+			Log() << "Initializing PortAudio with all host APIs";
+			const auto error = Pa_Initialize();
+			if (error != paNoError)
+				throw ASIOException(ASE_HWMalfunction, std::string("could not initialize PortAudio: ") + Pa_GetErrorText(error));
+			Log() << "PortAudio initialization successful";
+			return std::nullopt;
+		}
+
+	}
+
+	FlexASIO::PortAudioHandle::Shared FlexASIO::PortAudioHandle::shared;
+
+	FlexASIO::PortAudioHandle::PortAudioHandle(const std::optional<PaHostApiTypeId> hostApiTypeId) {
+		const std::lock_guard lock(shared.mutex);
+		if (shared.referenceCount > 0) {
+			if (shared.hostApiTypeId.has_value() && shared.hostApiTypeId != hostApiTypeId) {
+				shared.initializeAllHostApis = true;
+				throw ASIOException(ASE_NotPresent, "The configured backend is not available, as another FlexASIO instance in this process initialized PortAudio with host API " +
+					GetHostApiTypeIdString(*shared.hostApiTypeId) + " only; it will be available once all FlexASIO instances are gone");
+			}
+			Log() << "Sharing PortAudio initialization with " << shared.referenceCount << " other FlexASIO instances";
+		}
+		else shared.hostApiTypeId = InitializePortAudio(shared.initializeAllHostApis ? std::nullopt : hostApiTypeId);
+		++shared.referenceCount;
 	}
 	FlexASIO::PortAudioHandle::~PortAudioHandle() {
+		const std::lock_guard lock(shared.mutex);
+		if (--shared.referenceCount > 0) {
+			Log() << "Not terminating PortAudio, as " << shared.referenceCount << " other FlexASIO instances are using it";
+			return;
+		}
 		Log() << "Terminating PortAudio";
 		PaError error = Pa_Terminate();
 		if (error != paNoError)
@@ -43,13 +108,21 @@ namespace flexasio {
 	FlexASIO::Win32HighResolutionTimer::Win32HighResolutionTimer() {
 		Log() << "Starting high resolution timer";
 		timeBeginPeriod(1);
+
+		// Sample the steady clock just as timeGetTime() ticks over, so that the offset between the two is accurate to a
+		// small fraction of a millisecond. This takes at most one timer period.
+		const auto initialTimeMilliseconds = timeGetTime();
+		DWORD timeMilliseconds;
+		do timeMilliseconds = timeGetTime(); while (timeMilliseconds == initialTimeMilliseconds);
+		steadyClockOffsetNanoseconds = int64_t(timeMilliseconds) * 1000000 - steadyClock.GetTimeNanoseconds();
+		Log() << "Steady clock offset from timeGetTime(): " << steadyClockOffsetNanoseconds << " nanoseconds";
 	}
 	FlexASIO::Win32HighResolutionTimer::~Win32HighResolutionTimer() {
 		Log() << "Stopping high resolution timer";
 		timeEndPeriod(1);
 	}
 
-	DWORD FlexASIO::Win32HighResolutionTimer::GetTimeMilliseconds() const { return timeGetTime(); }
+	int64_t FlexASIO::Win32HighResolutionTimer::GetTimeNanoseconds() const { return steadyClock.GetTimeNanoseconds() + steadyClockOffsetNanoseconds; }
 
 	namespace {
 
@@ -60,12 +133,14 @@ namespace flexasio {
 		}
 
 		void LogPortAudioApiList() {
+			if (!IsLoggingEnabled()) return;
 			const auto pa_api_count = Pa_GetHostApiCount();
 			for (PaHostApiIndex pa_api_index = 0; pa_api_index < pa_api_count; ++pa_api_index) {
 				Log() << "Found backend: " << HostApi(pa_api_index);
 			}
 		}
 		void LogPortAudioDeviceList() {
+			if (!IsLoggingEnabled()) return;
 			const auto deviceCount = Pa_GetDeviceCount();
 			for (PaDeviceIndex deviceIndex = 0; deviceIndex < deviceCount; ++deviceIndex) {
 				Log() << "Found device: " << Device(deviceIndex);
@@ -97,8 +172,8 @@ namespace flexasio {
 			throw std::runtime_error(std::string("PortAudio host API '") + std::string(name) + "' not found");
 		}
 
-		std::optional<Device> SelectDevice(const PaHostApiIndex hostApiIndex, const PaDeviceIndex defaultDeviceIndex, const Config::Device& configDevice, const int minimumInputChannelCount, const int minimumOutputChannelCount) {
-			Log() << "Selecting PortAudio device with host API index " << hostApiIndex << ", minimum channel counts: " << minimumInputChannelCount << " input, " << minimumOutputChannelCount << " output";
+		std::optional<Device> SelectDevice(const DeviceCache& deviceCache, const PaDeviceIndex defaultDeviceIndex, const Config::Device& configDevice, const int minimumInputChannelCount, const int minimumOutputChannelCount) {
+			Log() << "Selecting PortAudio device, minimum channel counts: " << minimumInputChannelCount << " input, " << minimumOutputChannelCount << " output";
 
 			if (std::holds_alternative<Config::DefaultDevice>(configDevice)) {
 				if (defaultDeviceIndex == paNoDevice) {
@@ -126,20 +201,20 @@ namespace flexasio {
 			if (configRegex != nullptr) matchDescription = "whose name matches regex `" + configRegex->getString() + "`";
 			Log() << "Searching for a PortAudio device " << matchDescription;
 
-			std::optional<Device> foundDevice;
-			const auto deviceCount = Pa_GetDeviceCount();
-			for (PaDeviceIndex deviceIndex = 0; deviceIndex < deviceCount; ++deviceIndex) {
-				Device device(deviceIndex);
-				if (device.info.hostApi != hostApiIndex || device.info.maxInputChannels < minimumInputChannelCount || device.info.maxOutputChannels < minimumOutputChannelCount) continue;
+			std::vector<const DeviceCache::Entry*> candidates;
+			if (configName != nullptr) candidates = deviceCache.Find(*configName);
+			if (configRegex != nullptr)
+				for (const auto& entry : deviceCache.GetEntries())
+					if (std::regex_search(entry.name, configRegex->getRegex())) candidates.push_back(&entry);
 
-				const auto& name = device.info.name;
-				if (configName != nullptr && name != *configName) continue;
-				if (configRegex != nullptr && !std::regex_search(name, configRegex->getRegex())) continue;
+			std::optional<Device> foundDevice;
+			for (const auto candidate : candidates) {
+				if (candidate->maxInputChannels < minimumInputChannelCount || candidate->maxOutputChannels < minimumOutputChannelCount) continue;
 
-				Log() << "Found a match with device " << device.index;
+				Log() << "Found a match with device " << candidate->index;
 				if (foundDevice.has_value())
-					throw std::runtime_error(std::string("Device search found more than one device: `") + foundDevice->info.name + "` and `" + name + "` (minimum channel count: " + std::to_string(minimumInputChannelCount) + " input, " + std::to_string(minimumOutputChannelCount) + " output)");
-				foundDevice.emplace(device);
+					throw std::runtime_error(std::string("Device search found more than one device: `") + foundDevice->info.name + "` and `" + candidate->name + "` (minimum channel count: " + std::to_string(minimumInputChannelCount) + " input, " + std::to_string(minimumOutputChannelCount) + " output)");
+				foundDevice.emplace(candidate->index);
 			}
 			if (!foundDevice.has_value()) {
 				Log() << "No matching devices found";
@@ -148,15 +223,7 @@ namespace flexasio {
 			return *foundDevice;
 		}
 
-		std::string GetPaStreamCallbackResultString(PaStreamCallbackResult result) {
-			return ::dechamps_cpputil::EnumToString(result, {
-				{paContinue, "paContinue"},
-				{paComplete, "paComplete"},
-				{paAbort, "paAbort"},
-				});
-		}
-
-		ASIOSampleRate GetDefaultSampleRate(const std::optional<Device>& inputDevice, const std::optional<Device>& outputDevice) {
+		ASIOSampleRate GetDefaultSampleRate(const ProbeCache& probeCache, const std::optional<Device>& inputDevice, const std::optional<Device>& outputDevice) {
 			if (previousSampleRate.has_value()) {
 				// Work around a REW bug. See https://github.com/dechamps/FlexASIO/issues/31
 				// Another way of doing this would have been to only pick this sample rate if the application
@@ -165,6 +232,11 @@ namespace flexasio {
 				Log() << "Using default sample rate " << *previousSampleRate << " Hz from a previous instance of the driver";
 				return *previousSampleRate;
 			}
+			// Same idea, but for an instance in another process, e.g. the previous time the application was run.
+			if (const auto lastSampleRate = probeCache.GetLastSampleRate(); lastSampleRate.has_value() && IsValidSampleRate(*lastSampleRate)) {
+				Log() << "Using default sample rate " << *lastSampleRate << " Hz from the probe cache";
+				return *lastSampleRate;
+			}
 
 			ASIOSampleRate sampleRate = 0;
 			if (inputDevice.has_value()) {
@@ -178,13 +250,6 @@ namespace flexasio {
 			return sampleRate;
 		}
 
-		long Message(decltype(ASIOCallbacks::asioMessage) asioMessage, long selector, long value, void* message, double* opt) {
-			Log() << "Sending message: selector = " << ::dechamps_ASIOUtil::GetASIOMessageSelectorString(selector) << ", value = " << value << ", message = " << message << ", opt = " << opt;
-			const auto result = asioMessage(selector, value, message, opt);
-			Log() << "Result: " << result;
-			return result;
-		}
-
 		// This is purely for instrumentation - it makes it possible to see host capabilities in the log.
 		// Such information could be used to inform future development (there's no point in supporting more ASIO features if host applications don't support them).
 		void ProbeHostMessages(decltype(ASIOCallbacks::asioMessage) asioMessage) {
@@ -210,35 +275,83 @@ namespace flexasio {
 			return paContinue;
 		}
 
-		long GetBufferInfosChannelCount(const ASIOBufferInfo* asioBufferInfos, const long numChannels, const bool input) {
-			long result = 0;
-			for (long channelIndex = 0; channelIndex < numChannels; ++channelIndex)
-				if (!asioBufferInfos[channelIndex].isInput == !input)
-					++result;
-			return result;
+		PaTime GetDefaultSuggestedLatency(long bufferSizeInFrames, ASIOSampleRate sampleRate) {
+			return 3 * bufferSizeInFrames / sampleRate;
 		}
 
-		void CopyFromPortAudioBuffers(const std::vector<ASIOBufferInfo>& bufferInfos, const long doubleBufferIndex, const std::byte* const* portAudioBuffers, const size_t bufferSizeInBytes) {
-			for (const auto& bufferInfo : bufferInfos)
-			{
-				if (!bufferInfo.isInput) continue;
-				memcpy(bufferInfo.buffers[doubleBufferIndex], portAudioBuffers[bufferInfo.channelNum], bufferSizeInBytes);
+		// Similar to logging, stream callback tracing is enabled by creating a FlexASIO.trace file in the user directory.
+		std::optional<CallbackTracer::Options> GetCallbackTraceOptions() {
+			std::filesystem::path path;
+			try {
+				path = GetUserDirectory();
+			}
+			catch (...) {
+				return std::nullopt;
 			}
+			path.append("FlexASIO.trace");
+			if (!std::filesystem::exists(path)) return std::nullopt;
+			return CallbackTracer::Options{ .path = path, .durationSeconds = 10 };
 		}
-		void CopyToPortAudioBuffers(const std::vector<ASIOBufferInfo>& bufferInfos, const long doubleBufferIndex, std::byte* const* portAudioBuffers, const size_t bufferSizeInBytes) {
-			for (const auto& bufferInfo : bufferInfos)
-			{
-				if (bufferInfo.isInput) continue;
-				memcpy(portAudioBuffers[bufferInfo.channelNum], bufferInfo.buffers[doubleBufferIndex], bufferSizeInBytes);
+
+		// Likewise, the startup timeline is written to a FlexASIO.startup.json file in the user directory if it exists.
+		std::optional<std::filesystem::path> GetStartupTraceEventPath() {
+			std::filesystem::path path;
+			try {
+				path = GetUserDirectory();
 			}
+			catch (...) {
+				return std::nullopt;
+			}
+			path.append("FlexASIO.startup.json");
+			if (!std::filesystem::exists(path)) return std::nullopt;
+			return path;
 		}
 
-		template <typename Enum> void IncrementEnum(Enum& value) {
-			value = static_cast<Enum>(std::underlying_type_t<Enum>(value) + 1);
+		constexpr std::pair<std::string_view, RealtimeOptions::SchedulingPolicy> schedulingPolicies[] = {
+			{"other", RealtimeOptions::SchedulingPolicy::OTHER},
+			{"fifo", RealtimeOptions::SchedulingPolicy::FIFO},
+			{"rr", RealtimeOptions::SchedulingPolicy::RR},
+		};
+
+		RealtimeOptions GetRealtimeOptions(const Config::Realtime& realtimeConfig) {
+			RealtimeOptions realtimeOptions;
+			if (realtimeConfig.schedulingPolicy.has_value()) {
+				const auto schedulingPolicy = ::dechamps_cpputil::Find(std::string_view(*realtimeConfig.schedulingPolicy), schedulingPolicies);
+				if (!schedulingPolicy.has_value())
+					throw std::runtime_error(std::string("Invalid '") + *realtimeConfig.schedulingPolicy + "' scheduling policy - valid values are " + ::dechamps_cpputil::Join(schedulingPolicies, ", ", [](const auto& item) { return std::string("'") + std::string(item.first) + "'"; }));
+				realtimeOptions.schedulingPolicy = *schedulingPolicy;
+			}
+			realtimeOptions.priority = realtimeConfig.priority;
+			if (realtimeConfig.cpuAffinityMask.has_value()) realtimeOptions.cpuAffinityMask = uint64_t(*realtimeConfig.cpuAffinityMask);
+			realtimeOptions.flushDenormals = realtimeConfig.flushDenormals;
+			return realtimeOptions;
 		}
 
-		PaTime GetDefaultSuggestedLatency(long bufferSizeInFrames, ASIOSampleRate sampleRate) {
-			return 3 * bufferSizeInFrames / sampleRate;
+		// WASAPI assigns channels to speaker positions in increasing bit order, so the first channels keep the lowest bits.
+		DWORD TrimChannelMask(DWORD channelMask, int channelCount) {
+			DWORD trimmedChannelMask = 0;
+			for (DWORD bit = 1; bit != 0 && channelCount > 0; bit <<= 1) {
+				if ((channelMask & bit) == 0) continue;
+				trimmedChannelMask |= bit;
+				--channelCount;
+			}
+			return trimmedChannelMask;
+		}
+
+		Engine::LiveOptions::MeterType GetMeterType(std::string_view meter) {
+			return meter == "rms" ? Engine::LiveOptions::MeterType::RMS : Engine::LiveOptions::MeterType::PEAK;
+		}
+
+		std::optional<std::vector<MixPlan::Route>> GetRoutes(const std::optional<std::vector<Config::Stream::Route>>& routing, bool input) {
+			if (!routing.has_value()) return std::nullopt;
+			std::vector<MixPlan::Route> routes;
+			for (const auto& route : *routing)
+				routes.push_back({
+					.sourceChannel = input ? route.deviceChannel : route.asioChannel,
+					.destinationChannel = input ? route.asioChannel : route.deviceChannel,
+					.gain = float(route.gain),
+					});
+			return routes;
 		}
 
 	}
@@ -270,7 +383,7 @@ namespace flexasio {
 		throw std::runtime_error(std::string("Unable to convert wave format to sample type: ") + DescribeWaveFormat(waveFormat));
 	}
 
-	FlexASIO::SampleType FlexASIO::SelectSampleType(const PaHostApiTypeId hostApiTypeId, const Device& device, const Config::Stream& streamConfig) {
+	FlexASIO::SampleType FlexASIO::SelectSampleType(const PaHostApiTypeId hostApiTypeId, const DeviceCache::Entry& device, const Config::Stream& streamConfig) {
 		if (streamConfig.sampleType.has_value()) {
 			Log() << "Selecting sample type from configuration";
 			return ParseSampleType(*streamConfig.sampleType);
@@ -278,9 +391,9 @@ namespace flexasio {
 		if (hostApiTypeId == paWASAPI && streamConfig.wasapiExclusiveMode) {
 			try {
 				Log() << "WASAPI Exclusive mode detected, selecting sample type from WASAPI device default format";
-				const auto deviceFormat = GetWasapiDeviceDefaultFormat(device.index);
-				Log() << "WASAPI device default format: " << DescribeWaveFormat(deviceFormat);
-				return WaveFormatToSampleType(deviceFormat);
+				if (!device.wasapiDefaultFormat.has_value()) throw std::runtime_error("device default format is unknown");
+				Log() << "WASAPI device default format: " << DescribeWaveFormat(*device.wasapiDefaultFormat);
+				return WaveFormatToSampleType(*device.wasapiDefaultFormat);
 			}
 			catch (const std::exception& exception) {
 				Log() << "Unable to select sample type from WASAPI device default format: " << exception.what();
@@ -290,8 +403,8 @@ namespace flexasio {
 		return float32;
 	}
 
-	DWORD FlexASIO::SelectChannelMask(const PaHostApiTypeId hostApiTypeId, const Device& device, const Config::Stream& streamConfig) {
-		if (streamConfig.channels.has_value()) {
+	DWORD FlexASIO::SelectChannelMask(const PaHostApiTypeId hostApiTypeId, const DeviceCache::Entry& device, const std::optional<int>& configChannelCount) {
+		if (configChannelCount.has_value()) {
 			Log() << "Not using a channel mask because channel count is set in configuration";
 			return 0;
 		}
@@ -305,9 +418,9 @@ namespace flexasio {
 			// to be consistent. Sadly, this holds even if we eventually decide to open the device in
 			// exclusive mode.
 			Log() << "Selecting channel mask from WASAPI device mix format";
-			const auto deviceFormat = GetWasapiDeviceMixFormat(device.index);
-			Log() << "WASAPI device mix format: " << DescribeWaveFormat(deviceFormat);
-			return deviceFormat.dwChannelMask;
+			if (!device.wasapiMixFormat.has_value()) throw std::runtime_error("device mix format is unknown");
+			Log() << "WASAPI device mix format: " << DescribeWaveFormat(*device.wasapiMixFormat);
+			return device.wasapiMixFormat->dwChannelMask;
 		}
 		catch (const std::exception& exception) {
 			Log() << "Unable to select channel mask from WASAPI device mix format: " << exception.what();
@@ -315,63 +428,137 @@ namespace flexasio {
 		}
 	}
 
+	std::vector<FlexASIO::StreamDevice> FlexASIO::SelectAdditionalDevices(bool input) const {
+		const auto& streamConfig = input ? config.input : config.output;
+		const auto direction = input ? "input" : "output";
+		std::vector<StreamDevice> devices;
+		for (size_t deviceIndex = 0; deviceIndex < streamConfig.additionalDevices.size(); ++deviceIndex) {
+			// Device 0 is the master.
+			const auto deviceOrdinal = deviceIndex + 1;
+			try {
+				Log() << "Selecting additional " << direction << " device " << deviceOrdinal;
+				const auto device = SelectDevice(deviceCache, paNoDevice, streamConfig.additionalDevices[deviceIndex], input ? 1 : 0, input ? 0 : 1);
+				if (!device.has_value()) throw std::runtime_error("no device");
+				const auto configChannelCount = streamConfig.additionalChannels.empty() ? std::nullopt : std::optional<int>(streamConfig.additionalChannels[deviceIndex]);
+				auto& streamDevice = devices.emplace_back(StreamDevice{
+					.device = *device,
+					.channelCount = configChannelCount.has_value() ? *configChannelCount : input ? device->info.maxInputChannels : device->info.maxOutputChannels,
+					.sampleType = streamConfig.deviceSampleType.has_value() ? ParseSampleType(*streamConfig.deviceSampleType) : SelectSampleType(hostApi.info.type, deviceCache.Get(device->index), streamConfig),
+					.channelMask = SelectChannelMask(hostApi.info.type, deviceCache.Get(device->index), configChannelCount),
+				});
+				Log() << "Selected additional " << direction << " device " << deviceOrdinal << ": " << streamDevice.device << ", " << streamDevice.channelCount << " channels, sample type "
+					<< DescribeSampleType(streamDevice.sampleType) << ", channel mask " << GetWaveFormatChannelMaskString(streamDevice.channelMask);
+			}
+			catch (const std::exception& exception) {
+				throw std::runtime_error("Could not select additional " + std::string(direction) + " device " + std::to_string(deviceOrdinal) + ": " + exception.what());
+			}
+		}
+		return devices;
+	}
+
 	std::string FlexASIO::DescribeSampleType(const SampleType& sampleType) {
 		return "ASIO " + ::dechamps_ASIOUtil::GetASIOSampleTypeString(sampleType.asio) + ", PortAudio " + GetSampleFormatString(sampleType.pa) + ", size " + std::to_string(sampleType.size);
 	}
 
+	Engine::LiveOptions FlexASIO::GetEngineLiveOptions(const Config& config) const {
+		for (const auto input : { true, false }) {
+			const auto& sampleType = input ? inputSampleType : outputSampleType;
+			if ((input ? config.input : config.output).routing.has_value() && sampleType.has_value() && sampleType->asio != float32.asio)
+				throw ASIOException(ASE_InvalidMode, std::string(input ? "Input" : "Output") + " routing requires the Float32 sample type, but " + DescribeSampleType(*sampleType) + " is in use");
+		}
+		return {
+			.realtime = GetRealtimeOptions(config.realtime),
+			.inputRouting = GetRoutes(config.input.routing, /*input=*/true),
+			.outputRouting = GetRoutes(config.output.routing, /*input=*/false),
+			.inputMeterType = GetMeterType(config.input.meter),
+			.outputMeterType = GetMeterType(config.output.meter),
+		};
+	}
+
+	std::optional<Engine::StreamFormat::Conversion> FlexASIO::GetSampleConversion(const std::optional<SampleType>& sampleType, const std::optional<SampleType>& deviceSampleType, const Config::Stream& streamConfig) {
+		if (!sampleType.has_value() || !deviceSampleType.has_value() || deviceSampleType->asio == sampleType->asio) return std::nullopt;
+		return Engine::StreamFormat::Conversion{ .asioSampleType = sampleType->asio, .portAudioSampleType = deviceSampleType->asio, .dither = streamConfig.dither };
+	}
+
 	FlexASIO::FlexASIO(void* sysHandle) :
 		windowHandle(reinterpret_cast<decltype(windowHandle)>(sysHandle)),
+	configLoader(startupTimeline.Measure("ConfigLoader", [] { return ConfigLoader(); })),
 	portAudioDebugRedirector([](std::string_view str) { if (IsLoggingEnabled()) Log() << "[PortAudio] " << str; }),
-	hostApi([&] {
+	portAudioHandle(startupTimeline.Measure("PortAudioHandle", [&] { return PortAudioHandle(GetConfiguredHostApiTypeId(config)); })),
+	hostApi(startupTimeline.Measure("SelectHostApi", [&] {
 		LogPortAudioApiList();
 		auto hostApi = config.backend.has_value() ? SelectHostApiByName(*config.backend) : SelectDefaultHostApi();
 		Log() << "Selected backend: " << hostApi;
 		LogPortAudioDeviceList();
 		return hostApi;
-	}()),
-		inputDevice([&] {
+	})),
+		deviceCache(startupTimeline.Measure("DeviceCache", [&] { return DeviceCache(hostApi); })),
+		probeCache(startupTimeline.Measure("ProbeCache", [&] { return ProbeCache(hostApi, deviceCache); })),
+		inputDevice(startupTimeline.Measure("SelectDevice (input)", [&] {
 		Log() << "Selecting input device";
-		auto device = SelectDevice(hostApi.index, hostApi.info.defaultInputDevice, config.input.device, 1, 0);
+		auto device = SelectDevice(deviceCache, hostApi.info.defaultInputDevice, config.input.device, 1, 0);
 		if (device.has_value()) Log() << "Selected input device: " << *device;
 		else Log() << "No input device, proceeding without input";
 		return device;
-	}()),
-		outputDevice([&] {
+	})),
+		outputDevice(startupTimeline.Measure("SelectDevice (output)", [&] {
 		Log() << "Selecting output device";
-		auto device = SelectDevice(hostApi.index, hostApi.info.defaultOutputDevice, config.output.device, 0, 1);
+		auto device = SelectDevice(deviceCache, hostApi.info.defaultOutputDevice, config.output.device, 0, 1);
 		if (device.has_value()) Log() << "Selected output device: " << *device;
 		else Log() << "No output device, proceeding without output";
 		return device;
-	}()),
-		inputSampleType([&]() -> std::optional<SampleType> {
+	})),
+		inputSampleType(startupTimeline.Measure("SelectSampleType (input)", [&]() -> std::optional<SampleType> {
 		if (!inputDevice.has_value()) return std::nullopt;
 		try {
 			Log() << "Selecting input sample type";
-			const auto sampleType = SelectSampleType(hostApi.info.type, *inputDevice, config.input);
+			const auto sampleType = SelectSampleType(hostApi.info.type, deviceCache.Get(inputDevice->index), config.input);
 			Log() << "Selected input sample type: " << DescribeSampleType(sampleType);
 			return sampleType;
 		}
 		catch (const std::exception& exception) {
 			throw std::runtime_error(std::string("Could not select input sample type: ") + exception.what());
 		}
-	}()),
-		outputSampleType([&]() -> std::optional<SampleType> {
+	})),
+		outputSampleType(startupTimeline.Measure("SelectSampleType (output)", [&]() -> std::optional<SampleType> {
 		if (!outputDevice.has_value()) return std::nullopt;
 		try {
 			Log() << "Selecting output sample type";
-			const auto sampleType = SelectSampleType(hostApi.info.type, *outputDevice, config.output);
+			const auto sampleType = SelectSampleType(hostApi.info.type, deviceCache.Get(outputDevice->index), config.output);
 			Log() << "Selected output sample type: " << DescribeSampleType(sampleType);
 			return sampleType;
 		}
 		catch (const std::exception& exception) {
 			throw std::runtime_error(std::string("Could not select output sample type: ") + exception.what());
 		}
+	})),
+		inputDeviceSampleType([&]() -> std::optional<SampleType> {
+		if (!inputDevice.has_value() || !config.input.deviceSampleType.has_value()) return std::nullopt;
+		try {
+			const auto sampleType = ParseSampleType(*config.input.deviceSampleType);
+			Log() << "Selected input device sample type: " << DescribeSampleType(sampleType);
+			return sampleType;
+		}
+		catch (const std::exception& exception) {
+			throw std::runtime_error(std::string("Could not select input device sample type: ") + exception.what());
+		}
+	}()),
+		outputDeviceSampleType([&]() -> std::optional<SampleType> {
+		if (!outputDevice.has_value() || !config.output.deviceSampleType.has_value()) return std::nullopt;
+		try {
+			const auto sampleType = ParseSampleType(*config.output.deviceSampleType);
+			Log() << "Selected output device sample type: " << DescribeSampleType(sampleType);
+			return sampleType;
+		}
+		catch (const std::exception& exception) {
+			throw std::runtime_error(std::string("Could not select output device sample type: ") + exception.what());
+		}
 	}()),
 		inputChannelMask([&]() -> DWORD {
 		if (!inputDevice.has_value()) return 0;
 		try {
 			Log() << "Selecting input channel mask";
-			const auto channelMask = SelectChannelMask(hostApi.info.type, *inputDevice, config.input);
+			const auto channelMask = SelectChannelMask(hostApi.info.type, deviceCache.Get(inputDevice->index), config.input.channels);
 			Log() << "Selected input channel mask: " << GetWaveFormatChannelMaskString(channelMask);
 			return channelMask;
 		}
@@ -384,7 +571,7 @@ namespace flexasio {
 		if (!outputDevice.has_value()) return 0;
 		try {
 			Log() << "Selecting output channel mask";
-			const auto channelMask = SelectChannelMask(hostApi.info.type, *outputDevice, config.output);
+			const auto channelMask = SelectChannelMask(hostApi.info.type, deviceCache.Get(outputDevice->index), config.output.channels);
 			Log() << "Selected output channel mask: " << GetWaveFormatChannelMaskString(channelMask);
 			return channelMask;
 		}
@@ -393,31 +580,65 @@ namespace flexasio {
 			return 0;
 		}
 	}()),
-		sampleRate(GetDefaultSampleRate(inputDevice, outputDevice))
+		additionalInputDevices(SelectAdditionalDevices(/*input=*/true)),
+		additionalOutputDevices(SelectAdditionalDevices(/*input=*/false)),
+		sampleRate(GetDefaultSampleRate(probeCache, inputDevice, outputDevice))
 	{
 		Log() << "sysHandle = " << sysHandle;
 
 		if (!inputDevice.has_value() && !outputDevice.has_value()) throw ASIOException(ASE_HWMalfunction, "No usable input nor output devices");
 
 		Log() << "Input channel count: " << GetInputChannelCount();
-		if (inputDevice.has_value() && GetInputChannelCount() > inputDevice->info.maxInputChannels)
+		if (inputDevice.has_value() && GetMasterInputChannelCount() > inputDevice->info.maxInputChannels)
 			Log() << "WARNING: input channel count is higher than the max channel count for this device. Input device initialization might fail.";
+		for (const auto& additionalInputDevice : additionalInputDevices)
+			if (additionalInputDevice.channelCount > additionalInputDevice.device.info.maxInputChannels)
+				Log() << "WARNING: input channel count is higher than the max channel count for additional device " << additionalInputDevice.device << ". Device initialization might fail.";
 
 		Log() << "Output channel count: " << GetOutputChannelCount();
-		if (outputDevice.has_value() && GetOutputChannelCount() > outputDevice->info.maxOutputChannels)
+		if (outputDevice.has_value() && GetMasterOutputChannelCount() > outputDevice->info.maxOutputChannels)
 			Log() << "WARNING: output channel count is higher than the max channel count for this device. Output device initialization might fail.";
+		for (const auto& additionalOutputDevice : additionalOutputDevices)
+			if (additionalOutputDevice.channelCount > additionalOutputDevice.device.info.maxOutputChannels)
+				Log() << "WARNING: output channel count is higher than the max channel count for additional device " << additionalOutputDevice.device << ". Device initialization might fail.";
 	}
 
-	int FlexASIO::GetInputChannelCount() const {
+	int FlexASIO::GetMasterInputChannelCount() const {
 		if (!inputDevice.has_value()) return 0;
 		if (config.input.channels.has_value()) return *config.input.channels;
 		return inputDevice->info.maxInputChannels;
 	}
-	int FlexASIO::GetOutputChannelCount() const {
+	int FlexASIO::GetMasterOutputChannelCount() const {
 		if (!outputDevice.has_value()) return 0;
 		if (config.output.channels.has_value()) return *config.output.channels;
 		return outputDevice->info.maxOutputChannels;
 	}
+	int FlexASIO::GetInputChannelCount() const {
+		auto channelCount = GetMasterInputChannelCount();
+		for (const auto& additionalInputDevice : additionalInputDevices) channelCount += additionalInputDevice.channelCount;
+		return channelCount;
+	}
+	int FlexASIO::GetOutputChannelCount() const {
+		auto channelCount = GetMasterOutputChannelCount();
+		for (const auto& additionalOutputDevice : additionalOutputDevices) channelCount += additionalOutputDevice.channelCount;
+		return channelCount;
+	}
+
+	FlexASIO::StreamDevice FlexASIO::GetMasterStreamDevice(bool input) const {
+		return input ?
+			StreamDevice{
+				.device = *inputDevice,
+				.channelCount = GetMasterInputChannelCount(),
+				.sampleType = inputDeviceSampleType.has_value() ? *inputDeviceSampleType : *inputSampleType,
+				.channelMask = inputChannelMask,
+			} :
+			StreamDevice{
+				.device = *outputDevice,
+				.channelCount = GetMasterOutputChannelCount(),
+				.sampleType = outputDeviceSampleType.has_value() ? *outputDeviceSampleType : *outputSampleType,
+				.channelMask = outputChannelMask,
+			};
+	}
 
 	FlexASIO::BufferSizes FlexASIO::ComputeBufferSizes() const
 	{
@@ -529,10 +750,24 @@ namespace flexasio {
 		}
 
 		info->isActive = preparedState.has_value() && preparedState->IsChannelActive(info->isInput, info->channel);
-		info->channelGroup = 0;
 		info->type = info->isInput ? inputSampleType->asio : outputSampleType->asio;
+
+		// Channels of additional devices follow the channels of the master device. Each device gets its own channel group.
+		const auto& additionalDevices = info->isInput ? additionalInputDevices : additionalOutputDevices;
+		info->channelGroup = 0;
+		long deviceChannel = info->channel;
+		DWORD channelMask = info->isInput ? inputChannelMask : outputChannelMask;
+		for (long channelCount = info->isInput ? GetMasterInputChannelCount() : GetMasterOutputChannelCount(); deviceChannel >= channelCount; ) {
+			deviceChannel -= channelCount;
+			const auto& additionalDevice = additionalDevices[info->channelGroup++];
+			channelCount = additionalDevice.channelCount;
+			channelMask = additionalDevice.channelMask;
+		}
+
 		std::stringstream channel_string;
-		channel_string << (info->isInput ? "IN" : "OUT") << " " << getChannelName(info->channel, info->isInput ? inputChannelMask : outputChannelMask);
+		channel_string << (info->isInput ? "IN" : "OUT") << " ";
+		if (!additionalDevices.empty()) channel_string << info->channelGroup << ":";
+		channel_string << getChannelName(deviceChannel, channelMask);
 		strcpy_s(info->name, 32, channel_string.str().c_str());
 		Log() << "Returning: " << info->name << ", " << (info->isActive ? "active" : "inactive") << ", group " << info->channelGroup << ", type " << ::dechamps_ASIOUtil::GetASIOSampleTypeString(info->type);
 	}
@@ -541,7 +776,15 @@ namespace flexasio {
 	decltype(auto) FlexASIO::WithStreamParameters(bool inputEnabled, bool outputEnabled, double sampleRate, PaTime defaultSuggestedLatency, Functor functor) const
 	{
 		Log() << "FlexASIO::WithStreamParameters(inputEnabled = " << inputEnabled << ", outputEnabled = " << outputEnabled << ", sampleRate = " << sampleRate << ")";
+		return WithStreamParameters(
+			inputEnabled ? std::optional(GetMasterStreamDevice(/*input=*/true)) : std::nullopt,
+			outputEnabled ? std::optional(GetMasterStreamDevice(/*input=*/false)) : std::nullopt,
+			sampleRate, defaultSuggestedLatency, std::move(functor));
+	}
 
+	template <typename Functor>
+	decltype(auto) FlexASIO::WithStreamParameters(const std::optional<StreamDevice>& input, const std::optional<StreamDevice>& output, double sampleRate, PaTime defaultSuggestedLatency, Functor functor) const
+	{
 		auto exclusivity = hostApi.info.type == paWDMKS ? StreamExclusivity::EXCLUSIVE : StreamExclusivity::SHARED;
 
 		PaStreamParameters common_parameters = { 0 };
@@ -557,80 +800,58 @@ namespace flexasio {
 			common_wasapi_stream_info.flags = 0;
 		}
 
-		PaStreamParameters input_parameters = common_parameters;
-		PaWasapiStreamInfo input_wasapi_stream_info = common_wasapi_stream_info;
-		if (inputEnabled)
-		{
-			input_parameters.device = inputDevice->index;
-			input_parameters.channelCount = GetInputChannelCount();
-			input_parameters.sampleFormat |= inputSampleType->pa;
-			if (config.input.suggestedLatencySeconds.has_value()) input_parameters.suggestedLatency = *config.input.suggestedLatencySeconds;
+		const auto setParameters = [&](std::string_view direction, const StreamDevice& streamDevice, const Config::Stream& streamConfig, PaStreamParameters& parameters, PaWasapiStreamInfo& wasapiStreamInfo) {
+			parameters.device = streamDevice.device.index;
+			parameters.channelCount = streamDevice.channelCount;
+			parameters.sampleFormat |= streamDevice.sampleType.pa;
+			if (streamConfig.suggestedLatencySeconds.has_value()) parameters.suggestedLatency = *streamConfig.suggestedLatencySeconds;
 			if (hostApi.info.type == paWASAPI)
 			{
-				if (inputChannelMask != 0)
+				if (streamDevice.channelMask != 0)
 				{
-					input_wasapi_stream_info.flags |= paWinWasapiUseChannelMask;
-					input_wasapi_stream_info.channelMask = inputChannelMask;
+					wasapiStreamInfo.flags |= paWinWasapiUseChannelMask;
+					wasapiStreamInfo.channelMask = streamDevice.channelMask;
 				}
-				Log() << "Using " << (config.input.wasapiExclusiveMode ? "exclusive" : "shared") << " mode for input WASAPI stream";
-				if (config.input.wasapiExclusiveMode) {
-					input_wasapi_stream_info.flags |= paWinWasapiExclusive;
+				Log() << "Using " << (streamConfig.wasapiExclusiveMode ? "exclusive" : "shared") << " mode for " << direction << " WASAPI stream";
+				if (streamConfig.wasapiExclusiveMode) {
+					wasapiStreamInfo.flags |= paWinWasapiExclusive;
 					exclusivity = StreamExclusivity::EXCLUSIVE;
 				}
-				Log() << (config.input.wasapiAutoConvert ? "Enabling" : "Disabling") << " auto-conversion for input WASAPI stream";
-				if (config.input.wasapiAutoConvert) {
-					input_wasapi_stream_info.flags |= paWinWasapiAutoConvert;
+				Log() << (streamConfig.wasapiAutoConvert ? "Enabling" : "Disabling") << " auto-conversion for " << direction << " WASAPI stream";
+				if (streamConfig.wasapiAutoConvert) {
+					wasapiStreamInfo.flags |= paWinWasapiAutoConvert;
 				}
-				Log() << (config.input.wasapiExplicitSampleFormat ? "Enabling" : "Disabling") << " explicit sample format for input WASAPI stream";
-				if (config.input.wasapiExplicitSampleFormat) {
-					input_wasapi_stream_info.flags |= paWinWasapiExplicitSampleFormat;
+				Log() << (streamConfig.wasapiExplicitSampleFormat ? "Enabling" : "Disabling") << " explicit sample format for " << direction << " WASAPI stream";
+				if (streamConfig.wasapiExplicitSampleFormat) {
+					wasapiStreamInfo.flags |= paWinWasapiExplicitSampleFormat;
 				}
-				input_parameters.hostApiSpecificStreamInfo = &input_wasapi_stream_info;
+				parameters.hostApiSpecificStreamInfo = &wasapiStreamInfo;
 			}
-		}
+		};
+
+		PaStreamParameters input_parameters = common_parameters;
+		PaWasapiStreamInfo input_wasapi_stream_info = common_wasapi_stream_info;
+		if (input.has_value()) setParameters("input", *input, config.input, input_parameters, input_wasapi_stream_info);
 
 		PaStreamParameters output_parameters = common_parameters;
 		PaWasapiStreamInfo output_wasapi_stream_info = common_wasapi_stream_info;
-		if (outputEnabled)
-		{
-			output_parameters.device = outputDevice->index;
-			output_parameters.channelCount = GetOutputChannelCount();
-			output_parameters.sampleFormat |= outputSampleType->pa;
-			if (config.output.suggestedLatencySeconds.has_value()) output_parameters.suggestedLatency = *config.output.suggestedLatencySeconds;
-			if (hostApi.info.type == paWASAPI)
-			{
-				if (outputChannelMask != 0)
-				{
-					output_wasapi_stream_info.flags |= paWinWasapiUseChannelMask;
-					output_wasapi_stream_info.channelMask = outputChannelMask;
-				}
-				Log() << "Using " << (config.output.wasapiExclusiveMode ? "exclusive" : "shared") << " mode for output WASAPI stream";
-				if (config.output.wasapiExclusiveMode) {
-					output_wasapi_stream_info.flags |= paWinWasapiExclusive;
-					exclusivity = StreamExclusivity::EXCLUSIVE;
-				}
-				Log() << (config.output.wasapiAutoConvert ? "Enabling" : "Disabling") << " auto-conversion for output WASAPI stream";
-				if (config.output.wasapiAutoConvert) {
-					output_wasapi_stream_info.flags |= paWinWasapiAutoConvert;
-				}
-				Log() << (config.output.wasapiExplicitSampleFormat ? "Enabling" : "Disabling") << " explicit sample format for output WASAPI stream";
-				if (config.output.wasapiExplicitSampleFormat) {
-					output_wasapi_stream_info.flags |= paWinWasapiExplicitSampleFormat;
-				}
-				output_parameters.hostApiSpecificStreamInfo = &output_wasapi_stream_info;
-			}
-		}
+		if (output.has_value()) setParameters("output", *output, config.output, output_parameters, output_wasapi_stream_info);
 
 		return functor(StreamParameters{
-			.inputParameters = inputEnabled ? &input_parameters : NULL,
-			.outputParameters = outputEnabled ? &output_parameters : NULL,
+			.inputParameters = input.has_value() ? &input_parameters : NULL,
+			.outputParameters = output.has_value() ? &output_parameters : NULL,
 			.sampleRate = sampleRate,
 		}, exclusivity);
 	}
 
 	Stream FlexASIO::OpenStream(const StreamParameters& streamParameters, unsigned long framesPerBuffer, PaStreamCallback callback, void* callbackUserData) const
 	{
+		const auto span = startupTimeline.Measure("OpenStream");
 		Log() << "FlexASIO::OpenStream(framesPerBuffer = " << framesPerBuffer << ", callback = " << callback << ", callbackUserData = " << callbackUserData << ")";
+		if (config.adaptBackendBufferSize) {
+			Log() << "Letting PortAudio choose the buffer size; FlexASIO will adapt it to the ASIO buffer size";
+			framesPerBuffer = paFramesPerBufferUnspecified;
+		}
 		auto stream = flexasio::OpenStream(
 			streamParameters, framesPerBuffer, paPrimeOutputBuffersUsingStreamCallback, callback, callbackUserData);
 		const auto streamInfo = Pa_GetStreamInfo(stream.get());
@@ -653,7 +874,7 @@ namespace flexasio {
 		}
 
 		const auto checkParameters = [&](const StreamParameters& streamParameters, StreamExclusivity) {
-			CheckFormatSupported(streamParameters);
+			probeCache.CheckFormatSupported(streamParameters);
 		};
 
 		// We do not know whether the host application intends to use only input channels, only output channels, or both.
@@ -663,6 +884,8 @@ namespace flexasio {
 			try {
 				Log() << "Checking if input supports this sample rate";
 				WithStreamParameters(/*inputEnabled=*/true, /*outputEnabled=*/false, sampleRate, /*suggestedLatency*/0, checkParameters);
+				for (const auto& additionalInputDevice : additionalInputDevices)
+					WithStreamParameters(additionalInputDevice, std::nullopt, sampleRate, /*suggestedLatency*/0, checkParameters);
 				Log() << "Input supports this sample rate";
 				available = true;
 			}
@@ -673,6 +896,8 @@ namespace flexasio {
 			try {
 				Log() << "Checking if output supports this sample rate";
 				WithStreamParameters(/*inputEnabled=*/false, /*outputEnabled=*/true, sampleRate, /*suggestedLatency*/0, checkParameters);
+				for (const auto& additionalOutputDevice : additionalOutputDevices)
+					WithStreamParameters(std::nullopt, additionalOutputDevice, sampleRate, /*suggestedLatency*/0, checkParameters);
 				Log() << "Output supports this sample rate";
 				available = true;
 			}
@@ -688,6 +913,7 @@ namespace flexasio {
 	{
 		sampleRateWasAccessed = true;
 		previousSampleRate = sampleRate;
+		probeCache.SetLastSampleRate(sampleRate);
 		*sampleRateResult = sampleRate;
 		Log() << "Returning sample rate: " << *sampleRateResult;
 	}
@@ -701,6 +927,7 @@ namespace flexasio {
 
 		sampleRateWasAccessed = true;
 		previousSampleRate = requestedSampleRate;
+		probeCache.SetLastSampleRate(requestedSampleRate);
 
 		if (requestedSampleRate == sampleRate) {
 			Log() << "Requested sampled rate is equal to current sample rate";
@@ -716,6 +943,7 @@ namespace flexasio {
 	}
 
 	void FlexASIO::CreateBuffers(ASIOBufferInfo* bufferInfos, long numChannels, long bufferSize, ASIOCallbacks* callbacks) {
+		const auto span = startupTimeline.Measure("CreateBuffers");
 		Log() << "Request to create buffers for " << numChannels << " channels, size " << bufferSize << " samples";
 		if (numChannels < 1 || bufferSize < 1 || callbacks == nullptr || callbacks->bufferSwitch == nullptr)
 			throw ASIOException(ASE_InvalidParameter, "invalid createBuffer() parameters");
@@ -731,78 +959,171 @@ namespace flexasio {
 		preparedState.emplace(*this, sampleRate, bufferInfos, numChannels, bufferSize, callbacks);
 	}
 
-	FlexASIO::PreparedState::Buffers::Buffers(size_t bufferSetCount, size_t inputChannelCount, size_t outputChannelCount, size_t bufferSizeInFrames, size_t inputSampleSizeInBytes, size_t outputSampleSizeInBytes) :
-		bufferSetCount(bufferSetCount), inputChannelCount(inputChannelCount), outputChannelCount(outputChannelCount), bufferSizeInFrames(bufferSizeInFrames), inputSampleSizeInBytes(inputSampleSizeInBytes), outputSampleSizeInBytes(outputSampleSizeInBytes),
-		buffers(bufferSetCount * bufferSizeInFrames * (inputChannelCount * inputSampleSizeInBytes + outputChannelCount * outputSampleSizeInBytes)) {
-		Log() << "Allocated "
-			<< bufferSetCount << " buffer sets, "
-			<< inputChannelCount << "/" << outputChannelCount << " (I/O) channels per buffer set, "
-			<< bufferSizeInFrames << " samples per channel, "
-			<< inputSampleSizeInBytes << "/" << outputSampleSizeInBytes << " (I/O) bytes per sample, memory range: "
-			<< buffers.data() << "-" << buffers.data() + buffers.size();
-	}
-
-	FlexASIO::PreparedState::Buffers::~Buffers() {
-		Log() << "Destroying buffers";
-	}
-
 	FlexASIO::PreparedState::PreparedState(FlexASIO& flexASIO, ASIOSampleRate sampleRate, ASIOBufferInfo* asioBufferInfos, long numChannels, long bufferSizeInFrames, ASIOCallbacks* callbacks) :
-		flexASIO(flexASIO), sampleRate(sampleRate), callbacks(*callbacks),
-		buffers(
-			2,
-			GetBufferInfosChannelCount(asioBufferInfos, numChannels, true), GetBufferInfosChannelCount(asioBufferInfos, numChannels, false),
-			bufferSizeInFrames,
-			flexASIO.inputSampleType.has_value() ? flexASIO.inputSampleType->size : 0, flexASIO.outputSampleType.has_value() ? flexASIO.outputSampleType->size : 0),
-		bufferInfos([&] {
-		std::vector<ASIOBufferInfo> bufferInfos;
-		bufferInfos.reserve(numChannels);
-		size_t nextBuffersInputChannelIndex = 0;
-		size_t nextBuffersOutputChannelIndex = 0;
-		for (long channelIndex = 0; channelIndex < numChannels; ++channelIndex)
-		{
-			ASIOBufferInfo& asioBufferInfo = asioBufferInfos[channelIndex];
-			if (asioBufferInfo.isInput)
+		flexASIO(flexASIO), callbacks(*callbacks),
+		masterInputChannelCount(GetMasterChannelCount(/*input=*/true, asioBufferInfos, numChannels)),
+		masterOutputChannelCount(GetMasterChannelCount(/*input=*/false, asioBufferInfos, numChannels)),
+		engine(
+			sampleRate, asioBufferInfos, numChannels, bufferSizeInFrames, *callbacks,
 			{
-				if (asioBufferInfo.channelNum < 0 || asioBufferInfo.channelNum >= flexASIO.GetInputChannelCount())
-					throw ASIOException(ASE_InvalidParameter, "out of bounds input channel in createBuffers() buffer info");
-			}
-			else
+				.channelCount = flexASIO.GetInputChannelCount() - flexASIO.GetMasterInputChannelCount() + masterInputChannelCount,
+				.asioChannelCount = flexASIO.GetInputChannelCount(),
+				.sampleSizeInBytes = flexASIO.inputSampleType.has_value() ? flexASIO.inputSampleType->size : 0,
+				.asioSampleType = flexASIO.inputSampleType.has_value() ? std::optional(flexASIO.inputSampleType->asio) : std::nullopt,
+				.conversion = GetSampleConversion(flexASIO.inputSampleType, flexASIO.inputDeviceSampleType, flexASIO.config.input),
+			},
 			{
-				if (asioBufferInfo.channelNum < 0 || asioBufferInfo.channelNum >= flexASIO.GetOutputChannelCount())
-					throw ASIOException(ASE_InvalidParameter, "out of bounds output channel in createBuffers() buffer info");
+				.channelCount = flexASIO.GetOutputChannelCount() - flexASIO.GetMasterOutputChannelCount() + masterOutputChannelCount,
+				.asioChannelCount = flexASIO.GetOutputChannelCount(),
+				.sampleSizeInBytes = flexASIO.outputSampleType.has_value() ? flexASIO.outputSampleType->size : 0,
+				.asioSampleType = flexASIO.outputSampleType.has_value() ? std::optional(flexASIO.outputSampleType->asio) : std::nullopt,
+				.conversion = GetSampleConversion(flexASIO.outputSampleType, flexASIO.outputDeviceSampleType, flexASIO.config.output),
+			},
+			{ .alignment = flexASIO.config.alignBuffersToPages ? GetPageSize() : Engine::BufferOptions().alignment, .largePages = flexASIO.config.useLargePages, .lockMemory = flexASIO.config.lockMemory },
+			flexASIO.GetEngineLiveOptions(flexASIO.config),
+			GetCallbackTraceOptions()),
+		splitDuplex([&] {
+			if (!flexASIO.config.splitDuplex || !engine.HasInputBuffers() || !engine.HasOutputBuffers()) return false;
+			if (flexASIO.inputDevice->index == flexASIO.outputDevice->index) {
+				Log() << "Split duplex mode requested, but input and output are on the same device; using a single full duplex stream";
+				return false;
 			}
-			const auto getBuffer = asioBufferInfo.isInput ? &Buffers::GetInputBuffer : &Buffers::GetOutputBuffer;
-			auto& nextBuffersChannelIndex = asioBufferInfo.isInput ? nextBuffersInputChannelIndex : nextBuffersOutputChannelIndex;
-			const auto bufferSizeInBytes = asioBufferInfo.isInput ? buffers.GetInputBufferSizeInBytes() : buffers.GetOutputBufferSizeInBytes();
-
-			std::byte* first_half = (buffers.*getBuffer)(0, nextBuffersChannelIndex);
-			std::byte* second_half = (buffers.*getBuffer)(1, nextBuffersChannelIndex);
-			++nextBuffersChannelIndex;
-			asioBufferInfo.buffers[0] = first_half;
-			asioBufferInfo.buffers[1] = second_half;
-			Log() << "ASIO buffer #" << channelIndex << " is " << (asioBufferInfo.isInput ? "input" : "output") << " channel " << asioBufferInfo.channelNum
-				<< " - first half: " << first_half << "-" << first_half + bufferSizeInBytes
-				<< " - second half: " << second_half << "-" << second_half + bufferSizeInBytes;
-			bufferInfos.push_back(asioBufferInfo);
-		}
-		return bufferInfos;
-		}()), streamWithExclusivity(flexASIO.WithStreamParameters(
-			buffers.inputChannelCount > 0, buffers.outputChannelCount > 0, sampleRate, GetDefaultSuggestedLatency(bufferSizeInFrames, sampleRate),
+			Log() << "Input and output are on different devices; opening them as separate streams in split duplex mode";
+			return true;
+		}()),
+		aggregator([&]() -> std::optional<Aggregator> {
+			const auto inputDevices = GetAggregatedDevices(/*input=*/true);
+			const auto outputDevices = GetAggregatedDevices(/*input=*/false);
+			if (inputDevices.empty() && outputDevices.empty()) return std::nullopt;
+			const auto getAggregatorDevices = [&](const std::vector<StreamDevice>& streamDevices, bool dither) {
+				std::vector<Aggregator::Device> aggregatorDevices;
+				for (const auto& streamDevice : streamDevices)
+					aggregatorDevices.push_back({ .name = streamDevice.device.info.name, .channelCount = streamDevice.channelCount, .sampleType = streamDevice.sampleType.asio, .dither = dither });
+				return aggregatorDevices;
+			};
+			const auto getSampleType = [&](bool input) {
+				const auto& sampleType = input ? flexASIO.inputSampleType : flexASIO.outputSampleType;
+				const auto& deviceSampleType = input ? flexASIO.inputDeviceSampleType : flexASIO.outputDeviceSampleType;
+				if (!sampleType.has_value()) return ASIOSampleType(ASIOSTFloat32LSB);
+				return (deviceSampleType.has_value() ? *deviceSampleType : *sampleType).asio;
+			};
+			return std::optional<Aggregator>(std::in_place, Aggregator::Options{
+				.masterInputChannelCount = engine.HasInputBuffers() && !splitDuplex ? masterInputChannelCount : 0,
+				.masterOutputChannelCount = engine.HasOutputBuffers() ? masterOutputChannelCount : 0,
+				.inputSampleType = getSampleType(/*input=*/true),
+				.outputSampleType = getSampleType(/*input=*/false),
+				.inputDevices = getAggregatorDevices(inputDevices, /*dither=*/false),
+				.outputDevices = getAggregatorDevices(outputDevices, flexASIO.config.output.dither),
+				.sampleRate = sampleRate,
+				.framesPerBuffer = size_t(bufferSizeInFrames),
+				.safetyMarginFrames = size_t(bufferSizeInFrames),
+				.downstreamCallback = &Engine::StreamCallback,
+				.downstreamUserData = &engine,
+				.lockMemory = flexASIO.config.lockMemory,
+			});
+		}()),
+		streamWithExclusivity(flexASIO.WithStreamParameters(
+			engine.HasInputBuffers() && !splitDuplex ? std::optional(GetMasterStreamDevice(/*input=*/true)) : std::nullopt,
+			engine.HasOutputBuffers() ? std::optional(GetMasterStreamDevice(/*input=*/false)) : std::nullopt,
+			sampleRate, GetDefaultSuggestedLatency(bufferSizeInFrames, sampleRate),
 			[&](const StreamParameters& streamParameters, StreamExclusivity streamExclusivity) {
 				return StreamWithExclusivity{
-					.stream = flexASIO.OpenStream(streamParameters, static_cast<unsigned long>(bufferSizeInFrames), &PreparedState::StreamCallback, this),
+					.stream = aggregator.has_value() ?
+						flexASIO.OpenStream(streamParameters, static_cast<unsigned long>(bufferSizeInFrames), &Aggregator::MasterStreamCallback, &*aggregator) :
+						flexASIO.OpenStream(streamParameters, static_cast<unsigned long>(bufferSizeInFrames), &Engine::StreamCallback, &engine),
 					.exclusivity = streamExclusivity,
 				};
 			})),
-		configWatcher(flexASIO.configLoader, [this] { OnConfigChange(); }) {
-		if (callbacks->asioMessage) ProbeHostMessages(callbacks->asioMessage);
+		aggregatedInputStreams(OpenAggregatedStreams(/*input=*/true, sampleRate, bufferSizeInFrames)),
+		aggregatedOutputStreams(OpenAggregatedStreams(/*input=*/false, sampleRate, bufferSizeInFrames)),
+		configWatcher(flexASIO.startupTimeline.Measure("ConfigWatcher", [&] { return ConfigWatcher(flexASIO.configLoader, [this](const Config& newConfig) { OnConfigChange(newConfig); }); })) {
+		if (callbacks->asioMessage) flexASIO.startupTimeline.Measure("ProbeHostMessages", [&] { ProbeHostMessages(callbacks->asioMessage); });
+
+		if (aggregator.has_value()) {
+			const auto getLatencies = [&](const std::vector<StreamWithExclusivity>& streams, bool output) {
+				std::vector<size_t> latencies;
+				for (const auto& stream : streams) latencies.push_back(size_t(flexASIO.ComputeLatencyFromStream(stream.stream.get(), output, engine.GetBufferSizeInFrames())));
+				return latencies;
+			};
+			const auto getMasterLatency = [&](bool output) -> std::optional<size_t> {
+				if (!(output ? engine.HasOutputBuffers() : engine.HasInputBuffers() && !splitDuplex)) return std::nullopt;
+				return size_t(flexASIO.ComputeLatencyFromStream(streamWithExclusivity.stream.get(), output, engine.GetBufferSizeInFrames()));
+			};
+			aggregator->AlignLatencies(
+				getMasterLatency(/*output=*/false), getMasterLatency(/*output=*/true),
+				getLatencies(aggregatedInputStreams, /*output=*/false), getLatencies(aggregatedOutputStreams, /*output=*/true));
+		}
+
+		if (!flexASIO.inputMonitors.empty()) SetInputMonitors(flexASIO.GetInputMonitors());
+	}
+
+	int FlexASIO::PreparedState::GetMasterChannelCount(bool input, const ASIOBufferInfo* asioBufferInfos, long numChannels) const {
+		const auto channelCount = input ? flexASIO.GetMasterInputChannelCount() : flexASIO.GetMasterOutputChannelCount();
+		const auto& streamConfig = input ? flexASIO.config.input : flexASIO.config.output;
+		if (!streamConfig.trimInactiveChannels) return channelCount;
+		if (!(input ? flexASIO.additionalInputDevices : flexASIO.additionalOutputDevices).empty()) {
+			Log() << "Not trimming inactive " << (input ? "input" : "output") << " channels because several devices are aggregated";
+			return channelCount;
+		}
+
+		// PortAudio always opens the first N channels of a device, so the smallest stream that covers all the channels we
+		// need is the one that ends with the last of them.
+		const auto isChannelActive = [&](long channel) {
+			for (long channelIndex = 0; channelIndex < numChannels; ++channelIndex)
+				if (!!asioBufferInfos[channelIndex].isInput == input && asioBufferInfos[channelIndex].channelNum == channel) return true;
+			return false;
+		};
+		int trimmedChannelCount = 0;
+		for (long channelIndex = 0; channelIndex < numChannels; ++channelIndex)
+			if (!!asioBufferInfos[channelIndex].isInput == input)
+				trimmedChannelCount = (std::max)(trimmedChannelCount, int(asioBufferInfos[channelIndex].channelNum) + 1);
+		// Routes involving inactive ASIO channels are dropped by the Engine, so their device channels are not needed.
+		if (streamConfig.routing.has_value())
+			for (const auto& route : *streamConfig.routing)
+				if (isChannelActive(route.asioChannel))
+					trimmedChannelCount = (std::max)(trimmedChannelCount, route.deviceChannel + 1);
+		trimmedChannelCount = (std::min)(trimmedChannelCount, channelCount);
+		Log() << "Trimming " << (input ? "input" : "output") << " stream to " << trimmedChannelCount << " channels out of " << channelCount;
+		return trimmedChannelCount;
+	}
+
+	FlexASIO::StreamDevice FlexASIO::PreparedState::GetMasterStreamDevice(bool input) const {
+		auto streamDevice = flexASIO.GetMasterStreamDevice(input);
+		const auto channelCount = input ? masterInputChannelCount : masterOutputChannelCount;
+		if (channelCount != streamDevice.channelCount) {
+			streamDevice.channelCount = channelCount;
+			streamDevice.channelMask = TrimChannelMask(streamDevice.channelMask, channelCount);
+		}
+		return streamDevice;
 	}
 
-	bool FlexASIO::PreparedState::IsChannelActive(bool isInput, long channel) const {
-		for (const auto& buffersInfo : bufferInfos)
-			if (!!buffersInfo.isInput == !!isInput && buffersInfo.channelNum == channel)
-				return true;
-		return false;
+	std::vector<FlexASIO::StreamDevice> FlexASIO::PreparedState::GetAggregatedDevices(bool input) const {
+		if (!(input ? engine.HasInputBuffers() : engine.HasOutputBuffers())) return {};
+		std::vector<StreamDevice> streamDevices;
+		if (input && splitDuplex) streamDevices.push_back(GetMasterStreamDevice(/*input=*/true));
+		const auto& additionalDevices = input ? flexASIO.additionalInputDevices : flexASIO.additionalOutputDevices;
+		streamDevices.insert(streamDevices.end(), additionalDevices.begin(), additionalDevices.end());
+		return streamDevices;
+	}
+
+	std::vector<FlexASIO::PreparedState::StreamWithExclusivity> FlexASIO::PreparedState::OpenAggregatedStreams(bool input, ASIOSampleRate sampleRate, long bufferSizeInFrames) {
+		std::vector<StreamWithExclusivity> streams;
+		if (!aggregator.has_value()) return streams;
+		const auto streamDevices = GetAggregatedDevices(input);
+		for (size_t deviceIndex = 0; deviceIndex < streamDevices.size(); ++deviceIndex) {
+			Log() << "Opening " << (input ? "input" : "output") << " stream for aggregated device " << streamDevices[deviceIndex].device;
+			streams.push_back(flexASIO.WithStreamParameters(
+				input ? std::optional(streamDevices[deviceIndex]) : std::nullopt, input ? std::nullopt : std::optional(streamDevices[deviceIndex]),
+				sampleRate, GetDefaultSuggestedLatency(bufferSizeInFrames, sampleRate),
+				[&](const StreamParameters& streamParameters, StreamExclusivity streamExclusivity) {
+					return StreamWithExclusivity{
+						.stream = flexASIO.OpenStream(streamParameters, static_cast<unsigned long>(bufferSizeInFrames), &Aggregator::DeviceStreamCallback,
+							input ? aggregator->GetInputDeviceUserData(deviceIndex) : aggregator->GetOutputDeviceUserData(deviceIndex)),
+						.exclusivity = streamExclusivity,
+					};
+				}));
+		}
+		return streams;
 	}
 
 	void FlexASIO::DisposeBuffers()
@@ -821,14 +1142,18 @@ namespace flexasio {
 		return latencyInFrames;
 	}
 
-	long FlexASIO::ComputeLatencyFromStream(PaStream* stream, bool output, size_t bufferSizeInFrames) const
+	PaTime FlexASIO::GetStreamLatency(PaStream* stream, bool output) const
 	{
 		const PaStreamInfo* stream_info = Pa_GetStreamInfo(stream);
 		if (!stream_info) throw ASIOException(ASE_HWMalfunction, "unable to get stream info");
+		return output ? stream_info->outputLatency : stream_info->inputLatency;
+	}
 
+	long FlexASIO::ComputeLatencyFromStream(PaStream* stream, bool output, size_t bufferSizeInFrames) const
+	{
 		// See https://github.com/dechamps/FlexASIO/issues/10.
 		// The latency that PortAudio reports appears to take the buffer size into account already.
-		return ComputeLatency(long((output ? stream_info->outputLatency : stream_info->inputLatency) * sampleRate), output, bufferSizeInFrames);
+		return ComputeLatency(long(GetStreamLatency(stream, output) * sampleRate), output, bufferSizeInFrames);
 	}
 
 	void FlexASIO::GetLatencies(long* inputLatency, long* outputLatency) {
@@ -854,7 +1179,11 @@ namespace flexasio {
 				return WithStreamParameters(
 					/*inputEnabled=*/!output, /*outputEnabled=*/output, sampleRate, GetDefaultSuggestedLatency(bufferSize, sampleRate),
 					[&](const StreamParameters& streamParameters, StreamExclusivity) {
-						return ComputeLatencyFromStream(OpenStream(streamParameters, bufferSize, NoOpStreamCallback, nullptr).get(), output, bufferSize);
+						// Opening a stream can take a long time, so the result is remembered across driver instances.
+						const auto latency = probeCache.GetStreamLatency(streamParameters, bufferSize, output, [&] {
+							return GetStreamLatency(OpenStream(streamParameters, bufferSize, NoOpStreamCallback, nullptr).get(), output);
+						});
+						return ComputeLatency(long(latency * sampleRate), output, bufferSize);
 					});
 			};
 
@@ -884,55 +1213,56 @@ namespace flexasio {
 		Log() << "Returning input latency of " << *inputLatency << " samples and output latency of " << *outputLatency << " samples";
 	}
 
+	FlexASIO::StreamExclusivity FlexASIO::PreparedState::GetStreamExclusivity() const {
+		for (const auto& streams : { &aggregatedInputStreams, &aggregatedOutputStreams })
+			for (const auto& stream : *streams)
+				if (stream.exclusivity == StreamExclusivity::EXCLUSIVE) return StreamExclusivity::EXCLUSIVE;
+		return streamWithExclusivity.exclusivity;
+	}
+
 	void FlexASIO::PreparedState::GetLatencies(long* inputLatency, long* outputLatency)
 	{
-		*inputLatency = flexASIO.ComputeLatencyFromStream(streamWithExclusivity.stream.get(), /*output=*/false, buffers.bufferSizeInFrames);
-		*outputLatency = flexASIO.ComputeLatencyFromStream(streamWithExclusivity.stream.get(), /*output=*/true, buffers.bufferSizeInFrames);
+		*inputLatency = GetLatency(/*output=*/false);
+		*outputLatency = GetLatency(/*output=*/true);
+	}
+
+	long FlexASIO::PreparedState::GetLatency(bool output) const {
+		// Latencies of aggregated devices have been aligned, but the master device cannot be delayed, so report the worst.
+		auto latency = flexASIO.ComputeLatencyFromStream(streamWithExclusivity.stream.get(), output, engine.GetBufferSizeInFrames());
+		const auto& aggregatedStreams = output ? aggregatedOutputStreams : aggregatedInputStreams;
+		for (size_t deviceIndex = 0; deviceIndex < aggregatedStreams.size(); ++deviceIndex) {
+			const auto queueLatency = long((output ? aggregator->GetOutputDeviceQueue(deviceIndex) : aggregator->GetInputDeviceQueue(deviceIndex)).GetLatencyInFrames());
+			Log() << queueLatency << " samples added to " << (output ? "output" : "input") << " latency of aggregated device " << deviceIndex << " due to queueing";
+			latency = (std::max)(latency, flexASIO.ComputeLatencyFromStream(aggregatedStreams[deviceIndex].stream.get(), output, engine.GetBufferSizeInFrames()) + queueLatency);
+		}
+		return latency;
 	}
 
 	void FlexASIO::Start() {
 		if (!preparedState.has_value()) throw ASIOException(ASE_InvalidMode, "start() called before createBuffers()");
-		return preparedState->Start();
+		startupTimeline.Measure("StartStream", [&] { preparedState->Start(); });
+		startupTimeline.Finish(GetStartupTraceEventPath());
 	}
 
 	void FlexASIO::PreparedState::Start()
 	{
 		if (runningState.has_value()) throw ASIOException(ASE_InvalidMode, "start() called twice");
 		runningState.emplace(*this);
-		runningState->Start();
 	}
 
-	FlexASIO::PreparedState::RunningState::RunningState(PreparedState& preparedState) :
-		preparedState(preparedState),
-		host_supports_timeinfo([&] {
-		Log() << "Checking if the host supports time info";
-		const bool result = preparedState.callbacks.asioMessage &&
-			Message(preparedState.callbacks.asioMessage, kAsioSelectorSupported, kAsioSupportsTimeInfo, NULL, NULL) == 1 &&
-			Message(preparedState.callbacks.asioMessage, kAsioSupportsTimeInfo, 0, NULL, NULL) == 1;
-		Log() << "The host " << (result ? "supports" : "does not support") << " time info";
-		return result;
-	}()),
-		outputReadyState([&]() -> std::optional<std::atomic<OutputReadyState>> {
-		if (preparedState.flexASIO.hostSupportsOutputReady) return OutputReadyState::READY; else return std::nullopt;
-	}()) {}
-
-	FlexASIO::PreparedState::RunningState::~RunningState() {
-		if (outputReadyState.has_value()) {
-			auto& outputReady = *outputReadyState;
-			// Some applications (e.g. Max) will call stop() without calling outputReady() for the last bufferSwitch().
-			// In this situation, make sure we don't hang forever waiting for that outputReady() call.
-			// See https://github.com/dechamps/FlexASIO/issues/235
-			// 
-			// Note this code assumes that an application calls outputReady() *before* calling stop(), or that it calls
-			// it from within bufferSwitch(). If an application calls outputReady() after returning from bufferSwitch()
-			// *and* after calling stop(), then outputReady() will sadly race against RunningState teardown.
-			outputReady = OutputReadyState::STOPPING;
-			outputReady.notify_all();
+	FlexASIO::PreparedState::RunningState::RunningState(PreparedState& preparedState) : preparedState(preparedState) {
+		if (preparedState.aggregator.has_value()) {
+			preparedState.aggregator->Start(win32HighResolutionTimer);
+			// Start aggregated devices first, so that input is already queued by the time the master stream asks for it.
+			for (const auto& streams : { &preparedState.aggregatedInputStreams, &preparedState.aggregatedOutputStreams })
+				for (const auto& stream : *streams)
+					activeDeviceStreams.push_back(StartStream(stream.stream.get()));
 		}
+		preparedState.engine.Start(preparedState.streamWithExclusivity.stream.get(), win32HighResolutionTimer, preparedState.flexASIO.hostSupportsOutputReady);
 	}
 
-	void FlexASIO::PreparedState::RunningState::RunningState::Start() {
-		activeStream = StartStream(preparedState.streamWithExclusivity.stream.get());
+	FlexASIO::PreparedState::RunningState::~RunningState() {
+		preparedState.engine.Stop();
 	}
 
 	void FlexASIO::Stop() {
@@ -946,27 +1276,19 @@ namespace flexasio {
 		runningState.reset();
 	}
 
-	int FlexASIO::PreparedState::StreamCallback(const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags, void *userData) throw() {
-		if (IsLoggingEnabled()) Log() << "--- ENTERING STREAM CALLBACK";
-		PaStreamCallbackResult result = paContinue;
-		try {
-			auto& preparedState = *static_cast<PreparedState*>(userData);
-			if (!preparedState.runningState.has_value()) {
-				throw std::runtime_error("PortAudio stream callback fired in non-started state");
+	void FlexASIO::PreparedState::OnConfigChange(const Config& newConfig) {
+		// Note that flexASIO.config is the config the stream was set up with, not the last config seen by the watcher.
+		if (IsLiveConfigChange(flexASIO.config, newConfig)) {
+			Log() << "Config change does not affect stream parameters, applying it without a reset";
+			try {
+				engine.SetLiveOptions(flexASIO.GetEngineLiveOptions(newConfig));
+				return;
+			}
+			catch (const std::exception& exception) {
+				Log() << "Unable to apply config change without a reset: " << ::dechamps_cpputil::GetNestedExceptionMessage(exception);
 			}
-			result = preparedState.runningState->StreamCallback(input, output, frameCount, timeInfo, statusFlags);
-		}
-		catch (const std::exception& exception) {
-			if (IsLoggingEnabled()) Log() << "Caught exception in stream callback: " << exception.what();
-		}
-		catch (...) {
-			if (IsLoggingEnabled()) Log() << "Caught unknown exception in stream callback";
 		}
-		if (IsLoggingEnabled()) Log() << "--- EXITING STREAM CALLBACK (" << GetPaStreamCallbackResultString(result) << ")";
-		return result;
-	}
 
-	void FlexASIO::PreparedState::OnConfigChange() {
 		Log() << "Issuing reset request due to config change";
 		try {
 			RequestReset();
@@ -976,94 +1298,6 @@ namespace flexasio {
 		}
 	}
 
-	PaStreamCallbackResult FlexASIO::PreparedState::RunningState::StreamCallback(const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags)
-	{
-		auto currentSamplePosition = samplePosition.load();
-		currentSamplePosition.timestamp = ::dechamps_ASIOUtil::Int64ToASIO<ASIOTimeStamp>(((long long int) win32HighResolutionTimer.GetTimeMilliseconds()) * 1000000);
-		if (state == State::STEADYSTATE) currentSamplePosition.samples = ::dechamps_ASIOUtil::Int64ToASIO<ASIOSamples>(::dechamps_ASIOUtil::ASIOToInt64(currentSamplePosition.samples) + frameCount);
-		samplePosition.store(currentSamplePosition);
-		if (IsLoggingEnabled()) Log() << "Updated sample position: timestamp " << ::dechamps_ASIOUtil::ASIOToInt64(currentSamplePosition.timestamp) << ", " << ::dechamps_ASIOUtil::ASIOToInt64(currentSamplePosition.samples) << " samples";
-
-		if (IsLoggingEnabled()) Log() << "PortAudio stream callback with input " << input << ", output "
-			<< output << ", "
-			<< frameCount << " frames, time info ("
-			<< (timeInfo == nullptr ? "none" : DescribeStreamCallbackTimeInfo(*timeInfo)) << "), flags "
-			<< GetStreamCallbackFlagsString(statusFlags);
-
-		if (frameCount != preparedState.buffers.bufferSizeInFrames)
-		{
-			if (IsLoggingEnabled()) Log() << "Expected " << preparedState.buffers.bufferSizeInFrames << " frames, got " << frameCount << " instead, aborting";
-			return paContinue;
-		}
-
-		if (statusFlags & paInputOverflow && IsLoggingEnabled())
-			Log() << "INPUT OVERFLOW detected (some input data was discarded)";
-		if (statusFlags & paInputUnderflow && IsLoggingEnabled())
-			Log() << "INPUT UNDERFLOW detected (gaps were inserted in the input)";
-		if (statusFlags & paOutputOverflow && IsLoggingEnabled())
-			Log() << "OUTPUT OVERFLOW detected (some output data was discarded)";
-		if (statusFlags & paOutputUnderflow && IsLoggingEnabled())
-			Log() << "OUTPUT UNDERFLOW detected (gaps were inserted in the output)";
-
-		const auto inputSampleSizeInBytes = preparedState.buffers.inputSampleSizeInBytes;
-		const auto outputSampleSizeInBytes = preparedState.buffers.outputSampleSizeInBytes;
-		const std::byte* const* input_samples = static_cast<const std::byte* const*> (input);
-		std::byte* const* output_samples = static_cast<std::byte* const*>(output);
-
-		if (output_samples) {
-			for (int output_channel_index = 0; output_channel_index < preparedState.flexASIO.GetOutputChannelCount(); ++output_channel_index)
-				memset(output_samples[output_channel_index], 0, frameCount * outputSampleSizeInBytes);
-		}
-
-		const auto outputReady = outputReadyState.has_value() ? &*outputReadyState : nullptr;
-
-		// See dechamps_ASIOUtil/BUFFERS.md for the gory details of how ASIO buffer management works.
-
-		if (state != State::PRIMING) {
-			if (IsLoggingEnabled()) Log() << "Transferring input buffers from PortAudio to ASIO buffer index #" << driverBufferIndex;
-			CopyFromPortAudioBuffers(preparedState.bufferInfos, driverBufferIndex, input_samples, frameCount * inputSampleSizeInBytes);
-
-			if (outputReady != nullptr) {
-				// Reset OutputReady, but only if we are not STOPPING, atomically.
-				auto outputReadyState = OutputReadyState::READY;
-				outputReady->compare_exchange_strong(outputReadyState, OutputReadyState::NOT_READY);
-			}
-			if (!host_supports_timeinfo)
-			{
-				if (IsLoggingEnabled()) Log() << "Firing ASIO bufferSwitch() callback with buffer index: " << driverBufferIndex;
-				preparedState.callbacks.bufferSwitch(driverBufferIndex, ASIOTrue);
-				if (IsLoggingEnabled()) Log() << "bufferSwitch() complete";
-			}
-			else
-			{
-				ASIOTime time = { 0 };
-				time.timeInfo.flags = kSystemTimeValid | kSamplePositionValid | kSampleRateValid;
-				time.timeInfo.samplePosition = currentSamplePosition.samples;
-				time.timeInfo.systemTime = currentSamplePosition.timestamp;
-				time.timeInfo.sampleRate = preparedState.sampleRate;
-				if (IsLoggingEnabled()) Log() << "Firing ASIO bufferSwitchTimeInfo() callback with buffer index: " << driverBufferIndex << ", time info: (" << ::dechamps_ASIOUtil::DescribeASIOTime(time) << ")";
-				const auto timeResult = preparedState.callbacks.bufferSwitchTimeInfo(&time, driverBufferIndex, ASIOTrue);
-				if (IsLoggingEnabled()) Log() << "bufferSwitchTimeInfo() complete, returned time info: " << (timeResult == nullptr ? "none" : ::dechamps_ASIOUtil::DescribeASIOTime(*timeResult));
-			}
-		}
-
-		if (outputReady == nullptr) {
-			driverBufferIndex = (driverBufferIndex + 1) % 2;
-		}
-		else if (*outputReady == OutputReadyState::NOT_READY) {
-			if (IsLoggingEnabled()) Log() << "Waiting for the ASIO Host Application to signal OutputReady or stop";
-			outputReady->wait(OutputReadyState::NOT_READY);
-		}
-
-		if (IsLoggingEnabled()) Log() << "Transferring output buffers from buffer index #" << driverBufferIndex << " to PortAudio";
-		CopyToPortAudioBuffers(preparedState.bufferInfos, driverBufferIndex, output_samples, frameCount * outputSampleSizeInBytes);
-
-		if (outputReadyState.has_value()) driverBufferIndex = (driverBufferIndex + 1) % 2;
-
-		if (state != State::STEADYSTATE) IncrementEnum(state);
-		return paContinue;
-	}
-
 	void FlexASIO::GetSamplePosition(ASIOSamples* sPos, ASIOTimeStamp* tStamp) {
 		if (!preparedState.has_value()) throw ASIOException(ASE_InvalidMode, "getSamplePosition() called before createBuffers()");
 		return preparedState->GetSamplePosition(sPos, tStamp);
@@ -1071,16 +1305,7 @@ namespace flexasio {
 
 	void FlexASIO::PreparedState::GetSamplePosition(ASIOSamples* sPos, ASIOTimeStamp* tStamp)
 	{
-		if (!runningState.has_value()) throw ASIOException(ASE_InvalidMode, "getSamplePosition() called before start()");
-		return runningState->GetSamplePosition(sPos, tStamp);
-	}
-
-	void FlexASIO::PreparedState::RunningState::GetSamplePosition(ASIOSamples* sPos, ASIOTimeStamp* tStamp) const
-	{
-		const auto currentSamplePosition = samplePosition.load();
-		*sPos = currentSamplePosition.samples;
-		*tStamp = currentSamplePosition.timestamp;
-		if (IsLoggingEnabled()) Log() << "Returning: sample position " << ::dechamps_ASIOUtil::ASIOToInt64(*sPos) << ", timestamp " << ::dechamps_ASIOUtil::ASIOToInt64(*tStamp);
+		return engine.GetSamplePosition(sPos, tStamp);
 	}
 
 	void FlexASIO::OutputReady() {
@@ -1092,32 +1317,7 @@ namespace flexasio {
 	}
 
 	void FlexASIO::PreparedState::OutputReady() {
-		if (runningState.has_value()) runningState->OutputReady();
-	}
-
-	void FlexASIO::PreparedState::RunningState::OutputReady() {
-		if (!outputReadyState.has_value()) {
-			if (IsLoggingEnabled()) Log() << "Received OutputReady signal, but the ASIO Host Application did not advertise support for OutputReady!";
-			return;
-		}
-
-		auto& outputReady = *outputReadyState;
-		auto outputReadyState = OutputReadyState::NOT_READY;
-		if (outputReady.compare_exchange_strong(outputReadyState, OutputReadyState::READY)) {
-			if (IsLoggingEnabled()) Log() << "Successfully set OutputReady";
-			outputReady.notify_all();
-			return;
-		}
-
-		switch (outputReadyState) {
-			case OutputReadyState::NOT_READY: abort();
-			case OutputReadyState::READY:
-				if (IsLoggingEnabled()) Log() << "Received redundant OutputReady signal!";
-				break;
-			case OutputReadyState::STOPPING:
-				if (IsLoggingEnabled()) Log() << "Ignoring OutputReady signal because we are currently stopping";
-				break;
-		}		
+		engine.OutputReady();
 	}
 
 	void FlexASIO::PreparedState::RequestReset() {
@@ -1130,5 +1330,80 @@ namespace flexasio {
 		return OpenControlPanel(windowHandle);
 	}
 
+	void FlexASIO::Future(long selector, void* opt) {
+		switch (selector) {
+		case kAsioCanInputMeter:
+		case kAsioCanOutputMeter:
+			return;
+		case kAsioCanInputMonitor:
+			if (!CanMonitorInputs()) break;
+			return;
+		case kAsioSetInputMonitor:
+			if (opt == nullptr) throw ASIOException(ASE_InvalidParameter, "null input monitor");
+			return SetInputMonitor(*static_cast<const ASIOInputMonitor*>(opt));
+		case kAsioGetInputMeter:
+		case kAsioGetOutputMeter:
+			if (opt == nullptr) throw ASIOException(ASE_InvalidParameter, "null channel controls");
+			return GetMeter(selector == kAsioGetInputMeter, *static_cast<ASIOChannelControls*>(opt));
+		}
+		throw ASIOException(ASE_InvalidParameter, "future() selector is not supported");
+	}
+
+	void FlexASIO::GetMeter(bool isInput, ASIOChannelControls& channelControls) {
+		if (!preparedState.has_value()) throw ASIOException(ASE_InvalidMode, "meter requested before createBuffers()");
+		const auto level = preparedState->GetLevel(isInput, channelControls.channel);
+		if (!level.has_value()) throw ASIOException(ASE_InvalidParameter, "meter requested for a channel that is not active");
+		const auto value = preparedState->GetMeterType(isInput) == Engine::LiveOptions::MeterType::RMS ? level->rms : level->peak;
+		// ASIO meters range from 0 to 0x7fffffff (full scale).
+		channelControls.meter = value >= 1 ? 0x7fffffff : value > 0 ? long(double(value) * 0x7fffffff) : 0;
+		if (IsLoggingEnabled()) Log() << "Returning " << (isInput ? "input" : "output") << " channel " << channelControls.channel << " level: peak " << level->peak << ", RMS " << level->rms;
+	}
+
+	bool FlexASIO::CanMonitorInputs() const {
+		// Input monitoring mixes samples in the PortAudio streams, assuming that stream channels are ASIO channels.
+		if (config.input.routing.has_value() || config.output.routing.has_value() || config.input.trimInactiveChannels || config.output.trimInactiveChannels) return false;
+		// What matters is the sample type of the streams.
+		const auto isFloat32 = [](const std::optional<SampleType>& sampleType, const std::optional<SampleType>& deviceSampleType) {
+			const auto& streamSampleType = deviceSampleType.has_value() ? deviceSampleType : sampleType;
+			return streamSampleType.has_value() && streamSampleType->asio == ASIOSTFloat32LSB;
+		};
+		return isFloat32(inputSampleType, inputDeviceSampleType) && isFloat32(outputSampleType, outputDeviceSampleType);
+	}
+
+	void FlexASIO::SetInputMonitor(const ASIOInputMonitor& inputMonitor) {
+		Log() << "Setting input monitor: input " << inputMonitor.input << ", output " << inputMonitor.output << ", gain " << inputMonitor.gain << ", state " << inputMonitor.state << ", pan " << inputMonitor.pan;
+		if (!CanMonitorInputs()) throw ASIOException(ASE_InvalidMode, "input monitoring requires Float32 samples in both directions, and no routing or channel trimming");
+		if (inputMonitor.input < -1 || inputMonitor.input >= GetInputChannelCount())
+			throw ASIOException(ASE_InvalidParameter, "out of bounds input channel for input monitoring");
+		if (inputMonitor.state && (inputMonitor.output < 0 || inputMonitor.output >= GetOutputChannelCount()))
+			throw ASIOException(ASE_InvalidParameter, "out of bounds output channel for input monitoring");
+
+		// The ASIO gain ranges from -inf (0) to +12 dB (0x7fffffff), which puts unity gain at 0x20000000.
+		const auto gain = float(double((std::max)(inputMonitor.gain, 0L)) / 0x20000000);
+		const auto pan = float(double((std::max)(inputMonitor.pan, 0L)) / 0x7fffffff);
+		// -1 means all input channels.
+		const long firstInputChannel = inputMonitor.input == -1 ? 0 : inputMonitor.input;
+		const long endInputChannel = inputMonitor.input == -1 ? GetInputChannelCount() : inputMonitor.input + 1;
+		for (auto inputChannel = firstInputChannel; inputChannel < endInputChannel; ++inputChannel) {
+			if (inputMonitor.state) inputMonitors.insert_or_assign(inputChannel, Engine::InputMonitor{ .inputChannel = int(inputChannel), .outputChannel = int(inputMonitor.output), .gain = gain, .pan = pan });
+			else inputMonitors.erase(inputChannel);
+		}
+		if (preparedState.has_value()) preparedState->SetInputMonitors(GetInputMonitors());
+	}
+
+	std::vector<Engine::InputMonitor> FlexASIO::GetInputMonitors() const {
+		std::vector<Engine::InputMonitor> result;
+		for (const auto& [inputChannel, inputMonitor] : inputMonitors) result.push_back(inputMonitor);
+		return result;
+	}
+
+	void FlexASIO::PreparedState::SetInputMonitors(std::vector<Engine::InputMonitor> inputMonitors) {
+		if (!engine.CanMonitorInputs()) {
+			if (!inputMonitors.empty()) Log() << "Input monitoring is unavailable because the ASIO host application did not create both input and output buffers";
+			return;
+		}
+		engine.SetInputMonitors(std::move(inputMonitors));
+	}
+
 }
 
@@ -1,6 +1,13 @@
 #pragma once
 
+#include "aggregator.h"
 #include "config.h"
+#include "config_watcher.h"
+#include "device_cache.h"
+#include "engine.h"
+#include "log.h"
+#include "probe_cache.h"
+#include "startup_timeline.h"
 
 #include "portaudio.h"
 #include "../FlexASIOUtil/portaudio.h"
@@ -12,23 +19,14 @@
 
 #include <windows.h>
 
-#include <atomic>
+#include <cstdint>
+#include <map>
 #include <optional>
-#include <stdexcept>
 #include <mutex>
 #include <vector>
 
 namespace flexasio {
 
-	class ASIOException : public std::runtime_error {
-	public:
-		template <typename... Args> ASIOException(ASIOError asioError, Args&&... args) : asioError(asioError), std::runtime_error(std::forward<Args>(args)...) {}
-		ASIOError GetASIOError() const { return asioError; }
-
-	private:
-		ASIOError asioError;
-	};
-
 	class FlexASIO final {
 	public:
 		FlexASIO(void* sysHandle);
@@ -50,6 +48,8 @@ namespace flexasio {
 		void OutputReady();
 
 		void ControlPanel();
+		// Throws ASE_InvalidParameter if the selector is not supported.
+		void Future(long selector, void* opt);
 
 	private:
 		struct SampleType {
@@ -61,21 +61,53 @@ namespace flexasio {
 
 		enum class StreamExclusivity { SHARED, EXCLUSIVE };
 
+		// One direction of a PortAudio stream.
+		struct StreamDevice final {
+			Device device;
+			int channelCount;
+			// Sample type of the PortAudio stream, which is not necessarily the ASIO sample type.
+			SampleType sampleType;
+			DWORD channelMask;
+		};
+
+		// PortAudio initialization is shared between the FlexASIO instances of a process. The first instance only
+		// initializes the host API it needs, if it knows which one that is. PortAudio cannot bring up another host API
+		// without being terminated first, which would pull the rug from under the other instances; an instance that needs
+		// another host API therefore fails with ASE_NotPresent, and PortAudio is initialized with all host APIs once the
+		// other instances are gone.
 		class PortAudioHandle {
 		public:
-			PortAudioHandle();
+			// If `hostApiTypeId` is nullopt, all host APIs are initialized.
+			explicit PortAudioHandle(std::optional<PaHostApiTypeId> hostApiTypeId);
 			PortAudioHandle(const PortAudioHandle&) = delete;
 			PortAudioHandle(const PortAudioHandle&&) = delete;
 			~PortAudioHandle();
+
+		private:
+			struct Shared final {
+				std::mutex mutex;
+				size_t referenceCount = 0;
+				// The only host API PortAudio was initialized with, or nullopt if all of them were initialized.
+				std::optional<PaHostApiTypeId> hostApiTypeId;
+				// Set once an instance did not get the host API it needed.
+				bool initializeAllHostApis = false;
+			};
+			static Shared shared;
 		};
 
-		class Win32HighResolutionTimer {
+		// ASIO timestamps are expected to be in the timeGetTime() timebase. This clock has the same epoch, but nanosecond
+		// resolution.
+		class Win32HighResolutionTimer final : public Clock {
 		public:
 			Win32HighResolutionTimer();
 			Win32HighResolutionTimer(const Win32HighResolutionTimer&) = delete;
 			Win32HighResolutionTimer(Win32HighResolutionTimer&&) = delete;
 			~Win32HighResolutionTimer();
-			DWORD GetTimeMilliseconds() const;
+			int64_t GetTimeNanoseconds() const override;
+
+		private:
+			const SteadyClock steadyClock;
+			int64_t steadyClockOffsetNanoseconds;
 		};
 
 		class PreparedState {
@@ -84,9 +116,12 @@ namespace flexasio {
 			PreparedState(const PreparedState&) = delete;
 			PreparedState(PreparedState&&) = delete;
 
-			StreamExclusivity GetStreamExclusivity() const { return streamWithExclusivity.exclusivity;  }
+			StreamExclusivity GetStreamExclusivity() const;
 
-			bool IsChannelActive(bool isInput, long channel) const;
+			bool IsChannelActive(bool isInput, long channel) const { return engine.IsChannelActive(isInput, channel); }
+			std::optional<LevelMeter::Level> GetLevel(bool isInput, long channel) { return engine.GetLevel(isInput, channel); }
+			Engine::LiveOptions::MeterType GetMeterType(bool isInput) const { return engine.GetMeterType(isInput); }
+			void SetInputMonitors(std::vector<Engine::InputMonitor> inputMonitors);
 
 			void GetLatencies(long* inputLatency, long* outputLatency);
 			void Start();
@@ -98,90 +133,54 @@ namespace flexasio {
 			void RequestReset();
 
 		private:
-			struct Buffers
-			{
-				Buffers(size_t bufferSetCount, size_t inputChannelCount, size_t outputChannelCount, size_t bufferSizeInFrames, size_t inputSampleSizeInBytes, size_t outputSampleSizeInBytes);
-				~Buffers();
-				std::byte* GetInputBuffer(size_t bufferSetIndex, size_t channelIndex) { return buffers.data() + bufferSetIndex * GetBufferSetSizeInBytes() + channelIndex * GetInputBufferSizeInBytes(); }
-				std::byte* GetOutputBuffer(size_t bufferSetIndex, size_t channelIndex) { return GetInputBuffer(bufferSetIndex, inputChannelCount) + channelIndex * GetOutputBufferSizeInBytes(); }
-				size_t GetBufferSetSizeInBytes() const { return buffers.size() / bufferSetCount; }
-				size_t GetInputBufferSizeInBytes() const { if (buffers.empty()) return 0; return bufferSizeInFrames * inputSampleSizeInBytes; }
-				size_t GetOutputBufferSizeInBytes() const { if (buffers.empty()) return 0; return bufferSizeInFrames * outputSampleSizeInBytes; }
-
-				const size_t bufferSetCount;
-				const size_t inputChannelCount;
-				const size_t outputChannelCount;
-				const size_t bufferSizeInFrames;
-				const size_t inputSampleSizeInBytes;
-				const size_t outputSampleSizeInBytes;
-
-				// This is a giant buffer containing all ASIO buffers. It is organized as follows:
-				// [ input channel 0 buffer 0 ] [ input channel 1 buffer 0 ] ... [ input channel N buffer 0 ] [ output channel 0 buffer 0 ] [ output channel 1 buffer 0 ] .. [ output channel N buffer 0 ]
-				// [ input channel 0 buffer 1 ] [ input channel 1 buffer 1 ] ... [ input channel N buffer 1 ] [ output channel 0 buffer 1 ] [ output channel 1 buffer 1 ] .. [ output channel N buffer 1 ]
-				// The reason why this is a giant blob is to slightly improve performance by (theroretically) improving memory locality.
-				std::vector<std::byte> buffers;
-			};
-
+			// Holds the Windows-specific resources that are only needed while the engine is running.
 			class RunningState {
 			public:
 				RunningState(PreparedState& preparedState);
 				~RunningState();
 
-				// Note: the reason why this is not done in the constructor is to allow `PreparedState::Start()`
-				// to properly set `PreparedState::runningState` before callbacks start flying. This is because
-				// the ASIO host application may decide to call GetSamplePosition() or OutputReady() as soon
-				// as bufferSwitch() is called without waiting for Start() to return - we don't want these calls
-				// to race with `PreparedState::Start()` constructing `PreparedState::runningState`.
-				void Start();
-
-				void GetSamplePosition(ASIOSamples* sPos, ASIOTimeStamp* tStamp) const;
-				void OutputReady();
-
-				PaStreamCallbackResult StreamCallback(const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags);
-
 			private:
-				enum class State { PRIMING, PRIMED, STEADYSTATE };
-
-				struct SamplePosition {
-					ASIOSamples samples = { 0 };
-					ASIOTimeStamp timestamp = { 0 };
-				};
-
 				PreparedState& preparedState;
-				const bool host_supports_timeinfo;
-				enum class OutputReadyState { NOT_READY, READY, STOPPING };
-				std::optional<std::atomic<OutputReadyState>> outputReadyState;
-				State state = outputReadyState.has_value() ? State::PRIMING : State::PRIMED;
-				// The index of the "unlocked" buffer (or "half-buffer", i.e. 0 or 1) that contains data not currently being processed by the ASIO host.
-				long driverBufferIndex = state == State::PRIMING ? 1 : 0;
-				std::atomic<SamplePosition> samplePosition;
-
 				Win32HighResolutionTimer win32HighResolutionTimer;
-				ActiveStream activeStream;
+				std::vector<ActiveStream> activeDeviceStreams;
 			};
 
-			static int StreamCallback(const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags, void *userData) throw();
+			struct StreamWithExclusivity final {
+				Stream stream;
+				StreamExclusivity exclusivity;
+			};
 
-			void OnConfigChange();
+			void OnConfigChange(const Config& newConfig);
+			// The number of channels the master device of the given direction is opened with, which can be lower than the
+			// ASIO channel count if the trimInactiveChannels option is enabled.
+			int GetMasterChannelCount(bool input, const ASIOBufferInfo* asioBufferInfos, long numChannels) const;
+			// Like FlexASIO::GetMasterStreamDevice(), but with the channel count from GetMasterChannelCount().
+			StreamDevice GetMasterStreamDevice(bool input) const;
+			// Devices that are not part of the main stream, and are aggregated with it through their own streams.
+			std::vector<StreamDevice> GetAggregatedDevices(bool input) const;
+			std::vector<StreamWithExclusivity> OpenAggregatedStreams(bool input, ASIOSampleRate sampleRate, long bufferSizeInFrames);
+			long GetLatency(bool output) const;
 
 			FlexASIO& flexASIO;
-			const ASIOSampleRate sampleRate;
 			const ASIOCallbacks callbacks;
 
-			// PortAudio buffer addresses are dynamic and are only valid for the duration of the stream callback.
-			// In contrast, ASIO buffer addresses are static and are valid for as long as the stream is running.
-			// Thus we need our own buffer on top of PortAudio's buffers. This doens't add any latency because buffers are copied immediately.
-			Buffers buffers;
-			const std::vector<ASIOBufferInfo> bufferInfos;
+			const int masterInputChannelCount;
+			const int masterOutputChannelCount;
+			Engine engine;
+			// Set if input and output are on different devices and the splitDuplex option is enabled. The main stream is then
+			// output-only, and the master input device is aggregated like additional input devices.
+			const bool splitDuplex;
+			// Only set if there are aggregated devices. The main stream then goes through the aggregator, whose master device
+			// is the one of the main stream.
+			std::optional<Aggregator> aggregator;
 
-			struct StreamWithExclusivity final {
-				Stream stream;
-				StreamExclusivity exclusivity;
-			};
 			const StreamWithExclusivity streamWithExclusivity;
+			// In the order of the aggregator devices.
+			const std::vector<StreamWithExclusivity> aggregatedInputStreams;
+			const std::vector<StreamWithExclusivity> aggregatedOutputStreams;
 
 			std::optional<RunningState> runningState;
-			ConfigLoader::Watcher configWatcher;
+			ConfigWatcher configWatcher;
 		};
 
 		static const SampleType float32;
@@ -191,12 +190,23 @@ namespace flexasio {
 		static const std::pair<std::string_view, SampleType> sampleTypes[];
 		static SampleType ParseSampleType(std::string_view str);
 		static SampleType WaveFormatToSampleType(const WAVEFORMATEXTENSIBLE& waveFormat);
-		static SampleType SelectSampleType(PaHostApiTypeId hostApiTypeId, const Device& device, const Config::Stream& streamConfig);
+		static SampleType SelectSampleType(PaHostApiTypeId hostApiTypeId, const DeviceCache::Entry& device, const Config::Stream& streamConfig);
 		static std::string DescribeSampleType(const SampleType&);
-		static DWORD SelectChannelMask(PaHostApiTypeId hostApiTypeId, const Device& device, const Config::Stream& streamConfig);
-
+		Engine::LiveOptions GetEngineLiveOptions(const Config&) const;
+		static std::optional<Engine::StreamFormat::Conversion> GetSampleConversion(const std::optional<SampleType>& sampleType, const std::optional<SampleType>& deviceSampleType, const Config::Stream& streamConfig);
+		void GetMeter(bool isInput, ASIOChannelControls& channelControls);
+		bool CanMonitorInputs() const;
+		void SetInputMonitor(const ASIOInputMonitor& inputMonitor);
+		std::vector<Engine::InputMonitor> GetInputMonitors() const;
+		static DWORD SelectChannelMask(PaHostApiTypeId hostApiTypeId, const DeviceCache::Entry& device, const std::optional<int>& configChannelCount);
+		std::vector<StreamDevice> SelectAdditionalDevices(bool input) const;
+
+		// Including additional devices.
 		int GetInputChannelCount() const;
 		int GetOutputChannelCount() const;
+		int GetMasterInputChannelCount() const;
+		int GetMasterOutputChannelCount() const;
+		StreamDevice GetMasterStreamDevice(bool input) const;
 
 		struct BufferSizes {
 			long minimum;
@@ -208,12 +218,19 @@ namespace flexasio {
 
 		long ComputeLatency(long latencyInFrames, bool output, size_t bufferSizeInFrames) const;
 		long ComputeLatencyFromStream(PaStream* stream, bool output, size_t bufferSizeInFrames) const;
+		PaTime GetStreamLatency(PaStream* stream, bool output) const;
 
 		template <typename Functor>
 		decltype(auto) WithStreamParameters(bool inputEnabled, bool outputEnabled, double sampleRate, PaTime suggestedLatency, Functor functor) const;
+		template <typename Functor>
+		decltype(auto) WithStreamParameters(const std::optional<StreamDevice>& input, const std::optional<StreamDevice>& output, double sampleRate, PaTime suggestedLatency, Functor functor) const;
 		Stream OpenStream(const StreamParameters&, unsigned long framesPerBuffer, PaStreamCallback callback, void* callbackUserData) const;
 
 		const HWND windowHandle = nullptr;
+		// Declared early so that the writer thread runs for as long as any other thread (e.g. PortAudio's) could log.
+		AsyncLogWriter asyncLogWriter;
+		// Mutable so that phases can be measured from const methods, e.g. OpenStream().
+		mutable StartupTimeline startupTimeline;
 		const ConfigLoader configLoader;
 		const Config& config = configLoader.Initial();
 
@@ -221,16 +238,28 @@ namespace flexasio {
 		PortAudioHandle portAudioHandle;
 
 		const HostApi hostApi;
+		const DeviceCache deviceCache;
+		// Not const, as it remembers results as they are probed.
+		ProbeCache probeCache;
 		const std::optional<Device> inputDevice;
 		const std::optional<Device> outputDevice;
 		const std::optional<SampleType> inputSampleType;
 		const std::optional<SampleType> outputSampleType;
+		// If set, PortAudio streams are opened with this sample type instead, and samples are converted by the Engine.
+		const std::optional<SampleType> inputDeviceSampleType;
+		const std::optional<SampleType> outputDeviceSampleType;
 		const DWORD inputChannelMask;
 		const DWORD outputChannelMask;
+		// Devices listed after the master device in the configuration, if any.
+		const std::vector<StreamDevice> additionalInputDevices;
+		const std::vector<StreamDevice> additionalOutputDevices;
 
 		ASIOSampleRate sampleRate = 0;
 		bool sampleRateWasAccessed = false;
 		bool hostSupportsOutputReady = false;
+		// Set through kAsioSetInputMonitor, keyed by input channel. Kept across createBuffers() calls, as ASIO host
+		// applications expect input monitoring to behave like a hardware setting.
+		std::map<long, Engine::InputMonitor> inputMonitors;
 
 		std::optional<PreparedState> preparedState;
 	};
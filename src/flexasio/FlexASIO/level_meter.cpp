@@ -0,0 +1,300 @@
+#include "level_meter.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "simd.h"
+
+#include "log.h"
+
+namespace flexasio {
+
+	namespace {
+
+		using Kernel = void (*)(const std::byte* samples, size_t frameCount, float* peak, double* sumOfSquares);
+
+		struct Kernels final {
+			Kernel float32;
+			Kernel int32;
+			Kernel int24;
+			Kernel int16;
+		};
+
+		// Vector kernels take care of whole vectors, and leave the remaining samples to the scalar kernel.
+		namespace scalar {
+
+			float LoadFloat32(const std::byte* sample) {
+				float value;
+				memcpy(&value, sample, sizeof(value));
+				return value;
+			}
+
+			float LoadInt32(const std::byte* sample) {
+				int32_t value;
+				memcpy(&value, sample, sizeof(value));
+				return float(value) * 0x1p-31f;
+			}
+
+			float LoadInt24(const std::byte* sample) {
+				const auto value = int32_t(uint32_t(sample[0]) << 8 | uint32_t(sample[1]) << 16 | uint32_t(sample[2]) << 24);
+				return float(value) * 0x1p-31f;
+			}
+
+			float LoadInt16(const std::byte* sample) {
+				int16_t value;
+				memcpy(&value, sample, sizeof(value));
+				return float(value) * 0x1p-15f;
+			}
+
+			template <size_t sampleSize, float (*load)(const std::byte*)>
+			void Measure(const std::byte* samples, size_t frameCount, float* peak, double* sumOfSquares) {
+				float blockPeak = 0;
+				float blockSumOfSquares = 0;
+				for (size_t frameIndex = 0; frameIndex < frameCount; ++frameIndex) {
+					const auto value = load(samples + frameIndex * sampleSize);
+					blockPeak = (std::max)(blockPeak, std::abs(value));
+					blockSumOfSquares += value * value;
+				}
+				*peak = blockPeak;
+				*sumOfSquares = blockSumOfSquares;
+			}
+
+			constexpr Kernels kernels = {
+				.float32 = Measure<4, LoadFloat32>,
+				.int32 = Measure<4, LoadInt32>,
+				.int24 = Measure<3, LoadInt24>,
+				.int16 = Measure<2, LoadInt16>,
+			};
+
+		}
+
+		// Folds the lanes of the vector accumulators into the result of the scalar kernel on the remaining samples.
+		template <size_t laneCount> void Fold(const float(&lanePeaks)[laneCount], const float(&laneSumsOfSquares)[laneCount], float* peak, double* sumOfSquares) {
+			for (size_t laneIndex = 0; laneIndex < laneCount; ++laneIndex) {
+				*peak = (std::max)(*peak, lanePeaks[laneIndex]);
+				*sumOfSquares += laneSumsOfSquares[laneIndex];
+			}
+		}
+
+#ifdef FLEXASIO_SIMD_SSE2
+		namespace sse2 {
+
+			__m128 LoadFloat32(const std::byte* samples) {
+				return _mm_loadu_ps(reinterpret_cast<const float*>(samples));
+			}
+
+			__m128 LoadInt32(const std::byte* samples) {
+				return _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples))), _mm_set1_ps(0x1p-31f));
+			}
+
+			__m128 LoadInt16(const std::byte* samples) {
+				const auto values = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(samples));
+				// Sign-extend to 32 bits.
+				return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(values, values), 16)), _mm_set1_ps(0x1p-15f));
+			}
+
+			template <size_t sampleSize, __m128 (*load)(const std::byte*), float (*loadScalar)(const std::byte*)>
+			void Measure(const std::byte* samples, size_t frameCount, float* peak, double* sumOfSquares) {
+				const auto absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+				auto peakVector = _mm_setzero_ps();
+				auto sumOfSquaresVector = _mm_setzero_ps();
+				size_t frameIndex = 0;
+				for (; frameIndex + 4 <= frameCount; frameIndex += 4) {
+					const auto values = load(samples + frameIndex * sampleSize);
+					peakVector = _mm_max_ps(peakVector, _mm_and_ps(values, absMask));
+					sumOfSquaresVector = _mm_add_ps(sumOfSquaresVector, _mm_mul_ps(values, values));
+				}
+				scalar::Measure<sampleSize, loadScalar>(samples + frameIndex * sampleSize, frameCount - frameIndex, peak, sumOfSquares);
+				float lanePeaks[4];
+				float laneSumsOfSquares[4];
+				_mm_storeu_ps(lanePeaks, peakVector);
+				_mm_storeu_ps(laneSumsOfSquares, sumOfSquaresVector);
+				Fold(lanePeaks, laneSumsOfSquares, peak, sumOfSquares);
+			}
+
+			constexpr Kernels kernels = {
+				.float32 = Measure<4, LoadFloat32, scalar::LoadFloat32>,
+				.int32 = Measure<4, LoadInt32, scalar::LoadInt32>,
+				.int24 = scalar::Measure<3, scalar::LoadInt24>,
+				.int16 = Measure<2, LoadInt16, scalar::LoadInt16>,
+			};
+
+		}
+#endif
+
+#ifdef FLEXASIO_SIMD_X86
+		namespace avx2 {
+
+			FLEXASIO_TARGET_AVX2 __m256 LoadFloat32(const std::byte* samples) {
+				return _mm256_loadu_ps(reinterpret_cast<const float*>(samples));
+			}
+
+			FLEXASIO_TARGET_AVX2 __m256 LoadInt32(const std::byte* samples) {
+				return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(samples))), _mm256_set1_ps(0x1p-31f));
+			}
+
+			FLEXASIO_TARGET_AVX2 __m256 LoadInt16(const std::byte* samples) {
+				return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples)))), _mm256_set1_ps(0x1p-15f));
+			}
+
+			template <size_t sampleSize, __m256 (*load)(const std::byte*), float (*loadScalar)(const std::byte*)>
+			FLEXASIO_TARGET_AVX2 void Measure(const std::byte* samples, size_t frameCount, float* peak, double* sumOfSquares) {
+				const auto absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+				auto peakVector = _mm256_setzero_ps();
+				auto sumOfSquaresVector = _mm256_setzero_ps();
+				size_t frameIndex = 0;
+				for (; frameIndex + 8 <= frameCount; frameIndex += 8) {
+					const auto values = load(samples + frameIndex * sampleSize);
+					peakVector = _mm256_max_ps(peakVector, _mm256_and_ps(values, absMask));
+					sumOfSquaresVector = _mm256_add_ps(sumOfSquaresVector, _mm256_mul_ps(values, values));
+				}
+				scalar::Measure<sampleSize, loadScalar>(samples + frameIndex * sampleSize, frameCount - frameIndex, peak, sumOfSquares);
+				float lanePeaks[8];
+				float laneSumsOfSquares[8];
+				_mm256_storeu_ps(lanePeaks, peakVector);
+				_mm256_storeu_ps(laneSumsOfSquares, sumOfSquaresVector);
+				Fold(lanePeaks, laneSumsOfSquares, peak, sumOfSquares);
+			}
+
+			constexpr Kernels kernels = {
+				.float32 = Measure<4, LoadFloat32, scalar::LoadFloat32>,
+				.int32 = Measure<4, LoadInt32, scalar::LoadInt32>,
+				.int24 = scalar::Measure<3, scalar::LoadInt24>,
+				.int16 = Measure<2, LoadInt16, scalar::LoadInt16>,
+			};
+
+		}
+#endif
+
+#ifdef FLEXASIO_SIMD_NEON
+		namespace neon {
+
+			float32x4_t LoadFloat32(const std::byte* samples) {
+				return vld1q_f32(reinterpret_cast<const float*>(samples));
+			}
+
+			float32x4_t LoadInt32(const std::byte* samples) {
+				return vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(reinterpret_cast<const int32_t*>(samples))), 0x1p-31f);
+			}
+
+			float32x4_t LoadInt16(const std::byte* samples) {
+				return vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vld1_s16(reinterpret_cast<const int16_t*>(samples)))), 0x1p-15f);
+			}
+
+			template <size_t sampleSize, float32x4_t (*load)(const std::byte*), float (*loadScalar)(const std::byte*)>
+			void Measure(const std::byte* samples, size_t frameCount, float* peak, double* sumOfSquares) {
+				auto peakVector = vdupq_n_f32(0);
+				auto sumOfSquaresVector = vdupq_n_f32(0);
+				size_t frameIndex = 0;
+				for (; frameIndex + 4 <= frameCount; frameIndex += 4) {
+					const auto values = load(samples + frameIndex * sampleSize);
+					peakVector = vmaxq_f32(peakVector, vabsq_f32(values));
+					sumOfSquaresVector = vaddq_f32(sumOfSquaresVector, vmulq_f32(values, values));
+				}
+				scalar::Measure<sampleSize, loadScalar>(samples + frameIndex * sampleSize, frameCount - frameIndex, peak, sumOfSquares);
+				float lanePeaks[4];
+				float laneSumsOfSquares[4];
+				vst1q_f32(lanePeaks, peakVector);
+				vst1q_f32(laneSumsOfSquares, sumOfSquaresVector);
+				Fold(lanePeaks, laneSumsOfSquares, peak, sumOfSquares);
+			}
+
+			constexpr Kernels kernels = {
+				.float32 = Measure<4, LoadFloat32, scalar::LoadFloat32>,
+				.int32 = Measure<4, LoadInt32, scalar::LoadInt32>,
+				.int24 = scalar::Measure<3, scalar::LoadInt24>,
+				.int16 = Measure<2, LoadInt16, scalar::LoadInt16>,
+			};
+
+		}
+#endif
+
+		const Kernels& GetKernels(InstructionSet instructionSet) {
+			switch (instructionSet) {
+#ifdef FLEXASIO_SIMD_SSE2
+			case InstructionSet::SSE2: return sse2::kernels;
+#endif
+#ifdef FLEXASIO_SIMD_X86
+			case InstructionSet::AVX2: return avx2::kernels;
+#endif
+#ifdef FLEXASIO_SIMD_NEON
+			case InstructionSet::NEON: return neon::kernels;
+#endif
+			default: return scalar::kernels;
+			}
+		}
+
+		Kernel GetKernel(ASIOSampleType sampleType, InstructionSet instructionSet) {
+			const auto& kernels = GetKernels(instructionSet);
+			switch (sampleType) {
+			case ASIOSTFloat32LSB: return kernels.float32;
+			case ASIOSTInt32LSB: return kernels.int32;
+			case ASIOSTInt24LSB: return kernels.int24;
+			case ASIOSTInt16LSB: return kernels.int16;
+			}
+			throw std::runtime_error("Level metering is not supported for ASIO sample type " + std::to_string(sampleType));
+		}
+
+		InstructionSet ValidateInstructionSet(InstructionSet instructionSet) {
+			if (!IsInstructionSetSupported(instructionSet))
+				throw std::runtime_error("Instruction set " + GetInstructionSetString(instructionSet) + " is not supported on this CPU");
+			return instructionSet;
+		}
+
+	}
+
+	LevelMeter::LevelMeter(ASIOSampleType sampleType, size_t channelCount, Options options) :
+		instructionSet(ValidateInstructionSet(options.instructionSet.value_or(GetBestInstructionSet()))),
+		kernel(GetKernel(sampleType, instructionSet)),
+		channelCount(channelCount),
+		sharedChannelStates(std::make_unique<SharedChannelState[]>(channelCount)),
+		writerTotals(channelCount),
+		readerChannelStates(channelCount) {
+		Log() << "Level meter: " << channelCount << " channels, using " << GetInstructionSetString(instructionSet) << " code";
+	}
+
+	void LevelMeter::Measure(size_t channelIndex, const std::byte* samples, size_t frameCount) {
+		float peak;
+		double sumOfSquares;
+		kernel(samples, frameCount, &peak, &sumOfSquares);
+
+		auto& sharedChannelState = sharedChannelStates[channelIndex];
+		// Read() only ever lowers the peak back to zero, so this loop only retries if it races with it.
+		const auto newPeakBits = std::bit_cast<uint32_t>(peak);
+		auto peakBits = sharedChannelState.peakBits.load(std::memory_order_relaxed);
+		while (newPeakBits > peakBits && !sharedChannelState.peakBits.compare_exchange_weak(peakBits, newPeakBits, std::memory_order_relaxed)) {}
+
+		auto& totals = writerTotals[channelIndex];
+		totals.sumOfSquares += sumOfSquares;
+		totals.frameCount += frameCount;
+		// Publishing the totals also publishes the peak update above, as Store() has release semantics.
+		sharedChannelState.totals.Store(totals);
+	}
+
+	LevelMeter::Level LevelMeter::Read(size_t channelIndex) {
+		auto& sharedChannelState = sharedChannelStates[channelIndex];
+		auto& readerChannelState = readerChannelStates[channelIndex];
+		const auto totals = sharedChannelState.totals.Load();
+		const auto frameCount = totals.frameCount - readerChannelState.lastTotals.frameCount;
+		if (frameCount == 0) return readerChannelState.lastLevel;
+
+		readerChannelState.lastLevel = {
+			.peak = std::bit_cast<float>(sharedChannelState.peakBits.exchange(0, std::memory_order_relaxed)),
+			.rms = float(std::sqrt((totals.sumOfSquares - readerChannelState.lastTotals.sumOfSquares) / double(frameCount))),
+		};
+		readerChannelState.lastTotals = totals;
+		return readerChannelState.lastLevel;
+	}
+
+	std::vector<std::span<const std::byte>> LevelMeter::GetMemoryRanges() const {
+		return {
+			std::as_bytes(std::span(sharedChannelStates.get(), channelCount)),
+			std::as_bytes(std::span(writerTotals)),
+		};
+	}
+
+}
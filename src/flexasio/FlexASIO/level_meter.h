@@ -0,0 +1,87 @@
+#pragma once
+
+#include "sample_conversion.h"
+
+#include "../FlexASIOUtil/seqlock.h"
+
+#include <dechamps_ASIOUtil/asiosdk/asiosys.h>
+#include <dechamps_ASIOUtil/asiosdk/asio.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace flexasio {
+
+	// Measures the peak and RMS level of a set of channels, one buffer at a time, and makes the results available to
+	// another thread without locks. Levels are relative to full scale, i.e. a full scale square wave has a peak and RMS
+	// level of 1.
+	//
+	// Measure() is meant to be called from the stream callback right after a buffer is copied, while it is still in cache;
+	// it takes a single pass over the samples. Read() returns the level over all the samples measured since the previous
+	// call, so that peaks are not missed no matter how often the reader polls.
+	class LevelMeter final {
+	public:
+		struct Options final {
+			// Defaults to GetBestInstructionSet().
+			std::optional<InstructionSet> instructionSet = std::nullopt;
+		};
+
+		struct Level final {
+			float peak = 0;
+			float rms = 0;
+		};
+
+		LevelMeter(ASIOSampleType sampleType, size_t channelCount, Options options);
+		LevelMeter(const LevelMeter&) = delete;
+		LevelMeter(LevelMeter&&) = delete;
+
+		InstructionSet GetInstructionSet() const { return instructionSet; }
+
+		// Real-time safe. Must only be called from one thread at a time.
+		void Measure(size_t channelIndex, const std::byte* samples, size_t frameCount);
+		// If nothing was measured since the previous call for the same channel, returns the same level again. Lock-free.
+		// Must only be called from one thread at a time.
+		Level Read(size_t channelIndex);
+
+		// Heap memory accessed by Measure().
+		std::vector<std::span<const std::byte>> GetMemoryRanges() const;
+
+	private:
+		using Kernel = void (*)(const std::byte* samples, size_t frameCount, float* peak, double* sumOfSquares);
+
+		// Running totals since the meter was created. The reader computes the RMS level from the difference between two
+		// snapshots.
+		struct Totals final {
+			double sumOfSquares = 0;
+			uint64_t frameCount = 0;
+		};
+
+		// Written by Measure(), read by Read().
+		struct SharedChannelState final {
+			// Highest peak since the last Read(), as the bit pattern of a non-negative float, which orders the same way as the
+			// float itself. Reset by Read().
+			std::atomic<uint32_t> peakBits = 0;
+			SeqLock<Totals> totals;
+		};
+
+		// Only accessed by Read().
+		struct ReaderChannelState final {
+			Totals lastTotals;
+			Level lastLevel;
+		};
+
+		const InstructionSet instructionSet;
+		const Kernel kernel;
+		const size_t channelCount;
+		const std::unique_ptr<SharedChannelState[]> sharedChannelStates;
+		// Only accessed by Measure().
+		std::vector<Totals> writerTotals;
+		std::vector<ReaderChannelState> readerChannelStates;
+	};
+
+}
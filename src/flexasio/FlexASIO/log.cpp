@@ -1,10 +1,10 @@
 #include "log.h"
 
-#include <shlobj.h>
-#include <windows.h>
+#include <filesystem>
 
 #include <dechamps_CMakeUtils/version.h>
 
+#include "../FlexASIOUtil/async_log_sink.h"
 #include "../FlexASIOUtil/shell.h"
 
 namespace flexasio {
@@ -39,10 +39,16 @@ namespace flexasio {
 
 				void Write(const std::string_view str) override { return preamble_sink.Write(str); }
 
+				AsyncLogSink& GetAsyncSink() { return async_sink; }
+
 			private:
 				::dechamps_cpplog::FileLogSink file_sink;
 				::dechamps_cpplog::ThreadSafeLogSink thread_safe_sink{ file_sink };
-				::dechamps_cpplog::PreambleLogSink preamble_sink{ thread_safe_sink };
+				// Used by the writer thread to log about the log buffer itself.
+				::dechamps_cpplog::PreambleLogSink writer_preamble_sink{ thread_safe_sink };
+				AsyncLogSink async_sink{ thread_safe_sink, writer_preamble_sink };
+				// Note the preamble (timestamp, thread ID) is added by the thread that logs, not by the writer thread.
+				::dechamps_cpplog::PreambleLogSink preamble_sink{ async_sink };
 		};
 
 	}
@@ -50,4 +56,18 @@ namespace flexasio {
 	bool IsLoggingEnabled() { return FlexASIOLogSink::Get() != nullptr; }
 	::dechamps_cpplog::Logger Log() { return ::dechamps_cpplog::Logger(FlexASIOLogSink::Get()); }
 
+	AsyncLogWriter::AsyncLogWriter() {
+		const auto sink = FlexASIOLogSink::Get();
+		if (sink == nullptr) return;
+		Log() << "Starting asynchronous log writer";
+		sink->GetAsyncSink().Start();
+	}
+
+	AsyncLogWriter::~AsyncLogWriter() {
+		const auto sink = FlexASIOLogSink::Get();
+		if (sink == nullptr) return;
+		sink->GetAsyncSink().Stop();
+		Log() << "Stopped asynchronous log writer";
+	}
+
 }
\ No newline at end of file
@@ -8,4 +8,16 @@ namespace flexasio {
 	bool IsLoggingEnabled();
 	::dechamps_cpplog::Logger Log();
 
+	// While at least one instance of this class exists, log records are handed over to a background thread instead of
+	// being written to the log file synchronously, so that Log() never blocks (e.g. in the stream callback).
+	// Outside of that, logging is synchronous. Instances must not be static, because the writer thread cannot be
+	// stopped safely while the DLL is being unloaded.
+	class AsyncLogWriter final {
+	public:
+		AsyncLogWriter();
+		AsyncLogWriter(const AsyncLogWriter&) = delete;
+		AsyncLogWriter(AsyncLogWriter&&) = delete;
+		~AsyncLogWriter();
+	};
+
 }
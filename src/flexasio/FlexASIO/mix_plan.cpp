@@ -0,0 +1,233 @@
+#include "mix_plan.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "simd.h"
+
+#include "log.h"
+
+namespace flexasio {
+
+	namespace {
+
+		using Kernel = void (*)(const float* source, float* destination, size_t frameCount, float gain);
+
+		struct Kernels final {
+			// destination = source * gain
+			Kernel scale;
+			// destination += source
+			Kernel add;
+			// destination += source * gain
+			Kernel multiplyAdd;
+		};
+
+		// memcpy() is already as fast as it gets.
+		void Copy(const float* source, float* destination, size_t frameCount, float) {
+			memcpy(destination, source, frameCount * sizeof(float));
+		}
+
+		namespace scalar {
+
+			void Scale(const float* source, float* destination, size_t frameCount, float gain) {
+				for (size_t frameIndex = 0; frameIndex < frameCount; ++frameIndex)
+					destination[frameIndex] = source[frameIndex] * gain;
+			}
+
+			void Add(const float* source, float* destination, size_t frameCount, float) {
+				for (size_t frameIndex = 0; frameIndex < frameCount; ++frameIndex)
+					destination[frameIndex] += source[frameIndex];
+			}
+
+			void MultiplyAdd(const float* source, float* destination, size_t frameCount, float gain) {
+				for (size_t frameIndex = 0; frameIndex < frameCount; ++frameIndex)
+					destination[frameIndex] += source[frameIndex] * gain;
+			}
+
+			constexpr Kernels kernels = {
+				.scale = Scale,
+				.add = Add,
+				.multiplyAdd = MultiplyAdd,
+			};
+
+		}
+
+#ifdef FLEXASIO_SIMD_SSE2
+		namespace sse2 {
+
+			void Scale(const float* source, float* destination, size_t frameCount, float gain) {
+				const auto gainVector = _mm_set1_ps(gain);
+				size_t frameIndex = 0;
+				for (; frameIndex + 4 <= frameCount; frameIndex += 4)
+					_mm_storeu_ps(destination + frameIndex, _mm_mul_ps(_mm_loadu_ps(source + frameIndex), gainVector));
+				scalar::Scale(source + frameIndex, destination + frameIndex, frameCount - frameIndex, gain);
+			}
+
+			void Add(const float* source, float* destination, size_t frameCount, float gain) {
+				size_t frameIndex = 0;
+				for (; frameIndex + 4 <= frameCount; frameIndex += 4)
+					_mm_storeu_ps(destination + frameIndex, _mm_add_ps(_mm_loadu_ps(destination + frameIndex), _mm_loadu_ps(source + frameIndex)));
+				scalar::Add(source + frameIndex, destination + frameIndex, frameCount - frameIndex, gain);
+			}
+
+			void MultiplyAdd(const float* source, float* destination, size_t frameCount, float gain) {
+				const auto gainVector = _mm_set1_ps(gain);
+				size_t frameIndex = 0;
+				for (; frameIndex + 4 <= frameCount; frameIndex += 4)
+					_mm_storeu_ps(destination + frameIndex, _mm_add_ps(_mm_loadu_ps(destination + frameIndex), _mm_mul_ps(_mm_loadu_ps(source + frameIndex), gainVector)));
+				scalar::MultiplyAdd(source + frameIndex, destination + frameIndex, frameCount - frameIndex, gain);
+			}
+
+			constexpr Kernels kernels = {
+				.scale = Scale,
+				.add = Add,
+				.multiplyAdd = MultiplyAdd,
+			};
+
+		}
+#endif
+
+#ifdef FLEXASIO_SIMD_X86
+		// Note: FMA is deliberately not used, so that results do not depend on the instruction set.
+		namespace avx2 {
+
+			FLEXASIO_TARGET_AVX2 void Scale(const float* source, float* destination, size_t frameCount, float gain) {
+				const auto gainVector = _mm256_set1_ps(gain);
+				size_t frameIndex = 0;
+				for (; frameIndex + 8 <= frameCount; frameIndex += 8)
+					_mm256_storeu_ps(destination + frameIndex, _mm256_mul_ps(_mm256_loadu_ps(source + frameIndex), gainVector));
+				scalar::Scale(source + frameIndex, destination + frameIndex, frameCount - frameIndex, gain);
+			}
+
+			FLEXASIO_TARGET_AVX2 void Add(const float* source, float* destination, size_t frameCount, float gain) {
+				size_t frameIndex = 0;
+				for (; frameIndex + 8 <= frameCount; frameIndex += 8)
+					_mm256_storeu_ps(destination + frameIndex, _mm256_add_ps(_mm256_loadu_ps(destination + frameIndex), _mm256_loadu_ps(source + frameIndex)));
+				scalar::Add(source + frameIndex, destination + frameIndex, frameCount - frameIndex, gain);
+			}
+
+			FLEXASIO_TARGET_AVX2 void MultiplyAdd(const float* source, float* destination, size_t frameCount, float gain) {
+				const auto gainVector = _mm256_set1_ps(gain);
+				size_t frameIndex = 0;
+				for (; frameIndex + 8 <= frameCount; frameIndex += 8)
+					_mm256_storeu_ps(destination + frameIndex, _mm256_add_ps(_mm256_loadu_ps(destination + frameIndex), _mm256_mul_ps(_mm256_loadu_ps(source + frameIndex), gainVector)));
+				scalar::MultiplyAdd(source + frameIndex, destination + frameIndex, frameCount - frameIndex, gain);
+			}
+
+			constexpr Kernels kernels = {
+				.scale = Scale,
+				.add = Add,
+				.multiplyAdd = MultiplyAdd,
+			};
+
+		}
+#endif
+
+#ifdef FLEXASIO_SIMD_NEON
+		namespace neon {
+
+			void Scale(const float* source, float* destination, size_t frameCount, float gain) {
+				size_t frameIndex = 0;
+				for (; frameIndex + 4 <= frameCount; frameIndex += 4)
+					vst1q_f32(destination + frameIndex, vmulq_n_f32(vld1q_f32(source + frameIndex), gain));
+				scalar::Scale(source + frameIndex, destination + frameIndex, frameCount - frameIndex, gain);
+			}
+
+			void Add(const float* source, float* destination, size_t frameCount, float gain) {
+				size_t frameIndex = 0;
+				for (; frameIndex + 4 <= frameCount; frameIndex += 4)
+					vst1q_f32(destination + frameIndex, vaddq_f32(vld1q_f32(destination + frameIndex), vld1q_f32(source + frameIndex)));
+				scalar::Add(source + frameIndex, destination + frameIndex, frameCount - frameIndex, gain);
+			}
+
+			void MultiplyAdd(const float* source, float* destination, size_t frameCount, float gain) {
+				size_t frameIndex = 0;
+				for (; frameIndex + 4 <= frameCount; frameIndex += 4)
+					vst1q_f32(destination + frameIndex, vaddq_f32(vld1q_f32(destination + frameIndex), vmulq_n_f32(vld1q_f32(source + frameIndex), gain)));
+				scalar::MultiplyAdd(source + frameIndex, destination + frameIndex, frameCount - frameIndex, gain);
+			}
+
+			constexpr Kernels kernels = {
+				.scale = Scale,
+				.add = Add,
+				.multiplyAdd = MultiplyAdd,
+			};
+
+		}
+#endif
+
+		const Kernels& GetKernels(InstructionSet instructionSet) {
+			switch (instructionSet) {
+#ifdef FLEXASIO_SIMD_SSE2
+			case InstructionSet::SSE2: return sse2::kernels;
+#endif
+#ifdef FLEXASIO_SIMD_X86
+			case InstructionSet::AVX2: return avx2::kernels;
+#endif
+#ifdef FLEXASIO_SIMD_NEON
+			case InstructionSet::NEON: return neon::kernels;
+#endif
+			default: return scalar::kernels;
+			}
+		}
+
+	}
+
+	MixPlan::MixPlan(std::vector<Route> routes, Options options) :
+		instructionSet(options.instructionSet.value_or(GetBestInstructionSet())) {
+		if (!IsInstructionSetSupported(instructionSet))
+			throw std::runtime_error("Instruction set " + GetInstructionSetString(instructionSet) + " is not supported on this CPU");
+		const auto& kernels = GetKernels(instructionSet);
+
+		std::sort(routes.begin(), routes.end(), [](const Route& lhs, const Route& rhs) {
+			return std::make_pair(lhs.destinationChannel, lhs.sourceChannel) < std::make_pair(rhs.destinationChannel, rhs.sourceChannel);
+		});
+		for (auto route = routes.begin(); route != routes.end();) {
+			float gain = 0;
+			const auto next = std::find_if(route, routes.end(), [&](const Route& other) {
+				return other.destinationChannel != route->destinationChannel || other.sourceChannel != route->sourceChannel;
+			});
+			for (auto duplicate = route; duplicate != next; ++duplicate) gain += duplicate->gain;
+			const auto destinationChannel = route->destinationChannel;
+			const auto sourceChannel = route->sourceChannel;
+			route = next;
+			if (gain == 0) continue;
+
+			const auto firstForDestination = destinationChannels.empty() || destinationChannels.back() != destinationChannel;
+			if (firstForDestination) {
+				destinationChannels.push_back(destinationChannel);
+				firstOperation.push_back(operations.kernel.size());
+			}
+			operations.kernel.push_back(
+				firstForDestination && !options.accumulate ?
+				(gain == 1 ? Copy : kernels.scale) :
+				(gain == 1 ? kernels.add : kernels.multiplyAdd));
+			operations.sourceChannel.push_back(sourceChannel);
+			operations.gain.push_back(gain);
+			sourceChannels.push_back(sourceChannel);
+		}
+		firstOperation.push_back(operations.kernel.size());
+		std::sort(sourceChannels.begin(), sourceChannels.end());
+		sourceChannels.erase(std::unique(sourceChannels.begin(), sourceChannels.end()), sourceChannels.end());
+
+		Log() << "Mix plan: " << routes.size() << " routes, " << operations.kernel.size() << " operations, " << sourceChannels.size() << " source channels, "
+			<< destinationChannels.size() << " destination channels, using " << GetInstructionSetString(instructionSet) << " code";
+	}
+
+	void MixPlan::Mix(size_t destinationIndex, const float* const* sources, float* destination, size_t frameCount) const {
+		for (auto operationIndex = firstOperation[destinationIndex]; operationIndex < firstOperation[destinationIndex + 1]; ++operationIndex)
+			operations.kernel[operationIndex](sources[operations.sourceChannel[operationIndex]], destination, frameCount, operations.gain[operationIndex]);
+	}
+
+	std::vector<std::span<const std::byte>> MixPlan::GetMemoryRanges() const {
+		return {
+			std::as_bytes(std::span(operations.kernel)),
+			std::as_bytes(std::span(operations.sourceChannel)),
+			std::as_bytes(std::span(operations.gain)),
+			std::as_bytes(std::span(firstOperation)),
+		};
+	}
+
+}
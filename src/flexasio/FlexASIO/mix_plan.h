@@ -0,0 +1,68 @@
+#pragma once
+
+#include "sample_conversion.h"
+
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace flexasio {
+
+	// A routing matrix, compiled into the list of operations that computes each destination channel as a weighted sum of
+	// source channels. Samples are Float32.
+	//
+	// Only non-zero coefficients cost anything: each destination channel takes one pass per source channel that feeds it
+	// (the first of which overwrites the destination, and is a plain copy at unity gain, unless Options::accumulate is set).
+	// This makes one-to-one routing, fan-out, downmixing and muting equally cheap. Destination channels that no source feeds
+	// are left to the caller to silence.
+	class MixPlan final {
+	public:
+		struct Route final {
+			int sourceChannel;
+			int destinationChannel;
+			float gain;
+
+			bool operator==(const Route&) const = default;
+		};
+
+		struct Options final {
+			// Defaults to GetBestInstructionSet().
+			std::optional<InstructionSet> instructionSet = std::nullopt;
+			// If set, Mix() adds to the existing contents of the destination instead of overwriting it.
+			bool accumulate = false;
+		};
+
+		// Routes with zero gain are ignored. Routes between the same source and destination channels add up.
+		MixPlan(std::vector<Route> routes, Options options);
+
+		InstructionSet GetInstructionSet() const { return instructionSet; }
+		// Source channels that feed at least one destination channel, in increasing order.
+		const std::vector<int>& GetSourceChannels() const { return sourceChannels; }
+		// Destination channels that at least one source channel feeds, in increasing order.
+		const std::vector<int>& GetDestinationChannels() const { return destinationChannels; }
+
+		// Computes the destination channel at `destinationIndex` in GetDestinationChannels(). `sources` is indexed by
+		// source channel. `destination` must not overlap any of the sources. Real-time safe.
+		void Mix(size_t destinationIndex, const float* const* sources, float* destination, size_t frameCount) const;
+
+		// Heap memory accessed by Mix().
+		std::vector<std::span<const std::byte>> GetMemoryRanges() const;
+
+	private:
+		using Kernel = void (*)(const float* source, float* destination, size_t frameCount, float gain);
+
+		const InstructionSet instructionSet;
+		std::vector<int> sourceChannels;
+		std::vector<int> destinationChannels;
+		// Structure of arrays; one element per operation. The operations for each destination channel are contiguous.
+		struct {
+			std::vector<Kernel> kernel;
+			std::vector<int> sourceChannel;
+			std::vector<float> gain;
+		} operations;
+		// One element per destination channel, plus one past the end.
+		std::vector<size_t> firstOperation;
+	};
+
+}
@@ -15,10 +15,14 @@ namespace flexasio {
 
 	}
 
-	void CheckFormatSupported(const StreamParameters& streamParameters) {
+	PaError GetFormatSupport(const StreamParameters& streamParameters) {
 		Log() << "Checking that PortAudio supports format with...";
 		LogStreamParameters(streamParameters);
-		const auto error = Pa_IsFormatSupported(streamParameters.inputParameters, streamParameters.outputParameters, streamParameters.sampleRate);
+		return Pa_IsFormatSupported(streamParameters.inputParameters, streamParameters.outputParameters, streamParameters.sampleRate);
+	}
+
+	void CheckFormatSupported(const StreamParameters& streamParameters) {
+		const auto error = GetFormatSupport(streamParameters);
 		if (error != paFormatIsSupported) throw std::runtime_error(std::string("PortAudio does not support format: ") + Pa_GetErrorText(error));
 		Log() << "Format is supported";
 	}
@@ -12,6 +12,8 @@ namespace flexasio {
 		double sampleRate;
 	};
 
+	// Returns paFormatIsSupported, or the reason why the format is not supported.
+	PaError GetFormatSupport(const StreamParameters&);
 	void CheckFormatSupported(const StreamParameters&);
 
 	struct StreamDeleter {
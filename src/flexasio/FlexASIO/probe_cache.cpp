@@ -0,0 +1,178 @@
+#include "probe_cache.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+#include "cache_file.h"
+#include "log.h"
+
+namespace flexasio {
+
+	namespace {
+
+		// Bump this whenever the format of the file, or the meaning of what it contains, changes.
+		constexpr std::string_view fileHeader = "FlexASIO probe cache 1";
+		constexpr std::string_view fingerprintKey = "device fingerprint";
+		constexpr std::string_view sampleRateKey = "sample rate";
+		// Keeps the file from growing without bounds as the configuration changes.
+		constexpr size_t maxResultCount = 1024;
+
+		// Reasons for a format to be unsupported that do not depend on what else is going on on the system.
+		constexpr PaError conclusiveFormatErrors[] = { paInvalidSampleRate, paSampleFormatNotSupported, paInvalidChannelCount };
+
+		std::filesystem::path GetCachePath() {
+			return GetCacheDirectory() / "probes.cache";
+		}
+
+		std::string FormatDouble(double value) {
+			std::stringstream stream;
+			stream << std::hexfloat << value;
+			return stream.str();
+		}
+
+		std::optional<double> ParseDouble(const std::string& string) {
+			// std::stringstream does not parse std::hexfloat output.
+			char* end = nullptr;
+			const auto value = std::strtod(string.c_str(), &end);
+			if (end != string.c_str() + string.size()) return std::nullopt;
+			return value;
+		}
+
+		std::optional<PaError> ParseError(const std::string& string) {
+			PaError value;
+			const auto result = std::from_chars(string.data(), string.data() + string.size(), value);
+			if (result.ec != std::errc() || result.ptr != string.data() + string.size()) return std::nullopt;
+			return value;
+		}
+
+	}
+
+	ProbeCache::ProbeCache(const HostApi& hostApi, const DeviceCache& deviceCache) : hostApiName(hostApi.info.name), deviceCache(deviceCache) {
+		if (!deviceCache.IsWarm()) {
+			Log() << "Not using probe cache, as the device list might have changed";
+			dirty = true;
+			return;
+		}
+		try {
+			// Values come first, since keys can contain any character.
+			for (const auto& line : LoadCacheFile(GetCachePath(), fileHeader)[hostApiName]) {
+				const auto separator = line.find('\t');
+				if (separator == line.npos) continue;
+				results.emplace(line.substr(separator + 1), line.substr(0, separator));
+			}
+		}
+		catch (const std::exception& exception) {
+			Log() << "Unable to load probe cache: " << exception.what();
+		}
+		const auto fingerprint = Find(std::string(fingerprintKey));
+		if (fingerprint == nullptr || *fingerprint != std::to_string(deviceCache.GetFingerprint())) {
+			if (!results.empty()) Log() << "Discarding probe cache, as it was written for a different device list";
+			results.clear();
+			dirty = true;
+			return;
+		}
+		Log() << "Loaded " << results.size() << " results from probe cache";
+	}
+
+	ProbeCache::~ProbeCache() {
+		if (!dirty) return;
+		try {
+			const auto path = GetCachePath();
+			auto sections = LoadCacheFile(path, fileHeader);
+			auto& section = sections[hostApiName];
+			section.clear();
+			section.push_back(std::to_string(deviceCache.GetFingerprint()) + "\t" + std::string(fingerprintKey));
+			for (const auto& [key, value] : results)
+				if (key != fingerprintKey) section.push_back(value + "\t" + key);
+			SaveCacheFile(path, fileHeader, sections);
+			Log() << "Saved " << results.size() << " results to probe cache";
+		}
+		catch (const std::exception& exception) {
+			Log() << "Unable to save probe cache: " << exception.what();
+		}
+	}
+
+	std::string ProbeCache::GetKey(const PaStreamParameters* const parameters) const {
+		if (parameters == nullptr) return "none";
+		// The device index depends on the host APIs PortAudio was initialized with. Use the position of the device
+		// within the host API instead, which is part of the device fingerprint.
+		const auto& entry = deviceCache.Get(parameters->device);
+		auto keyParameters = *parameters;
+		keyParameters.device = PaDeviceIndex(&entry - deviceCache.GetEntries().data());
+		return DescribeStreamParameters(keyParameters) + " named `" + entry.name + "`";
+	}
+
+	std::string ProbeCache::GetKey(const StreamParameters& streamParameters) const {
+		return "input " + GetKey(streamParameters.inputParameters) + ", output " + GetKey(streamParameters.outputParameters) + ", sample rate " + FormatDouble(streamParameters.sampleRate);
+	}
+
+	const std::string* ProbeCache::Find(const std::string& key) const {
+		const auto result = results.find(key);
+		return result == results.end() ? nullptr : &result->second;
+	}
+
+	void ProbeCache::Remember(const std::string& key, std::string value) {
+		if (results.size() >= maxResultCount && Find(key) == nullptr) {
+			Log() << "Probe cache is full, clearing it";
+			results.clear();
+		}
+		results[key] = std::move(value);
+		dirty = true;
+	}
+
+	void ProbeCache::CheckFormatSupported(const StreamParameters& streamParameters) {
+		const auto key = "format of " + GetKey(streamParameters);
+		std::optional<PaError> cachedError;
+		if (const auto cached = Find(key); cached != nullptr) {
+			cachedError = ParseError(*cached);
+			if (!cachedError.has_value()) {
+				Log() << "Ignoring invalid format support in probe cache: " << *cached;
+				results.erase(key);
+				dirty = true;
+			}
+		}
+		PaError error;
+		if (cachedError.has_value()) {
+			error = *cachedError;
+			Log() << "Using format support from probe cache: " << Pa_GetErrorText(error);
+		}
+		else {
+			error = GetFormatSupport(streamParameters);
+			if (error == paFormatIsSupported || std::find(std::begin(conclusiveFormatErrors), std::end(conclusiveFormatErrors), error) != std::end(conclusiveFormatErrors))
+				Remember(key, std::to_string(error));
+		}
+		if (error != paFormatIsSupported) throw std::runtime_error(std::string("PortAudio does not support format: ") + Pa_GetErrorText(error));
+		Log() << "Format is supported";
+	}
+
+	double ProbeCache::GetStreamLatency(const StreamParameters& streamParameters, unsigned long framesPerBuffer, bool output, const std::function<double()>& probe) {
+		const auto key = std::string(output ? "output" : "input") + " latency of " + GetKey(streamParameters) + ", " + std::to_string(framesPerBuffer) + " frames per buffer";
+		if (const auto cached = Find(key); cached != nullptr) {
+			const auto latency = ParseDouble(*cached);
+			if (latency.has_value()) {
+				Log() << "Using stream latency from probe cache: " << *latency << " seconds";
+				return *latency;
+			}
+		}
+		const auto latency = probe();
+		Remember(key, FormatDouble(latency));
+		return latency;
+	}
+
+	std::optional<double> ProbeCache::GetLastSampleRate() const {
+		const auto cached = Find(std::string(sampleRateKey));
+		if (cached == nullptr) return std::nullopt;
+		return ParseDouble(*cached);
+	}
+
+	void ProbeCache::SetLastSampleRate(double sampleRate) {
+		const auto value = FormatDouble(sampleRate);
+		const auto cached = Find(std::string(sampleRateKey));
+		if (cached != nullptr && *cached == value) return;
+		Remember(std::string(sampleRateKey), value);
+	}
+
+}
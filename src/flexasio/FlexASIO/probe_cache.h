@@ -0,0 +1,54 @@
+#pragma once
+
+#include "device_cache.h"
+#include "portaudio.h"
+#include "../FlexASIOUtil/portaudio.h"
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace flexasio {
+
+	// Remembers the results of PortAudio queries that are expensive (e.g. because they involve opening a stream), so that
+	// the same query can be answered immediately the next time it is made, including by driver instances in other
+	// processes.
+	//
+	// Results are keyed by everything that could influence them: the identity of the device and the stream parameters,
+	// which reflect the relevant configuration options (sample type, channel count, exclusive mode, etc.). They are
+	// persisted in probes.cache in the cache directory, with one section per host API, when the ProbeCache is destroyed.
+	// The section is discarded if the device list changed since it was written, or if it is not known whether it changed
+	// (see DeviceCache::IsWarm()).
+	class ProbeCache final {
+	public:
+		ProbeCache(const HostApi& hostApi, const DeviceCache& deviceCache);
+		ProbeCache(const ProbeCache&) = delete;
+		ProbeCache(ProbeCache&&) = delete;
+		~ProbeCache();
+
+		// Memoized version of ::flexasio::CheckFormatSupported(). A format that is unsupported for reasons that might be
+		// temporary (e.g. the device being in use) is probed again next time.
+		void CheckFormatSupported(const StreamParameters& streamParameters);
+
+		// Memoized latency of a stream opened with these parameters, in seconds, as reported by PortAudio. `probe` is
+		// called if the latency is not known yet. Failures are not remembered.
+		double GetStreamLatency(const StreamParameters& streamParameters, unsigned long framesPerBuffer, bool output, const std::function<double()>& probe);
+
+		// The last sample rate used by a driver instance, in any process, with the same device list.
+		std::optional<double> GetLastSampleRate() const;
+		void SetLastSampleRate(double sampleRate);
+
+	private:
+		std::string GetKey(const PaStreamParameters* parameters) const;
+		std::string GetKey(const StreamParameters& streamParameters) const;
+		const std::string* Find(const std::string& key) const;
+		void Remember(const std::string& key, std::string value);
+
+		const std::string hostApiName;
+		const DeviceCache& deviceCache;
+		std::unordered_map<std::string, std::string> results;
+		bool dirty = false;
+	};
+
+}
@@ -0,0 +1,248 @@
+#include "resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+#include <stdexcept>
+#include <string>
+
+#include "simd.h"
+
+namespace flexasio {
+
+	namespace {
+
+		// Slightly below Nyquist, so that the transition band of such a short filter does not fold back too much.
+		constexpr double cutoff = 0.45;
+		// Roughly 80 dB of stopband attenuation.
+		constexpr double kaiserBeta = 8;
+
+		// Zeroth order modified Bessel function of the first kind, which the Kaiser window is defined in terms of.
+		double BesselI0(double x) {
+			double sum = 1;
+			double term = 1;
+			for (int k = 1; term > sum * 1e-12; ++k) {
+				term *= (x / (2 * k)) * (x / (2 * k));
+				sum += term;
+			}
+			return sum;
+		}
+
+		std::vector<float> ComputeCoefficients() {
+			constexpr auto halfLength = double(Resampler::tapCount) / 2;
+			std::vector<float> coefficients;
+			coefficients.reserve((Resampler::phaseCount + 1) * Resampler::tapCount);
+			for (size_t phase = 0; phase <= Resampler::phaseCount; ++phase) {
+				std::vector<double> row;
+				for (size_t tap = 0; tap < Resampler::tapCount; ++tap) {
+					const auto offset = double(tap) - double(Resampler::delayInFrames) - double(phase) / Resampler::phaseCount;
+					const auto sinc = offset == 0 ? 1 : std::sin(std::numbers::pi * 2 * cutoff * offset) / (std::numbers::pi * 2 * cutoff * offset);
+					const auto window = BesselI0(kaiserBeta * std::sqrt((std::max)(0.0, 1 - (offset / halfLength) * (offset / halfLength)))) / BesselI0(kaiserBeta);
+					row.push_back(sinc * window);
+				}
+				// Normalize for unity gain at DC, so that no phase sounds louder than any other.
+				double sum = 0;
+				for (const auto coefficient : row) sum += coefficient;
+				for (const auto coefficient : row) coefficients.push_back(float(coefficient / sum));
+			}
+			return coefficients;
+		}
+
+		std::vector<float> ComputeCoefficientDeltas(const std::vector<float>& coefficients) {
+			std::vector<float> coefficientDeltas;
+			coefficientDeltas.reserve(Resampler::phaseCount * Resampler::tapCount);
+			for (size_t index = 0; index < Resampler::phaseCount * Resampler::tapCount; ++index)
+				coefficientDeltas.push_back(coefficients[index + Resampler::tapCount] - coefficients[index]);
+			return coefficientDeltas;
+		}
+
+		struct Block final {
+			const float* coefficients;
+			const float* coefficientDeltas;
+			std::span<const float* const> input;
+			double position;
+			double ratio;
+			std::span<float* const> output;
+			size_t frameCount;
+		};
+		using Kernel = void (*)(const Block&);
+
+		struct Phase final {
+			size_t inputOffset;
+			const float* coefficients;
+			const float* coefficientDeltas;
+			float interpolation;
+		};
+
+		inline double GetFramePosition(double position, double ratio, size_t frameIndex) {
+			return position + double(frameIndex) * ratio;
+		}
+
+		// Meant to be inlined into the kernels: calling non-AVX code from the AVX2 kernel on every frame incurs state
+		// transition penalties on some CPUs.
+		inline Phase GetPhase(const Block& block, size_t frameIndex) {
+			const auto framePosition = GetFramePosition(block.position, block.ratio, frameIndex);
+			const auto inputOffset = std::floor(framePosition);
+			const auto scaledFraction = (framePosition - inputOffset) * Resampler::phaseCount;
+			const auto row = (std::min)(size_t(scaledFraction), Resampler::phaseCount - 1);
+			return {
+				.inputOffset = size_t(inputOffset),
+				.coefficients = block.coefficients + row * Resampler::tapCount,
+				.coefficientDeltas = block.coefficientDeltas + row * Resampler::tapCount,
+				.interpolation = float(scaledFraction - double(row)),
+			};
+		}
+
+		namespace scalar {
+
+			void Resample(const Block& block) {
+				float coefficients[Resampler::tapCount];
+				for (size_t frameIndex = 0; frameIndex < block.frameCount; ++frameIndex) {
+					const auto phase = GetPhase(block, frameIndex);
+					for (size_t tap = 0; tap < Resampler::tapCount; ++tap)
+						coefficients[tap] = phase.coefficients[tap] + phase.interpolation * phase.coefficientDeltas[tap];
+					for (size_t channelIndex = 0; channelIndex < block.input.size(); ++channelIndex) {
+						const auto input = block.input[channelIndex] + phase.inputOffset;
+						float sum = 0;
+						for (size_t tap = 0; tap < Resampler::tapCount; ++tap) sum += coefficients[tap] * input[tap];
+						block.output[channelIndex][frameIndex] = sum;
+					}
+				}
+			}
+
+		}
+
+#ifdef FLEXASIO_SIMD_SSE2
+		namespace sse2 {
+
+			float HorizontalSum(__m128 value) {
+				value = _mm_add_ps(value, _mm_movehl_ps(value, value));
+				return _mm_cvtss_f32(_mm_add_ss(value, _mm_shuffle_ps(value, value, 1)));
+			}
+
+			void Resample(const Block& block) {
+				alignas(16) float coefficients[Resampler::tapCount];
+				for (size_t frameIndex = 0; frameIndex < block.frameCount; ++frameIndex) {
+					const auto phase = GetPhase(block, frameIndex);
+					const auto interpolation = _mm_set1_ps(phase.interpolation);
+					for (size_t tap = 0; tap < Resampler::tapCount; tap += 4)
+						_mm_store_ps(coefficients + tap, _mm_add_ps(_mm_loadu_ps(phase.coefficients + tap), _mm_mul_ps(interpolation, _mm_loadu_ps(phase.coefficientDeltas + tap))));
+					for (size_t channelIndex = 0; channelIndex < block.input.size(); ++channelIndex) {
+						const auto input = block.input[channelIndex] + phase.inputOffset;
+						// Two accumulators to shorten the dependency chain.
+						auto sum0 = _mm_setzero_ps();
+						auto sum1 = _mm_setzero_ps();
+						for (size_t tap = 0; tap < Resampler::tapCount; tap += 8) {
+							sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_load_ps(coefficients + tap), _mm_loadu_ps(input + tap)));
+							sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_load_ps(coefficients + tap + 4), _mm_loadu_ps(input + tap + 4)));
+						}
+						block.output[channelIndex][frameIndex] = HorizontalSum(_mm_add_ps(sum0, sum1));
+					}
+				}
+			}
+
+		}
+#endif
+
+#ifdef FLEXASIO_SIMD_X86
+		namespace avx2 {
+
+			FLEXASIO_TARGET_AVX2 void Resample(const Block& block) {
+				alignas(32) float coefficients[Resampler::tapCount];
+				for (size_t frameIndex = 0; frameIndex < block.frameCount; ++frameIndex) {
+					const auto phase = GetPhase(block, frameIndex);
+					const auto interpolation = _mm256_set1_ps(phase.interpolation);
+					for (size_t tap = 0; tap < Resampler::tapCount; tap += 8)
+						_mm256_store_ps(coefficients + tap, _mm256_add_ps(_mm256_loadu_ps(phase.coefficients + tap), _mm256_mul_ps(interpolation, _mm256_loadu_ps(phase.coefficientDeltas + tap))));
+					for (size_t channelIndex = 0; channelIndex < block.input.size(); ++channelIndex) {
+						const auto input = block.input[channelIndex] + phase.inputOffset;
+						auto sum0 = _mm256_setzero_ps();
+						auto sum1 = _mm256_setzero_ps();
+						for (size_t tap = 0; tap < Resampler::tapCount; tap += 16) {
+							sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_load_ps(coefficients + tap), _mm256_loadu_ps(input + tap)));
+							sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_load_ps(coefficients + tap + 8), _mm256_loadu_ps(input + tap + 8)));
+						}
+						const auto sum = _mm256_add_ps(sum0, sum1);
+						auto halves = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+						halves = _mm_add_ps(halves, _mm_movehl_ps(halves, halves));
+						block.output[channelIndex][frameIndex] = _mm_cvtss_f32(_mm_add_ss(halves, _mm_shuffle_ps(halves, halves, 1)));
+					}
+				}
+			}
+
+		}
+#endif
+
+#ifdef FLEXASIO_SIMD_NEON
+		namespace neon {
+
+			void Resample(const Block& block) {
+				alignas(16) float coefficients[Resampler::tapCount];
+				for (size_t frameIndex = 0; frameIndex < block.frameCount; ++frameIndex) {
+					const auto phase = GetPhase(block, frameIndex);
+					for (size_t tap = 0; tap < Resampler::tapCount; tap += 4)
+						vst1q_f32(coefficients + tap, vfmaq_n_f32(vld1q_f32(phase.coefficients + tap), vld1q_f32(phase.coefficientDeltas + tap), phase.interpolation));
+					for (size_t channelIndex = 0; channelIndex < block.input.size(); ++channelIndex) {
+						const auto input = block.input[channelIndex] + phase.inputOffset;
+						auto sum0 = vdupq_n_f32(0);
+						auto sum1 = vdupq_n_f32(0);
+						for (size_t tap = 0; tap < Resampler::tapCount; tap += 8) {
+							sum0 = vfmaq_f32(sum0, vld1q_f32(coefficients + tap), vld1q_f32(input + tap));
+							sum1 = vfmaq_f32(sum1, vld1q_f32(coefficients + tap + 4), vld1q_f32(input + tap + 4));
+						}
+						block.output[channelIndex][frameIndex] = vaddvq_f32(vaddq_f32(sum0, sum1));
+					}
+				}
+			}
+
+		}
+#endif
+
+		Kernel GetKernel(InstructionSet instructionSet) {
+			switch (instructionSet) {
+#ifdef FLEXASIO_SIMD_SSE2
+			case InstructionSet::SSE2: return sse2::Resample;
+#endif
+#ifdef FLEXASIO_SIMD_X86
+			case InstructionSet::AVX2: return avx2::Resample;
+#endif
+#ifdef FLEXASIO_SIMD_NEON
+			case InstructionSet::NEON: return neon::Resample;
+#endif
+			default: return scalar::Resample;
+			}
+		}
+
+	}
+
+	Resampler::Resampler(Options options) :
+		instructionSet(options.instructionSet.value_or(GetBestInstructionSet())),
+		coefficients(ComputeCoefficients()),
+		coefficientDeltas(ComputeCoefficientDeltas(coefficients)) {
+		if (!IsInstructionSetSupported(instructionSet))
+			throw std::runtime_error("Instruction set " + GetInstructionSetString(instructionSet) + " is not supported on this CPU");
+	}
+
+	std::vector<std::span<const std::byte>> Resampler::GetMemoryRanges() const {
+		return { std::as_bytes(std::span(coefficients)), std::as_bytes(std::span(coefficientDeltas)) };
+	}
+
+	size_t Resampler::GetInputFrameCount(double position, double ratio, size_t outputFrameCount) {
+		if (outputFrameCount == 0) return 0;
+		return size_t(std::floor(GetFramePosition(position, ratio, outputFrameCount - 1))) + tapCount;
+	}
+
+	double Resampler::Resample(std::span<const float* const> input, double position, double ratio, std::span<float* const> output, size_t outputFrameCount) const {
+		GetKernel(instructionSet)({
+			.coefficients = coefficients.data(),
+			.coefficientDeltas = coefficientDeltas.data(),
+			.input = input,
+			.position = position,
+			.ratio = ratio,
+			.output = output,
+			.frameCount = outputFrameCount,
+			});
+		return GetFramePosition(position, ratio, outputFrameCount);
+	}
+
+}
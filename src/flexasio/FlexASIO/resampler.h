@@ -0,0 +1,54 @@
+#pragma once
+
+#include "sample_conversion.h"
+
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace flexasio {
+
+	// Resamples non-interleaved float32 audio by a ratio that can change from one call to the next, e.g. to track the
+	// drift between two clocks. The ratio is expected to stay close to 1; the filter does not band-limit the signal any
+	// further, so large ratios would alias.
+	//
+	// Each output frame is computed from `tapCount` consecutive input frames using a Kaiser-windowed sinc filter. Filter
+	// coefficients are precomputed for `phaseCount` fractional positions, and linearly interpolated in between.
+	//
+	// Resample() is real-time safe, and is thread-safe as long as each thread uses its own input and output.
+	class Resampler final {
+	public:
+		static constexpr size_t tapCount = 32;
+		static constexpr size_t phaseCount = 256;
+		// The output frame at position `p` is the input signal at fractional frame `p + delayInFrames`.
+		static constexpr size_t delayInFrames = tapCount / 2 - 1;
+
+		struct Options final {
+			// Defaults to GetBestInstructionSet().
+			std::optional<InstructionSet> instructionSet = std::nullopt;
+		};
+
+		explicit Resampler(Options options);
+
+		InstructionSet GetInstructionSet() const { return instructionSet; }
+		std::vector<std::span<const std::byte>> GetMemoryRanges() const;
+
+		// Number of input frames, starting from the integer part of `position`, that Resample() reads to produce
+		// `outputFrameCount` frames.
+		static size_t GetInputFrameCount(double position, double ratio, size_t outputFrameCount);
+
+		// Output frame `n` is computed at input position `position + n * ratio`. `position` must be non-negative, and
+		// each input channel must hold at least GetInputFrameCount() frames. Returns the position of the frame following
+		// the last output frame.
+		double Resample(std::span<const float* const> input, double position, double ratio, std::span<float* const> output, size_t outputFrameCount) const;
+
+	private:
+		const InstructionSet instructionSet;
+		// `phaseCount + 1` rows of `tapCount` coefficients each; the last row is for interpolating the last phase.
+		std::vector<float> coefficients;
+		// Difference between each row and the next, so that interpolation is a single multiply-add.
+		std::vector<float> coefficientDeltas;
+	};
+
+}
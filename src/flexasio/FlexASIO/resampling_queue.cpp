@@ -0,0 +1,273 @@
+#include "resampling_queue.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <numbers>
+
+#include "log.h"
+
+namespace flexasio {
+
+	namespace {
+
+		// Bandwidth of the loop that adjusts the resampling ratio. Low enough that the ratio does not audibly wobble, yet
+		// high enough to settle within seconds.
+		constexpr double controlLoopBandwidthHz = 0.05;
+		constexpr double controlLoopDamping = std::numbers::sqrt2 / 2;
+		// Real clocks are never this far apart. This also bounds how fast the loop can catch up after a disturbance.
+		constexpr double maxDrift = 0.01;
+		// Narrower than the engine's: any jitter left in the clock models ends up modulating the resampling ratio. It only
+		// needs to be a few times wider than the control loop.
+		constexpr double clockModelBandwidthHz = 0.1;
+		constexpr double logIntervalSeconds = 10;
+
+		constexpr auto float32SampleType = ASIOSTFloat32LSB;
+
+		std::optional<SampleConverter> GetConverter(ASIOSampleType inputSampleType, ASIOSampleType outputSampleType, bool dither) {
+			if (inputSampleType == outputSampleType) return std::nullopt;
+			return SampleConverter(inputSampleType, outputSampleType, { .dither = dither });
+		}
+
+		size_t GetRingCapacityInFrames(const ResamplingQueue::Options& options) {
+			const auto initialTargetFrameCount = Resampler::tapCount + 2 * options.framesPerBuffer + options.safetyMarginFrames;
+			// Leaves plenty of room for calls larger than expected, for latency alignment, and for one side starting well
+			// before the other.
+			return std::bit_ceil((std::max)(4 * initialTargetFrameCount, size_t(options.sampleRate / 2)));
+		}
+
+	}
+
+	ResamplingQueue::ResamplingQueue(Options options) :
+		options(std::move(options)),
+		readSampleSizeInBytes(GetSampleSizeInBytes(this->options.readSampleType)),
+		ringCapacityInFrames(GetRingCapacityInFrames(this->options)),
+		ring(this->options.channelCount, std::vector<float>(2 * ringCapacityInFrames)),
+		writerState({ .converter = GetConverter(this->options.writeSampleType, float32SampleType, false) }),
+		readerState({
+			.resampler = Resampler({}),
+			.converter = GetConverter(float32SampleType, this->options.readSampleType, this->options.dither),
+			.ringPointers = std::vector<const float*>(this->options.channelCount),
+			.resampledBlock = std::vector<std::vector<float>>(this->options.channelCount, std::vector<float>(this->options.framesPerBuffer)),
+			.resampledBlockPointers = std::vector<float*>(this->options.channelCount),
+			.outputPointers = std::vector<float*>(this->options.channelCount),
+			}) {
+		for (int channelIndex = 0; channelIndex < this->options.channelCount; ++channelIndex)
+			readerState.resampledBlockPointers[channelIndex] = readerState.resampledBlock[channelIndex].data();
+		targetFrameCount = ComputeTargetFrameCount(0);
+		if (this->options.lockMemory) {
+			const auto memoryRanges = GetMemoryRanges();
+			size_t sizeInBytes = 0;
+			try {
+				for (const auto& memoryRange : memoryRanges) sizeInBytes += memoryLocks.emplace_back(memoryRange).GetSize();
+				Log() << "Locked " << this->options.name << " queue in memory: " << memoryRanges.size() << " ranges spanning " << sizeInBytes << " bytes of pages";
+			}
+			catch (const std::exception& exception) {
+				memoryLocks.clear();
+				Log() << "WARNING: unable to lock " << this->options.name << " queue in memory, stream callbacks may incur page faults: " << exception.what();
+			}
+		}
+		Log() << "Queue for " << this->options.name << ": " << this->options.channelCount << " channels, ring buffer of " << ringCapacityInFrames << " frames, initial target of "
+			<< targetFrameCount.load() << " queued frames, resampling with " << GetInstructionSetString(readerState.resampler.GetInstructionSet());
+	}
+
+	ResamplingQueue::~ResamplingQueue() {
+		if (!started) return;
+		const auto statistics = GetStatistics();
+		Log() << "Queue for " << options.name << " statistics: " << statistics.underrunCount << " underruns, " << statistics.overflowCount << " overflows, estimated drift "
+			<< statistics.drift * 1e6 << " ppm";
+	}
+
+	size_t ResamplingQueue::ComputeTargetFrameCount(int64_t maxWriteFramesPerCall) const {
+		// The reader needs enough audio to produce a whole block. By the time it runs, the last write may have been up to
+		// one write ago.
+		const auto targetFrameCount = Resampler::tapCount +
+			(std::max)(readerState.maxFramesPerCall, options.framesPerBuffer) +
+			(std::max)(size_t(maxWriteFramesPerCall), options.framesPerBuffer) +
+			options.safetyMarginFrames + extraLatencyInFrames;
+		return (std::min)(targetFrameCount, ringCapacityInFrames / 2);
+	}
+
+	size_t ResamplingQueue::GetLatencyInFrames() const {
+		return targetFrameCount.load(std::memory_order_relaxed) - Resampler::delayInFrames;
+	}
+
+	std::vector<std::span<const std::byte>> ResamplingQueue::GetMemoryRanges() const {
+		auto memoryRanges = readerState.resampler.GetMemoryRanges();
+		for (const auto& channelRing : ring) memoryRanges.push_back(std::as_bytes(std::span(channelRing)));
+		for (const auto& channelBlock : readerState.resampledBlock) memoryRanges.push_back(std::as_bytes(std::span(channelBlock)));
+		memoryRanges.push_back(std::as_bytes(std::span(readerState.ringPointers)));
+		memoryRanges.push_back(std::as_bytes(std::span(readerState.resampledBlockPointers)));
+		memoryRanges.push_back(std::as_bytes(std::span(readerState.outputPointers)));
+		return memoryRanges;
+	}
+
+	ResamplingQueue::Statistics ResamplingQueue::GetStatistics() const {
+		return { .underrunCount = readerState.underrunCount, .overflowCount = readerState.overflowCount, .drift = readerState.drift };
+	}
+
+	void ResamplingQueue::SetExtraLatencyInFrames(size_t extraLatencyInFrames) {
+		this->extraLatencyInFrames = extraLatencyInFrames;
+		targetFrameCount = ComputeTargetFrameCount(writerState.position.maxFramesPerCall);
+		Log() << "Queue for " << options.name << ": adding " << extraLatencyInFrames << " frames of latency for alignment, target is now " << targetFrameCount.load() << " queued frames";
+	}
+
+	void ResamplingQueue::Start() {
+		started = true;
+
+		writerState.clockModel.emplace(options.sampleRate, clockModelBandwidthHz);
+		writerState.receivedFrameCount = 0;
+		writerState.position = {};
+		writePosition.Store(writerState.position);
+		releasedFrameCount = 0;
+
+		// Note the drift estimate is kept, as it is a property of the devices.
+		auto& state = readerState;
+		state.clockModel.emplace(options.sampleRate, clockModelBandwidthHz);
+		state.playedFrameCount = 0;
+		state.observedOverflowCount = 0;
+		state.synchronized = false;
+		state.readFrameCount = 0;
+		state.readFramePhase = 0;
+		state.underrunCount = 0;
+		state.overflowCount = 0;
+		state.nextLogFrameCount = 0;
+	}
+
+	void ResamplingQueue::Write(const std::byte* const* input, size_t frameCount, int64_t timeNanoseconds) {
+		auto& state = writerState;
+		state.receivedFrameCount += frameCount;
+		state.clockModel->Update(state.receivedFrameCount, timeNanoseconds);
+
+		auto& position = state.position;
+		position.maxFramesPerCall = (std::max)(position.maxFramesPerCall, int64_t(frameCount));
+		if (position.writtenFrameCount + int64_t(frameCount) - releasedFrameCount.load(std::memory_order_acquire) > int64_t(ringCapacityInFrames)) {
+			// The reader will notice and start over.
+			++position.overflowCount;
+			writePosition.Store(position);
+			return;
+		}
+
+		const auto ringOffset = size_t(position.writtenFrameCount) & (ringCapacityInFrames - 1);
+		const auto frameCountBeforeWrap = (std::min)(frameCount, ringCapacityInFrames - ringOffset);
+		for (int channelIndex = 0; channelIndex < options.channelCount; ++channelIndex) {
+			const auto channelRing = ring[channelIndex].data();
+			const auto samples = channelRing + ringOffset;
+			if (state.converter.has_value()) state.converter->Convert(input[channelIndex], reinterpret_cast<std::byte*>(samples), frameCount);
+			else memcpy(samples, input[channelIndex], frameCount * sizeof(float));
+			memcpy(samples + ringCapacityInFrames, samples, frameCountBeforeWrap * sizeof(float));
+			memcpy(channelRing, samples + frameCountBeforeWrap, (frameCount - frameCountBeforeWrap) * sizeof(float));
+		}
+
+		position.writtenFrameCount += frameCount;
+		position.timeNanoseconds = state.clockModel->GetTimeNanoseconds(state.receivedFrameCount);
+		writePosition.Store(position);
+	}
+
+	void ResamplingQueue::Read(std::byte* const* output, size_t frameCount, int64_t timeNanoseconds) {
+		auto& state = readerState;
+		if (frameCount > state.maxFramesPerCall) {
+			if (IsLoggingEnabled() && frameCount > options.framesPerBuffer)
+				Log() << "Queue for " << options.name << ": read of " << frameCount << " frames, larger than the expected " << options.framesPerBuffer << "; queueing more audio to accommodate it";
+			state.maxFramesPerCall = frameCount;
+		}
+		state.clockModel->Update(state.playedFrameCount, timeNanoseconds);
+
+		for (size_t frameOffset = 0; frameOffset < frameCount; ) {
+			const auto blockFrameCount = (std::min)(frameCount - frameOffset, options.framesPerBuffer);
+			if (state.converter.has_value()) {
+				ReadBlock(state.resampledBlockPointers, blockFrameCount);
+				for (int channelIndex = 0; channelIndex < options.channelCount; ++channelIndex)
+					state.converter->Convert(reinterpret_cast<const std::byte*>(state.resampledBlockPointers[channelIndex]), output[channelIndex] + frameOffset * readSampleSizeInBytes, blockFrameCount);
+			}
+			else {
+				for (int channelIndex = 0; channelIndex < options.channelCount; ++channelIndex)
+					state.outputPointers[channelIndex] = reinterpret_cast<float*>(output[channelIndex]) + frameOffset;
+				ReadBlock(state.outputPointers, blockFrameCount);
+			}
+			frameOffset += blockFrameCount;
+		}
+	}
+
+	void ResamplingQueue::ReadBlock(std::span<float* const> output, size_t frameCount) {
+		auto& state = readerState;
+		const auto readTimeNanoseconds = state.clockModel->GetTimeNanoseconds(state.playedFrameCount);
+		state.playedFrameCount += frameCount;
+
+		const auto position = writePosition.Load();
+		const auto targetFrameCount = ComputeTargetFrameCount(position.maxFramesPerCall);
+		this->targetFrameCount.store(targetFrameCount, std::memory_order_relaxed);
+		if (position.overflowCount != state.observedOverflowCount) {
+			state.observedOverflowCount = position.overflowCount;
+			if (state.synchronized) {
+				++state.overflowCount;
+				if (IsLoggingEnabled()) Log() << "Queue for " << options.name << ": OVERFLOW, starting over";
+				state.synchronized = false;
+			}
+		}
+
+		const auto resample = [&] {
+			if (position.writtenFrameCount == 0) return false;
+
+			// How many frames would have been written by now, had audio been arriving continuously rather than in chunks.
+			const auto writtenFrameCount = double(position.writtenFrameCount) + double(readTimeNanoseconds - position.timeNanoseconds) * options.sampleRate / 1e9;
+			const auto getError = [&] { return writtenFrameCount - (double(state.readFrameCount) + state.readFramePhase) - double(targetFrameCount); };
+			// This can happen if one of the sides stalls. Slowly resampling our way back would take a long time and wind
+			// up the integral term, so start over instead.
+			if (state.synchronized && std::abs(getError()) > double(targetFrameCount)) {
+				++(getError() < 0 ? state.underrunCount : state.overflowCount);
+				if (IsLoggingEnabled()) Log() << "Queue for " << options.name << ": " << getError() + double(targetFrameCount) << " frames queued, too far off target " << targetFrameCount << ", starting over";
+				state.synchronized = false;
+			}
+			if (!state.synchronized) {
+				// Jump to the target, but never backwards (the audio we would need may have been overwritten), nor too
+				// close to the last frame actually written.
+				const auto readFrameCount = (std::min)(
+					int64_t(std::floor(writtenFrameCount - double(targetFrameCount))),
+					position.writtenFrameCount - int64_t(Resampler::GetInputFrameCount(0, 1 + maxDrift, frameCount)));
+				if (readFrameCount < state.readFrameCount) return false;
+				state.readFrameCount = readFrameCount;
+				state.readFramePhase = 0;
+				state.synchronized = true;
+				releasedFrameCount.store(state.readFrameCount, std::memory_order_release);
+				if (IsLoggingEnabled()) Log() << "Queue for " << options.name << ": synchronized with " << position.writtenFrameCount - state.readFrameCount << " frames queued";
+			}
+
+			// A proportional-integral controller. The integral term tracks the drift between the two clocks; the
+			// proportional term steers the amount of queued audio towards the target.
+			constexpr auto naturalFrequency = 2 * std::numbers::pi * controlLoopBandwidthHz;
+			const auto proportionalGain = 2 * controlLoopDamping * naturalFrequency / options.sampleRate;
+			const auto integralGain = naturalFrequency * naturalFrequency / options.sampleRate;
+			const auto error = getError();
+			state.ratio = std::clamp(1 + state.drift + proportionalGain * error, 1 - maxDrift, 1 + maxDrift);
+			state.drift = std::clamp(state.drift + integralGain * error * double(frameCount) / options.sampleRate, -maxDrift, maxDrift);
+
+			if (state.readFrameCount + int64_t(Resampler::GetInputFrameCount(state.readFramePhase, state.ratio, frameCount)) > position.writtenFrameCount) {
+				++state.underrunCount;
+				if (IsLoggingEnabled()) Log() << "Queue for " << options.name << ": UNDERRUN, starting over";
+				state.synchronized = false;
+				return false;
+			}
+
+			const auto ringOffset = size_t(state.readFrameCount) & (ringCapacityInFrames - 1);
+			for (int channelIndex = 0; channelIndex < options.channelCount; ++channelIndex)
+				state.ringPointers[channelIndex] = ring[channelIndex].data() + ringOffset;
+			const auto nextPosition = state.resampler.Resample(state.ringPointers, state.readFramePhase, state.ratio, output, frameCount);
+			const auto consumedFrameCount = std::floor(nextPosition);
+			state.readFrameCount += int64_t(consumedFrameCount);
+			state.readFramePhase = nextPosition - consumedFrameCount;
+			releasedFrameCount.store(state.readFrameCount, std::memory_order_release);
+
+			if (IsLoggingEnabled() && state.playedFrameCount >= state.nextLogFrameCount) {
+				Log() << "Queue for " << options.name << ": " << error + double(targetFrameCount) << " frames queued (target " << targetFrameCount << "), resampling ratio "
+					<< state.ratio << ", estimated drift " << state.drift * 1e6 << " ppm";
+				state.nextLogFrameCount = state.playedFrameCount + int64_t(logIntervalSeconds * options.sampleRate);
+			}
+			return true;
+		};
+		if (!resample())
+			for (const auto channel : output) std::fill(channel, channel + frameCount, 0.0f);
+	}
+
+}
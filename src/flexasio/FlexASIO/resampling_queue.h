@@ -0,0 +1,156 @@
+#pragma once
+
+#include "clock_model.h"
+#include "resampler.h"
+#include "sample_conversion.h"
+#include "../FlexASIOUtil/memory_lock.h"
+#include "../FlexASIOUtil/seqlock.h"
+
+#include <dechamps_ASIOUtil/asiosdk/asiosys.h>
+#include <dechamps_ASIOUtil/asiosdk/asio.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace flexasio {
+
+	// A single producer, single consumer audio queue between two threads that are paced by different clocks, typically
+	// the callbacks of PortAudio streams on two different devices.
+	//
+	// Write() converts audio to float32 and queues it in a ring buffer. Read() reads it back through an adaptive
+	// resampler. The resampling ratio is adjusted continuously by a control loop that keeps the amount of queued audio
+	// around a target, which compensates for the drift between the two clocks. Write() and Read() times are filtered
+	// through clock models, so that scheduling jitter does not modulate the ratio.
+	//
+	// If the queue runs dry or overflows anyway (e.g. because one side stalled), the reader starts over from the target
+	// fill level, inserting silence or skipping audio as necessary.
+	class ResamplingQueue final {
+	public:
+		struct Options final {
+			// Identifies the queue in the log, e.g. "input device 1".
+			std::string name;
+			int channelCount;
+			// Sample types of the non-interleaved buffers passed to Write() and Read(), respectively.
+			ASIOSampleType writeSampleType;
+			ASIOSampleType readSampleType;
+			// Applies to the conversion from float32 to `readSampleType`.
+			bool dither = false;
+			double sampleRate;
+			// Size of the calls that both sides are expected to make. Larger Read() calls are processed in chunks. If
+			// larger calls are observed on either side, more audio is queued to accommodate them, which adds latency.
+			size_t framesPerBuffer;
+			// Additional audio kept queued, on top of what the call sizes require, to absorb scheduling jitter.
+			size_t safetyMarginFrames;
+			// Locks the memory returned by GetMemoryRanges() for the lifetime of the object.
+			bool lockMemory = false;
+		};
+
+		// Counters since the last Start(). Only meaningful while both sides are stopped.
+		struct Statistics final {
+			uint64_t underrunCount;
+			uint64_t overflowCount;
+			// Estimated rate of the writer clock relative to the reader clock, minus one.
+			double drift;
+		};
+
+		explicit ResamplingQueue(Options options);
+		ResamplingQueue(const ResamplingQueue&) = delete;
+		ResamplingQueue(ResamplingQueue&&) = delete;
+		~ResamplingQueue();
+
+		// Latency added by the queue, in frames. Can increase over time if calls are larger than expected.
+		size_t GetLatencyInFrames() const;
+		// Heap memory accessed by Write() and Read().
+		std::vector<std::span<const std::byte>> GetMemoryRanges() const;
+		Statistics GetStatistics() const;
+
+		// Queues more audio than necessary, so that the latency of this path matches the latency of other paths. Must
+		// not be called while either side is running.
+		void SetExtraLatencyInFrames(size_t extraLatencyInFrames);
+
+		// Must be called while neither side is running, before they start. Write() and Read() must not be called before
+		// Start().
+		void Start();
+
+		// `timeNanoseconds` is typically the time the stream callback making the call was called. If a callback makes
+		// several calls, each covering part of the callback buffer, add the duration of the frames that precede each part.
+		void Write(const std::byte* const* input, size_t frameCount, int64_t timeNanoseconds);
+		void Read(std::byte* const* output, size_t frameCount, int64_t timeNanoseconds);
+
+	private:
+		struct WritePosition final {
+			// Total number of frames written to the ring buffer.
+			int64_t writtenFrameCount = 0;
+			// Time of the last write, according to the writer clock model. Only valid if at least one frame was written.
+			int64_t timeNanoseconds = 0;
+			uint64_t overflowCount = 0;
+			int64_t maxFramesPerCall = 0;
+		};
+
+		// Fills `output` with `frameCount` frames of resampled audio, or silence.
+		void ReadBlock(std::span<float* const> output, size_t frameCount);
+		size_t ComputeTargetFrameCount(int64_t maxWriteFramesPerCall) const;
+
+		const Options options;
+		const size_t readSampleSizeInBytes;
+		// Power of two.
+		const size_t ringCapacityInFrames;
+		// Frames are stored twice, at `frame % ringCapacityInFrames` and `frame % ringCapacityInFrames + ringCapacityInFrames`,
+		// so that any range of up to `ringCapacityInFrames` frames is contiguous in memory.
+		std::vector<std::vector<float>> ring;
+		size_t extraLatencyInFrames = 0;
+
+		// Only accessed by the writer.
+		struct WriterState final {
+			std::optional<SampleConverter> converter;
+			// Reset by Start().
+			std::optional<ClockModel> clockModel;
+			// Including frames that were dropped because the ring buffer was full.
+			int64_t receivedFrameCount = 0;
+			WritePosition position;
+		};
+		WriterState writerState;
+
+		// Written by the writer, read by the reader.
+		SeqLock<WritePosition> writePosition;
+		// Written by the reader, read by the writer. Frames before this one can be overwritten.
+		std::atomic<int64_t> releasedFrameCount = 0;
+		std::atomic<size_t> targetFrameCount = 0;
+
+		// Only accessed by the reader.
+		struct ReaderState final {
+			Resampler resampler;
+			std::optional<SampleConverter> converter;
+			// Reset by Start().
+			std::optional<ClockModel> clockModel;
+			int64_t playedFrameCount = 0;
+			size_t maxFramesPerCall = 0;
+			uint64_t observedOverflowCount = 0;
+			bool synchronized = false;
+			// Ring buffer frame, and fraction thereof, that the resampler is at.
+			int64_t readFrameCount = 0;
+			double readFramePhase = 0;
+			// Integral term of the control loop, which converges to the drift between the two clocks.
+			double drift = 0;
+			double ratio = 1;
+			uint64_t underrunCount = 0;
+			uint64_t overflowCount = 0;
+			int64_t nextLogFrameCount = 0;
+
+			std::vector<const float*> ringPointers;
+			std::vector<std::vector<float>> resampledBlock;
+			std::vector<float*> resampledBlockPointers;
+			std::vector<float*> outputPointers;
+		};
+		ReaderState readerState;
+		bool started = false;
+
+		std::vector<MemoryLock> memoryLocks;
+	};
+
+}
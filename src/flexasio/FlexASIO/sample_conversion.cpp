@@ -0,0 +1,510 @@
+#include "sample_conversion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "simd.h"
+
+#include <dechamps_cpputil/string.h>
+
+namespace flexasio {
+
+	namespace {
+
+		using Kernel = void (*)(const std::byte* input, std::byte* output, size_t sampleCount, int bits, uint32_t* ditherState);
+
+		struct Kernels final {
+			Kernel float32ToInt32;
+			Kernel int32ToFloat32;
+			Kernel int16ToInt32;
+			Kernel int32ToInt16;
+			Kernel int24ToInt32;
+			Kernel int32ToInt24;
+		};
+
+		constexpr float int32ToFloat32Scale = 0x1p-31f;
+		constexpr float ditherScale = 0x1p-32f;
+
+		// Parameters for quantizing a float sample to `bits` bits, then MSB-aligning the result in an int32.
+		struct Quantization final {
+			explicit Quantization(int bits) :
+				scale(std::ldexp(1.0f, bits - 1)),
+				minimum(-scale),
+				// Above 24 bits, scale - 1 is not representable and would round up to scale, which would overflow.
+				maximum(bits > 24 ? std::nextafter(scale, 0.0f) : scale - 1),
+				shift(32 - bits) {}
+
+			const float scale;
+			const float minimum;
+			const float maximum;
+			const int shift;
+		};
+
+		namespace scalar {
+
+			float NextUniform(uint32_t& state) {
+				state ^= state << 13;
+				state ^= state >> 17;
+				state ^= state << 5;
+				return float(int32_t(state)) * ditherScale;
+			}
+
+			int32_t LoadInt32(const std::byte* input) {
+				int32_t value;
+				memcpy(&value, input, sizeof(value));
+				return value;
+			}
+			void StoreInt32(std::byte* output, int32_t value) {
+				memcpy(output, &value, sizeof(value));
+			}
+
+			void Float32ToInt32(const std::byte* input, std::byte* output, size_t sampleCount, int bits, uint32_t* ditherState) {
+				const Quantization quantization(bits);
+				for (size_t sampleIndex = 0; sampleIndex < sampleCount; ++sampleIndex) {
+					float value;
+					memcpy(&value, input + sampleIndex * sizeof(float), sizeof(value));
+					value *= quantization.scale;
+					if (ditherState != nullptr) value += NextUniform(ditherState[0]) + NextUniform(ditherState[0]);
+					// Note the order of the operands, which ensures NaN is mapped to the minimum.
+					value = (std::min)(quantization.maximum, (std::max)(quantization.minimum, value));
+					StoreInt32(output + sampleIndex * sizeof(int32_t), int32_t(uint32_t(std::lrint(value)) << quantization.shift));
+				}
+			}
+
+			void Int32ToFloat32(const std::byte* input, std::byte* output, size_t sampleCount, int, uint32_t*) {
+				for (size_t sampleIndex = 0; sampleIndex < sampleCount; ++sampleIndex) {
+					const float value = float(LoadInt32(input + sampleIndex * sizeof(int32_t))) * int32ToFloat32Scale;
+					memcpy(output + sampleIndex * sizeof(float), &value, sizeof(value));
+				}
+			}
+
+			void Int16ToInt32(const std::byte* input, std::byte* output, size_t sampleCount, int, uint32_t*) {
+				for (size_t sampleIndex = 0; sampleIndex < sampleCount; ++sampleIndex) {
+					int16_t value;
+					memcpy(&value, input + sampleIndex * sizeof(int16_t), sizeof(value));
+					StoreInt32(output + sampleIndex * sizeof(int32_t), int32_t(uint32_t(uint16_t(value)) << 16));
+				}
+			}
+
+			void Int32ToInt16(const std::byte* input, std::byte* output, size_t sampleCount, int, uint32_t*) {
+				for (size_t sampleIndex = 0; sampleIndex < sampleCount; ++sampleIndex) {
+					const auto value = int16_t(LoadInt32(input + sampleIndex * sizeof(int32_t)) >> 16);
+					memcpy(output + sampleIndex * sizeof(int16_t), &value, sizeof(value));
+				}
+			}
+
+			void Int24ToInt32(const std::byte* input, std::byte* output, size_t sampleCount, int, uint32_t*) {
+				for (size_t sampleIndex = 0; sampleIndex < sampleCount; ++sampleIndex) {
+					const auto sample = input + sampleIndex * 3;
+					StoreInt32(output + sampleIndex * sizeof(int32_t), int32_t(
+						uint32_t(sample[0]) << 8 |
+						uint32_t(sample[1]) << 16 |
+						uint32_t(sample[2]) << 24));
+				}
+			}
+
+			void Int32ToInt24(const std::byte* input, std::byte* output, size_t sampleCount, int, uint32_t*) {
+				for (size_t sampleIndex = 0; sampleIndex < sampleCount; ++sampleIndex) {
+					const auto value = uint32_t(LoadInt32(input + sampleIndex * sizeof(int32_t)));
+					const auto sample = output + sampleIndex * 3;
+					sample[0] = std::byte(value >> 8);
+					sample[1] = std::byte(value >> 16);
+					sample[2] = std::byte(value >> 24);
+				}
+			}
+
+			constexpr Kernels kernels = {
+				.float32ToInt32 = Float32ToInt32,
+				.int32ToFloat32 = Int32ToFloat32,
+				.int16ToInt32 = Int16ToInt32,
+				.int32ToInt16 = Int32ToInt16,
+				.int24ToInt32 = Int24ToInt32,
+				.int32ToInt24 = Int32ToInt24,
+			};
+
+		}
+
+#ifdef FLEXASIO_SIMD_SSE2
+		namespace sse2 {
+
+			__m128i NextRandom(__m128i state) {
+				state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+				state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+				return _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+			}
+
+			void Float32ToInt32(const std::byte* input, std::byte* output, size_t sampleCount, int bits, uint32_t* ditherState) {
+				const Quantization quantization(bits);
+				const auto scale = _mm_set1_ps(quantization.scale);
+				const auto minimum = _mm_set1_ps(quantization.minimum);
+				const auto maximum = _mm_set1_ps(quantization.maximum);
+				const auto shift = _mm_cvtsi32_si128(quantization.shift);
+				auto dither = ditherState == nullptr ? _mm_setzero_si128() : _mm_loadu_si128(reinterpret_cast<const __m128i*>(ditherState));
+				size_t sampleIndex = 0;
+				for (; sampleIndex + 4 <= sampleCount; sampleIndex += 4) {
+					auto value = _mm_mul_ps(_mm_loadu_ps(reinterpret_cast<const float*>(input + sampleIndex * sizeof(float))), scale);
+					if (ditherState != nullptr) {
+						dither = NextRandom(dither);
+						const auto first = _mm_cvtepi32_ps(dither);
+						dither = NextRandom(dither);
+						value = _mm_add_ps(value, _mm_mul_ps(_mm_add_ps(first, _mm_cvtepi32_ps(dither)), _mm_set1_ps(ditherScale)));
+					}
+					// _mm_max_ps() returns the second operand if the first one is NaN.
+					value = _mm_min_ps(_mm_max_ps(value, minimum), maximum);
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(output + sampleIndex * sizeof(int32_t)), _mm_sll_epi32(_mm_cvtps_epi32(value), shift));
+				}
+				if (ditherState != nullptr) _mm_storeu_si128(reinterpret_cast<__m128i*>(ditherState), dither);
+				scalar::Float32ToInt32(input + sampleIndex * sizeof(float), output + sampleIndex * sizeof(int32_t), sampleCount - sampleIndex, bits, ditherState);
+			}
+
+			void Int32ToFloat32(const std::byte* input, std::byte* output, size_t sampleCount, int bits, uint32_t* ditherState) {
+				const auto scale = _mm_set1_ps(int32ToFloat32Scale);
+				size_t sampleIndex = 0;
+				for (; sampleIndex + 4 <= sampleCount; sampleIndex += 4)
+					_mm_storeu_ps(reinterpret_cast<float*>(output + sampleIndex * sizeof(float)),
+						_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + sampleIndex * sizeof(int32_t)))), scale));
+				scalar::Int32ToFloat32(input + sampleIndex * sizeof(int32_t), output + sampleIndex * sizeof(float), sampleCount - sampleIndex, bits, ditherState);
+			}
+
+			void Int16ToInt32(const std::byte* input, std::byte* output, size_t sampleCount, int bits, uint32_t* ditherState) {
+				size_t sampleIndex = 0;
+				for (; sampleIndex + 8 <= sampleCount; sampleIndex += 8) {
+					const auto value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + sampleIndex * sizeof(int16_t)));
+					// Interleaving with zeros puts each 16-bit sample in the upper half of a 32-bit lane.
+					const auto zero = _mm_setzero_si128();
+					const auto samples = reinterpret_cast<__m128i*>(output + sampleIndex * sizeof(int32_t));
+					_mm_storeu_si128(samples, _mm_unpacklo_epi16(zero, value));
+					_mm_storeu_si128(samples + 1, _mm_unpackhi_epi16(zero, value));
+				}
+				scalar::Int16ToInt32(input + sampleIndex * sizeof(int16_t), output + sampleIndex * sizeof(int32_t), sampleCount - sampleIndex, bits, ditherState);
+			}
+
+			void Int32ToInt16(const std::byte* input, std::byte* output, size_t sampleCount, int bits, uint32_t* ditherState) {
+				size_t sampleIndex = 0;
+				for (; sampleIndex + 8 <= sampleCount; sampleIndex += 8) {
+					const auto samples = reinterpret_cast<const __m128i*>(input + sampleIndex * sizeof(int32_t));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(output + sampleIndex * sizeof(int16_t)),
+						_mm_packs_epi32(_mm_srai_epi32(_mm_loadu_si128(samples), 16), _mm_srai_epi32(_mm_loadu_si128(samples + 1), 16)));
+				}
+				scalar::Int32ToInt16(input + sampleIndex * sizeof(int32_t), output + sampleIndex * sizeof(int16_t), sampleCount - sampleIndex, bits, ditherState);
+			}
+
+			// SSE2 has no byte shuffle instruction, so packed 24-bit samples are handled by the scalar code.
+			constexpr Kernels kernels = {
+				.float32ToInt32 = Float32ToInt32,
+				.int32ToFloat32 = Int32ToFloat32,
+				.int16ToInt32 = Int16ToInt32,
+				.int32ToInt16 = Int32ToInt16,
+				.int24ToInt32 = scalar::Int24ToInt32,
+				.int32ToInt24 = scalar::Int32ToInt24,
+			};
+
+		}
+#endif
+
+#ifdef FLEXASIO_SIMD_X86
+		namespace avx2 {
+
+			FLEXASIO_TARGET_AVX2 __m256i NextRandom(__m256i state) {
+				state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 13));
+				state = _mm256_xor_si256(state, _mm256_srli_epi32(state, 17));
+				return _mm256_xor_si256(state, _mm256_slli_epi32(state, 5));
+			}
+
+			FLEXASIO_TARGET_AVX2 void Float32ToInt32(const std::byte* input, std::byte* output, size_t sampleCount, int bits, uint32_t* ditherState) {
+				const Quantization quantization(bits);
+				const auto scale = _mm256_set1_ps(quantization.scale);
+				const auto minimum = _mm256_set1_ps(quantization.minimum);
+				const auto maximum = _mm256_set1_ps(quantization.maximum);
+				const auto shift = _mm_cvtsi32_si128(quantization.shift);
+				auto dither = ditherState == nullptr ? _mm256_setzero_si256() : _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ditherState));
+				size_t sampleIndex = 0;
+				for (; sampleIndex + 8 <= sampleCount; sampleIndex += 8) {
+					auto value = _mm256_mul_ps(_mm256_loadu_ps(reinterpret_cast<const float*>(input + sampleIndex * sizeof(float))), scale);
+					if (ditherState != nullptr) {
+						dither = NextRandom(dither);
+						const auto first = _mm256_cvtepi32_ps(dither);
+						dither = NextRandom(dither);
+						value = _mm256_add_ps(value, _mm256_mul_ps(_mm256_add_ps(first, _mm256_cvtepi32_ps(dither)), _mm256_set1_ps(ditherScale)));
+					}
+					// _mm256_max_ps() returns the second operand if the first one is NaN.
+					value = _mm256_min_ps(_mm256_max_ps(value, minimum), maximum);
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(output + sampleIndex * sizeof(int32_t)), _mm256_sll_epi32(_mm256_cvtps_epi32(value), shift));
+				}
+				if (ditherState != nullptr) _mm256_storeu_si256(reinterpret_cast<__m256i*>(ditherState), dither);
+				scalar::Float32ToInt32(input + sampleIndex * sizeof(float), output + sampleIndex * sizeof(int32_t), sampleCount - sampleIndex, bits, ditherState);
+			}
+
+			FLEXASIO_TARGET_AVX2 void Int32ToFloat32(const std::byte* input, std::byte* output, size_t sampleCount, int bits, uint32_t* ditherState) {
+				const auto scale = _mm256_set1_ps(int32ToFloat32Scale);
+				size_t sampleIndex = 0;
+				for (; sampleIndex + 8 <= sampleCount; sampleIndex += 8)
+					_mm256_storeu_ps(reinterpret_cast<float*>(output + sampleIndex * sizeof(float)),
+						_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + sampleIndex * sizeof(int32_t)))), scale));
+				scalar::Int32ToFloat32(input + sampleIndex * sizeof(int32_t), output + sampleIndex * sizeof(float), sampleCount - sampleIndex, bits, ditherState);
+			}
+
+			FLEXASIO_TARGET_AVX2 void Int16ToInt32(const std::byte* input, std::byte* output, size_t sampleCount, int bits, uint32_t* ditherState) {
+				size_t sampleIndex = 0;
+				for (; sampleIndex + 8 <= sampleCount; sampleIndex += 8)
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(output + sampleIndex * sizeof(int32_t)),
+						_mm256_slli_epi32(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + sampleIndex * sizeof(int16_t)))), 16));
+				scalar::Int16ToInt32(input + sampleIndex * sizeof(int16_t), output + sampleIndex * sizeof(int32_t), sampleCount - sampleIndex, bits, ditherState);
+			}
+
+			FLEXASIO_TARGET_AVX2 void Int32ToInt16(const std::byte* input, std::byte* output, size_t sampleCount, int bits, uint32_t* ditherState) {
+				size_t sampleIndex = 0;
+				for (; sampleIndex + 8 <= sampleCount; sampleIndex += 8) {
+					const auto value = _mm256_srai_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + sampleIndex * sizeof(int32_t))), 16);
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(output + sampleIndex * sizeof(int16_t)),
+						_mm_packs_epi32(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1)));
+				}
+				scalar::Int32ToInt16(input + sampleIndex * sizeof(int32_t), output + sampleIndex * sizeof(int16_t), sampleCount - sampleIndex, bits, ditherState);
+			}
+
+			// 8 packed samples (24 bytes) are loaded, then spread so that each 128-bit lane holds 4 samples (12 bytes) which
+			// are then shuffled into place within the lane.
+			FLEXASIO_TARGET_AVX2 void Int24ToInt32(const std::byte* input, std::byte* output, size_t sampleCount, int bits, uint32_t* ditherState) {
+				const auto spread = _mm256_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0);
+				const auto unpack = _mm256_setr_epi8(
+					-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+					-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+				size_t sampleIndex = 0;
+				for (; sampleIndex + 8 <= sampleCount; sampleIndex += 8) {
+					const auto samples = input + sampleIndex * 3;
+					const auto packed = _mm256_inserti128_si256(
+						_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples))),
+						_mm_loadl_epi64(reinterpret_cast<const __m128i*>(samples + 16)), 1);
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(output + sampleIndex * sizeof(int32_t)),
+						_mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(packed, spread), unpack));
+				}
+				scalar::Int24ToInt32(input + sampleIndex * 3, output + sampleIndex * sizeof(int32_t), sampleCount - sampleIndex, bits, ditherState);
+			}
+
+			// The reverse of Int24ToInt32().
+			FLEXASIO_TARGET_AVX2 void Int32ToInt24(const std::byte* input, std::byte* output, size_t sampleCount, int bits, uint32_t* ditherState) {
+				const auto pack = _mm256_setr_epi8(
+					1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1,
+					1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1);
+				const auto gather = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+				size_t sampleIndex = 0;
+				for (; sampleIndex + 8 <= sampleCount; sampleIndex += 8) {
+					const auto packed = _mm256_permutevar8x32_epi32(
+						_mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + sampleIndex * sizeof(int32_t))), pack), gather);
+					const auto samples = output + sampleIndex * 3;
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(samples), _mm256_castsi256_si128(packed));
+					_mm_storel_epi64(reinterpret_cast<__m128i*>(samples + 16), _mm256_extracti128_si256(packed, 1));
+				}
+				scalar::Int32ToInt24(input + sampleIndex * sizeof(int32_t), output + sampleIndex * 3, sampleCount - sampleIndex, bits, ditherState);
+			}
+
+			constexpr Kernels kernels = {
+				.float32ToInt32 = Float32ToInt32,
+				.int32ToFloat32 = Int32ToFloat32,
+				.int16ToInt32 = Int16ToInt32,
+				.int32ToInt16 = Int32ToInt16,
+				.int24ToInt32 = Int24ToInt32,
+				.int32ToInt24 = Int32ToInt24,
+			};
+
+		}
+#endif
+
+#ifdef FLEXASIO_SIMD_NEON
+		namespace neon {
+
+			uint32x4_t NextRandom(uint32x4_t state) {
+				state = veorq_u32(state, vshlq_n_u32(state, 13));
+				state = veorq_u32(state, vshrq_n_u32(state, 17));
+				return veorq_u32(state, vshlq_n_u32(state, 5));
+			}
+
+			void Float32ToInt32(const std::byte* input, std::byte* output, size_t sampleCount, int bits, uint32_t* ditherState) {
+				const Quantization quantization(bits);
+				const auto minimum = vdupq_n_f32(quantization.minimum);
+				const auto maximum = vdupq_n_f32(quantization.maximum);
+				const auto shift = vdupq_n_s32(quantization.shift);
+				auto dither = ditherState == nullptr ? vdupq_n_u32(0) : vld1q_u32(ditherState);
+				size_t sampleIndex = 0;
+				for (; sampleIndex + 4 <= sampleCount; sampleIndex += 4) {
+					auto value = vmulq_n_f32(vld1q_f32(reinterpret_cast<const float*>(input + sampleIndex * sizeof(float))), quantization.scale);
+					if (ditherState != nullptr) {
+						dither = NextRandom(dither);
+						const auto first = vcvtq_f32_s32(vreinterpretq_s32_u32(dither));
+						dither = NextRandom(dither);
+						value = vaddq_f32(value, vmulq_n_f32(vaddq_f32(first, vcvtq_f32_s32(vreinterpretq_s32_u32(dither))), ditherScale));
+					}
+					// Unlike vmaxq_f32(), vmaxnmq_f32() returns the number if one of the operands is NaN.
+					value = vminnmq_f32(vmaxnmq_f32(value, minimum), maximum);
+					vst1q_s32(reinterpret_cast<int32_t*>(output + sampleIndex * sizeof(int32_t)), vshlq_s32(vcvtnq_s32_f32(value), shift));
+				}
+				if (ditherState != nullptr) vst1q_u32(ditherState, dither);
+				scalar::Float32ToInt32(input + sampleIndex * sizeof(float), output + sampleIndex * sizeof(int32_t), sampleCount - sampleIndex, bits, ditherState);
+			}
+
+			void Int32ToFloat32(const std::byte* input, std::byte* output, size_t sampleCount, int bits, uint32_t* ditherState) {
+				size_t sampleIndex = 0;
+				for (; sampleIndex + 4 <= sampleCount; sampleIndex += 4)
+					vst1q_f32(reinterpret_cast<float*>(output + sampleIndex * sizeof(float)),
+						vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(reinterpret_cast<const int32_t*>(input + sampleIndex * sizeof(int32_t)))), int32ToFloat32Scale));
+				scalar::Int32ToFloat32(input + sampleIndex * sizeof(int32_t), output + sampleIndex * sizeof(float), sampleCount - sampleIndex, bits, ditherState);
+			}
+
+			void Int16ToInt32(const std::byte* input, std::byte* output, size_t sampleCount, int bits, uint32_t* ditherState) {
+				size_t sampleIndex = 0;
+				for (; sampleIndex + 4 <= sampleCount; sampleIndex += 4)
+					vst1q_s32(reinterpret_cast<int32_t*>(output + sampleIndex * sizeof(int32_t)),
+						vshll_n_s16(vld1_s16(reinterpret_cast<const int16_t*>(input + sampleIndex * sizeof(int16_t))), 16));
+				scalar::Int16ToInt32(input + sampleIndex * sizeof(int16_t), output + sampleIndex * sizeof(int32_t), sampleCount - sampleIndex, bits, ditherState);
+			}
+
+			void Int32ToInt16(const std::byte* input, std::byte* output, size_t sampleCount, int bits, uint32_t* ditherState) {
+				size_t sampleIndex = 0;
+				for (; sampleIndex + 4 <= sampleCount; sampleIndex += 4)
+					vst1_s16(reinterpret_cast<int16_t*>(output + sampleIndex * sizeof(int16_t)),
+						vshrn_n_s32(vld1q_s32(reinterpret_cast<const int32_t*>(input + sampleIndex * sizeof(int32_t))), 16));
+				scalar::Int32ToInt16(input + sampleIndex * sizeof(int32_t), output + sampleIndex * sizeof(int16_t), sampleCount - sampleIndex, bits, ditherState);
+			}
+
+			constexpr Kernels kernels = {
+				.float32ToInt32 = Float32ToInt32,
+				.int32ToFloat32 = Int32ToFloat32,
+				.int16ToInt32 = Int16ToInt32,
+				.int32ToInt16 = Int32ToInt16,
+				.int24ToInt32 = scalar::Int24ToInt32,
+				.int32ToInt24 = scalar::Int32ToInt24,
+			};
+
+		}
+#endif
+
+		const Kernels& GetKernels(InstructionSet instructionSet) {
+			switch (instructionSet) {
+#ifdef FLEXASIO_SIMD_SSE2
+			case InstructionSet::SSE2: return sse2::kernels;
+#endif
+#ifdef FLEXASIO_SIMD_X86
+			case InstructionSet::AVX2: return avx2::kernels;
+#endif
+#ifdef FLEXASIO_SIMD_NEON
+			case InstructionSet::NEON: return neon::kernels;
+#endif
+			default: return scalar::kernels;
+			}
+		}
+
+		bool IsFloat(ASIOSampleType sampleType) {
+			return sampleType == ASIOSTFloat32LSB;
+		}
+
+		Kernel GetToInt32Kernel(const Kernels& kernels, ASIOSampleType sampleType) {
+			switch (sampleType) {
+			case ASIOSTFloat32LSB: return kernels.float32ToInt32;
+			case ASIOSTInt24LSB: return kernels.int24ToInt32;
+			case ASIOSTInt16LSB: return kernels.int16ToInt32;
+			default: return nullptr;
+			}
+		}
+
+		Kernel GetFromInt32Kernel(const Kernels& kernels, ASIOSampleType sampleType) {
+			switch (sampleType) {
+			case ASIOSTFloat32LSB: return kernels.int32ToFloat32;
+			case ASIOSTInt24LSB: return kernels.int32ToInt24;
+			case ASIOSTInt16LSB: return kernels.int32ToInt16;
+			default: return nullptr;
+			}
+		}
+
+	}
+
+	std::string GetInstructionSetString(InstructionSet instructionSet) {
+		return ::dechamps_cpputil::EnumToString(instructionSet, {
+			{InstructionSet::SCALAR, "scalar"},
+			{InstructionSet::SSE2, "SSE2"},
+			{InstructionSet::AVX2, "AVX2"},
+			{InstructionSet::NEON, "NEON"},
+			});
+	}
+
+	bool IsInstructionSetSupported(InstructionSet instructionSet) {
+		switch (instructionSet) {
+		case InstructionSet::SCALAR: return true;
+#ifdef FLEXASIO_SIMD_SSE2
+		case InstructionSet::SSE2: return true;
+#endif
+#ifdef FLEXASIO_SIMD_X86
+		case InstructionSet::AVX2: {
+			static const bool supported = HasAvx2();
+			return supported;
+		}
+#endif
+#ifdef FLEXASIO_SIMD_NEON
+		case InstructionSet::NEON: return true;
+#endif
+		default: return false;
+		}
+	}
+
+	InstructionSet GetBestInstructionSet() {
+		for (const auto instructionSet : { InstructionSet::AVX2, InstructionSet::SSE2, InstructionSet::NEON })
+			if (IsInstructionSetSupported(instructionSet)) return instructionSet;
+		return InstructionSet::SCALAR;
+	}
+
+	size_t GetSampleSizeInBytes(ASIOSampleType sampleType) {
+		switch (sampleType) {
+		case ASIOSTFloat32LSB: return 4;
+		case ASIOSTInt32LSB: return 4;
+		case ASIOSTInt24LSB: return 3;
+		case ASIOSTInt16LSB: return 2;
+		default: throw std::runtime_error("Unsupported sample type for conversion: " + std::to_string(sampleType));
+		}
+	}
+
+	SampleConverter::SampleConverter(ASIOSampleType inputSampleType, ASIOSampleType outputSampleType, Options options) :
+		inputSampleSizeInBytes(GetSampleSizeInBytes(inputSampleType)),
+		outputSampleSizeInBytes(GetSampleSizeInBytes(outputSampleType)),
+		instructionSet(options.instructionSet.value_or(GetBestInstructionSet())),
+		dither(options.dither) {
+		if (!IsInstructionSetSupported(instructionSet))
+			throw std::runtime_error("Instruction set " + GetInstructionSetString(instructionSet) + " is not supported on this CPU");
+
+		for (size_t lane = 0; lane < ditherState.size(); ++lane)
+			// Any odd multiplier gives distinct, non-zero seeds.
+			ditherState[lane] = uint32_t(0x9E3779B9u * (lane + 1));
+
+		if (inputSampleType == outputSampleType) return;
+		const auto& kernels = GetKernels(instructionSet);
+		toInt32 = GetToInt32Kernel(kernels, inputSampleType);
+		fromInt32 = GetFromInt32Kernel(kernels, outputSampleType);
+		if (!IsFloat(outputSampleType)) bits = int(8 * outputSampleSizeInBytes);
+	}
+
+	void SampleConverter::Convert(const std::byte* input, std::byte* output, size_t sampleCount) {
+		const auto ditherState = dither ? this->ditherState.data() : nullptr;
+		if (toInt32 == nullptr && fromInt32 == nullptr) {
+			memcpy(output, input, sampleCount * inputSampleSizeInBytes);
+			return;
+		}
+		if (fromInt32 == nullptr) {
+			toInt32(input, output, sampleCount, bits, ditherState);
+			return;
+		}
+		if (toInt32 == nullptr) {
+			fromInt32(input, output, sampleCount, bits, ditherState);
+			return;
+		}
+
+		// Small enough to stay in L1 cache between the two passes.
+		constexpr size_t intermediateSizeInSamples = 256;
+		alignas(32) std::byte intermediate[intermediateSizeInSamples * sizeof(int32_t)];
+		for (size_t sampleIndex = 0; sampleIndex < sampleCount; sampleIndex += intermediateSizeInSamples) {
+			const auto chunkSampleCount = (std::min)(intermediateSizeInSamples, sampleCount - sampleIndex);
+			toInt32(input + sampleIndex * inputSampleSizeInBytes, intermediate, chunkSampleCount, bits, ditherState);
+			fromInt32(intermediate, output + sampleIndex * outputSampleSizeInBytes, chunkSampleCount, bits, ditherState);
+		}
+	}
+
+}
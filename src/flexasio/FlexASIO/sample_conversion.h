@@ -0,0 +1,63 @@
+#pragma once
+
+#include <dechamps_ASIOUtil/asiosdk/asiosys.h>
+#include <dechamps_ASIOUtil/asiosdk/asio.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace flexasio {
+
+	enum class InstructionSet { SCALAR, SSE2, AVX2, NEON };
+	std::string GetInstructionSetString(InstructionSet);
+	bool IsInstructionSetSupported(InstructionSet);
+	// Determined at runtime from the capabilities of the CPU we are running on.
+	InstructionSet GetBestInstructionSet();
+
+	// Throws if the sample type is not supported by SampleConverter.
+	size_t GetSampleSizeInBytes(ASIOSampleType);
+
+	// Converts between the little-endian linear PCM sample types used by FlexASIO: Float32, Int32, packed Int24 and Int16.
+	//
+	// Integer full scale maps to [-1, 1) in floating point. Float to integer conversion rounds to the nearest value and
+	// clips; it can optionally apply +/- 1 LSB TPDF dither, which only makes sense if the output has less resolution than
+	// the input. Integer to integer conversion simply adds or drops least significant bits.
+	//
+	// Convert() is real-time safe. It is not thread-safe, because it updates the dither state.
+	class SampleConverter final {
+	public:
+		struct Options final {
+			bool dither = false;
+			// Defaults to GetBestInstructionSet().
+			std::optional<InstructionSet> instructionSet = std::nullopt;
+		};
+
+		SampleConverter(ASIOSampleType inputSampleType, ASIOSampleType outputSampleType, Options options);
+
+		size_t GetInputSampleSizeInBytes() const { return inputSampleSizeInBytes; }
+		size_t GetOutputSampleSizeInBytes() const { return outputSampleSizeInBytes; }
+		InstructionSet GetInstructionSet() const { return instructionSet; }
+
+		void Convert(const std::byte* input, std::byte* output, size_t sampleCount);
+
+	private:
+		// Integer samples go through int32 (MSB-aligned) as an intermediate format. `bits` is the resolution to quantize
+		// float samples to; `ditherState` is null if dither is disabled.
+		using Kernel = void (*)(const std::byte* input, std::byte* output, size_t sampleCount, int bits, uint32_t* ditherState);
+
+		const size_t inputSampleSizeInBytes;
+		const size_t outputSampleSizeInBytes;
+		const InstructionSet instructionSet;
+		// Null if the input, respectively the output, is already int32. Both are null if no conversion is necessary.
+		Kernel toInt32 = nullptr;
+		Kernel fromInt32 = nullptr;
+		int bits = 32;
+		bool dither;
+		// One xorshift32 generator per SIMD lane.
+		std::array<uint32_t, 8> ditherState;
+	};
+
+}
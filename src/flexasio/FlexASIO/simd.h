@@ -0,0 +1,50 @@
+#pragma once
+
+// Compile-time detection of the SIMD instruction sets that kernels can be built for. Whether the CPU actually supports
+// them is a runtime question; see IsInstructionSetSupported() in sample_conversion.h.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define FLEXASIO_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC allows the use of any intrinsic regardless of the target architecture.
+#define FLEXASIO_TARGET_AVX2
+#else
+#define FLEXASIO_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FLEXASIO_SIMD_SSE2
+#endif
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define FLEXASIO_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+namespace flexasio {
+
+#ifdef FLEXASIO_SIMD_X86
+	// Whether both the CPU and the OS support AVX2. Kernels marked FLEXASIO_TARGET_AVX2 must only run if this is true.
+	inline bool HasAvx2() {
+#ifdef _MSC_VER
+		int cpuInfo[4];
+		__cpuid(cpuInfo, 0);
+		if (cpuInfo[0] < 7) return false;
+		__cpuid(cpuInfo, 1);
+		constexpr int osxsave = 1 << 27;
+		constexpr int avx = 1 << 28;
+		if ((cpuInfo[2] & (osxsave | avx)) != (osxsave | avx)) return false;
+		// Make sure the OS saves the YMM registers on context switches.
+		if ((_xgetbv(0) & 0x6) != 0x6) return false;
+		__cpuidex(cpuInfo, 7, 0);
+		constexpr int avx2 = 1 << 5;
+		return (cpuInfo[1] & avx2) != 0;
+#else
+		return __builtin_cpu_supports("avx2");
+#endif
+	}
+#endif
+
+}
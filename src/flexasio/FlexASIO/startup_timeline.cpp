@@ -0,0 +1,114 @@
+#include "startup_timeline.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+#include "log.h"
+
+namespace flexasio {
+
+	namespace {
+
+		double ToMilliseconds(std::chrono::steady_clock::duration duration) {
+			return std::chrono::duration<double, std::milli>(duration).count();
+		}
+
+		int64_t ToMicroseconds(std::chrono::steady_clock::duration duration) {
+			return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+		}
+
+		std::string EscapeJsonString(std::string_view str) {
+			std::string result;
+			for (const auto c : str) {
+				if (c == '"' || c == '\\') result += '\\';
+				if (static_cast<unsigned char>(c) < 0x20) continue;
+				result += c;
+			}
+			return result;
+		}
+
+	}
+
+	StartupTimeline::Span::Span(StartupTimeline& startupTimeline, std::string_view name) :
+		startupTimeline(startupTimeline), recordIndex(startupTimeline.Begin(name)) {}
+
+	StartupTimeline::Span::~Span() {
+		startupTimeline.End(recordIndex);
+	}
+
+	StartupTimeline::StartupTimeline() {
+		records.reserve(64);
+	}
+
+	size_t StartupTimeline::Begin(std::string_view name) {
+		const auto now = Now();
+		std::scoped_lock lock(mutex);
+		if (finished || records.size() >= maxRecordCount) return noRecord;
+		records.push_back({ .name = name, .threadId = std::this_thread::get_id(), .start = now, .end = std::nullopt });
+		return records.size() - 1;
+	}
+
+	void StartupTimeline::End(size_t recordIndex) {
+		if (recordIndex == noRecord) return;
+		const auto now = Now();
+		std::scoped_lock lock(mutex);
+		records[recordIndex].end = now;
+	}
+
+	void StartupTimeline::Finish(const std::optional<std::filesystem::path>& traceEventPath) {
+		const auto endTime = Now();
+		std::scoped_lock lock(mutex);
+		if (finished) return;
+		finished = true;
+		if (IsLoggingEnabled()) LogTimeline(endTime);
+		if (traceEventPath.has_value()) {
+			try {
+				WriteTraceEvents(*traceEventPath);
+			}
+			catch (const std::exception& exception) {
+				Log() << "Unable to write startup trace events: " << exception.what();
+			}
+		}
+	}
+
+	void StartupTimeline::LogTimeline(std::chrono::steady_clock::duration endTime) const {
+		std::stringstream timeline;
+		timeline << std::fixed << std::setprecision(2);
+		timeline << "Startup timeline (" << ToMilliseconds(endTime) << " ms from driver instantiation to start):";
+		for (auto record = records.begin(); record != records.end(); ++record) {
+			if (!record->end.has_value()) continue;
+			// Records are in start order, so the spans that enclose this one are the ones before it that end after it.
+			const auto depth = std::count_if(records.begin(), record, [&](const Record& other) {
+				return other.threadId == record->threadId && (!other.end.has_value() || *other.end >= *record->end);
+			});
+			timeline << "\n" << std::string(2 * size_t(depth + 1), ' ') << "[+" << ToMilliseconds(record->start) << " ms] "
+				<< record->name << ": " << ToMilliseconds(*record->end - record->start) << " ms";
+		}
+		Log() << timeline.str();
+	}
+
+	void StartupTimeline::WriteTraceEvents(const std::filesystem::path& path) const {
+		std::ofstream file(path, std::ios::out | std::ios::trunc);
+		if (!file) throw std::runtime_error("unable to open file");
+
+		std::map<std::thread::id, size_t> threadIndexes;
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		bool first = true;
+		for (const auto& record : records) {
+			if (!record.end.has_value()) continue;
+			const auto threadIndex = threadIndexes.try_emplace(record.threadId, threadIndexes.size()).first->second;
+			if (!first) file << ",";
+			first = false;
+			file << "\n{\"name\":\"" << EscapeJsonString(record.name) << "\",\"cat\":\"startup\",\"ph\":\"X\",\"ts\":" << ToMicroseconds(record.start)
+				<< ",\"dur\":" << ToMicroseconds(*record.end - record.start) << ",\"pid\":0,\"tid\":" << threadIndex << "}";
+		}
+		file << "\n]}\n";
+		if (!file) throw std::runtime_error("unable to write file");
+		Log() << "Wrote startup trace events to " << path;
+	}
+
+}
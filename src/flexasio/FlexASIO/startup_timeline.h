@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace flexasio {
+
+	// Records how long each phase of driver bring-up takes (from instantiation to the first start()), so that slow
+	// startups can be attributed to a specific phase. Phases are measured using scoped spans, which can be nested.
+	class StartupTimeline final {
+	public:
+		class Span final {
+		public:
+			Span(StartupTimeline&, std::string_view name);
+			Span(const Span&) = delete;
+			Span(Span&&) = delete;
+			~Span();
+
+		private:
+			StartupTimeline& startupTimeline;
+			const size_t recordIndex;
+		};
+
+		StartupTimeline();
+		StartupTimeline(const StartupTimeline&) = delete;
+		StartupTimeline(StartupTimeline&&) = delete;
+
+		// `name` must outlive the StartupTimeline (typically, a string literal).
+		[[nodiscard]] Span Measure(std::string_view name) { return Span(*this, name); }
+		template <typename Functor>
+		decltype(auto) Measure(std::string_view name, Functor functor) {
+			const Span span(*this, name);
+			return functor();
+		}
+
+		// Logs the timeline as a single record and, if `traceEventPath` is set, writes it there in the Chrome trace event
+		// format (which can be opened in chrome://tracing or https://ui.perfetto.dev). Spans are not recorded anymore
+		// afterwards. Only the first call does anything.
+		void Finish(const std::optional<std::filesystem::path>& traceEventPath);
+
+	private:
+		struct Record final {
+			std::string_view name;
+			std::thread::id threadId;
+			std::chrono::steady_clock::duration start;
+			std::optional<std::chrono::steady_clock::duration> end;
+		};
+
+		static constexpr size_t noRecord = SIZE_MAX;
+		// Some phases can happen any number of times before start() (e.g. OpenStream() while probing latencies).
+		static constexpr size_t maxRecordCount = 1000;
+
+		size_t Begin(std::string_view name);
+		void End(size_t recordIndex);
+		std::chrono::steady_clock::duration Now() const { return std::chrono::steady_clock::now() - startTime; }
+
+		void LogTimeline(std::chrono::steady_clock::duration endTime) const;
+		void WriteTraceEvents(const std::filesystem::path&) const;
+
+		const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+		std::mutex mutex;
+		std::vector<Record> records;
+		bool finished = false;
+	};
+
+}
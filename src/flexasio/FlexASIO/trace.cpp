@@ -0,0 +1,117 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+#include "log.h"
+
+namespace flexasio {
+
+	namespace {
+
+		// Same limit as the log file, to prevent accidental disk space exhaustion if anomalies keep happening.
+		constexpr std::uintmax_t maxTraceFileSize = 1024 * 1024 * 1024;
+
+		template <typename T> void ReadBinary(std::istream& stream, T* data, size_t count) {
+			stream.read(reinterpret_cast<char*>(data), std::streamsize(count * sizeof(T)));
+			if (!stream) throw std::runtime_error("unexpected end of trace file");
+		}
+
+	}
+
+	std::optional<CallbackTraceDump> ReadCallbackTraceDump(std::istream& stream) {
+		if (stream.peek() == std::istream::traits_type::eof()) return std::nullopt;
+
+		CallbackTraceDump dump;
+		ReadBinary(stream, &dump.header, 1);
+		if (memcmp(dump.header.magic, CallbackTraceDumpHeader::expectedMagic, sizeof(dump.header.magic)) != 0)
+			throw std::runtime_error("not a FlexASIO trace file");
+		if (dump.header.version != CallbackTraceDumpHeader::currentVersion)
+			throw std::runtime_error("unsupported trace file version " + std::to_string(dump.header.version));
+
+		dump.records.resize(dump.header.recordCount);
+		ReadBinary(stream, dump.records.data(), dump.records.size());
+		return dump;
+	}
+
+	CallbackTracer::CallbackTracer(const Options& options, const double sampleRate, const size_t bufferSizeInFrames) :
+		path(options.path), sampleRate(sampleRate), bufferSizeInFrames(bufferSizeInFrames),
+		dumpRecordCount(std::max<size_t>(1, size_t(std::ceil(options.durationSeconds * sampleRate / double(bufferSizeInFrames))))),
+		ring(std::make_unique<CallbackTraceRecord[]>(ringSize)) {
+		Log() << "Enabling stream callback tracing to " << path << ", keeping " << dumpRecordCount << " records (" << options.durationSeconds << " seconds)";
+		dumperThread = std::thread([this] { RunDumper(); });
+	}
+
+	CallbackTracer::~CallbackTracer() {
+		// Note: if the dumper thread is busy, it will pick up the stop request after it's done with the current dump.
+		triggerPosition = stopTrigger;
+		triggerPosition.notify_one();
+		dumperThread.join();
+	}
+
+	void CallbackTracer::Record(const CallbackTraceRecord& record, const bool anomaly) {
+		const auto position = writePosition.load(std::memory_order_relaxed);
+		// If the dumper takes so long to copy the records that we are about to overwrite them, drop the new record instead.
+		const auto pendingTriggerPosition = triggerPosition.load(std::memory_order_acquire);
+		if (pendingTriggerPosition < stopTrigger && position >= pendingTriggerPosition + dumpRecordCount) return;
+		ring[position % ringSize] = record;
+		writePosition.store(position + 1, std::memory_order_release);
+
+		if (!anomaly || position < nextTriggerPosition) return;
+		nextTriggerPosition = position + dumpRecordCount;
+		auto expected = noTrigger;
+		// If the dumper is still busy with the previous dump, this anomaly will have to go unrecorded.
+		if (triggerPosition.compare_exchange_strong(expected, position + 1))
+			triggerPosition.notify_one();
+	}
+
+	void CallbackTracer::RunDumper() {
+		for (;;) {
+			triggerPosition.wait(noTrigger);
+			const auto endPosition = triggerPosition.load();
+			if (endPosition == stopTrigger) break;
+
+			const auto beginPosition = endPosition - (std::min)(endPosition, dumpRecordCount);
+			std::vector<CallbackTraceRecord> records;
+			records.reserve(endPosition - beginPosition);
+			for (auto position = beginPosition; position < endPosition; ++position)
+				records.push_back(ring[position % ringSize]);
+			// Lets the recording thread know that it can reuse these records.
+			auto expected = endPosition;
+			triggerPosition.compare_exchange_strong(expected, noTrigger, std::memory_order_release);
+
+			try {
+				Dump(records);
+			}
+			catch (const std::exception& exception) {
+				Log() << "Unable to write stream callback trace: " << exception.what();
+			}
+		}
+	}
+
+	void CallbackTracer::Dump(const std::vector<CallbackTraceRecord>& records) {
+		std::error_code fileSizeError;
+		const auto fileSize = std::filesystem::file_size(path, fileSizeError);
+		if (!fileSizeError && fileSize >= maxTraceFileSize)
+			throw std::runtime_error("trace file is too large");
+
+		Log() << "Stream callback anomaly detected, dumping " << records.size() << " trace records to " << path;
+		CallbackTraceDumpHeader header = { 0 };
+		memcpy(header.magic, CallbackTraceDumpHeader::expectedMagic, sizeof(header.magic));
+		header.version = CallbackTraceDumpHeader::currentVersion;
+		header.bufferSizeInFrames = uint32_t(bufferSizeInFrames);
+		header.sampleRate = sampleRate;
+		header.recordCount = records.size();
+
+		std::ofstream stream(path, std::ios::binary | std::ios::app);
+		stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		stream.write(reinterpret_cast<const char*>(records.data()), std::streamsize(records.size() * sizeof(CallbackTraceRecord)));
+		stream.close();
+		if (!stream) throw std::runtime_error("I/O error while writing trace file");
+	}
+
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace flexasio {
+
+	// One record per stream callback. This is also the on-disk format, so it must not depend on the platform.
+	struct CallbackTraceRecord final {
+		// Steady clock, arbitrary origin.
+		int64_t entryTimeNanoseconds;
+		// PortAudio stream callback time info, NaN if PortAudio did not provide it.
+		double inputBufferAdcTime;
+		double currentTime;
+		double outputBufferDacTime;
+		int64_t callbackDurationNanoseconds;
+		int64_t bufferSwitchDurationNanoseconds;
+		int64_t outputReadyWaitNanoseconds;
+		uint32_t frameCount;
+		// PaStreamCallbackFlags
+		uint32_t statusFlags;
+	};
+	static_assert(sizeof(CallbackTraceRecord) == 64);
+
+	// A trace file is a sequence of dumps, each of which is a header followed by `recordCount` records. The last record of
+	// each dump is the one that triggered it.
+	struct CallbackTraceDumpHeader final {
+		static constexpr char expectedMagic[8] = { 'F', 'L', 'X', 'T', 'R', 'A', 'C', 'E' };
+		static constexpr uint32_t currentVersion = 1;
+
+		char magic[8];
+		uint32_t version;
+		uint32_t bufferSizeInFrames;
+		double sampleRate;
+		uint64_t recordCount;
+	};
+	static_assert(sizeof(CallbackTraceDumpHeader) == 32);
+
+	struct CallbackTraceDump final {
+		CallbackTraceDumpHeader header;
+		std::vector<CallbackTraceRecord> records;
+	};
+
+	// Returns std::nullopt on clean end of file.
+	std::optional<CallbackTraceDump> ReadCallbackTraceDump(std::istream&);
+
+	// A "flight recorder" for the stream callback. Recording is cheap and real-time safe; when an anomaly is recorded,
+	// the last `durationSeconds` worth of records are appended to the trace file by a background thread.
+	class CallbackTracer final {
+	public:
+		struct Options final {
+			std::filesystem::path path;
+			double durationSeconds;
+		};
+
+		CallbackTracer(const Options&, double sampleRate, size_t bufferSizeInFrames);
+		CallbackTracer(const CallbackTracer&) = delete;
+		CallbackTracer(CallbackTracer&&) = delete;
+		~CallbackTracer();
+
+		// Must only be called from one thread at a time (i.e. the stream callback).
+		void Record(const CallbackTraceRecord&, bool anomaly);
+
+		// Heap memory accessed by Record().
+		std::span<const std::byte> GetMemoryRange() const { return std::as_bytes(std::span(ring.get(), ringSize)); }
+
+	private:
+		static constexpr size_t noTrigger = SIZE_MAX;
+		static constexpr size_t stopTrigger = SIZE_MAX - 1;
+
+		void RunDumper();
+		void Dump(const std::vector<CallbackTraceRecord>&);
+
+		const std::filesystem::path path;
+		const double sampleRate;
+		const size_t bufferSizeInFrames;
+		const size_t dumpRecordCount;
+		// Twice as large as what we dump, so that the callback does not overwrite records while they are being copied.
+		const size_t ringSize = 2 * dumpRecordCount;
+		const std::unique_ptr<CallbackTraceRecord[]> ring;
+
+		std::atomic<size_t> writePosition = 0;
+		// Only accessed by the recording thread. Prevents dumps from overlapping.
+		size_t nextTriggerPosition = 0;
+		// Write position just after the anomalous record, or one of the special values above.
+		std::atomic<size_t> triggerPosition = noTrigger;
+
+		std::thread dumperThread;
+	};
+
+}
@@ -0,0 +1,296 @@
+// Simulates device aggregation (as used in split duplex mode, or when several devices are listed) and reports how well
+// the drift between the device clocks is compensated, as well as the cost and quality of the resampler involved.
+//
+// The master device is output-only. An additional input device captures a sine wave, and the downstream callback plays a
+// sine wave to an additional output device. All three streams fire callbacks at the pace of their own (simulated) clock,
+// each callback being late by a random amount of time. The audio delivered to the downstream callback and to the output
+// device is then checked against a clean sine wave at the frequency it should have after resampling, one window at a
+// time.
+
+#include "../FlexASIO/aggregator.h"
+#include "../FlexASIO/log.h"
+#include "../FlexASIO/resampler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <numbers>
+#include <random>
+#include <span>
+#include <vector>
+
+namespace flexasio {
+	namespace {
+
+		constexpr double sampleRate = 48000;
+		constexpr size_t framesPerBuffer = 256;
+		constexpr double sineFrequency = 1000;
+		constexpr double sineAmplitude = 0.5;
+		// Mean of the (exponentially distributed) amount of time callbacks are late by.
+		constexpr auto meanLateness = std::chrono::microseconds(300);
+		constexpr auto simulatedDuration = std::chrono::minutes(20);
+		// Gives the control loop time to settle before we start measuring.
+		constexpr auto settlingDuration = std::chrono::seconds(60);
+		// Short enough that slow variations in timing (which the control loop is expected to cause) are not mistaken for
+		// noise, but long enough to catch glitches.
+		constexpr size_t analysisWindowFrames = 4096;
+		// Input device clock rate relative to the master clock, minus one. The output device drifts the other way.
+		constexpr double drifts[] = { 0, 50e-6, -50e-6, 500e-6 };
+
+		class SimulatedClock final : public Clock {
+		public:
+			int64_t GetTimeNanoseconds() const override { return timeNanoseconds; }
+			int64_t timeNanoseconds = 0;
+		};
+
+		double GetSignalToNoiseRatioDecibels(double signalPower, double noisePower) {
+			return 10 * std::log10(signalPower / noisePower);
+		}
+
+		// Fits a sine wave of known frequency (but unknown amplitude and phase) to one window of samples at a time, and
+		// keeps track of the worst ratio between the sine wave and the residual.
+		class SineAnalyzer final {
+		public:
+			explicit SineAnalyzer(double frequency) : angularFrequency(2 * std::numbers::pi * frequency / sampleRate) {
+				window.reserve(analysisWindowFrames);
+			}
+
+			void Process(std::span<const float> samples) {
+				for (const auto sample : samples) {
+					window.push_back(sample);
+					if (window.size() == analysisWindowFrames) Analyze();
+				}
+			}
+
+			double GetMinSignalToNoiseRatioDecibels() const { return minSignalToNoiseRatioDecibels; }
+
+		private:
+			void Analyze() {
+				// Least squares fit of `cosine * cos(phase) + sine * sin(phase)`.
+				double cosineCosine = 0, sineSine = 0, cosineSine = 0, sampleCosine = 0, sampleSine = 0;
+				for (size_t index = 0; index < window.size(); ++index) {
+					const auto phase = angularFrequency * double(frameIndex + index);
+					const auto cosine = std::cos(phase);
+					const auto sine = std::sin(phase);
+					cosineCosine += cosine * cosine;
+					sineSine += sine * sine;
+					cosineSine += cosine * sine;
+					sampleCosine += window[index] * cosine;
+					sampleSine += window[index] * sine;
+				}
+				const auto determinant = cosineCosine * sineSine - cosineSine * cosineSine;
+				const auto cosine = (sampleCosine * sineSine - sampleSine * cosineSine) / determinant;
+				const auto sine = (sampleSine * cosineCosine - sampleCosine * cosineSine) / determinant;
+				double noisePower = 0;
+				for (size_t index = 0; index < window.size(); ++index) {
+					const auto phase = angularFrequency * double(frameIndex + index);
+					const auto residual = window[index] - (cosine * std::cos(phase) + sine * std::sin(phase));
+					noisePower += residual * residual;
+				}
+				noisePower /= double(window.size());
+				const auto signalPower = (cosine * cosine + sine * sine) / 2;
+				minSignalToNoiseRatioDecibels = (std::min)(minSignalToNoiseRatioDecibels, GetSignalToNoiseRatioDecibels(signalPower, noisePower));
+				frameIndex += window.size();
+				window.clear();
+			}
+
+			const double angularFrequency;
+			std::vector<float> window;
+			int64_t frameIndex = 0;
+			double minSignalToNoiseRatioDecibels = INFINITY;
+		};
+
+		// Skips the settling time, and only analyzes whole windows past it, so that windows line up with the sine wave phase.
+		class SettledSineAnalyzer final {
+		public:
+			explicit SettledSineAnalyzer(double frequency) : analyzer(frequency) {}
+
+			void Process(std::span<const float> samples) {
+				const auto skipFrameCount = (std::min)(samples.size(), size_t((std::max)(int64_t(0), settlingFrameCount - frameCount)));
+				analyzer.Process(samples.subspan(skipFrameCount));
+				frameCount += samples.size();
+			}
+
+			double GetMinSignalToNoiseRatioDecibels() const { return analyzer.GetMinSignalToNoiseRatioDecibels(); }
+
+		private:
+			static int64_t GetSettlingFrameCount() {
+				const auto settlingFrameCount = int64_t(std::chrono::duration<double>(settlingDuration).count() * sampleRate);
+				return settlingFrameCount - settlingFrameCount % analysisWindowFrames;
+			}
+
+			SineAnalyzer analyzer;
+			const int64_t settlingFrameCount = GetSettlingFrameCount();
+			int64_t frameCount = 0;
+		};
+
+		float GetSineSample(int64_t frameIndex) {
+			return float(sineAmplitude * std::sin(2 * std::numbers::pi * sineFrequency * double(frameIndex) / sampleRate));
+		}
+
+		struct DownstreamState final {
+			SettledSineAnalyzer* inputAnalyzer;
+			int64_t outputFrameCount = 0;
+		};
+
+		int DownstreamCallback(const void* input, void* output, unsigned long frameCount, const PaStreamCallbackTimeInfo*, PaStreamCallbackFlags, void* userData) {
+			auto& state = *static_cast<DownstreamState*>(userData);
+			state.inputAnalyzer->Process({ static_cast<const float* const*>(input)[0], frameCount });
+			// Channel 0 is the master device, channel 1 the additional output device.
+			const auto outputSamples = static_cast<float* const*>(output);
+			for (unsigned long frameIndex = 0; frameIndex < frameCount; ++frameIndex) {
+				outputSamples[0][frameIndex] = 0;
+				outputSamples[1][frameIndex] = GetSineSample(state.outputFrameCount++);
+			}
+			return paContinue;
+		}
+
+		void RunAggregator(double drift) {
+			const auto inputDeviceRate = 1 + drift;
+			const auto outputDeviceRate = 1 - drift;
+			// The input device clock runs faster by `drift`, so the sine wave it captures plays back faster by the same
+			// amount. Conversely, the output device consumes samples faster than the master produces them.
+			SettledSineAnalyzer inputAnalyzer(sineFrequency * inputDeviceRate);
+			SettledSineAnalyzer outputAnalyzer(sineFrequency / outputDeviceRate);
+			DownstreamState downstreamState{ .inputAnalyzer = &inputAnalyzer };
+
+			Aggregator aggregator({
+				.masterInputChannelCount = 0,
+				.masterOutputChannelCount = 1,
+				.inputSampleType = ASIOSTFloat32LSB,
+				.outputSampleType = ASIOSTFloat32LSB,
+				.inputDevices = { { .name = "simulated", .channelCount = 1, .sampleType = ASIOSTFloat32LSB } },
+				.outputDevices = { { .name = "simulated", .channelCount = 1, .sampleType = ASIOSTFloat32LSB } },
+				.sampleRate = sampleRate,
+				.framesPerBuffer = framesPerBuffer,
+				.safetyMarginFrames = framesPerBuffer,
+				.downstreamCallback = DownstreamCallback,
+				.downstreamUserData = &downstreamState,
+				});
+			SimulatedClock clock;
+			aggregator.Start(clock);
+
+			std::vector<float> inputDeviceBuffer(framesPerBuffer), outputDeviceBuffer(framesPerBuffer), masterBuffer(framesPerBuffer);
+			const float* const inputDevice[] = { inputDeviceBuffer.data() };
+			float* outputDevice[] = { outputDeviceBuffer.data() };
+			float* master[] = { masterBuffer.data() };
+
+			std::mt19937 random;
+			std::exponential_distribution<double> lateness(1.0 / double(std::chrono::nanoseconds(meanLateness).count()));
+			// Start at an arbitrary time, far enough from zero to catch precision issues.
+			const auto startTimeNanoseconds = int64_t(1) << 50;
+			const auto bufferDurationNanoseconds = 1e9 * framesPerBuffer / sampleRate;
+			struct SimulatedStream final {
+				double rate;
+				int64_t callbackCount = 0;
+				int64_t nextCallbackTime = 0;
+			};
+			SimulatedStream masterStream{ .rate = 1 }, inputDeviceStream{ .rate = inputDeviceRate }, outputDeviceStream{ .rate = outputDeviceRate };
+			const auto scheduleNextCallback = [&](SimulatedStream& stream) {
+				const auto callbackTime = startTimeNanoseconds + int64_t(double(stream.callbackCount + 1) * bufferDurationNanoseconds / stream.rate) + int64_t(lateness(random));
+				stream.nextCallbackTime = (std::max)(stream.nextCallbackTime, callbackTime);
+			};
+			for (auto stream : { &masterStream, &inputDeviceStream, &outputDeviceStream }) scheduleNextCallback(*stream);
+
+			int64_t inputFrameIndex = 0;
+			const auto endTimeNanoseconds = startTimeNanoseconds + std::chrono::nanoseconds(simulatedDuration).count();
+			while (clock.timeNanoseconds < endTimeNanoseconds) {
+				auto& stream = *(std::min)({ &masterStream, &inputDeviceStream, &outputDeviceStream }, [](const SimulatedStream* lhs, const SimulatedStream* rhs) { return lhs->nextCallbackTime < rhs->nextCallbackTime; });
+				clock.timeNanoseconds = stream.nextCallbackTime;
+				if (&stream == &masterStream)
+					Aggregator::MasterStreamCallback(nullptr, master, framesPerBuffer, nullptr, 0, &aggregator);
+				else if (&stream == &inputDeviceStream) {
+					for (auto& sample : inputDeviceBuffer) sample = GetSineSample(inputFrameIndex++);
+					Aggregator::DeviceStreamCallback(inputDevice, nullptr, framesPerBuffer, nullptr, 0, aggregator.GetInputDeviceUserData(0));
+				}
+				else {
+					Aggregator::DeviceStreamCallback(nullptr, outputDevice, framesPerBuffer, nullptr, 0, aggregator.GetOutputDeviceUserData(0));
+					outputAnalyzer.Process(outputDeviceBuffer);
+				}
+				++stream.callbackCount;
+				scheduleNextCallback(stream);
+			}
+
+			std::cout << std::fixed << std::setprecision(1) << drift * 1e6;
+			for (const auto& [queue, analyzer] : { std::pair(&aggregator.GetInputDeviceQueue(0), &inputAnalyzer), std::pair(&aggregator.GetOutputDeviceQueue(0), &outputAnalyzer) }) {
+				const auto statistics = queue->GetStatistics();
+				std::cout << "\t" << statistics.drift * 1e6 << "\t" << statistics.underrunCount << "\t" << statistics.overflowCount << "\t" << analyzer->GetMinSignalToNoiseRatioDecibels();
+			}
+			std::cout << std::endl;
+		}
+
+		void RunResampler(InstructionSet instructionSet) {
+			constexpr size_t channelCount = 2;
+			constexpr size_t outputFrameCount = 1 << 20;
+			constexpr double ratio = 1 + 100e-6;
+			constexpr double frequencies[] = { 1000, 10000, 18000 };
+
+			const Resampler resampler({ .instructionSet = instructionSet });
+			std::cout << GetInstructionSetString(instructionSet);
+
+			const auto inputFrameCount = Resampler::GetInputFrameCount(0, ratio, outputFrameCount);
+			std::vector<std::vector<float>> input(channelCount, std::vector<float>(inputFrameCount));
+			std::vector<std::vector<float>> output(channelCount, std::vector<float>(outputFrameCount));
+			std::vector<const float*> inputPointers;
+			std::vector<float*> outputPointers;
+			for (size_t channelIndex = 0; channelIndex < channelCount; ++channelIndex) {
+				inputPointers.push_back(input[channelIndex].data());
+				outputPointers.push_back(output[channelIndex].data());
+			}
+
+			for (const auto frequency : frequencies) {
+				const auto angularFrequency = 2 * std::numbers::pi * frequency / sampleRate;
+				for (auto& channel : input)
+					for (size_t frameIndex = 0; frameIndex < inputFrameCount; ++frameIndex)
+						channel[frameIndex] = float(sineAmplitude * std::sin(angularFrequency * double(frameIndex)));
+
+				const auto startTime = std::chrono::steady_clock::now();
+				resampler.Resample(inputPointers, 0, ratio, outputPointers, outputFrameCount);
+				const auto duration = std::chrono::steady_clock::now() - startTime;
+
+				double noisePower = 0;
+				for (size_t frameIndex = 0; frameIndex < outputFrameCount; ++frameIndex) {
+					const auto expected = sineAmplitude * std::sin(angularFrequency * (double(frameIndex) * ratio + Resampler::delayInFrames));
+					const auto residual = output[0][frameIndex] - expected;
+					noisePower += residual * residual;
+				}
+				noisePower /= outputFrameCount;
+				std::cout << "\t" << std::fixed << std::setprecision(2) << std::chrono::duration<double, std::nano>(duration).count() / (outputFrameCount * channelCount)
+					<< "\t" << std::setprecision(1) << GetSignalToNoiseRatioDecibels(sineAmplitude * sineAmplitude / 2, noisePower);
+			}
+			std::cout << std::endl;
+		}
+
+		void BenchmarkMain() {
+			if (IsLoggingEnabled())
+				std::cerr << "WARNING: FlexASIO logging is enabled. This will slow down the benchmark considerably. Remove the FlexASIO.log file from your user directory to disable logging." << std::endl;
+
+			std::cout << "# Resampler, " << Resampler::tapCount << " taps, " << Resampler::phaseCount << " phases" << std::endl;
+			std::cout << "instruction set\t1 kHz (ns/sample)\tSNR (dB)\t10 kHz (ns/sample)\tSNR (dB)\t18 kHz (ns/sample)\tSNR (dB)" << std::endl;
+			for (const auto instructionSet : { InstructionSet::SCALAR, InstructionSet::SSE2, InstructionSet::AVX2, InstructionSet::NEON })
+				if (IsInstructionSetSupported(instructionSet)) RunResampler(instructionSet);
+
+			std::cout << std::endl << "# Aggregation, " << framesPerBuffer << " frames at " << sampleRate << " Hz, "
+				<< std::chrono::duration<double>(simulatedDuration).count() << " simulated seconds each, ignoring the first "
+				<< std::chrono::duration<double>(settlingDuration).count() << " seconds" << std::endl;
+			std::cout << "drift (ppm)\tinput estimated drift (ppm)\tunderruns\toverflows\tworst SNR (dB)\toutput estimated drift (ppm)\tunderruns\toverflows\tworst SNR (dB)" << std::endl;
+			for (const auto drift : drifts) RunAggregator(drift);
+		}
+
+	}
+}
+
+int main(int, char**) {
+	try {
+		::flexasio::BenchmarkMain();
+	}
+	catch (const std::exception& exception) {
+		std::cerr << "ERROR: " << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
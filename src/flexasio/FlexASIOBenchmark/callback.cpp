@@ -0,0 +1,151 @@
+// Measures the cost of the FlexASIO stream callback in isolation, i.e. without any audio device, PortAudio host API or
+// ASIO host application in the way. The engine is driven directly with synthetic PortAudio buffers, and the ASIO host is
+// modeled as a no-op bufferSwitch() that immediately signals OutputReady.
+
+#include "../FlexASIO/engine.h"
+#include "../FlexASIO/log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+namespace flexasio {
+	namespace {
+
+		struct SampleType final {
+			std::string_view name;
+			size_t size;
+		};
+		constexpr SampleType sampleTypes[] = {
+			{ "Float32", 4 },
+			{ "Int32", 4 },
+			{ "Int24", 3 },
+			{ "Int16", 2 },
+		};
+		constexpr int channelCounts[] = { 2, 4, 8, 16, 32, 64, 128, 256 };
+		constexpr long bufferSizesInFrames[] = { 16, 32, 64, 128, 256, 512, 1024, 2048, 4096 };
+
+		// Enough to make the measurement stable without making the full sweep take forever.
+		constexpr int64_t targetSamplesPerRun = int64_t(1) << 25;
+		constexpr int64_t minIterations = 64;
+		constexpr int64_t maxIterations = int64_t(1) << 20;
+		constexpr int64_t warmupIterations = 16;
+
+		Engine* currentEngine = nullptr;
+
+		void BufferSwitch(long, ASIOBool) {
+			currentEngine->OutputReady();
+		}
+		void SampleRateDidChange(ASIOSampleRate) {}
+		ASIOTime* BufferSwitchTimeInfo(ASIOTime* params, long doubleBufferIndex, ASIOBool directProcess) {
+			BufferSwitch(doubleBufferIndex, directProcess);
+			return params;
+		}
+
+		// Emulates the non-interleaved buffers PortAudio passes to the stream callback.
+		class PortAudioBuffers final {
+		public:
+			PortAudioBuffers(int channelCount, size_t bufferSizeInBytes) {
+				storage.reserve(channelCount);
+				pointers.reserve(channelCount);
+				for (int channelIndex = 0; channelIndex < channelCount; ++channelIndex) {
+					auto& buffer = storage.emplace_back(bufferSizeInBytes);
+					pointers.push_back(buffer.data());
+				}
+			}
+
+			std::byte** Get() { return pointers.data(); }
+
+		private:
+			std::vector<std::vector<std::byte>> storage;
+			std::vector<std::byte*> pointers;
+		};
+
+		struct Result final {
+			int64_t iterations;
+			double nanosecondsPerCallback;
+			double nanosecondsPerSample;
+		};
+
+		Result Run(const int channelCount, const long bufferSizeInFrames, const SampleType& sampleType) {
+			std::vector<ASIOBufferInfo> bufferInfos;
+			for (const auto isInput : { ASIOTrue, ASIOFalse })
+				for (int channelIndex = 0; channelIndex < channelCount; ++channelIndex) {
+					ASIOBufferInfo bufferInfo = { 0 };
+					bufferInfo.isInput = isInput;
+					bufferInfo.channelNum = channelIndex;
+					bufferInfos.push_back(bufferInfo);
+				}
+
+			ASIOCallbacks callbacks = { 0 };
+			callbacks.bufferSwitch = BufferSwitch;
+			callbacks.sampleRateDidChange = SampleRateDidChange;
+			callbacks.bufferSwitchTimeInfo = BufferSwitchTimeInfo;
+
+			const Engine::StreamFormat streamFormat = { .channelCount = channelCount, .sampleSizeInBytes = sampleType.size };
+			Engine engine(48000, bufferInfos.data(), long(bufferInfos.size()), bufferSizeInFrames, callbacks, streamFormat, streamFormat, {}, {}, std::nullopt);
+			currentEngine = &engine;
+
+			const auto bufferSizeInBytes = bufferSizeInFrames * sampleType.size;
+			PortAudioBuffers input(channelCount, bufferSizeInBytes);
+			PortAudioBuffers output(channelCount, bufferSizeInBytes);
+
+			const SteadyClock clock;
+			engine.Start(nullptr, clock, /*hostSupportsOutputReady=*/true);
+
+			const auto callback = [&] {
+				Engine::StreamCallback(input.Get(), output.Get(), bufferSizeInFrames, nullptr, 0, &engine);
+			};
+			for (int64_t iteration = 0; iteration < warmupIterations; ++iteration) callback();
+
+			const auto samplesPerCallback = int64_t(bufferSizeInFrames) * channelCount * 2;
+			const auto iterations = std::clamp(targetSamplesPerRun / samplesPerCallback, minIterations, maxIterations);
+			const auto start = std::chrono::steady_clock::now();
+			for (int64_t iteration = 0; iteration < iterations; ++iteration) callback();
+			const auto end = std::chrono::steady_clock::now();
+
+			engine.Stop();
+			currentEngine = nullptr;
+
+			const auto nanosecondsPerCallback = double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()) / double(iterations);
+			return {
+				.iterations = iterations,
+				.nanosecondsPerCallback = nanosecondsPerCallback,
+				.nanosecondsPerSample = nanosecondsPerCallback / double(samplesPerCallback),
+			};
+		}
+
+		void BenchmarkMain() {
+			if (IsLoggingEnabled())
+				std::cerr << "WARNING: FlexASIO logging is enabled. Results will be dominated by logging overhead. Remove the FlexASIO.log file from your user directory to disable logging." << std::endl;
+
+			std::cout << "# Samples are counted across all input and output channels." << std::endl;
+			std::cout << "type\tchannels\tframes\titerations\tns/callback\tns/sample" << std::endl;
+			for (const auto& sampleType : sampleTypes)
+				for (const auto channelCount : channelCounts)
+					for (const auto bufferSizeInFrames : bufferSizesInFrames) {
+						const auto result = Run(channelCount, bufferSizeInFrames, sampleType);
+						std::cout << sampleType.name << "\t" << channelCount << "\t" << bufferSizeInFrames << "\t" << result.iterations << "\t"
+							<< std::fixed << std::setprecision(1) << result.nanosecondsPerCallback << "\t"
+							<< std::setprecision(3) << result.nanosecondsPerSample << std::endl;
+					}
+		}
+
+	}
+}
+
+int main(int, char**) {
+	try {
+		::flexasio::BenchmarkMain();
+	}
+	catch (const std::exception& exception) {
+		std::cerr << "ERROR: " << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
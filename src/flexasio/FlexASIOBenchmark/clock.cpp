@@ -0,0 +1,203 @@
+// Measures the jitter of the timestamps the engine reports to the ASIO host application through bufferSwitchTimeInfo(),
+// and compares it with naively timestamping each buffer switch with the time at which it happens (which is what FlexASIO
+// used to do, with millisecond resolution). Jitter is the deviation of timestamps from a straight line fitted to them.
+//
+// The engine is driven either from a simulated clock, where each callback is late by a random amount of time, or from
+// the system clock, where callbacks are paced by sleeping and the jitter is whatever the OS scheduler produces.
+
+#include "../FlexASIO/engine.h"
+#include "../FlexASIO/log.h"
+
+#include <dechamps_ASIOUtil/asio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace flexasio {
+	namespace {
+
+		constexpr ASIOSampleRate sampleRate = 48000;
+		constexpr long bufferSizeInFrames = 128;
+		constexpr int channelCount = 2;
+		constexpr size_t sampleSizeInBytes = 4;
+		constexpr auto bufferDuration = std::chrono::nanoseconds(int64_t(1e9 * bufferSizeInFrames / sampleRate));
+		// Gives the clock model time to converge before we start measuring.
+		constexpr auto warmupDuration = std::chrono::seconds(2);
+
+		// Mean of the (exponentially distributed) amount of time simulated callbacks are late by.
+		constexpr auto simulatedMeanLateness = std::chrono::microseconds(300);
+		constexpr auto simulatedDuration = std::chrono::seconds(60);
+		constexpr auto systemDuration = std::chrono::seconds(10);
+
+		class SimulatedClock final : public Clock {
+		public:
+			int64_t GetTimeNanoseconds() const override { return timeNanoseconds; }
+			int64_t timeNanoseconds = 0;
+		};
+
+		struct Timestamps final {
+			// Time at which bufferSwitchTimeInfo() was called.
+			std::vector<int64_t> bufferSwitch;
+			// Time reported by the engine in bufferSwitchTimeInfo().
+			std::vector<int64_t> reported;
+		};
+
+		Engine* currentEngine = nullptr;
+		const Clock* currentClock = nullptr;
+		Timestamps* currentTimestamps = nullptr;
+
+		void BufferSwitch(long, ASIOBool) {
+			currentEngine->OutputReady();
+		}
+		void SampleRateDidChange(ASIOSampleRate) {}
+		long AsioMessage(long selector, long value, void*, double*) {
+			if (selector == kAsioSelectorSupported) return value == kAsioSupportsTimeInfo;
+			return selector == kAsioSupportsTimeInfo;
+		}
+		ASIOTime* BufferSwitchTimeInfo(ASIOTime* params, long doubleBufferIndex, ASIOBool directProcess) {
+			currentTimestamps->bufferSwitch.push_back(currentClock->GetTimeNanoseconds());
+			currentTimestamps->reported.push_back(::dechamps_ASIOUtil::ASIOToInt64(params->timeInfo.systemTime));
+			BufferSwitch(doubleBufferIndex, directProcess);
+			return params;
+		}
+
+		// `waitForCallback(callbackIndex)` is expected to return when it's time to run the callback.
+		Timestamps Run(const Clock& clock, const int64_t callbackCount, const std::function<void(int64_t)>& waitForCallback) {
+			std::vector<ASIOBufferInfo> bufferInfos;
+			for (const auto isInput : { ASIOTrue, ASIOFalse })
+				for (int channelIndex = 0; channelIndex < channelCount; ++channelIndex) {
+					ASIOBufferInfo bufferInfo = { 0 };
+					bufferInfo.isInput = isInput;
+					bufferInfo.channelNum = channelIndex;
+					bufferInfos.push_back(bufferInfo);
+				}
+
+			ASIOCallbacks callbacks = { 0 };
+			callbacks.bufferSwitch = BufferSwitch;
+			callbacks.sampleRateDidChange = SampleRateDidChange;
+			callbacks.asioMessage = AsioMessage;
+			callbacks.bufferSwitchTimeInfo = BufferSwitchTimeInfo;
+
+			const Engine::StreamFormat streamFormat = { .channelCount = channelCount, .sampleSizeInBytes = sampleSizeInBytes };
+			Engine engine(sampleRate, bufferInfos.data(), long(bufferInfos.size()), bufferSizeInFrames, callbacks, streamFormat, streamFormat, {}, {}, std::nullopt);
+
+			std::vector<std::vector<std::byte>> storage(2 * channelCount, std::vector<std::byte>(bufferSizeInFrames * sampleSizeInBytes));
+			std::vector<std::byte*> input, output;
+			for (int channelIndex = 0; channelIndex < channelCount; ++channelIndex) {
+				input.push_back(storage[channelIndex].data());
+				output.push_back(storage[channelCount + channelIndex].data());
+			}
+
+			Timestamps timestamps;
+			timestamps.bufferSwitch.reserve(callbackCount);
+			timestamps.reported.reserve(callbackCount);
+			currentEngine = &engine;
+			currentClock = &clock;
+			currentTimestamps = &timestamps;
+
+			engine.Start(nullptr, clock, /*hostSupportsOutputReady=*/true);
+			for (int64_t callbackIndex = 0; callbackIndex < callbackCount; ++callbackIndex) {
+				waitForCallback(callbackIndex);
+				Engine::StreamCallback(input.data(), output.data(), bufferSizeInFrames, nullptr, 0, &engine);
+			}
+			engine.Stop();
+
+			currentEngine = nullptr;
+			currentClock = nullptr;
+			currentTimestamps = nullptr;
+			return timestamps;
+		}
+
+		struct Jitter final {
+			double rmsNanoseconds;
+			double maxNanoseconds;
+		};
+
+		// Fits a straight line through the timestamps, and returns the deviation from that line.
+		Jitter GetJitter(const std::vector<int64_t>& timestamps, const size_t warmupCount) {
+			const auto count = double(timestamps.size() - warmupCount);
+			const auto firstTimestamp = timestamps[warmupCount];
+			double sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+			for (size_t index = warmupCount; index < timestamps.size(); ++index) {
+				const auto x = double(index);
+				const auto y = double(timestamps[index] - firstTimestamp);
+				sumX += x; sumY += y; sumXX += x * x; sumXY += x * y;
+			}
+			const auto slope = (count * sumXY - sumX * sumY) / (count * sumXX - sumX * sumX);
+			const auto intercept = (sumY - slope * sumX) / count;
+
+			Jitter jitter = { 0, 0 };
+			for (size_t index = warmupCount; index < timestamps.size(); ++index) {
+				const auto deviation = std::abs(double(timestamps[index] - firstTimestamp) - (intercept + slope * double(index)));
+				jitter.rmsNanoseconds += deviation * deviation;
+				jitter.maxNanoseconds = (std::max)(jitter.maxNanoseconds, deviation);
+			}
+			jitter.rmsNanoseconds = std::sqrt(jitter.rmsNanoseconds / count);
+			return jitter;
+		}
+
+		void PrintJitter(std::string_view clockName, std::string_view timestampsName, const std::vector<int64_t>& timestamps, const size_t warmupCount) {
+			const auto jitter = GetJitter(timestamps, warmupCount);
+			std::cout << clockName << "\t" << timestampsName << "\t"
+				<< std::fixed << std::setprecision(1) << jitter.rmsNanoseconds / 1e3 << "\t" << jitter.maxNanoseconds / 1e3 << std::endl;
+		}
+
+		void PrintResults(std::string_view clockName, const Timestamps& timestamps) {
+			const auto warmupCount = size_t(warmupDuration / bufferDuration);
+			std::vector<int64_t> bufferSwitchMilliseconds;
+			for (const auto timestamp : timestamps.bufferSwitch) bufferSwitchMilliseconds.push_back(timestamp / 1000000 * 1000000);
+			PrintJitter(clockName, "buffer switch time, millisecond resolution (before)", bufferSwitchMilliseconds, warmupCount);
+			PrintJitter(clockName, "buffer switch time", timestamps.bufferSwitch, warmupCount);
+			PrintJitter(clockName, "clock model (after)", timestamps.reported, warmupCount);
+		}
+
+		void BenchmarkMain() {
+			if (IsLoggingEnabled())
+				std::cerr << "WARNING: FlexASIO logging is enabled. This will slow down the engine and make system clock results worse. Remove the FlexASIO.log file from your user directory to disable logging." << std::endl;
+
+			std::cout << "# " << bufferSizeInFrames << " frames at " << sampleRate << " Hz, ignoring the first " << std::chrono::duration<double>(warmupDuration).count() << " seconds" << std::endl;
+			std::cout << "clock\ttimestamps\trms jitter (us)\tmax jitter (us)" << std::endl;
+
+			{
+				SimulatedClock clock;
+				std::mt19937 random;
+				std::exponential_distribution<double> lateness(1.0 / double(std::chrono::nanoseconds(simulatedMeanLateness).count()));
+				PrintResults("simulated", Run(clock, simulatedDuration / bufferDuration, [&](int64_t callbackIndex) {
+					// Start at an arbitrary time, far enough from zero to catch precision issues.
+					clock.timeNanoseconds = int64_t(1) << 50;
+					clock.timeNanoseconds += callbackIndex * bufferDuration.count() + int64_t(lateness(random));
+				}));
+			}
+
+			{
+				const SteadyClock clock;
+				const auto startTime = std::chrono::steady_clock::now();
+				PrintResults("system", Run(clock, systemDuration / bufferDuration, [&](int64_t callbackIndex) {
+					std::this_thread::sleep_until(startTime + callbackIndex * bufferDuration);
+				}));
+			}
+		}
+
+	}
+}
+
+int main(int, char**) {
+	try {
+		::flexasio::BenchmarkMain();
+	}
+	catch (const std::exception& exception) {
+		std::cerr << "ERROR: " << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+// Measures the cost of the FlexASIO sample converters for every supported pair of sample types and every instruction
+// set the CPU supports. The scalar code converts one sample at a time, the same way PortAudio's generic converters do,
+// and serves as the baseline that SIMD code is compared against.
+
+#include "../FlexASIO/sample_conversion.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string_view>
+#include <vector>
+
+namespace flexasio {
+	namespace {
+
+		struct SampleType final {
+			std::string_view name;
+			ASIOSampleType asio;
+		};
+		constexpr SampleType sampleTypes[] = {
+			{ "Float32", ASIOSTFloat32LSB },
+			{ "Int32", ASIOSTInt32LSB },
+			{ "Int24", ASIOSTInt24LSB },
+			{ "Int16", ASIOSTInt16LSB },
+		};
+		constexpr InstructionSet instructionSets[] = { InstructionSet::SCALAR, InstructionSet::SSE2, InstructionSet::AVX2, InstructionSet::NEON };
+
+		// Roughly 64 channels of 512 samples, i.e. the amount of data converted in a single callback of a large stream.
+		constexpr size_t sampleCount = 64 * 512;
+		constexpr int64_t iterations = 2000;
+		constexpr int64_t warmupIterations = 100;
+
+		std::vector<std::byte> MakeInput(const SampleType& sampleType) {
+			std::vector<std::byte> input(sampleCount * GetSampleSizeInBytes(sampleType.asio));
+			std::mt19937 random;
+			if (sampleType.asio == ASIOSTFloat32LSB) {
+				std::uniform_real_distribution<float> distribution(-1, 1);
+				for (size_t sampleIndex = 0; sampleIndex < sampleCount; ++sampleIndex) {
+					const auto value = distribution(random);
+					memcpy(input.data() + sampleIndex * sizeof(value), &value, sizeof(value));
+				}
+			}
+			else for (auto& byte : input) byte = std::byte(random());
+			return input;
+		}
+
+		double Run(const SampleType& inputSampleType, const SampleType& outputSampleType, const InstructionSet instructionSet, const bool dither) {
+			SampleConverter converter(inputSampleType.asio, outputSampleType.asio, { .dither = dither, .instructionSet = instructionSet });
+			const auto input = MakeInput(inputSampleType);
+			std::vector<std::byte> output(sampleCount * converter.GetOutputSampleSizeInBytes());
+
+			for (int64_t iteration = 0; iteration < warmupIterations; ++iteration) converter.Convert(input.data(), output.data(), sampleCount);
+			const auto start = std::chrono::steady_clock::now();
+			for (int64_t iteration = 0; iteration < iterations; ++iteration) converter.Convert(input.data(), output.data(), sampleCount);
+			const auto end = std::chrono::steady_clock::now();
+
+			return double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()) / double(iterations * sampleCount);
+		}
+
+		void BenchmarkMain() {
+			std::cout << "# Best instruction set on this CPU: " << GetInstructionSetString(GetBestInstructionSet()) << std::endl;
+			std::cout << "from\tto\tdither\tinstructionSet\tns/sample\tspeedup" << std::endl;
+			for (const auto& inputSampleType : sampleTypes)
+				for (const auto& outputSampleType : sampleTypes) {
+					if (inputSampleType.asio == outputSampleType.asio) continue;
+					for (const auto dither : { false, true }) {
+						if (dither && (inputSampleType.asio != ASIOSTFloat32LSB || outputSampleType.asio == ASIOSTInt32LSB)) continue;
+						double baseline = 0;
+						for (const auto instructionSet : instructionSets) {
+							if (!IsInstructionSetSupported(instructionSet)) continue;
+							const auto nanosecondsPerSample = Run(inputSampleType, outputSampleType, instructionSet, dither);
+							if (instructionSet == InstructionSet::SCALAR) baseline = nanosecondsPerSample;
+							std::cout << inputSampleType.name << "\t" << outputSampleType.name << "\t" << (dither ? "yes" : "no") << "\t" << GetInstructionSetString(instructionSet) << "\t"
+								<< std::fixed << std::setprecision(3) << nanosecondsPerSample << "\t"
+								<< std::setprecision(2) << baseline / nanosecondsPerSample << std::endl;
+						}
+					}
+				}
+		}
+
+	}
+}
+
+int main(int, char**) {
+	try {
+		::flexasio::BenchmarkMain();
+	}
+	catch (const std::exception& exception) {
+		std::cerr << "ERROR: " << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
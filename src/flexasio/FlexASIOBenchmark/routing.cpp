@@ -0,0 +1,91 @@
+// Checks that routing is compiled against the right channel counts when the PortAudio stream only includes some of the
+// channels exposed to the ASIO host application, as is the case when inactive channels are trimmed.
+//
+// The scenario is an 8-channel to 2-channel output downmix where the ASIO host application only creates buffers for the
+// first two channels: the routes from the other six channels must be ignored, even though they are outside of the
+// 2-channel stream as far as the ASIO side is concerned.
+
+#include "../FlexASIO/engine.h"
+#include "../FlexASIO/log.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace flexasio {
+	namespace {
+
+		constexpr int asioChannelCount = 8;
+		constexpr int streamChannelCount = 2;
+		constexpr long bufferSizeInFrames = 64;
+
+		void BufferSwitch(long, ASIOBool) {}
+		void SampleRateDidChange(ASIOSampleRate) {}
+		ASIOTime* BufferSwitchTimeInfo(ASIOTime* params, long, ASIOBool) { return params; }
+
+		std::vector<MixPlan::Route> GetDownmixRoutes() {
+			std::vector<MixPlan::Route> routes;
+			for (int asioChannel = 0; asioChannel < asioChannelCount; ++asioChannel)
+				routes.push_back({ .sourceChannel = asioChannel, .destinationChannel = asioChannel % streamChannelCount, .gain = 1 });
+			return routes;
+		}
+
+		bool CanCompile(std::vector<MixPlan::Route> outputRouting) {
+			std::vector<ASIOBufferInfo> bufferInfos;
+			for (int channelIndex = 0; channelIndex < streamChannelCount; ++channelIndex) {
+				ASIOBufferInfo bufferInfo = { 0 };
+				bufferInfo.isInput = ASIOFalse;
+				bufferInfo.channelNum = channelIndex;
+				bufferInfos.push_back(bufferInfo);
+			}
+			ASIOCallbacks callbacks = { 0 };
+			callbacks.bufferSwitch = BufferSwitch;
+			callbacks.sampleRateDidChange = SampleRateDidChange;
+			callbacks.bufferSwitchTimeInfo = BufferSwitchTimeInfo;
+			try {
+				Engine engine(48000, bufferInfos.data(), long(bufferInfos.size()), bufferSizeInFrames, callbacks,
+					{ .channelCount = 0, .sampleSizeInBytes = 0 },
+					{ .channelCount = streamChannelCount, .asioChannelCount = asioChannelCount, .sampleSizeInBytes = sizeof(float) },
+					{}, { .outputRouting = std::move(outputRouting) }, std::nullopt);
+				return true;
+			}
+			catch (const std::exception& exception) {
+				std::cerr << "Engine construction failed: " << exception.what() << std::endl;
+				return false;
+			}
+		}
+
+		bool TestMain() {
+			bool success = true;
+			const auto check = [&](const std::string& description, bool result) {
+				std::cout << (result ? "PASS" : "FAIL") << ": " << description << std::endl;
+				if (!result) success = false;
+			};
+
+			check("downmix from inactive ASIO channels beyond the trimmed stream", CanCompile(GetDownmixRoutes()));
+
+			auto outOfStream = GetDownmixRoutes();
+			outOfStream.push_back({ .sourceChannel = 1, .destinationChannel = streamChannelCount, .gain = 1 });
+			check("route from an active ASIO channel to a device channel beyond the stream is rejected", !CanCompile(std::move(outOfStream)));
+
+			auto outOfAsio = GetDownmixRoutes();
+			outOfAsio.push_back({ .sourceChannel = asioChannelCount, .destinationChannel = 0, .gain = 1 });
+			check("route from a channel beyond the ASIO channel count is rejected", !CanCompile(std::move(outOfAsio)));
+
+			return success;
+		}
+
+	}
+}
+
+int main(int, char**) {
+	try {
+		if (!::flexasio::TestMain()) return EXIT_FAILURE;
+	}
+	catch (const std::exception& exception) {
+		std::cerr << "ERROR: " << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,176 @@
+// Stress tests the publication of the sample position by the stream callback, by having several threads call
+// GetSamplePosition() in a tight loop while the engine runs callbacks back to back.
+//
+// Checks that every sample position read is consistent, i.e. is one of the (sample position, timestamp) pairs the engine
+// reported to bufferSwitchTimeInfo(), and reports how the duration of the stream callback is affected by readers. The
+// callback never waits for readers, so its duration should not depend on how many there are (no priority inversion).
+
+#include "../FlexASIO/engine.h"
+#include "../FlexASIO/log.h"
+#include "../FlexASIOUtil/histogram.h"
+
+#include <dechamps_ASIOUtil/asio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace flexasio {
+	namespace {
+
+		constexpr ASIOSampleRate sampleRate = 48000;
+		constexpr long bufferSizeInFrames = 32;
+		constexpr int channelCount = 2;
+		constexpr size_t sampleSizeInBytes = 4;
+		constexpr int64_t callbackCount = 200000;
+		constexpr int readerCounts[] = { 0, 1, 2, 4, 8 };
+		// Per reader. Reads beyond that are still done, but are not checked.
+		constexpr size_t maxCheckedReadCount = 1 << 20;
+
+		struct SamplePosition final {
+			int64_t samples;
+			int64_t timestamp;
+		};
+
+		std::vector<SamplePosition>* currentBufferSwitchPositions = nullptr;
+
+		void BufferSwitch(long, ASIOBool) {}
+		void SampleRateDidChange(ASIOSampleRate) {}
+		long AsioMessage(long selector, long value, void*, double*) {
+			if (selector == kAsioSelectorSupported) return value == kAsioSupportsTimeInfo;
+			return selector == kAsioSupportsTimeInfo;
+		}
+		ASIOTime* BufferSwitchTimeInfo(ASIOTime* params, long, ASIOBool) {
+			currentBufferSwitchPositions->push_back({
+				.samples = ::dechamps_ASIOUtil::ASIOToInt64(params->timeInfo.samplePosition),
+				.timestamp = ::dechamps_ASIOUtil::ASIOToInt64(params->timeInfo.systemTime),
+			});
+			return params;
+		}
+
+		struct Result final {
+			uint64_t readCount;
+			uint64_t inconsistentReadCount;
+			Histogram callbackDuration;
+		};
+
+		Result Run(const int readerCount) {
+			std::vector<ASIOBufferInfo> bufferInfos;
+			for (const auto isInput : { ASIOTrue, ASIOFalse })
+				for (int channelIndex = 0; channelIndex < channelCount; ++channelIndex) {
+					ASIOBufferInfo bufferInfo = { 0 };
+					bufferInfo.isInput = isInput;
+					bufferInfo.channelNum = channelIndex;
+					bufferInfos.push_back(bufferInfo);
+				}
+
+			ASIOCallbacks callbacks = { 0 };
+			callbacks.bufferSwitch = BufferSwitch;
+			callbacks.sampleRateDidChange = SampleRateDidChange;
+			callbacks.asioMessage = AsioMessage;
+			callbacks.bufferSwitchTimeInfo = BufferSwitchTimeInfo;
+
+			const Engine::StreamFormat streamFormat = { .channelCount = channelCount, .sampleSizeInBytes = sampleSizeInBytes };
+			Engine engine(sampleRate, bufferInfos.data(), long(bufferInfos.size()), bufferSizeInFrames, callbacks, streamFormat, streamFormat, {}, {}, std::nullopt);
+
+			std::vector<std::vector<std::byte>> storage(2 * channelCount, std::vector<std::byte>(bufferSizeInFrames * sampleSizeInBytes));
+			std::vector<std::byte*> input, output;
+			for (int channelIndex = 0; channelIndex < channelCount; ++channelIndex) {
+				input.push_back(storage[channelIndex].data());
+				output.push_back(storage[channelCount + channelIndex].data());
+			}
+
+			std::vector<SamplePosition> bufferSwitchPositions;
+			bufferSwitchPositions.reserve(callbackCount + 1);
+			currentBufferSwitchPositions = &bufferSwitchPositions;
+
+			const SteadyClock clock;
+			// Without OutputReady, every callback calls bufferSwitchTimeInfo(), including the first one. This makes it easy to
+			// check sample positions against the ones reported there.
+			engine.Start(nullptr, clock, /*hostSupportsOutputReady=*/false);
+
+			std::atomic<bool> stop = false;
+			std::vector<uint64_t> readCounts(readerCount, 0);
+			std::vector<std::vector<SamplePosition>> reads(readerCount);
+			std::vector<std::thread> readers;
+			for (int readerIndex = 0; readerIndex < readerCount; ++readerIndex)
+				readers.emplace_back([&, readerIndex] {
+					auto& readerReads = reads[readerIndex];
+					readerReads.reserve(maxCheckedReadCount);
+					uint64_t readCount = 0;
+					while (!stop) {
+						ASIOSamples samples;
+						ASIOTimeStamp timestamp;
+						engine.GetSamplePosition(&samples, &timestamp);
+						++readCount;
+						if (readerReads.size() < maxCheckedReadCount)
+							readerReads.push_back({ .samples = ::dechamps_ASIOUtil::ASIOToInt64(samples), .timestamp = ::dechamps_ASIOUtil::ASIOToInt64(timestamp) });
+					}
+					readCounts[readerIndex] = readCount;
+				});
+
+			Result result = { 0, 0, {} };
+			for (int64_t callbackIndex = 0; callbackIndex < callbackCount; ++callbackIndex) {
+				const auto start = clock.GetTimeNanoseconds();
+				Engine::StreamCallback(input.data(), output.data(), bufferSizeInFrames, nullptr, 0, &engine);
+				result.callbackDuration.Record(clock.GetTimeNanoseconds() - start);
+			}
+
+			stop = true;
+			for (auto& reader : readers) reader.join();
+			engine.Stop();
+			currentBufferSwitchPositions = nullptr;
+
+			// Readers can also observe the initial sample position, before the first callback.
+			bufferSwitchPositions.push_back({ .samples = 0, .timestamp = 0 });
+			const auto isBefore = [](const SamplePosition& lhs, const SamplePosition& rhs) {
+				return std::tie(lhs.samples, lhs.timestamp) < std::tie(rhs.samples, rhs.timestamp);
+			};
+			std::sort(bufferSwitchPositions.begin(), bufferSwitchPositions.end(), isBefore);
+			for (int readerIndex = 0; readerIndex < readerCount; ++readerIndex) {
+				result.readCount += readCounts[readerIndex];
+				for (const auto& read : reads[readerIndex])
+					if (!std::binary_search(bufferSwitchPositions.begin(), bufferSwitchPositions.end(), read, isBefore)) ++result.inconsistentReadCount;
+			}
+			return result;
+		}
+
+		bool BenchmarkMain() {
+			if (IsLoggingEnabled())
+				std::cerr << "WARNING: FlexASIO logging is enabled. Results will be dominated by logging overhead. Remove the FlexASIO.log file from your user directory to disable logging." << std::endl;
+
+			std::cout << "# " << callbackCount << " callbacks of " << bufferSizeInFrames << " frames, " << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+			std::cout << "readers\treads\tinconsistent reads\tcallback 50% (us)\t99.9% (us)\tmax (us)" << std::endl;
+			bool success = true;
+			for (const auto readerCount : readerCounts) {
+				const auto result = Run(readerCount);
+				std::cout << readerCount << "\t" << result.readCount << "\t" << result.inconsistentReadCount << "\t"
+					<< std::fixed << std::setprecision(3)
+					<< result.callbackDuration.GetValueAtPercentile(50) / 1e3 << "\t"
+					<< result.callbackDuration.GetValueAtPercentile(99.9) / 1e3 << "\t"
+					<< result.callbackDuration.GetMax() / 1e3 << std::endl;
+				if (result.inconsistentReadCount > 0) success = false;
+			}
+			if (!success) std::cerr << "ERROR: inconsistent sample positions were read" << std::endl;
+			return success;
+		}
+
+	}
+}
+
+int main(int, char**) {
+	try {
+		if (!::flexasio::BenchmarkMain()) return EXIT_FAILURE;
+	}
+	catch (const std::exception& exception) {
+		std::cerr << "ERROR: " << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
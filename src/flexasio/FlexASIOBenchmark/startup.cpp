@@ -0,0 +1,167 @@
+// Measures how long it takes to instantiate and initialize the driver (i.e. what an ASIO host application waits for
+// when it loads FlexASIO), using the configuration in the user directory and the actual audio devices.
+//
+// Like most host applications, each run also enumerates the supported sample rates and asks for latencies, which
+// involves probing the audio devices.
+//
+// The first run happens with empty caches in a process that never initialized PortAudio before ("cold"). It is
+// followed by runs where both are warm, and by a run where the caches are deleted but the process is warm, which
+// isolates the effect of the caches from the one-time cost of loading system libraries. Finally, a run happens while
+// another driver instance is alive, so that PortAudio does not need to be initialized again.
+//
+// The driver only initializes the PortAudio host API of the configured backend (see FlexASIO::PortAudioHandle). To show
+// what that saves, the time it takes to initialize and terminate PortAudio directly is then reported, for each host API
+// alone and for all of them.
+
+#include "../FlexASIO/cflexasio.h"
+#include "../FlexASIO/log.h"
+#include "../FlexASIOUtil/portaudio.h"
+#include "../FlexASIOUtil/shell.h"
+#include "../FlexASIOUtil/windows_com.h"
+
+#include <dechamps_ASIOUtil/asiosdk/iasiodrv.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace flexasio {
+	namespace {
+
+		constexpr int warmRunCount = 20;
+		constexpr int portAudioRunCount = 5;
+
+		struct Timings final {
+			double initMilliseconds;
+			double releaseMilliseconds;
+		};
+
+		void DeleteCaches() {
+			// See DeviceCache and ProbeCache.
+			std::filesystem::remove_all(std::filesystem::path(GetLocalAppDataDirectory()) / "FlexASIO");
+		}
+
+		IASIO* CreateInitializedDriver() {
+			auto* const asioDriver = CreateFlexASIO();
+			if (asioDriver == nullptr) throw std::runtime_error("Unable to create driver");
+			if (asioDriver->init(nullptr) != ASIOTrue) {
+				std::string errorMessage(124, '\0');
+				asioDriver->getErrorMessage(errorMessage.data());
+				ReleaseFlexASIO(asioDriver);
+				throw std::runtime_error("Driver initialization failed: " + std::string(errorMessage.c_str()));
+			}
+			return asioDriver;
+		}
+
+		Timings Run() {
+			const auto startTime = std::chrono::steady_clock::now();
+			auto* const asioDriver = CreateInitializedDriver();
+			long inputChannelCount, outputChannelCount;
+			asioDriver->getChannels(&inputChannelCount, &outputChannelCount);
+			for (const auto sampleRate : { 44100.0, 48000.0, 88200.0, 96000.0, 176400.0, 192000.0 }) asioDriver->canSampleRate(sampleRate);
+			long inputLatency, outputLatency;
+			asioDriver->getLatencies(&inputLatency, &outputLatency);
+			const auto initTime = std::chrono::steady_clock::now();
+			ReleaseFlexASIO(asioDriver);
+			const auto releaseTime = std::chrono::steady_clock::now();
+			return {
+				.initMilliseconds = std::chrono::duration<double, std::milli>(initTime - startTime).count(),
+				.releaseMilliseconds = std::chrono::duration<double, std::milli>(releaseTime - initTime).count(),
+			};
+		}
+
+		// The driver instance that is timed shares PortAudio with another instance that stays alive.
+		Timings RunWhileAnotherInstanceIsAlive() {
+			auto* const otherAsioDriver = CreateInitializedDriver();
+			try {
+				const auto timings = Run();
+				ReleaseFlexASIO(otherAsioDriver);
+				return timings;
+			}
+			catch (...) {
+				ReleaseFlexASIO(otherAsioDriver);
+				throw;
+			}
+		}
+
+		// Median over several runs.
+		double GetPortAudioInitializationMilliseconds(std::optional<PaHostApiTypeId> hostApiTypeId) {
+			std::vector<double> milliseconds;
+			for (int runIndex = 0; runIndex < portAudioRunCount; ++runIndex) {
+				RestrictPortAudioHostApi(hostApiTypeId);
+				const auto startTime = std::chrono::steady_clock::now();
+				const auto error = Pa_Initialize();
+				if (error != paNoError) throw std::runtime_error(std::string("Unable to initialize PortAudio: ") + Pa_GetErrorText(error));
+				Pa_Terminate();
+				milliseconds.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count());
+			}
+			RestrictPortAudioHostApi(std::nullopt);
+			std::sort(milliseconds.begin(), milliseconds.end());
+			return milliseconds[milliseconds.size() / 2];
+		}
+
+		void PrintPortAudioTimings() {
+			std::cout << "host API\tPortAudio init + terminate (ms)" << std::endl;
+			std::cout << "all\t" << std::fixed << std::setprecision(2) << GetPortAudioInitializationMilliseconds(std::nullopt) << std::endl;
+			for (const auto hostApiTypeId : { paMME, paDirectSound, paWASAPI, paWDMKS, paASIO }) {
+				if (!RestrictPortAudioHostApi(hostApiTypeId)) continue;
+				std::cout << GetHostApiTypeIdString(hostApiTypeId) << "\t" << std::fixed << std::setprecision(2) << GetPortAudioInitializationMilliseconds(hostApiTypeId) << std::endl;
+			}
+		}
+
+		void PrintTimings(std::string_view name, const Timings& timings) {
+			std::cout << name << "\t" << std::fixed << std::setprecision(2) << timings.initMilliseconds << "\t" << timings.releaseMilliseconds << std::endl;
+		}
+
+		void BenchmarkMain() {
+			if (IsLoggingEnabled())
+				std::cerr << "WARNING: FlexASIO logging is enabled. This will slow down initialization. Remove the FlexASIO.log file from your user directory to disable logging." << std::endl;
+
+			// ASIO host applications typically initialize drivers from their UI thread.
+			const COMInitializer comInitializer(COINIT_APARTMENTTHREADED);
+
+			std::cout << "run\tinit (ms)\trelease (ms)" << std::endl;
+
+			DeleteCaches();
+			PrintTimings("cold", Run());
+
+			std::vector<Timings> warmTimings;
+			for (int runIndex = 0; runIndex < warmRunCount; ++runIndex) warmTimings.push_back(Run());
+			const auto percentile = [&](double fraction) {
+				std::sort(warmTimings.begin(), warmTimings.end(), [](const Timings& lhs, const Timings& rhs) { return lhs.initMilliseconds < rhs.initMilliseconds; });
+				return warmTimings[size_t(fraction * double(warmTimings.size() - 1))];
+			};
+			PrintTimings("warm (min)", percentile(0));
+			PrintTimings("warm (median)", percentile(0.5));
+			PrintTimings("warm (max)", percentile(1));
+
+			DeleteCaches();
+			PrintTimings("warm process, cold caches", Run());
+
+			PrintTimings("warm, sharing PortAudio with another instance", RunWhileAnotherInstanceIsAlive());
+
+			std::cout << std::endl;
+			PrintPortAudioTimings();
+		}
+
+	}
+}
+
+int main(int, char**) {
+	try {
+		::flexasio::BenchmarkMain();
+	}
+	catch (const std::exception& exception) {
+		std::cerr << "ERROR: " << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,86 @@
+// Converts a FlexASIO.trace file (see CallbackTracer) to human-readable text or CSV on standard output.
+
+#include "../FlexASIO/trace.h"
+#include "../FlexASIOUtil/portaudio.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string_view>
+
+namespace flexasio {
+	namespace {
+
+		bool IsMissedDeadline(const CallbackTraceDumpHeader& header, const CallbackTraceRecord& record) {
+			return double(record.callbackDurationNanoseconds) > 1e9 * header.bufferSizeInFrames / header.sampleRate;
+		}
+
+		double GetRelativeTimeMilliseconds(const CallbackTraceDump& dump, const CallbackTraceRecord& record) {
+			return double(record.entryTimeNanoseconds - dump.records.back().entryTimeNanoseconds) / 1e6;
+		}
+
+		void PrintText(size_t dumpIndex, const CallbackTraceDump& dump) {
+			std::cout << "Dump #" << dumpIndex << ": " << dump.records.size() << " records, sample rate " << dump.header.sampleRate << " Hz, buffer size "
+				<< dump.header.bufferSizeInFrames << " frames (" << 1e3 * dump.header.bufferSizeInFrames / dump.header.sampleRate << " ms)" << std::endl;
+			for (const auto& record : dump.records) {
+				std::cout << std::fixed
+					<< std::setw(12) << std::setprecision(3) << GetRelativeTimeMilliseconds(dump, record) << " ms: "
+					<< record.frameCount << " frames, time info (ADC " << std::setprecision(6) << record.inputBufferAdcTime << ", current " << record.currentTime << ", DAC " << record.outputBufferDacTime << "), "
+					<< std::setprecision(1) << "callback " << record.callbackDurationNanoseconds / 1e3 << " us, bufferSwitch " << record.bufferSwitchDurationNanoseconds / 1e3 << " us, outputReady wait " << record.outputReadyWaitNanoseconds / 1e3 << " us, "
+					<< "flags " << GetStreamCallbackFlagsString(record.statusFlags)
+					<< (IsMissedDeadline(dump.header, record) ? " [MISSED DEADLINE]" : "") << std::endl;
+			}
+			std::cout << std::defaultfloat;
+		}
+
+		void PrintCSVHeader() {
+			std::cout << "dump,relativeTimeMilliseconds,entryTimeNanoseconds,frameCount,inputBufferAdcTime,currentTime,outputBufferDacTime,callbackDurationNanoseconds,bufferSwitchDurationNanoseconds,outputReadyWaitNanoseconds,statusFlags,missedDeadline" << std::endl;
+		}
+
+		void PrintCSV(size_t dumpIndex, const CallbackTraceDump& dump) {
+			for (const auto& record : dump.records)
+				std::cout << std::setprecision(9)
+					<< dumpIndex << "," << GetRelativeTimeMilliseconds(dump, record) << "," << record.entryTimeNanoseconds << "," << record.frameCount << ","
+					<< record.inputBufferAdcTime << "," << record.currentTime << "," << record.outputBufferDacTime << ","
+					<< record.callbackDurationNanoseconds << "," << record.bufferSwitchDurationNanoseconds << "," << record.outputReadyWaitNanoseconds << ","
+					<< record.statusFlags << "," << (IsMissedDeadline(dump.header, record) ? 1 : 0) << std::endl;
+		}
+
+		void Convert(int argc, char** argv) {
+			bool csv = false;
+			const char* path = nullptr;
+			for (int argIndex = 1; argIndex < argc; ++argIndex) {
+				const std::string_view arg = argv[argIndex];
+				if (arg == "--csv") csv = true;
+				else if (path == nullptr) path = argv[argIndex];
+				else throw std::runtime_error("unexpected argument: " + std::string(arg));
+			}
+			if (path == nullptr) throw std::runtime_error("usage: FlexASIOTraceConverter [--csv] <trace file>");
+
+			std::ifstream stream(path, std::ios::binary);
+			if (!stream) throw std::runtime_error(std::string("unable to open ") + path);
+
+			if (csv) PrintCSVHeader();
+			size_t dumpIndex = 0;
+			while (const auto dump = ReadCallbackTraceDump(stream)) {
+				if (csv) PrintCSV(dumpIndex, *dump);
+				else PrintText(dumpIndex, *dump);
+				++dumpIndex;
+			}
+		}
+
+	}
+}
+
+int main(int argc, char** argv) {
+	try {
+		::flexasio::Convert(argc, argv);
+	}
+	catch (const std::exception& exception) {
+		std::cerr << "ERROR: " << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
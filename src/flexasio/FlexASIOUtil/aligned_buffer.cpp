@@ -0,0 +1,94 @@
+#include "aligned_buffer.h"
+
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#endif
+
+namespace flexasio {
+
+	namespace {
+
+		size_t RoundUp(size_t value, size_t multiple) {
+			return (value + multiple - 1) / multiple * multiple;
+		}
+
+	}
+
+#ifdef _WIN32
+	size_t GetPageSize() {
+		SYSTEM_INFO systemInfo;
+		::GetSystemInfo(&systemInfo);
+		return systemInfo.dwPageSize;
+	}
+
+	std::byte* AlignedBuffer::AllocateLargePages(const size_t size, const size_t alignment, size_t& allocationSize) {
+		const auto largePageSize = ::GetLargePageMinimum();
+		if (largePageSize == 0 || largePageSize % alignment != 0) return nullptr;
+		allocationSize = RoundUp(size, largePageSize);
+		// Fails if the process does not hold SeLockMemoryPrivilege. VirtualAlloc() memory is always zero-initialized.
+		return static_cast<std::byte*>(::VirtualAlloc(NULL, allocationSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE));
+	}
+
+	void AlignedBuffer::FreeLargePages(std::byte* const data, size_t) {
+		::VirtualFree(data, 0, MEM_RELEASE);
+	}
+#else
+	size_t GetPageSize() {
+		return size_t(::sysconf(_SC_PAGESIZE));
+	}
+
+#ifdef __linux__
+	std::byte* AlignedBuffer::AllocateLargePages(const size_t size, const size_t alignment, size_t& allocationSize) {
+		// This is the huge page size on all common Linux configurations. It is only used to round up the allocation;
+		// the kernel will fail the mapping if it does not match.
+		constexpr size_t hugePageSize = 2 * 1024 * 1024;
+		if (hugePageSize % alignment != 0) return nullptr;
+		allocationSize = RoundUp(size, hugePageSize);
+		// Fails if no huge pages have been reserved by the administrator. Anonymous mappings are always zero-initialized.
+		const auto data = ::mmap(nullptr, allocationSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		return data == MAP_FAILED ? nullptr : static_cast<std::byte*>(data);
+	}
+
+	void AlignedBuffer::FreeLargePages(std::byte* const data, const size_t allocationSize) {
+		::munmap(data, allocationSize);
+	}
+#else
+	std::byte* AlignedBuffer::AllocateLargePages(size_t, size_t, size_t&) {
+		return nullptr;
+	}
+
+	void AlignedBuffer::FreeLargePages(std::byte*, size_t) {}
+#endif
+#endif
+
+	AlignedBuffer::AlignedBuffer(const size_t size, const size_t alignment, const bool largePages) : size(size), alignment(alignment) {
+		if (alignment == 0 || (alignment & (alignment - 1)) != 0) throw std::invalid_argument("Buffer alignment must be a power of two");
+
+		if (largePages && size > 0) {
+			size_t allocationSize = 0;
+			data = AllocateLargePages(size, alignment, allocationSize);
+			if (data != nullptr) {
+				largePageAllocationSize = allocationSize;
+				return;
+			}
+		}
+
+		data = static_cast<std::byte*>(::operator new(size, std::align_val_t(alignment)));
+		memset(data, 0, size);
+	}
+
+	AlignedBuffer::~AlignedBuffer() {
+		if (UsesLargePages()) FreeLargePages(data, largePageAllocationSize);
+		else ::operator delete(data, std::align_val_t(alignment));
+	}
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+
+namespace flexasio {
+
+	size_t GetPageSize();
+
+	// A zero-initialized block of memory that starts at the requested alignment, which must be a power of two.
+	//
+	// The memory can optionally be backed by large pages (a.k.a. huge pages), which reduces TLB pressure. Large pages are
+	// not always available (e.g. on Windows, the user needs the "Lock pages in memory" privilege), in which case regular
+	// pages are silently used instead; use UsesLargePages() to find out.
+	class AlignedBuffer final {
+	public:
+		AlignedBuffer(size_t size, size_t alignment, bool largePages);
+		AlignedBuffer(const AlignedBuffer&) = delete;
+		AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+		~AlignedBuffer();
+
+		std::byte* GetData() const { return data; }
+		size_t GetSize() const { return size; }
+		bool UsesLargePages() const { return largePageAllocationSize != 0; }
+
+	private:
+		// Returns null if large pages are not available.
+		static std::byte* AllocateLargePages(size_t size, size_t alignment, size_t& allocationSize);
+		static void FreeLargePages(std::byte* data, size_t allocationSize);
+
+		const size_t size;
+		const size_t alignment;
+		size_t largePageAllocationSize = 0;
+		std::byte* data = nullptr;
+	};
+
+}
@@ -0,0 +1,124 @@
+#include "async_log_sink.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace flexasio {
+
+	namespace {
+
+		// The writer thread polls instead of being woken up, so that producers never have to make any system calls.
+		constexpr auto writerPollInterval = std::chrono::milliseconds(10);
+
+	}
+
+	AsyncLogSink::AsyncLogSink(::dechamps_cpplog::LogSink& sink, ::dechamps_cpplog::LogSink& reportSink) :
+		sink(sink), reportSink(reportSink), slots(std::make_unique<Slot[]>(slotCount)) {
+		for (size_t slotIndex = 0; slotIndex < slotCount; ++slotIndex)
+			slots[slotIndex].sequence.store(slotIndex, std::memory_order_relaxed);
+	}
+
+	AsyncLogSink::~AsyncLogSink() {
+		// If we get here with the writer still running, the process is most likely exiting without having stopped it.
+		// Joining the writer thread is not an option at this point (see the class comment), so just let it go.
+		if (writerThread.joinable()) writerThread.detach();
+	}
+
+	void AsyncLogSink::Start() {
+		const std::lock_guard lock(mutex);
+		if (referenceCount++ > 0) return;
+
+		stopping = false;
+		writerThread = std::thread([this] { RunWriter(); });
+		accepting = true;
+	}
+
+	void AsyncLogSink::Stop() {
+		const std::lock_guard lock(mutex);
+		if (referenceCount == 0) abort();
+		if (--referenceCount > 0) return;
+
+		accepting = false;
+		// Wait for any concurrent Write() calls that might still be pushing into the ring to finish, so that the writer
+		// thread sees every record before it exits.
+		while (inFlightWriteCount > 0) std::this_thread::yield();
+		stopping = true;
+		writerThread.join();
+	}
+
+	void AsyncLogSink::Write(const std::string_view str) {
+		++inFlightWriteCount;
+		if (accepting) {
+			if (!TryPush(str)) ++droppedRecordCount;
+			--inFlightWriteCount;
+			return;
+		}
+		--inFlightWriteCount;
+		sink.Write(str);
+	}
+
+	bool AsyncLogSink::TryPush(std::string_view record) {
+		constexpr auto slotSize = sizeof(Slot::data);
+		record = record.substr(0, slotCount * slotSize);
+		const auto recordSlotCount = std::max<size_t>(1, (record.size() + slotSize - 1) / slotSize);
+
+		// The consumer frees slots in order, so if the last slot we need is free, then all the slots before it are too.
+		auto position = enqueuePosition.load(std::memory_order_relaxed);
+		for (;;) {
+			const auto lastPosition = position + recordSlotCount - 1;
+			const auto sequence = slots[lastPosition % slotCount].sequence.load(std::memory_order_acquire);
+			const auto difference = static_cast<std::ptrdiff_t>(sequence - lastPosition);
+			if (difference == 0) {
+				if (enqueuePosition.compare_exchange_weak(position, position + recordSlotCount, std::memory_order_relaxed)) break;
+			}
+			else if (difference < 0) return false;
+			else position = enqueuePosition.load(std::memory_order_relaxed);
+		}
+
+		// Publish the first slot last, so that the consumer never sees a partially published record.
+		for (auto slotIndex = recordSlotCount; slotIndex-- > 0; ) {
+			auto& slot = slots[(position + slotIndex) % slotCount];
+			const auto chunk = record.substr(std::min(slotIndex * slotSize, record.size()), slotSize);
+			memcpy(slot.data, chunk.data(), chunk.size());
+			slot.recordSize = record.size();
+			slot.sequence.store(position + slotIndex + 1, std::memory_order_release);
+		}
+		return true;
+	}
+
+	bool AsyncLogSink::TryPop(std::string& record) {
+		constexpr auto slotSize = sizeof(Slot::data);
+		const auto& firstSlot = slots[dequeuePosition % slotCount];
+		if (firstSlot.sequence.load(std::memory_order_acquire) != dequeuePosition + 1) return false;
+
+		const auto recordSize = firstSlot.recordSize;
+		const auto recordSlotCount = std::max<size_t>(1, (recordSize + slotSize - 1) / slotSize);
+		record.clear();
+		for (size_t slotIndex = 0; slotIndex < recordSlotCount; ++slotIndex) {
+			auto& slot = slots[(dequeuePosition + slotIndex) % slotCount];
+			record.append(slot.data, std::min(slotSize, recordSize - slotIndex * slotSize));
+			slot.sequence.store(dequeuePosition + slotIndex + slotCount, std::memory_order_release);
+		}
+		dequeuePosition += recordSlotCount;
+		return true;
+	}
+
+	void AsyncLogSink::RunWriter() {
+		std::string record;
+		for (;;) {
+			const bool stop = stopping;
+			while (TryPop(record)) sink.Write(record);
+
+			const auto droppedRecords = droppedRecordCount.exchange(0);
+			if (droppedRecords > 0)
+				::dechamps_cpplog::Logger(&reportSink) << "Log buffer overflow: " << droppedRecords << " log records were dropped";
+
+			if (stop) break;
+			std::this_thread::sleep_for(writerPollInterval);
+		}
+	}
+
+}
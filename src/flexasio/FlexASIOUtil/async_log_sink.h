@@ -0,0 +1,69 @@
+#pragma once
+
+#include <dechamps_cpplog/log.h>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace flexasio {
+
+	// A log sink that never blocks the calling thread, making it safe to use from real-time threads.
+	//
+	// While the writer is running (see Start() and Stop()), Write() copies the record into a preallocated lock-free
+	// ring buffer, and a background thread drains the ring into `sink`. If the ring is full, the record is dropped and
+	// counted; the writer thread then reports the number of dropped records through `reportSink`.
+	//
+	// While the writer is not running, Write() simply forwards to `sink` synchronously.
+	//
+	// Start() and Stop() are reference counted. The writer thread must be stopped before the object is destroyed; in
+	// particular, do not rely on static destruction to stop it, as joining a thread while the Windows loader lock is
+	// held will deadlock.
+	class AsyncLogSink final : public ::dechamps_cpplog::LogSink {
+	public:
+		AsyncLogSink(::dechamps_cpplog::LogSink& sink, ::dechamps_cpplog::LogSink& reportSink);
+		~AsyncLogSink();
+
+		void Start();
+		void Stop();
+
+		void Write(std::string_view) override;
+
+	private:
+		// Records that do not fit in a single slot span multiple consecutive slots.
+		struct alignas(64) Slot final {
+			// Follows the scheme described in https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+			std::atomic<size_t> sequence;
+			// Only meaningful in the first slot of a record.
+			size_t recordSize;
+			char data[240];
+		};
+		static constexpr size_t slotCount = 4096;
+		static_assert((slotCount & (slotCount - 1)) == 0);
+
+		bool TryPush(std::string_view);
+		bool TryPop(std::string& record);
+		void RunWriter();
+
+		::dechamps_cpplog::LogSink& sink;
+		::dechamps_cpplog::LogSink& reportSink;
+
+		const std::unique_ptr<Slot[]> slots;
+		std::atomic<size_t> enqueuePosition = 0;
+		size_t dequeuePosition = 0;
+		std::atomic<size_t> droppedRecordCount = 0;
+
+		std::atomic<bool> accepting = false;
+		std::atomic<size_t> inFlightWriteCount = 0;
+		std::atomic<bool> stopping = false;
+
+		std::mutex mutex;
+		size_t referenceCount = 0;
+		std::thread writerThread;
+	};
+
+}
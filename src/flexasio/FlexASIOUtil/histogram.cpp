@@ -0,0 +1,26 @@
+#include "histogram.h"
+
+#include <cmath>
+
+namespace flexasio {
+
+	uint64_t Histogram::GetBucketUpperBound(const size_t bucketIndex) {
+		if (bucketIndex < subBucketCount) return bucketIndex;
+		const auto shift = bucketIndex / subBucketCount - 1;
+		const auto subBucket = bucketIndex % subBucketCount;
+		return ((subBucketCount + subBucket + 1) << shift) - 1;
+	}
+
+	int64_t Histogram::GetValueAtPercentile(const double percentile) const {
+		if (count == 0) return 0;
+		const auto targetCount = (std::max)(uint64_t(1), uint64_t(std::ceil(double(count) * percentile / 100)));
+		uint64_t cumulativeCount = 0;
+		for (size_t bucketIndex = 0; bucketIndex < counts.size(); ++bucketIndex) {
+			cumulativeCount += counts[bucketIndex];
+			if (cumulativeCount >= targetCount)
+				return std::clamp(int64_t(GetBucketUpperBound(bucketIndex)), min, max);
+		}
+		return max;
+	}
+
+}
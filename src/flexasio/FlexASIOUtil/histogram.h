@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace flexasio {
+
+	// A histogram of non-negative integer values with logarithmic buckets, similar to HdrHistogram. Each power of two
+	// is split into a fixed number of linear sub-buckets, bounding the relative error of reported values.
+	//
+	// Recording is cheap and never allocates, making it suitable for real-time threads. This class is not thread-safe.
+	class Histogram final {
+	public:
+		void Record(int64_t value) {
+			value = (std::max)(value, int64_t(0));
+			++counts[GetBucketIndex(uint64_t(value))];
+			++count;
+			min = (std::min)(min, value);
+			max = (std::max)(max, value);
+		}
+
+		uint64_t GetCount() const { return count; }
+		int64_t GetMin() const { return count == 0 ? 0 : min; }
+		int64_t GetMax() const { return count == 0 ? 0 : max; }
+		// Returns an upper bound of the value below which `percentile` percent of recorded values fall.
+		int64_t GetValueAtPercentile(double percentile) const;
+
+	private:
+		static constexpr int subBucketBits = 4;
+		static constexpr uint64_t subBucketCount = 1 << subBucketBits;
+		static constexpr size_t bucketCount = (64 - subBucketBits + 1) * subBucketCount;
+
+		static size_t GetBucketIndex(uint64_t value) {
+			if (value < subBucketCount) return size_t(value);
+			const auto shift = std::bit_width(value) - 1 - subBucketBits;
+			return size_t((shift + 1) * subBucketCount + ((value >> shift) & (subBucketCount - 1)));
+		}
+		static uint64_t GetBucketUpperBound(size_t bucketIndex);
+
+		std::array<uint64_t, bucketCount> counts = {};
+		uint64_t count = 0;
+		int64_t min = (std::numeric_limits<int64_t>::max)();
+		int64_t max = 0;
+	};
+
+}
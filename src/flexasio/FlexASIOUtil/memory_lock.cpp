@@ -0,0 +1,119 @@
+#include "memory_lock.h"
+
+#include "aligned_buffer.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <sys/mman.h>
+#endif
+
+namespace flexasio {
+
+	namespace {
+
+#ifdef _WIN32
+		void LockPages(const uintptr_t begin, const uintptr_t end) {
+			const auto address = reinterpret_cast<void*>(begin);
+			const auto size = end - begin;
+			if (::VirtualLock(address, size)) return;
+			auto error = ::GetLastError();
+			if (error == ERROR_WORKING_SET_QUOTA) {
+				// The amount of memory a process can lock is bounded by its minimum working set size, which is quite small
+				// by default.
+				SIZE_T minimumWorkingSetSize, maximumWorkingSetSize;
+				if (::GetProcessWorkingSetSize(::GetCurrentProcess(), &minimumWorkingSetSize, &maximumWorkingSetSize) &&
+					::SetProcessWorkingSetSize(::GetCurrentProcess(), minimumWorkingSetSize + size, (std::max)(maximumWorkingSetSize, minimumWorkingSetSize + size)) &&
+					::VirtualLock(address, size))
+					return;
+				error = ::GetLastError();
+			}
+			throw std::system_error(int(error), std::system_category(), "Unable to lock memory (VirtualLock)");
+		}
+
+		void UnlockPages(const uintptr_t begin, const uintptr_t end) {
+			::VirtualUnlock(reinterpret_cast<void*>(begin), end - begin);
+		}
+#else
+		void LockPages(const uintptr_t begin, const uintptr_t end) {
+			if (::mlock(reinterpret_cast<const void*>(begin), end - begin) == 0) return;
+			throw std::system_error(errno, std::generic_category(), "Unable to lock memory (mlock); the locked memory limit (RLIMIT_MEMLOCK, see ulimit -l) might be too low");
+		}
+
+		void UnlockPages(const uintptr_t begin, const uintptr_t end) {
+			::munlock(reinterpret_cast<const void*>(begin), end - begin);
+		}
+#endif
+
+		std::mutex mutex;
+		// Number of MemoryLock instances covering each locked page, keyed by page address. Guarded by `mutex`.
+		std::map<uintptr_t, size_t> pageLockCounts;
+
+		// Calls function(runBegin, runEnd) for every maximal run of consecutive pages for which predicate(page) is true.
+		// predicate is called exactly once per page, in order.
+		template <typename Predicate, typename Function> void ForEachRun(const uintptr_t begin, const uintptr_t end, const size_t pageSize, Predicate predicate, Function function) {
+			auto runBegin = begin;
+			for (auto page = begin; page < end; page += pageSize) {
+				if (predicate(page)) continue;
+				if (runBegin < page) function(runBegin, page);
+				runBegin = page + pageSize;
+			}
+			if (runBegin < end) function(runBegin, end);
+		}
+
+	}
+
+	MemoryLock::MemoryLock(const std::span<const std::byte> range) {
+		if (range.empty()) return;
+		const auto pageSize = GetPageSize();
+		const auto rangeBegin = reinterpret_cast<uintptr_t>(range.data());
+		const auto pagesBegin = rangeBegin / pageSize * pageSize;
+		const auto pagesEnd = (rangeBegin + range.size() + pageSize - 1) / pageSize * pageSize;
+
+		// Locking is enough to make pages resident, but touching them first means we don't rely on that. Only touch bytes
+		// within the range, as the rest of the page might not belong to the caller.
+		for (auto page = pagesBegin; page < pagesEnd; page += pageSize)
+			static_cast<void>(*reinterpret_cast<const volatile std::byte*>((std::max)(page, rangeBegin)));
+
+		std::scoped_lock lock(mutex);
+		std::vector<std::pair<uintptr_t, uintptr_t>> lockedRuns;
+		try {
+			ForEachRun(pagesBegin, pagesEnd, pageSize,
+				[&](uintptr_t page) { return !pageLockCounts.contains(page); },
+				[&](uintptr_t runBegin, uintptr_t runEnd) {
+				LockPages(runBegin, runEnd);
+				lockedRuns.emplace_back(runBegin, runEnd);
+			});
+		}
+		catch (...) {
+			for (const auto& [runBegin, runEnd] : lockedRuns) UnlockPages(runBegin, runEnd);
+			throw;
+		}
+		for (auto page = pagesBegin; page < pagesEnd; page += pageSize) ++pageLockCounts[page];
+		begin = pagesBegin;
+		end = pagesEnd;
+	}
+
+	MemoryLock::MemoryLock(MemoryLock&& other) : begin(std::exchange(other.begin, 0)), end(std::exchange(other.end, 0)) {}
+
+	MemoryLock::~MemoryLock() {
+		if (begin == end) return;
+		std::scoped_lock lock(mutex);
+		ForEachRun(begin, end, GetPageSize(),
+			[&](uintptr_t page) {
+			const auto pageLockCount = pageLockCounts.find(page);
+			if (--pageLockCount->second > 0) return false;
+			pageLockCounts.erase(pageLockCount);
+			return true;
+		}, UnlockPages);
+	}
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace flexasio {
+
+	// Faults in the pages spanned by a range of memory and locks them in physical memory, so that accessing the range can
+	// not cause a page fault. The pages are unlocked on destruction.
+	//
+	// Locks are reference counted per page, process-wide: overlapping ranges can be locked and unlocked independently.
+	//
+	// Throws std::system_error if the pages cannot be locked, typically because the process exceeded its locked memory
+	// limit (RLIMIT_MEMLOCK on POSIX). On Windows the process working set is automatically grown to make room.
+	class MemoryLock final {
+	public:
+		explicit MemoryLock(std::span<const std::byte>);
+		MemoryLock(const MemoryLock&) = delete;
+		MemoryLock(MemoryLock&&);
+		MemoryLock& operator=(const MemoryLock&) = delete;
+		MemoryLock& operator=(MemoryLock&&) = delete;
+		~MemoryLock();
+
+		size_t GetSize() const { return end - begin; }
+
+	private:
+		// Page-aligned.
+		uintptr_t begin = 0;
+		uintptr_t end = 0;
+	};
+
+}
@@ -1,12 +1,15 @@
 #include "portaudio.h"
 
+#ifdef _WIN32
 #include <pa_win_wasapi.h>
 
 #include <mmreg.h>
 #include <ks.h>
 #include <ksmedia.h>
+#endif
 
 #include <cctype>
+#include <sstream>
 #include <stdexcept>
 #include <string_view>
 
@@ -18,6 +21,14 @@ extern "C" {
 	extern void PaUtil_SetDebugPrintFunction(PaUtilLogCallback cb);
 }
 
+#ifdef _WIN32
+// From portaudio_host_api_filter.c, which FlexASIO injects into the PortAudio DLL.
+extern "C" {
+	extern PaError PaFlexASIO_RestrictHostApi(PaHostApiTypeId type);
+	extern void PaFlexASIO_UnrestrictHostApis(void);
+}
+#endif
+
 // From src/common/pa_hostapi.h, which is not exposed publicly but is nonetheless useful here.
 //
 /** The common header for all data structures whose pointers are passed through
@@ -87,6 +98,19 @@ namespace flexasio {
 
 	PortAudioDebugRedirector::Singleton PortAudioDebugRedirector::singleton;
 
+#ifdef _WIN32
+	bool RestrictPortAudioHostApi(const std::optional<PaHostApiTypeId> hostApiTypeId) {
+		if (!hostApiTypeId.has_value()) {
+			PaFlexASIO_UnrestrictHostApis();
+			return true;
+		}
+		const auto error = PaFlexASIO_RestrictHostApi(*hostApiTypeId);
+		if (error == paHostApiNotFound) return false;
+		if (error != paNoError) throw std::runtime_error(std::string("Unable to restrict PortAudio host APIs: ") + Pa_GetErrorText(error));
+		return true;
+	}
+#endif
+
 	std::string GetHostApiTypeIdString(PaHostApiTypeId hostApiTypeId) {
 		return ::dechamps_cpputil::EnumToString(hostApiTypeId, {
 			{ paInDevelopment, "In development" },
@@ -129,6 +153,7 @@ namespace flexasio {
 			});
 	}
 
+#ifdef _WIN32
 	std::string GetWasapiFlagsString(PaWasapiFlags wasapiFlags) {
 		return ::dechamps_cpputil::BitfieldToString(wasapiFlags, {
 			{ paWinWasapiExclusive, "Exclusive" },
@@ -175,6 +200,7 @@ namespace flexasio {
 			{ eStreamOptionMatchFormat, "MatchFormat" },
 			});
 	}
+#endif
 
 	std::string GetStreamCallbackFlagsString(PaStreamCallbackFlags streamCallbackFlags) {
 		return ::dechamps_cpputil::BitfieldToString(streamCallbackFlags, {
@@ -219,6 +245,7 @@ namespace flexasio {
 		return *info;
 	}
 
+#ifdef _WIN32
 	WAVEFORMATEXTENSIBLE GetWasapiDeviceDefaultFormat(PaDeviceIndex index) {
 		WAVEFORMATEXTENSIBLE format = { 0 };
 		const auto result = PaWasapi_GetDeviceDefaultFormat(&format, sizeof(format), index);
@@ -301,6 +328,7 @@ namespace flexasio {
 
 		return result.str();
 	}
+#endif
 
 	std::string DescribeStreamParameters(const PaStreamParameters& parameters) {
 		std::stringstream result;
@@ -315,6 +343,7 @@ namespace flexasio {
 			result << ", host API specific: " << hostApiSpecificHeader->size << " bytes structure, type "
 				<< GetHostApiTypeIdString(hostApiSpecificHeader->hostApiType) << ", version "
 				<< hostApiSpecificHeader->version;
+#ifdef _WIN32
 			if (hostApiSpecificHeader->hostApiType == paWASAPI) {
 				const auto wasapiSpecific = static_cast<const PaWasapiStreamInfo*>(parameters.hostApiSpecificStreamInfo);
 				result << ", WASAPI specific: flags " << GetWasapiFlagsString(PaWasapiFlags(wasapiSpecific->flags)) << ", channel mask "
@@ -325,6 +354,7 @@ namespace flexasio {
 					<< GetWasapiStreamCategoryString(wasapiSpecific->streamCategory) << ", stream option "
 					<< GetWasapiStreamOptionString(wasapiSpecific->streamOption);
 			}
+#endif
 		}
 
 		return result.str();
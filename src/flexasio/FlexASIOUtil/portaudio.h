@@ -1,13 +1,17 @@
 #pragma once
 
 #include <portaudio.h>
+
+#ifdef _WIN32
 #include <pa_win_wasapi.h>
 
 #include <windows.h>
 #include <MMReg.h>
+#endif
 
 #include <functional>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <string_view>
 
@@ -15,6 +19,8 @@ namespace flexasio {
 
 	class PortAudioDebugRedirector final {
 	public:
+		// Note: PortAudio can emit debug output from any thread, including the stream callback thread. Therefore the
+		// function must not block.
 		using Write = void(std::string_view);
 
 		explicit PortAudioDebugRedirector(Write write) { singleton.Start(write); }
@@ -41,13 +47,22 @@ namespace flexasio {
 		static Singleton singleton;
 	};
 
+#ifdef _WIN32
+	// Makes the next Pa_Initialize() call only initialize the host API of the given type, or all of them if nullopt.
+	// Must not be called while PortAudio is initialized. Returns false, and does nothing, if PortAudio was not built with
+	// that host API.
+	bool RestrictPortAudioHostApi(std::optional<PaHostApiTypeId> hostApiTypeId);
+#endif
+
 	std::string GetHostApiTypeIdString(PaHostApiTypeId hostApiTypeId);
 	std::string GetSampleFormatString(PaSampleFormat sampleFormat);
 	std::string GetStreamFlagsString(PaStreamFlags streamFlags);
+#ifdef _WIN32
 	std::string GetWasapiFlagsString(PaWasapiFlags wasapiFlags);
 	std::string GetWasapiThreadPriorityString(PaWasapiThreadPriority threadPriority);
 	std::string GetWasapiStreamCategoryString(PaWasapiStreamCategory streamCategory);
 	std::string GetWasapiStreamOptionString(PaWasapiStreamOption streamOption);
+#endif
 	std::string GetStreamCallbackFlagsString(PaStreamCallbackFlags streamCallbackFlags);
 
 	struct HostApi {
@@ -74,6 +89,7 @@ namespace flexasio {
 		static const PaDeviceInfo& GetInfo(PaDeviceIndex index);
 	};
 
+#ifdef _WIN32
 	WAVEFORMATEXTENSIBLE GetWasapiDeviceDefaultFormat(PaDeviceIndex index);
 	WAVEFORMATEXTENSIBLE GetWasapiDeviceMixFormat(PaDeviceIndex index);
 
@@ -81,6 +97,7 @@ namespace flexasio {
 	std::string GetWaveFormatChannelMaskString(DWORD channelMask);
 	std::string GetWaveSubFormatString(const GUID& subFormat);
 	std::string DescribeWaveFormat(const WAVEFORMATEXTENSIBLE& waveFormatExtensible);
+#endif
 
 	std::string DescribeStreamParameters(const PaStreamParameters& parameters);
 	std::string DescribeStreamInfo(const PaStreamInfo& info);
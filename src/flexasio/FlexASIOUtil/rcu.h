@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace flexasio {
+
+	// Publishes immutable snapshots of a value from a writer thread to a single reader thread, read-copy-update style.
+	//
+	// The reader never waits and never allocates, which makes Read() suitable for real-time threads. The reader must call
+	// Quiesce() whenever it does not hold any reference obtained through Read() (e.g. at the end of each audio callback),
+	// which tells the writer when a replaced snapshot can be freed. Replaced snapshots are freed during later calls to
+	// Publish() once the reader has quiesced, or when the Rcu is destroyed.
+	template <typename T> class Rcu final {
+	public:
+		explicit Rcu(T value) : current(new T(std::move(value))) {}
+		Rcu(const Rcu&) = delete;
+		Rcu& operator=(const Rcu&) = delete;
+		// Must not race with the reader.
+		~Rcu() { delete current.load(); }
+
+		// Reader side. The reference remains valid until the next call to Quiesce().
+		const T& Read() const { return *current.load(); }
+		void Quiesce() { quiescentCount.fetch_add(1); }
+
+		// Writer side. Must only be called from one thread at a time.
+		void Publish(T value) {
+			// If the reader quiesced after a snapshot was replaced, any later Read() returns a newer snapshot.
+			const auto currentQuiescentCount = quiescentCount.load();
+			std::erase_if(retired, [&](const Retired& retiredSnapshot) { return currentQuiescentCount > retiredSnapshot.quiescentCount; });
+			std::unique_ptr<const T> previous(current.exchange(new T(std::move(value))));
+			retired.push_back({ .snapshot = std::move(previous), .quiescentCount = quiescentCount.load() });
+		}
+
+	private:
+		struct Retired final {
+			std::unique_ptr<const T> snapshot;
+			uint64_t quiescentCount;
+		};
+
+		// All operations on these are sequentially consistent, which the reasoning in Publish() relies on.
+		std::atomic<const T*> current;
+		std::atomic<uint64_t> quiescentCount = 0;
+		std::vector<Retired> retired;
+	};
+
+}
@@ -0,0 +1,153 @@
+#include "realtime.h"
+
+#include <dechamps_cpputil/string.h>
+
+#include <sstream>
+#include <system_error>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86)
+#include <xmmintrin.h>
+#define FLEXASIO_REALTIME_MXCSR
+#endif
+
+namespace flexasio {
+
+	namespace {
+
+		void ApplyFlushDenormals(std::ostream& description) {
+#if defined(FLEXASIO_REALTIME_MXCSR)
+			constexpr unsigned int flushToZero = 0x8000;
+			constexpr unsigned int denormalsAreZero = 0x0040;
+			_mm_setcsr(_mm_getcsr() | flushToZero | denormalsAreZero);
+			description << "flush-to-zero and denormals-are-zero enabled (MXCSR 0x" << std::hex << _mm_getcsr() << std::dec << ")";
+#elif defined(__aarch64__)
+			// On AArch64, FPCR.FZ covers both denormal inputs and outputs.
+			uint64_t fpcr;
+			__asm__ volatile("mrs %0, fpcr" : "=r"(fpcr));
+			fpcr |= uint64_t(1) << 24;
+			__asm__ volatile("msr fpcr, %0" : : "r"(fpcr));
+			description << "flush-to-zero enabled (FPCR 0x" << std::hex << fpcr << std::dec << ")";
+#else
+			description << "unable to flush denormals: not supported on this architecture";
+#endif
+		}
+
+#ifdef _WIN32
+		std::string GetLastErrorString() {
+			return std::system_category().message(int(::GetLastError()));
+		}
+
+		void ApplyScheduling(const RealtimeOptions& options, std::ostream& description) {
+			if (options.schedulingPolicy.has_value())
+				description << "ignored scheduling policy " << GetSchedulingPolicyString(*options.schedulingPolicy) << " (not supported on Windows), ";
+			if (options.priority.has_value() && !::SetThreadPriority(::GetCurrentThread(), *options.priority))
+				description << "unable to set thread priority to " << *options.priority << ": " << GetLastErrorString() << ", ";
+			description << "thread priority is " << ::GetThreadPriority(::GetCurrentThread());
+		}
+
+		void ApplyCpuAffinity(const uint64_t cpuAffinityMask, std::ostream& description) {
+			if (::SetThreadAffinityMask(::GetCurrentThread(), DWORD_PTR(cpuAffinityMask)) == 0)
+				description << "unable to set CPU affinity mask to 0x" << std::hex << cpuAffinityMask << std::dec << ": " << GetLastErrorString();
+			else
+				description << "CPU affinity mask set to 0x" << std::hex << cpuAffinityMask << std::dec;
+		}
+#else
+		int GetPosixSchedulingPolicy(const RealtimeOptions::SchedulingPolicy schedulingPolicy) {
+			switch (schedulingPolicy) {
+			case RealtimeOptions::SchedulingPolicy::FIFO: return SCHED_FIFO;
+			case RealtimeOptions::SchedulingPolicy::RR: return SCHED_RR;
+			default: return SCHED_OTHER;
+			}
+		}
+
+		std::string GetPosixSchedulingPolicyString(const int policy) {
+			return ::dechamps_cpputil::EnumToString(policy, {
+				{SCHED_OTHER, "SCHED_OTHER"},
+				{SCHED_FIFO, "SCHED_FIFO"},
+				{SCHED_RR, "SCHED_RR"},
+				});
+		}
+
+		void ApplyScheduling(const RealtimeOptions& options, std::ostream& description) {
+			int policy;
+			sched_param parameters;
+			auto error = ::pthread_getschedparam(::pthread_self(), &policy, &parameters);
+			if (error == 0 && (options.schedulingPolicy.has_value() || options.priority.has_value())) {
+				if (options.schedulingPolicy.has_value()) {
+					policy = GetPosixSchedulingPolicy(*options.schedulingPolicy);
+					parameters.sched_priority = ::sched_get_priority_min(policy);
+				}
+				if (options.priority.has_value()) parameters.sched_priority = *options.priority;
+				error = ::pthread_setschedparam(::pthread_self(), policy, &parameters);
+				if (error != 0)
+					description << "unable to set scheduling policy " << GetPosixSchedulingPolicyString(policy) << " with priority " << parameters.sched_priority << ": " << std::generic_category().message(error)
+					<< " (real-time scheduling typically requires CAP_SYS_NICE or a sufficient RLIMIT_RTPRIO), ";
+			}
+			error = ::pthread_getschedparam(::pthread_self(), &policy, &parameters);
+			if (error != 0) description << "unable to query scheduling policy: " << std::generic_category().message(error);
+			else description << "scheduling policy is " << GetPosixSchedulingPolicyString(policy) << " with priority " << parameters.sched_priority;
+		}
+
+		void ApplyCpuAffinity(const uint64_t cpuAffinityMask, std::ostream& description) {
+#ifdef __linux__
+			cpu_set_t cpuSet;
+			CPU_ZERO(&cpuSet);
+			for (int cpu = 0; cpu < 64; ++cpu)
+				if ((cpuAffinityMask >> cpu) & 1) CPU_SET(cpu, &cpuSet);
+			const auto error = ::pthread_setaffinity_np(::pthread_self(), sizeof(cpuSet), &cpuSet);
+			if (error != 0)
+				description << "unable to set CPU affinity mask to 0x" << std::hex << cpuAffinityMask << std::dec << ": " << std::generic_category().message(error);
+			else
+				description << "CPU affinity mask set to 0x" << std::hex << cpuAffinityMask << std::dec;
+#else
+			description << "unable to set CPU affinity mask to 0x" << std::hex << cpuAffinityMask << std::dec << ": not supported on this platform";
+#endif
+		}
+#endif
+
+	}
+
+	std::string GetSchedulingPolicyString(const RealtimeOptions::SchedulingPolicy schedulingPolicy) {
+		return ::dechamps_cpputil::EnumToString(schedulingPolicy, {
+			{RealtimeOptions::SchedulingPolicy::OTHER, "other"},
+			{RealtimeOptions::SchedulingPolicy::FIFO, "fifo"},
+			{RealtimeOptions::SchedulingPolicy::RR, "rr"},
+			});
+	}
+
+	namespace {
+
+		void ApplyRealtimeOptionsToCurrentThread(const RealtimeOptions& options, std::ostream& description) {
+			ApplyScheduling(options, description);
+			if (options.cpuAffinityMask.has_value()) {
+				description << ", ";
+				ApplyCpuAffinity(*options.cpuAffinityMask, description);
+			}
+			if (options.flushDenormals) {
+				description << ", ";
+				ApplyFlushDenormals(description);
+			}
+		}
+
+	}
+
+	std::string ApplyRealtimeOptionsToCurrentThread(const RealtimeOptions& options) {
+		std::stringstream description;
+		ApplyRealtimeOptionsToCurrentThread(options, description);
+		return description.str();
+	}
+
+	void ApplyRealtimeOptionsToCurrentThreadQuietly(const RealtimeOptions& options) {
+		// A stream without a buffer ignores everything that is written to it, without formatting it.
+		std::ostream description(nullptr);
+		ApplyRealtimeOptionsToCurrentThread(options, description);
+	}
+
+}
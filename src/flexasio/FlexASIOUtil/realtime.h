@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace flexasio {
+
+	// Scheduling and floating point settings for threads that run real-time audio code. Options that are not set leave
+	// the corresponding thread attribute alone.
+	struct RealtimeOptions final {
+		// POSIX scheduling policies. Windows does not have an equivalent; use `priority` instead.
+		enum class SchedulingPolicy { OTHER, FIFO, RR };
+		std::optional<SchedulingPolicy> schedulingPolicy = std::nullopt;
+		// On Windows, a value accepted by SetThreadPriority(), e.g. 2 (THREAD_PRIORITY_HIGHEST) or 15
+		// (THREAD_PRIORITY_TIME_CRITICAL). On POSIX, the static priority for the scheduling policy; if the policy is set but
+		// the priority isn't, the lowest priority of the policy is used.
+		std::optional<int> priority = std::nullopt;
+		// Bit N set means the thread may run on CPU N.
+		std::optional<uint64_t> cpuAffinityMask = std::nullopt;
+		// Enables the flush-to-zero and denormals-are-zero floating point modes, so that DSP code never hits the (very
+		// slow) denormal number code paths.
+		bool flushDenormals = false;
+
+		bool operator==(const RealtimeOptions&) const = default;
+	};
+
+	std::string GetSchedulingPolicyString(RealtimeOptions::SchedulingPolicy);
+
+	// Applies the options to the calling thread. Options are applied independently of each other, and failures are not
+	// fatal. Returns a human-readable description of what was done, including any failures, and of the resulting state of
+	// the thread.
+	std::string ApplyRealtimeOptionsToCurrentThread(const RealtimeOptions&);
+	// Same, but without the description, which avoids memory allocations when called from a real-time thread.
+	void ApplyRealtimeOptionsToCurrentThreadQuietly(const RealtimeOptions&);
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+namespace flexasio {
+
+	// Publishes a value from a single writer thread to any number of reader threads, without locks.
+	//
+	// The writer never waits, no matter what the readers are doing, which makes Store() suitable for real-time threads.
+	// Readers retry if they race with the writer. If the writer is preempted in the middle of Store(), readers yield to
+	// give it a chance to finish.
+	//
+	// The value is stored as an array of relaxed atomic words, as opposed to plain memory, so that concurrent reads and
+	// writes are well-defined; see H. Boehm, "Can seqlocks get along with programming language memory models?" (2012).
+	template <typename T> class SeqLock final {
+		static_assert(std::is_trivially_copyable_v<T>);
+
+	public:
+		explicit SeqLock(const T& value = T()) { Store(value); }
+		SeqLock(const SeqLock&) = delete;
+		SeqLock& operator=(const SeqLock&) = delete;
+
+		// Must only be called from one thread at a time.
+		void Store(const T& value) {
+			Words words = {};
+			memcpy(words.data(), &value, sizeof(value));
+
+			const auto currentSequence = sequence.load(std::memory_order_relaxed);
+			sequence.store(currentSequence + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			for (size_t wordIndex = 0; wordIndex < words.size(); ++wordIndex)
+				data[wordIndex].store(words[wordIndex], std::memory_order_relaxed);
+			sequence.store(currentSequence + 2, std::memory_order_release);
+		}
+
+		T Load() const {
+			for (;;) {
+				const auto sequenceBefore = sequence.load(std::memory_order_acquire);
+				if (sequenceBefore % 2 != 0) {
+					std::this_thread::yield();
+					continue;
+				}
+
+				Words words;
+				for (size_t wordIndex = 0; wordIndex < words.size(); ++wordIndex)
+					words[wordIndex] = data[wordIndex].load(std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (sequence.load(std::memory_order_relaxed) != sequenceBefore) continue;
+
+				T value;
+				memcpy(static_cast<void*>(&value), words.data(), sizeof(value));
+				return value;
+			}
+		}
+
+	private:
+		using Word = size_t;
+		static_assert(std::atomic<Word>::is_always_lock_free);
+		using Words = std::array<Word, (sizeof(T) + sizeof(Word) - 1) / sizeof(Word)>;
+
+		// Odd while a Store() is in progress.
+		std::atomic<size_t> sequence = 0;
+		std::array<std::atomic<Word>, std::tuple_size_v<Words>> data;
+	};
+
+}
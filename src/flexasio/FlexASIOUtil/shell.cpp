@@ -1,18 +1,43 @@
 #include "shell.h"
 
 #include <system_error>
+
+#ifdef _WIN32
 #include <shlobj.h>
+#else
+#include <cstdlib>
+#include <filesystem>
+#include <stdexcept>
+#endif
 
 namespace flexasio {
 
+#ifdef _WIN32
+	namespace {
+		std::wstring GetKnownFolderPath(REFKNOWNFOLDERID knownFolderId) {
+			PWSTR path = nullptr;
+			const auto getKnownFolderPathHResult = ::SHGetKnownFolderPath(knownFolderId, 0, NULL, &path);
+			if (getKnownFolderPathHResult != S_OK)
+				throw std::system_error(getKnownFolderPathHResult, std::system_category(), "SHGetKnownFolderPath() failed");
+			const std::wstring pathString(path);
+			::CoTaskMemFree(path);
+			return pathString;
+		}
+	}
+
+	std::wstring GetUserDirectory() { return GetKnownFolderPath(FOLDERID_Profile); }
+	std::wstring GetLocalAppDataDirectory() { return GetKnownFolderPath(FOLDERID_LocalAppData); }
+#else
 	std::wstring GetUserDirectory() {
-		PWSTR userDirectory = nullptr;
-		const auto getKnownFolderPathHResult = ::SHGetKnownFolderPath(FOLDERID_Profile, 0, NULL, &userDirectory);
-		if (getKnownFolderPathHResult != S_OK)
-			throw std::system_error(getKnownFolderPathHResult, std::system_category(), "SHGetKnownFolderPath() failed");
-		const std::wstring userDirectoryString(userDirectory);
-		::CoTaskMemFree(userDirectory);
-		return userDirectoryString;
+		const auto home = std::getenv("HOME");
+		if (home == nullptr) throw std::runtime_error("HOME environment variable is not set");
+		return std::filesystem::path(home).wstring();
+	}
+	std::wstring GetLocalAppDataDirectory() {
+		const auto cacheHome = std::getenv("XDG_CACHE_HOME");
+		if (cacheHome != nullptr) return std::filesystem::path(cacheHome).wstring();
+		return (std::filesystem::path(GetUserDirectory()) / ".cache").wstring();
 	}
+#endif
 
 }
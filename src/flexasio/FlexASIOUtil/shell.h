@@ -5,4 +5,6 @@
 
 namespace flexasio {
 	std::wstring GetUserDirectory();
+	// Where per-user data that can be safely deleted (e.g. caches) belongs.
+	std::wstring GetLocalAppDataDirectory();
 }
\ No newline at end of file
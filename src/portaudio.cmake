@@ -25,5 +25,12 @@ function(ADD_LIBRARY)
 			-P "${FLEXASIO_LIST_DIR}/portaudio_version_stamp.cmake"
 	)
 	set_property(SOURCE src/common/pa_front.c APPEND PROPERTY OBJECT_DEPENDS flexasio_version_stamp_gen)
-	set_property(SOURCE src/common/pa_front.c APPEND PROPERTY COMPILE_OPTIONS "/FI${FLEXASIO_VERSION_FILE}")
+	if(MSVC)
+		set_property(SOURCE src/common/pa_front.c APPEND PROPERTY COMPILE_OPTIONS "/FI${FLEXASIO_VERSION_FILE}")
+	else()
+		set_property(SOURCE src/common/pa_front.c APPEND PROPERTY COMPILE_OPTIONS -include "${FLEXASIO_VERSION_FILE}")
+	endif()
+
+	# Lets FlexASIO choose which host APIs Pa_Initialize() brings up.
+	target_sources(${ARGV0} PRIVATE "${FLEXASIO_LIST_DIR}/portaudio_host_api_filter.c")
 endfunction()
@@ -0,0 +1,103 @@
+/* Injected into the PortAudio library by portaudio.cmake.
+ *
+ * Pa_Initialize() initializes every host API PortAudio was built with, which takes time (each host API enumerates its
+ * devices). The functions below make it possible to only initialize one of them, by filtering the list of host API
+ * initializers that Pa_Initialize() goes through. They must not be called while PortAudio is initialized. */
+
+#include "pa_hostapi.h"
+
+#ifdef _WIN32
+#define FLEXASIO_EXPORT __declspec(dllexport)
+#else
+#define FLEXASIO_EXPORT __attribute__((visibility("default")))
+#endif
+
+/* Defined in pa_win_hostapis.c. */
+#if PA_USE_WMME
+PaError PaWinMme_Initialize( PaUtilHostApiRepresentation **hostApi, PaHostApiIndex index );
+#endif
+#if PA_USE_DS
+PaError PaWinDs_Initialize( PaUtilHostApiRepresentation **hostApi, PaHostApiIndex index );
+#endif
+#if PA_USE_ASIO
+PaError PaAsio_Initialize( PaUtilHostApiRepresentation **hostApi, PaHostApiIndex index );
+#endif
+#if PA_USE_WDMKS
+PaError PaWinWdm_Initialize( PaUtilHostApiRepresentation **hostApi, PaHostApiIndex index );
+#endif
+#if PA_USE_WASAPI
+PaError PaWasapi_Initialize( PaUtilHostApiRepresentation **hostApi, PaHostApiIndex index );
+#endif
+
+typedef struct FlexASIOHostApiInitializer
+{
+    PaHostApiTypeId type;
+    PaUtilHostApiInitializer *initializer;
+} FlexASIOHostApiInitializer;
+
+static const FlexASIOHostApiInitializer knownInitializers[] =
+{
+#if PA_USE_WMME
+    { paMME, PaWinMme_Initialize },
+#endif
+#if PA_USE_DS
+    { paDirectSound, PaWinDs_Initialize },
+#endif
+#if PA_USE_ASIO
+    { paASIO, PaAsio_Initialize },
+#endif
+#if PA_USE_WDMKS
+    { paWDMKS, PaWinWdm_Initialize },
+#endif
+#if PA_USE_WASAPI
+    { paWASAPI, PaWasapi_Initialize },
+#endif
+    { paInDevelopment, 0 }
+};
+
+#define FLEXASIO_MAX_HOST_API_INITIALIZERS 32
+/* Copy of paHostApiInitializers before it was first filtered, including the terminating null pointer. */
+static PaUtilHostApiInitializer *allInitializers[ FLEXASIO_MAX_HOST_API_INITIALIZERS ];
+static int allInitializersSaved = 0;
+
+static int SaveInitializers( void )
+{
+    int i;
+    if( allInitializersSaved ) return 1;
+    for( i = 0; paHostApiInitializers[i] != 0; ++i )
+    {
+        if( i + 1 >= FLEXASIO_MAX_HOST_API_INITIALIZERS ) return 0;
+        allInitializers[i] = paHostApiInitializers[i];
+    }
+    allInitializers[i] = 0;
+    allInitializersSaved = 1;
+    return 1;
+}
+
+/* Returns paHostApiNotFound, and leaves the host API list untouched, if PortAudio was not built with that host API. */
+FLEXASIO_EXPORT PaError PaFlexASIO_RestrictHostApi( PaHostApiTypeId type )
+{
+    int i, j;
+    if( !SaveInitializers() ) return paInternalError;
+    for( i = 0; knownInitializers[i].initializer != 0; ++i )
+    {
+        if( knownInitializers[i].type != type ) continue;
+        for( j = 0; allInitializers[j] != 0; ++j )
+        {
+            if( allInitializers[j] != knownInitializers[i].initializer ) continue;
+            paHostApiInitializers[0] = allInitializers[j];
+            paHostApiInitializers[1] = 0;
+            return paNoError;
+        }
+    }
+    return paHostApiNotFound;
+}
+
+FLEXASIO_EXPORT void PaFlexASIO_UnrestrictHostApis( void )
+{
+    int i;
+    if( !allInitializersSaved ) return;
+    for( i = 0; allInitializers[i] != 0; ++i )
+        paHostApiInitializers[i] = allInitializers[i];
+    paHostApiInitializers[i] = 0;
+}